@@ -0,0 +1,198 @@
+#include "arena.h"
+#include "assert.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_DEFAULT_BLOCK_SIZE (1 << 20)
+
+typedef struct arena_block arena_block_t;
+
+struct arena_block {
+    arena_block_t* next;
+    size_t capacity;
+    size_t used;
+};
+
+// the first ARENA_BLOCK_HEADER_SIZE bytes of a block hold the header, the payload follows
+#define ARENA_BLOCK_HEADER_SIZE ((sizeof(arena_block_t) + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1))
+
+struct arena {
+    pthread_mutex_t mutex;
+    arena_block_t* first;
+    arena_block_t* last;
+    arena_block_t* current;
+    size_t block_size;
+};
+
+static inline char* block_payload(arena_block_t* block){
+    return ((char*) block) + ARENA_BLOCK_HEADER_SIZE;
+}
+
+static inline size_t align_size(size_t size){
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+}
+
+arena_t* arena_new(size_t block_size){
+    arena_t* new_arena = (arena_t*) malloc(sizeof(arena_t));
+    pthread_mutex_init(&new_arena->mutex, NULL);
+    new_arena->first = NULL;
+    new_arena->last = NULL;
+    new_arena->current = NULL;
+    new_arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+    return new_arena;
+}
+
+void arena_destroy(arena_t* arena){
+    arena_block_t* block = arena->first;
+    while(block){
+        arena_block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+    pthread_mutex_destroy(&arena->mutex);
+    free(arena);
+}
+
+// the offset into the payload of block of its next allocation aligned to alignment
+static inline size_t aligned_offset(arena_block_t* block, size_t alignment){
+    uintptr_t address = (uintptr_t) block_payload(block) + block->used;
+    uintptr_t aligned_address = (address + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    return block->used + (aligned_address - address);
+}
+
+void* arena_alloc_aligned(arena_t* arena, size_t size, size_t alignment){
+    NDEBUG_ASSERT(alignment >= ARENA_ALIGNMENT && (alignment & (alignment - 1)) == 0, "Arena alignment must be a power of two of at least 16 bytes!\n");
+    size = align_size(size ? size : 1);
+    pthread_mutex_lock(&arena->mutex);
+    // blocks retained from before the last rewind are reused before new ones are allocated
+    arena_block_t* block = arena->current;
+    while(block && aligned_offset(block, alignment) + size > block->capacity){
+        block = block->next;
+    }
+    if(!block){
+        // room to align the allocation wherever the payload starts
+        size_t padded_size = size + alignment - ARENA_ALIGNMENT;
+        size_t capacity = (padded_size > arena->block_size) ? padded_size : arena->block_size;
+        block = (arena_block_t*) malloc(ARENA_BLOCK_HEADER_SIZE + capacity);
+        NDEBUG_ASSERT(block != NULL, "Arena out of memory!\n");
+        block->next = NULL;
+        block->capacity = capacity;
+        block->used = 0;
+        if(arena->last){
+            arena->last->next = block;
+        }else{
+            arena->first = block;
+        }
+        arena->last = block;
+    }
+    arena->current = block;
+    size_t offset = aligned_offset(block, alignment);
+    void* ptr = block_payload(block) + offset;
+    block->used = offset + size;
+    pthread_mutex_unlock(&arena->mutex);
+    return ptr;
+}
+
+void* arena_alloc(arena_t* arena, size_t size){
+    return arena_alloc_aligned(arena, size, ARENA_ALIGNMENT);
+}
+
+// releases everything allocated from the arena, but keeps its blocks for reuse
+void arena_rewind(arena_t* arena){
+    pthread_mutex_lock(&arena->mutex);
+    for(arena_block_t* block = arena->first; block; block = block->next){
+#ifndef NDEBUG
+        // poison released memory so that dangling references fail loudly
+        memset(block_payload(block), 0xdb, block->used);
+#endif
+        block->used = 0;
+    }
+    arena->current = arena->first;
+    pthread_mutex_unlock(&arena->mutex);
+}
+
+bool arena_contains(arena_t* arena, const void* ptr){
+    bool contains = false;
+    pthread_mutex_lock(&arena->mutex);
+    for(arena_block_t* block = arena->first; block && !contains; block = block->next){
+        uintptr_t begin = (uintptr_t) block_payload(block);
+        contains = (begin <= (uintptr_t) ptr) && ((uintptr_t) ptr < begin + block->capacity);
+    }
+    pthread_mutex_unlock(&arena->mutex);
+    return contains;
+}
+
+size_t arena_get_bytes_used(arena_t* arena){
+    size_t bytes_used = 0;
+    pthread_mutex_lock(&arena->mutex);
+    for(arena_block_t* block = arena->first; block; block = block->next){
+        bytes_used += block->used;
+    }
+    pthread_mutex_unlock(&arena->mutex);
+    return bytes_used;
+}
+
+size_t arena_get_bytes_reserved(arena_t* arena){
+    size_t bytes_reserved = 0;
+    pthread_mutex_lock(&arena->mutex);
+    for(arena_block_t* block = arena->first; block; block = block->next){
+        bytes_reserved += block->capacity;
+    }
+    pthread_mutex_unlock(&arena->mutex);
+    return bytes_reserved;
+}
+
+/**
+ * GRAPH ARENA
+*/
+
+static pthread_once_t graph_arena_once = PTHREAD_ONCE_INIT;
+static arena_t* graph_arena = NULL;
+static int graph_arena_depth = 0; // arena_begin calls may nest
+
+static void graph_arena_init(void){
+    graph_arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE);
+}
+
+arena_t* arena_get_graph_arena(void){
+    pthread_once(&graph_arena_once, &graph_arena_init);
+    return graph_arena;
+}
+
+void arena_begin(void){
+    arena_get_graph_arena();
+    __atomic_add_fetch(&graph_arena_depth, 1, __ATOMIC_SEQ_CST);
+}
+
+void arena_end(void){
+    NDEBUG_ASSERT(graph_arena_depth > 0, "arena_end called without matching arena_begin!\n");
+    __atomic_sub_fetch(&graph_arena_depth, 1, __ATOMIC_SEQ_CST);
+}
+
+void arena_reset(void){
+    arena_rewind(arena_get_graph_arena());
+}
+
+bool arena_is_active(void){
+    return __atomic_load_n(&graph_arena_depth, __ATOMIC_RELAXED) > 0;
+}
+
+void* arena_malloc(size_t size){
+    if(arena_is_active()){
+        return arena_alloc(graph_arena, size);
+    }
+    return malloc(size);
+}
+
+void* arena_calloc(size_t count, size_t size){
+    if(arena_is_active()){
+        // blocks are reused after a rewind, so they must be cleared explicitly
+        void* ptr = arena_alloc(graph_arena, count * size);
+        memset(ptr, 0, count * size);
+        return ptr;
+    }
+    return calloc(count, size);
+}
@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * bump allocator whose memory is released all at once
+ *
+ * the graph arena is a process-wide arena which, while active (between arena_begin and arena_end),
+ * serves every tensor, variable and grad metadata allocation made by coral (shapes are interned, see shape.h)
+ * a training step is then
+ *     arena_begin(); loss = forward(...); backwards(loss); arena_end();
+ *     ... update parameters in place ...
+ *     arena_reset();
+ * where parameters are created outside of the arena so that they survive the reset
+*/
+
+typedef struct arena arena_t;
+
+arena_t* arena_new(size_t block_size);
+void arena_destroy(arena_t* arena);
+// aligned to 16 bytes
+void* arena_alloc(arena_t* arena, size_t size);
+// alignment is a power of two, at least 16
+void* arena_alloc_aligned(arena_t* arena, size_t size, size_t alignment);
+void arena_rewind(arena_t* arena);
+bool arena_contains(arena_t* arena, const void* ptr);
+size_t arena_get_bytes_used(arena_t* arena);
+size_t arena_get_bytes_reserved(arena_t* arena);
+
+void arena_begin(void);
+void arena_end(void);
+void arena_reset(void);
+bool arena_is_active(void);
+arena_t* arena_get_graph_arena(void);
+
+// allocation entry points used throughout coral, served by the graph arena while it is active
+void* arena_malloc(size_t size);
+void* arena_calloc(size_t count, size_t size);
+
+#endif // ARENA_H
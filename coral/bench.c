@@ -0,0 +1,433 @@
+#include "tensor.h"
+#include "variable.h"
+#include "grad.h"
+#include "arena.h"
+#include "module.h"
+#include "optim.h"
+#include "parallel.h"
+#include "simd.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * micro-benchmarks of the tensor and autograd hot paths
+ * usage: ./bench [-o results.json] [filter ...]
+ * runs the benchmarks whose names contain any of the filters (all of them without filters),
+ * printing a table as they run and writing the results as JSON to the -o file (bench.json by default)
+ *
+ * each benchmark is warmed up, then timed over BENCH_NUM_BATCHES batches of enough iterations to take
+ * BENCH_MIN_BATCH_NS, and reports the median batch
+ * bytes and flops are the least the op must move and compute (every operand read once, the result written once),
+ * so GB/s and GFLOP/s compare kernels against the machine rather than against each other's overheads
+ * allocations count the tensors whose data the op allocates, see tensor_get_num_allocations
+*/
+
+#define BENCH_NUM_BATCHES 5
+#define BENCH_MIN_BATCH_NS 20e6
+#define BENCH_MAX_RESULTS 128
+#define BENCH_ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+typedef void (* bench_fn_t)(void* context);
+
+typedef struct {
+    char name[64];
+    size_t num_elements; // of the output, or for reductions of the input
+    double bytes;
+    double flops;
+    size_t iterations;
+    double ns_per_op;
+    double allocations_per_op;
+} bench_result_t;
+
+static bench_result_t results[BENCH_MAX_RESULTS];
+static int num_results = 0;
+
+static int num_filters = 0;
+static char** filters = NULL;
+
+static double now_ns(void){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static bool is_selected(const char* name){
+    if(num_filters == 0){
+        return true;
+    }
+    for(int filter_index = 0; filter_index < num_filters; filter_index++){
+        if(strstr(name, filters[filter_index])){
+            return true;
+        }
+    }
+    return false;
+}
+
+static double time_batch(bench_fn_t fn, void* context, size_t iterations){
+    double start = now_ns();
+    for(size_t iteration = 0; iteration < iterations; iteration++){
+        fn(context);
+    }
+    return now_ns() - start;
+}
+
+static int compare_doubles(const void* left, const void* right){
+    double difference = *(const double*) left - *(const double*) right;
+    return (difference > 0) - (difference < 0);
+}
+
+static void run_benchmark(const char* name, size_t num_elements, double bytes, double flops, bench_fn_t fn, void* context){
+    if(!is_selected(name)){
+        return;
+    }
+    NDEBUG_ASSERT(num_results < BENCH_MAX_RESULTS, "Too many benchmarks!\n");
+    fn(context);
+    // double the batch until it takes long enough to time
+    size_t iterations = 1;
+    while(time_batch(fn, context, iterations) < BENCH_MIN_BATCH_NS){
+        iterations *= 2;
+    }
+    double batch_ns[BENCH_NUM_BATCHES];
+    size_t allocations = tensor_get_num_allocations();
+    for(int batch = 0; batch < BENCH_NUM_BATCHES; batch++){
+        batch_ns[batch] = time_batch(fn, context, iterations);
+    }
+    allocations = tensor_get_num_allocations() - allocations;
+    qsort(batch_ns, BENCH_NUM_BATCHES, sizeof(double), compare_doubles);
+
+    bench_result_t* result = &results[num_results++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->num_elements = num_elements;
+    result->bytes = bytes;
+    result->flops = flops;
+    result->iterations = iterations;
+    result->ns_per_op = batch_ns[BENCH_NUM_BATCHES / 2] / iterations;
+    result->allocations_per_op = (double) allocations / (iterations * BENCH_NUM_BATCHES);
+    printf("%-32s %12.0f ns/op %8.3f ns/entry %8.2f GB/s %8.2f GFLOP/s %6.2f allocs/op\n",
+            result->name, result->ns_per_op, result->ns_per_op / num_elements,
+            result->bytes / result->ns_per_op, result->flops / result->ns_per_op, result->allocations_per_op);
+}
+
+static void write_json(FILE* file){
+    fprintf(file, "{\n  \"num_threads\": %d,\n  \"simd_width\": %d,\n  \"benchmarks\": [\n", parallel_get_num_threads(), SIMD_WIDTH);
+    for(int result_index = 0; result_index < num_results; result_index++){
+        bench_result_t* result = &results[result_index];
+        fprintf(file, "    {\"name\": \"%s\", \"num_elements\": %zu, \"iterations\": %zu, \"ns_per_op\": %.1f, "
+                      "\"ns_per_element\": %.4f, \"gb_per_s\": %.3f, \"gflop_per_s\": %.3f, \"allocations_per_op\": %.2f}%s\n",
+                result->name, result->num_elements, result->iterations, result->ns_per_op,
+                result->ns_per_op / result->num_elements, result->bytes / result->ns_per_op,
+                result->flops / result->ns_per_op, result->allocations_per_op,
+                result_index + 1 < num_results ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/**
+ * OPERANDS
+ * results are freed every iteration, so that their data is recycled by the buffer pool as it would be in a caller
+*/
+
+static tensor_entry_t index_pattern(size_t index){
+    size_t residue = index % 17;
+    return residue * 0.125f - 1;
+}
+
+static tensor_t* new_operand(int num_dims, size_t* dims){
+    tensor_t* tensor = tensor_new(shape_new(num_dims, dims));
+    tensor_in_place_apply_index_fn(tensor, index_pattern);
+    return tensor;
+}
+
+static void free_result(tensor_t* result){
+    tensor_release(result);
+    free(result);
+}
+
+static size_t total_size(tensor_t* left_tensor, tensor_t* right_tensor){
+    return left_tensor->shape->size + right_tensor->shape->size;
+}
+
+static double entry_bytes(size_t num_entries){
+    return (double) num_entries * sizeof(tensor_entry_t);
+}
+
+/**
+ * ELEMENTWISE
+ * tensor_add over each broadcast pattern, rows x columns entries
+*/
+
+typedef struct {
+    tensor_t* left_tensor;
+    tensor_t* right_tensor;
+} binary_context_t;
+
+static void run_add(void* context){
+    binary_context_t* operands = (binary_context_t*) context;
+    free_result(tensor_add(operands->left_tensor, operands->right_tensor));
+}
+
+static void bench_add_pattern(const char* pattern, size_t size, tensor_t* left_tensor, tensor_t* right_tensor){
+    char name[64];
+    snprintf(name, sizeof(name), "add/%s/%zu", pattern, size);
+    binary_context_t context = {left_tensor, right_tensor};
+    size_t num_elements = shape_get_broadcast_shape(left_tensor->shape, right_tensor->shape)->size;
+    run_benchmark(name, num_elements, entry_bytes(total_size(left_tensor, right_tensor) + num_elements), num_elements, run_add, &context);
+}
+
+static void bench_add(size_t rows, size_t columns){
+    size_t size = rows * columns;
+    size_t matrix_dims[2] = {rows, columns};
+    size_t transposed_dims[2] = {columns, rows};
+    size_t scalar_dims[1] = {1};
+    size_t row_dims[1] = {columns};
+    size_t column_dims[2] = {rows, 1};
+    size_t outer_row_dims[2] = {1, columns};
+    size_t batch_dims[3] = {16, rows / 16, columns};
+    size_t middle_dims[3] = {16, 1, columns};
+    tensor_t* matrix = new_operand(2, matrix_dims);
+    tensor_t* other_matrix = new_operand(2, matrix_dims);
+    tensor_t* transposed = new_operand(2, transposed_dims);
+    tensor_t* scalar = new_operand(1, scalar_dims);
+    tensor_t* row = new_operand(1, row_dims);
+    tensor_t* column = new_operand(2, column_dims);
+    tensor_t* outer_row = new_operand(2, outer_row_dims);
+    tensor_t* batch = new_operand(3, batch_dims);
+    tensor_t* middle = new_operand(3, middle_dims);
+    tensor_t* transposed_view = tensor_transpose(transposed, 0, 1);
+
+    bench_add_pattern("same", size, matrix, other_matrix);
+    bench_add_pattern("scalar_right", size, matrix, scalar);
+    bench_add_pattern("scalar_left", size, scalar, matrix);
+    bench_add_pattern("row", size, matrix, row);
+    bench_add_pattern("column", size, matrix, column);
+    bench_add_pattern("outer", size, column, outer_row);
+    bench_add_pattern("middle", size, batch, middle);
+    bench_add_pattern("transposed", size, matrix, transposed_view);
+
+    tensor_t* operands[] = {matrix, other_matrix, transposed, scalar, row, column, outer_row, batch, middle};
+    for(size_t operand_index = 0; operand_index < BENCH_ARRAY_SIZE(operands); operand_index++){
+        free_result(operands[operand_index]);
+    }
+    free(transposed_view);
+}
+
+/**
+ * REDUCTIONS
+*/
+
+typedef struct {
+    tensor_t* tensor;
+    shape_t* target_shape;
+} reduce_context_t;
+
+static void run_reduce_to_shape(void* context){
+    reduce_context_t* operands = (reduce_context_t*) context;
+    free_result(tensor_reduce_to_shape(operands->tensor, operands->target_shape));
+}
+
+static void run_sum(void* context){
+    free_result(tensor_sum((tensor_t*) context));
+}
+
+static void bench_reduce(size_t rows, size_t columns){
+    size_t size = rows * columns;
+    size_t matrix_dims[2] = {rows, columns};
+    tensor_t* matrix = new_operand(2, matrix_dims);
+    struct {
+        const char* pattern;
+        shape_t* target_shape;
+    } patterns[] = {
+        {"rows", shape_new(1, (size_t[]) {columns})},
+        {"columns", shape_new(2, (size_t[]) {rows, 1})},
+        {"all", shape_new(1, (size_t[]) {1})},
+    };
+    char name[64];
+    for(size_t pattern_index = 0; pattern_index < BENCH_ARRAY_SIZE(patterns); pattern_index++){
+        reduce_context_t context = {matrix, patterns[pattern_index].target_shape};
+        snprintf(name, sizeof(name), "reduce_to_shape/%s/%zu", patterns[pattern_index].pattern, size);
+        run_benchmark(name, size, entry_bytes(size + context.target_shape->size), size, run_reduce_to_shape, &context);
+    }
+    snprintf(name, sizeof(name), "sum/%zu", size);
+    run_benchmark(name, size, entry_bytes(size + 1), size, run_sum, matrix);
+    free_result(matrix);
+}
+
+/**
+ * MATMUL
+ * n x n times n x n
+*/
+
+static void run_matmul(void* context){
+    binary_context_t* operands = (binary_context_t*) context;
+    free_result(tensor_matmul(operands->left_tensor, operands->right_tensor));
+}
+
+static void bench_matmul(size_t n){
+    size_t dims[2] = {n, n};
+    binary_context_t context = {new_operand(2, dims), new_operand(2, dims)};
+    char name[64];
+    snprintf(name, sizeof(name), "matmul/%zu", n);
+    run_benchmark(name, n * n, entry_bytes(3 * n * n), 2.0 * n * n * n, run_matmul, &context);
+    free_result(context.left_tensor);
+    free_result(context.right_tensor);
+}
+
+/**
+ * BATCHES
+ * num_tensors tiny (2x2x4, as in main.c) adds one op at a time into preallocated results, against one batched add
+*/
+
+typedef struct {
+    size_t num_tensors;
+    tensor_t** left_tensors;
+    tensor_t** right_tensors;
+    tensor_t** dest_tensors;
+    tensor_batch_t* left_batch;
+    tensor_batch_t* right_batch;
+    tensor_batch_t* dest_batch;
+} batched_context_t;
+
+static void run_unbatched_add(void* context){
+    batched_context_t* operands = (batched_context_t*) context;
+    for(size_t index = 0; index < operands->num_tensors; index++){
+        tensor_add_into(operands->dest_tensors[index], operands->left_tensors[index], operands->right_tensors[index]);
+    }
+}
+
+static void run_batched_add(void* context){
+    batched_context_t* operands = (batched_context_t*) context;
+    tensor_add_batched(operands->dest_batch, operands->left_batch, operands->right_batch);
+}
+
+static void bench_batched_add(size_t num_tensors){
+    size_t dims[3] = {2, 2, 4};
+    shape_t* shape = shape_new(3, dims);
+    batched_context_t context = {num_tensors, malloc(num_tensors * sizeof(tensor_t*)), malloc(num_tensors * sizeof(tensor_t*)), malloc(num_tensors * sizeof(tensor_t*)),
+                                 tensor_batch_new(num_tensors, shape), tensor_batch_new(num_tensors, shape), tensor_batch_new(num_tensors, shape)};
+    for(size_t index = 0; index < num_tensors; index++){
+        context.left_tensors[index] = new_operand(3, dims);
+        context.right_tensors[index] = new_operand(3, dims);
+        context.dest_tensors[index] = tensor_empty(shape);
+        tensor_batch_set(context.left_batch, index, context.left_tensors[index]);
+        tensor_batch_set(context.right_batch, index, context.right_tensors[index]);
+    }
+    size_t size = num_tensors * shape->size;
+    char name[64];
+    snprintf(name, sizeof(name), "add_unbatched/%zux16", num_tensors);
+    run_benchmark(name, size, entry_bytes(3 * size), size, run_unbatched_add, &context);
+    snprintf(name, sizeof(name), "add_batched/%zux16", num_tensors);
+    run_benchmark(name, size, entry_bytes(3 * size), size, run_batched_add, &context);
+    for(size_t index = 0; index < num_tensors; index++){
+        free_result(context.left_tensors[index]);
+        free_result(context.right_tensors[index]);
+        free_result(context.dest_tensors[index]);
+    }
+    tensor_batch_release(context.left_batch);
+    tensor_batch_release(context.right_batch);
+    tensor_batch_release(context.dest_batch);
+    free(context.left_tensors);
+    free(context.right_tensors);
+    free(context.dest_tensors);
+}
+
+/**
+ * AUTOGRAD
+ * forward and backward of the mse loss of a batch x features prediction, a step of a training loop:
+ * the graph is built in the graph arena and reset afterwards, while the gradient of the prediction persists
+*/
+
+typedef struct {
+    variable_t* actual;
+    variable_t* expected;
+} loss_context_t;
+
+static void run_mse_loss(void* context){
+    loss_context_t* operands = (loss_context_t*) context;
+    arena_begin();
+    backwards(variable_mse_loss(operands->actual, operands->expected));
+    arena_end();
+    arena_reset();
+}
+
+static void bench_mse_loss(size_t batch, size_t features){
+    size_t size = batch * features;
+    size_t dims[2] = {batch, features};
+    loss_context_t context = {
+        variable_new_from_tensor(new_operand(2, dims)),
+        variable_new_from_tensor(new_operand(2, dims)),
+    };
+    char name[64];
+    snprintf(name, sizeof(name), "mse_loss_backward/%zu", size);
+    // reads both operands and writes the gradient; subtract, square and sum forward, and the scaled difference backward
+    run_benchmark(name, size, entry_bytes(3 * size), 5.0 * size, run_mse_loss, &context);
+}
+
+/**
+ * OPTIMIZERS
+ * steps over num_parameters parameters of parameter_size entries each, the same number of entries as
+ * one large parameter should cost about the same as many small ones
+*/
+
+static void run_optimizer_step(void* context){
+    optimizer_step((optimizer_t*) context);
+}
+
+static void bench_optimizers(size_t num_parameters, size_t parameter_size){
+    module_t* model = module_new();
+    for(size_t parameter = 0; parameter < num_parameters; parameter++){
+        char parameter_name[32];
+        snprintf(parameter_name, sizeof(parameter_name), "parameter%zu", parameter);
+        variable_t* variable = variable_new_from_tensor(new_operand(1, &parameter_size));
+        tensor_in_place_apply_index_fn(variable_get_gradient(variable), &index_pattern);
+        module_add_parameter(model, parameter_name, variable);
+    }
+    size_t size = num_parameters * parameter_size;
+    char name[64];
+    optimizer_t* sgd = optimizer_new_sgd(model, 1e-3, 0.9);
+    snprintf(name, sizeof(name), "sgd_momentum/%zux%zu", num_parameters, parameter_size);
+    // reads the parameter, gradient and velocity, writes the parameter and velocity
+    run_benchmark(name, size, entry_bytes(5 * size), 4.0 * size, run_optimizer_step, sgd);
+    optimizer_free(sgd);
+    optimizer_t* adam = optimizer_new_adam(model, 1e-3, 0.9, 0.999, 1e-8);
+    snprintf(name, sizeof(name), "adam/%zux%zu", num_parameters, parameter_size);
+    // reads the parameter, gradient and both moments, writes the parameter and both moments
+    run_benchmark(name, size, entry_bytes(7 * size), 13.0 * size, run_optimizer_step, adam);
+    optimizer_free(adam);
+    module_free(model);
+}
+
+int main(int argc, char** argv){
+    const char* json_path = "bench.json";
+    int first_filter = 1;
+    if(argc > 2 && strcmp(argv[1], "-o") == 0){
+        json_path = argv[2];
+        first_filter = 3;
+    }
+    num_filters = argc - first_filter;
+    filters = argv + first_filter;
+    size_t sizes[3][2] = {{64, 64}, {512, 512}, {2048, 2048}};
+    for(int size_index = 0; size_index < 3; size_index++){
+        bench_add(sizes[size_index][0], sizes[size_index][1]);
+    }
+    for(int size_index = 0; size_index < 3; size_index++){
+        bench_reduce(sizes[size_index][0], sizes[size_index][1]);
+    }
+    size_t matmul_sizes[4] = {64, 256, 512, 1024};
+    for(int size_index = 0; size_index < 4; size_index++){
+        bench_matmul(matmul_sizes[size_index]);
+    }
+    bench_batched_add(4096);
+    for(int size_index = 0; size_index < 3; size_index++){
+        bench_mse_loss(sizes[size_index][0], sizes[size_index][1]);
+    }
+    bench_optimizers(1, (size_t) 1 << 22);
+    bench_optimizers(4096, 1024);
+    FILE* json_file = fopen(json_path, "w");
+    NDEBUG_ASSERT(json_file != NULL, "Could not open the results file!\n");
+    write_json(json_file);
+    fclose(json_file);
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include "checkpoint.h"
+#include "grad.h"
+#include "arena.h"
+#include "assert.h"
+#include "utils.h"
+#include <pthread.h>
+
+typedef struct {
+    checkpoint_unary_fn_t unary_fn;
+    checkpoint_binary_fn_t binary_fn;
+    void* context;
+    tensor_t* right_gradient; // computed along with the left gradient, see checkpoint_left_backwards_grad
+} segment_t;
+
+static inline segment_t* segment_new(checkpoint_unary_fn_t unary_fn, checkpoint_binary_fn_t binary_fn, void* context){
+    segment_t* new_segment = (segment_t*) arena_malloc(sizeof(segment_t));
+    new_segment->unary_fn = unary_fn;
+    new_segment->binary_fn = binary_fn;
+    new_segment->context = context;
+    new_segment->right_gradient = NULL;
+    return new_segment;
+}
+
+/**
+ * RECOMPUTATION
+ * segments are recomputed one at a time: the leaves they read are accumulated into without the gradient
+ * locks, and plans are not built concurrently
+ * recomputing a segment may recompute the segments nested inside of it, hence the per thread depth
+*/
+
+static pthread_mutex_t recompute_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int recompute_depth = 0;
+
+static void recompute_begin(void){
+    NDEBUG_ASSERT(coral_is_grad_enabled(), "Checkpointed segments cannot be recomputed in no-grad mode!\n");
+    if(recompute_depth++ == 0){
+        pthread_mutex_lock(&recompute_mutex);
+    }
+}
+
+static void recompute_end(void){
+    if(--recompute_depth == 0){
+        pthread_mutex_unlock(&recompute_mutex);
+    }
+}
+
+// stands in for an input of the segment, so that the graph recorded by the segment stops at its inputs
+// in the forward pass it requires grad as the input does, so that the output requires grad when either the inputs or
+// the parameters the segment captures do, in a recomputation it does, as the gradients of both stand-ins come out of it
+static variable_t* segment_input_new(variable_t* input, bool requires_grad){
+    variable_t* new_variable = (variable_t*) arena_malloc(sizeof(variable_t));
+    new_variable->tensor = input->tensor;
+    new_variable->gradient = NULL;
+    new_variable->grad_meta = grad_meta_new();
+    new_variable->requires_grad = requires_grad;
+    return new_variable;
+}
+
+// a segment which ends in a view of an activation recorded inside of it gives its output a copy of its own,
+// as the activations a root views outlive its plan (see grad.c)
+static void own_output(variable_t* output){
+    grad_meta_t* grad_meta = output->grad_meta;
+    for(int input_index = 0; input_index < grad_meta->num_inputs; input_index++){
+        variable_t* input = grad_meta->inputs[input_index]->variable;
+        if(input->grad_meta->num_inputs > 0 && !output->tensor->owns_data && tensor_shares_memory(output->tensor, input->tensor)){
+            tensor_t* copy = tensor_copy(output->tensor);
+            *output->tensor = *copy;
+            return;
+        }
+    }
+}
+
+// releases the activations recorded inside the segment, only its output is kept
+static void release_segment(variable_t* output){
+    NDEBUG_ASSERT(output->grad_meta && output->grad_meta->num_inputs > 0, "Checkpointed segment must compute its output from its inputs!\n");
+    own_output(output);
+    backward_plan_t* plan = backward_plan_new(output);
+    backward_plan_release_activations(plan);
+    backward_plan_free(plan);
+}
+
+// backpropagates output_gradient through the recomputed segment, releasing it on the way
+static void backward_segment(variable_t* recomputed, tensor_t* output_gradient){
+    own_output(recomputed);
+    backward_plan_t* plan = backward_plan_new(recomputed);
+    backward_plan_set_memory_planning(plan, true);
+    backward_plan_run_from_gradient(plan, output_gradient);
+    backward_plan_free(plan);
+    tensor_release(recomputed->tensor);
+    tensor_release(recomputed->gradient);
+}
+
+/**
+ * GRADIENTS
+ * the gradients of the inputs are those of their stand-ins in the recomputed segment
+*/
+
+static tensor_t* checkpoint_unary_backwards_grad(variable_t* input, variable_t* output){
+    segment_t* segment = (segment_t*) output->grad_meta->op_context;
+    recompute_begin();
+    variable_t* segment_input = segment_input_new(input, true);
+    backward_segment((*segment->unary_fn)(segment_input, segment->context), output->gradient);
+    recompute_end();
+    return variable_get_gradient(segment_input);
+}
+
+// both gradients come out of the same recomputation, the right one is kept for checkpoint_right_backwards_grad
+// which grad.c calls right after this one (which always runs, see checkpoint_binary), if the right input requires grad
+static tensor_t* checkpoint_left_backwards_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    segment_t* segment = (segment_t*) output->grad_meta->op_context;
+    recompute_begin();
+    variable_t* left_input = segment_input_new(input, true);
+    variable_t* right_input = segment_input_new(other_input, true);
+    backward_segment((*segment->binary_fn)(left_input, right_input, segment->context), output->gradient);
+    recompute_end();
+    if(other_input->requires_grad){
+        segment->right_gradient = variable_get_gradient(right_input);
+    }else{
+        tensor_release(variable_get_gradient(right_input));
+    }
+    return variable_get_gradient(left_input);
+}
+
+static tensor_t* checkpoint_right_backwards_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    segment_t* segment = (segment_t*) output->grad_meta->op_context;
+    if(segment->right_gradient == NULL){
+        tensor_release(checkpoint_left_backwards_grad(other_input, input, output));
+    }
+    tensor_t* right_gradient = segment->right_gradient;
+    segment->right_gradient = NULL;
+    return right_gradient;
+}
+
+/**
+ * SEGMENTS
+*/
+
+variable_t* checkpoint_unary(checkpoint_unary_fn_t fn, variable_t* input, void* context){
+    if(!coral_is_grad_enabled()){
+        return (*fn)(input, context);
+    }
+    variable_t* output = (*fn)(segment_input_new(input, input->requires_grad), context);
+    release_segment(output);
+    bool segment_requires_grad = output->requires_grad;
+    set_unary_grad_meta(output, input, &checkpoint_unary_backwards_grad, "checkpoint");
+    output->requires_grad |= segment_requires_grad;
+    set_unary_grad_needs(output, GRAD_NEEDS_INPUT);
+    // the recomputation accumulates into the captured parameters even when the input is constant
+    set_unary_always_runs(output, true);
+    output->grad_meta->op_context = segment_new(fn, NULL, context);
+    return output;
+}
+
+variable_t* checkpoint_binary(checkpoint_binary_fn_t fn, variable_t* left_input, variable_t* right_input, void* context){
+    if(!coral_is_grad_enabled()){
+        return (*fn)(left_input, right_input, context);
+    }
+    variable_t* output = (*fn)(segment_input_new(left_input, left_input->requires_grad), segment_input_new(right_input, right_input->requires_grad), context);
+    release_segment(output);
+    bool segment_requires_grad = output->requires_grad;
+    set_binary_grad_meta(output, left_input, right_input, &checkpoint_left_backwards_grad, &checkpoint_right_backwards_grad, "checkpoint");
+    output->requires_grad |= segment_requires_grad;
+    set_binary_grad_needs(output, GRAD_NEEDS_INPUT | GRAD_NEEDS_OTHER_INPUT, GRAD_NEEDS_INPUT | GRAD_NEEDS_OTHER_INPUT);
+    // one recomputation, run through the left input, accumulates into the captured parameters whichever inputs are constant
+    set_binary_always_runs(output, true, false);
+    output->grad_meta->op_context = segment_new(NULL, fn, context);
+    return output;
+}
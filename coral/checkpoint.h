@@ -0,0 +1,27 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "variable.h"
+
+/**
+ * gradient checkpointing
+ * a checkpointed segment of the forward graph is recorded as a single node whose inputs are the inputs of
+ * the segment: the activations inside the segment are released as soon as the forward pass leaves it, and
+ * the segment is run again during the backward pass to recover them, trading one extra forward pass of the
+ * segment for its memory
+ * checkpointing a chain of N ops in segments of sqrt(N) ops keeps O(sqrt(N)) activations alive at once
+ *
+ * segments must be deterministic, and must only read their inputs and leaf variables (parameters, passed in
+ * through context), whose gradients are accumulated while the segment is recomputed
+ * recomputation is serialized, so when backward passes run concurrently, leaves read by a segment should
+ * not also be read outside of checkpointed segments
+ * in no-grad mode the segment is simply run
+*/
+
+typedef variable_t* (* checkpoint_unary_fn_t)(variable_t* input, void* context);
+typedef variable_t* (* checkpoint_binary_fn_t)(variable_t* left_input, variable_t* right_input, void* context);
+
+variable_t* checkpoint_unary(checkpoint_unary_fn_t fn, variable_t* input, void* context);
+variable_t* checkpoint_binary(checkpoint_binary_fn_t fn, variable_t* left_input, variable_t* right_input, void* context);
+
+#endif // CHECKPOINT_H
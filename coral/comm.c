@@ -0,0 +1,542 @@
+#include "comm.h"
+#include "dtype.h"
+#include "profile.h"
+#include "assert.h"
+#include "utils.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+struct comm {
+    int rank;
+    int world_size;
+    int next_socket; // to rank + 1
+    int previous_socket; // from rank - 1
+    void* send_buffer;
+    void* receive_buffer;
+    size_t buffer_size; // bytes of each
+};
+
+/**
+ * CONNECTIONS
+*/
+
+static int listen_on(int port){
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if(listener < 0){
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if(bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 1) != 0){
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+// retries until the host listens, or COMM_CONNECT_TIMEOUT_MS passes
+static int connect_to(const char* host, int port){
+    char port_string[16];
+    snprintf(port_string, sizeof(port_string), "%d", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses;
+    if(getaddrinfo(host, port_string, &hints, &addresses) != 0){
+        return -1;
+    }
+    int connection = -1;
+    for(int attempt = 0; attempt < COMM_CONNECT_TIMEOUT_MS / 10 && connection < 0; attempt++){
+        connection = socket(AF_INET, SOCK_STREAM, 0);
+        if(connection >= 0 && connect(connection, addresses->ai_addr, addresses->ai_addrlen) != 0){
+            close(connection);
+            connection = -1;
+            struct timespec delay = {0, 10 * 1000 * 1000};
+            nanosleep(&delay, NULL);
+        }
+    }
+    freeaddrinfo(addresses);
+    return connection;
+}
+
+static bool send_all(int connection, const void* data, size_t size){
+    for(size_t sent = 0; sent < size;){
+        ssize_t result = send(connection, (const char*) data + sent, size - sent, MSG_NOSIGNAL);
+        if(result <= 0 && errno != EINTR){
+            return false;
+        }
+        sent += (result > 0) ? (size_t) result : 0;
+    }
+    return true;
+}
+
+static bool receive_all(int connection, void* data, size_t size){
+    for(size_t received = 0; received < size;){
+        ssize_t result = recv(connection, (char*) data + received, size - received, 0);
+        if(result == 0 || (result < 0 && errno != EINTR)){
+            return false;
+        }
+        received += (result > 0) ? (size_t) result : 0;
+    }
+    return true;
+}
+
+static void set_no_delay(int connection){
+    int no_delay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+}
+
+comm_t* comm_new(int rank, int world_size, const char** hosts, int base_port){
+    NDEBUG_ASSERT(0 <= rank && rank < world_size, "Rank out of range of the world!\n");
+    comm_t* new_comm = (comm_t*) calloc(1, sizeof(comm_t));
+    NDEBUG_ASSERT(new_comm != NULL, "Failed to allocate comm.\n");
+    new_comm->rank = rank;
+    new_comm->world_size = world_size;
+    new_comm->next_socket = -1;
+    new_comm->previous_socket = -1;
+    if(world_size == 1){
+        return new_comm;
+    }
+    // every process listens before connecting, so connections complete whatever order the processes start in
+    int next_rank = (rank + 1) % world_size;
+    int previous_rank = (rank + world_size - 1) % world_size;
+    int listener = listen_on(base_port + rank);
+    if(listener >= 0){
+        new_comm->next_socket = connect_to(hosts[next_rank], base_port + next_rank);
+        new_comm->previous_socket = (new_comm->next_socket >= 0) ? accept(listener, NULL, NULL) : -1;
+        close(listener);
+    }
+    // each process introduces itself to the next
+    int32_t sent_rank = rank;
+    int32_t received_rank = -1;
+    bool connected = new_comm->previous_socket >= 0 && send_all(new_comm->next_socket, &sent_rank, sizeof(sent_rank))
+                     && receive_all(new_comm->previous_socket, &received_rank, sizeof(received_rank));
+    if(!connected || received_rank != previous_rank){
+        comm_free(new_comm);
+        return NULL;
+    }
+    set_no_delay(new_comm->next_socket);
+    set_no_delay(new_comm->previous_socket);
+    return new_comm;
+}
+
+static int get_env_int(const char* name, int default_value){
+    char* value = getenv(name);
+    return value ? atoi(value) : default_value;
+}
+
+comm_t* comm_new_from_env(void){
+    int rank = get_env_int("CORAL_RANK", 0);
+    int world_size = get_env_int("CORAL_WORLD_SIZE", 1);
+    int base_port = get_env_int("CORAL_PORT", 29500);
+    NDEBUG_ASSERT(0 <= rank && rank < world_size, "CORAL_RANK out of range of CORAL_WORLD_SIZE!\n");
+    char* env_hosts = getenv("CORAL_HOSTS");
+    char* host_list = strdup(env_hosts ? env_hosts : "");
+    const char** hosts = (const char**) malloc(world_size * sizeof(const char*));
+    NDEBUG_ASSERT(host_list != NULL && hosts != NULL, "Failed to allocate comm.\n");
+    char* remaining = host_list;
+    for(int host_rank = 0; host_rank < world_size; host_rank++){
+        char* host = strsep(&remaining, ",");
+        hosts[host_rank] = (host && *host) ? host : "127.0.0.1";
+    }
+    comm_t* new_comm = comm_new(rank, world_size, hosts, base_port);
+    free(hosts);
+    free(host_list);
+    return new_comm;
+}
+
+void comm_free(comm_t* comm){
+    if(comm->next_socket >= 0){
+        close(comm->next_socket);
+    }
+    if(comm->previous_socket >= 0){
+        close(comm->previous_socket);
+    }
+    free(comm->send_buffer);
+    free(comm->receive_buffer);
+    free(comm);
+}
+
+int comm_get_rank(comm_t* comm){
+    return comm->rank;
+}
+
+int comm_get_world_size(comm_t* comm){
+    return comm->world_size;
+}
+
+/**
+ * RING ALL-REDUCE
+ * the buffer is split into world_size chunks:
+ * in step s of the reduce-scatter, rank r sends chunk r - s to the next rank and adds chunk r - s - 1 from
+ * the previous one, after which it holds the whole sum of chunk r + 1, which it averages;
+ * in step s of the all-gather, it sends chunk r + 1 - s and overwrites chunk r - s with the one received
+*/
+
+// sends and receives at once, as a ring of processes which all sent first would wait on each other
+static bool exchange(comm_t* comm, const void* send_data, size_t send_size, void* receive_data, size_t receive_size){
+    size_t sent = 0;
+    size_t received = 0;
+    while(sent < send_size || received < receive_size){
+        struct pollfd connections[2] = {
+            {comm->next_socket, (sent < send_size) ? POLLOUT : 0, 0},
+            {comm->previous_socket, (received < receive_size) ? POLLIN : 0, 0},
+        };
+        if(poll(connections, 2, -1) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        if((connections[0].revents | connections[1].revents) & (POLLERR | POLLNVAL)){
+            return false;
+        }
+        if(connections[0].revents & POLLOUT){
+            ssize_t result = send(comm->next_socket, (const char*) send_data + sent, send_size - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if(result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                return false;
+            }
+            sent += (result > 0) ? (size_t) result : 0;
+        }
+        if(connections[1].revents & (POLLIN | POLLHUP)){
+            ssize_t result = recv(comm->previous_socket, (char*) receive_data + received, receive_size - received, MSG_DONTWAIT);
+            if(result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+                return false;
+            }
+            received += (result > 0) ? (size_t) result : 0;
+        }
+    }
+    return true;
+}
+
+static void reserve_buffers(comm_t* comm, size_t size){
+    if(size <= comm->buffer_size){
+        return;
+    }
+    comm->send_buffer = realloc(comm->send_buffer, size);
+    comm->receive_buffer = realloc(comm->receive_buffer, size);
+    NDEBUG_ASSERT(comm->send_buffer && comm->receive_buffer, "Failed to allocate comm buffers.\n");
+    comm->buffer_size = size;
+}
+
+static inline size_t chunk_begin(size_t count, int world_size, int chunk){
+    return count * chunk / world_size;
+}
+
+static void encode_float16(uint16_t* encoded, const tensor_entry_t* data, size_t count){
+    for(size_t index = 0; index < count; index++){
+        encoded[index] = float_to_float16(data[index]);
+    }
+}
+
+bool comm_all_reduce_mean(comm_t* comm, tensor_entry_t* data, size_t count, bool compress){
+    int world_size = comm->world_size;
+    if(world_size == 1){
+        return true;
+    }
+    size_t entry_size = compress ? sizeof(uint16_t) : sizeof(tensor_entry_t);
+    PROFILE_SCOPE("comm", "all_reduce", 2 * count * entry_size);
+    reserve_buffers(comm, (count / world_size + 1) * sizeof(tensor_entry_t));
+    const uint16_t* received_encoded = (const uint16_t*) comm->receive_buffer;
+    const tensor_entry_t* received = (const tensor_entry_t*) comm->receive_buffer;
+    int rank = comm->rank;
+    for(int step = 0; step < world_size - 1; step++){
+        int send_chunk = (rank - step + world_size) % world_size;
+        int receive_chunk = (rank - step - 1 + 2 * world_size) % world_size;
+        size_t send_begin = chunk_begin(count, world_size, send_chunk);
+        size_t send_count = chunk_begin(count, world_size, send_chunk + 1) - send_begin;
+        size_t receive_begin = chunk_begin(count, world_size, receive_chunk);
+        size_t receive_count = chunk_begin(count, world_size, receive_chunk + 1) - receive_begin;
+        const void* send_data = data + send_begin;
+        if(compress){
+            encode_float16((uint16_t*) comm->send_buffer, data + send_begin, send_count);
+            send_data = comm->send_buffer;
+        }
+        if(!exchange(comm, send_data, send_count * entry_size, comm->receive_buffer, receive_count * entry_size)){
+            return false;
+        }
+        tensor_entry_t* reduced = data + receive_begin;
+        for(size_t index = 0; index < receive_count; index++){
+            reduced[index] += compress ? float16_to_float(received_encoded[index]) : received[index];
+        }
+    }
+    int owned_chunk = (rank + 1) % world_size;
+    size_t owned_begin = chunk_begin(count, world_size, owned_chunk);
+    size_t owned_end = chunk_begin(count, world_size, owned_chunk + 1);
+    for(size_t index = owned_begin; index < owned_end; index++){
+        data[index] /= world_size;
+        // rounded as the other processes receive it, so that every process has the same average
+        data[index] = compress ? float16_to_float(float_to_float16(data[index])) : data[index];
+    }
+    for(int step = 0; step < world_size - 1; step++){
+        int send_chunk = (rank + 1 - step + world_size) % world_size;
+        int receive_chunk = (rank - step + world_size) % world_size;
+        size_t send_begin = chunk_begin(count, world_size, send_chunk);
+        size_t send_count = chunk_begin(count, world_size, send_chunk + 1) - send_begin;
+        size_t receive_begin = chunk_begin(count, world_size, receive_chunk);
+        size_t receive_count = chunk_begin(count, world_size, receive_chunk + 1) - receive_begin;
+        if(!compress){
+            if(!exchange(comm, data + send_begin, send_count * entry_size, data + receive_begin, receive_count * entry_size)){
+                return false;
+            }
+            continue;
+        }
+        encode_float16((uint16_t*) comm->send_buffer, data + send_begin, send_count);
+        if(!exchange(comm, comm->send_buffer, send_count * entry_size, comm->receive_buffer, receive_count * entry_size)){
+            return false;
+        }
+        for(size_t index = 0; index < receive_count; index++){
+            data[receive_begin + index] = float16_to_float(received_encoded[index]);
+        }
+    }
+    return true;
+}
+
+/**
+ * BUCKETED REDUCER
+ * buckets are ranges [begin, end) of the gradient bucket of the module, holding whole parameters
+ * a run counts down the parameters of each bucket which the plan reaches as their gradients are finalized,
+ * while the communication thread reduces the buckets in order, each once its count reaches 0
+*/
+
+typedef struct {
+    size_t begin;
+    size_t end;
+    int first_parameter;
+    int end_parameter;
+    int num_pending; // parameters of the run which are not final yet
+    int ready_position; // in the topological order of the plan, when the last of its parameters is final (-1 if none is in the plan)
+} bucket_t;
+
+// parameters sorted by address, to find the bucket of a finalized leaf
+typedef struct {
+    variable_t* parameter;
+    int bucket;
+} parameter_bucket_t;
+
+struct comm_reducer {
+    comm_t* comm;
+    module_t* module;
+    bool compress;
+    int num_buckets;
+    bucket_t* buckets;
+    int* order; // buckets in the order they are reduced
+    int num_parameters;
+    parameter_bucket_t* parameter_buckets;
+    int* parameter_positions; // scratch, of each parameter in the plan
+    backward_plan_t* plan; // attached to
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t started; // a run was attached, or the reducer is stopping
+    pthread_cond_t finalized; // a bucket became ready
+    pthread_cond_t reduced; // a bucket was reduced
+    unsigned long generation; // runs attached
+    int num_reduced; // buckets of the current run
+    bool failed;
+    bool stopping;
+};
+
+static void* run_reducer(void* raw_reducer){
+    comm_reducer_t* reducer = (comm_reducer_t*) raw_reducer;
+    tensor_entry_t* gradients = module_get_gradient_bucket(reducer->module)->data;
+    unsigned long seen_generation = 0;
+    pthread_mutex_lock(&reducer->mutex);
+    for(;;){
+        while(reducer->generation == seen_generation && !reducer->stopping){
+            pthread_cond_wait(&reducer->started, &reducer->mutex);
+        }
+        if(reducer->stopping){
+            break;
+        }
+        seen_generation = reducer->generation;
+        for(int position = 0; position < reducer->num_buckets; position++){
+            bucket_t* bucket = &reducer->buckets[reducer->order[position]];
+            while(bucket->num_pending > 0){
+                pthread_cond_wait(&reducer->finalized, &reducer->mutex);
+            }
+            bool failed = reducer->failed;
+            pthread_mutex_unlock(&reducer->mutex);
+            // after a failure the remaining buckets are skipped, but still counted so that comm_reducer_wait returns
+            bool reduced = failed || comm_all_reduce_mean(reducer->comm, gradients + bucket->begin, bucket->end - bucket->begin, reducer->compress);
+            pthread_mutex_lock(&reducer->mutex);
+            reducer->failed = reducer->failed || !reduced;
+            reducer->num_reduced++;
+            pthread_cond_broadcast(&reducer->reduced);
+        }
+    }
+    pthread_mutex_unlock(&reducer->mutex);
+    return NULL;
+}
+
+static int compare_parameters(const void* left, const void* right){
+    uintptr_t left_address = (uintptr_t) ((const parameter_bucket_t*) left)->parameter;
+    uintptr_t right_address = (uintptr_t) ((const parameter_bucket_t*) right)->parameter;
+    return (left_address > right_address) - (left_address < right_address);
+}
+
+comm_reducer_t* comm_reducer_new(comm_t* comm, module_t* module, size_t bucket_size, bool compress){
+    NDEBUG_ASSERT(module_is_flat(module), "Reduced modules must be flat!\n");
+    NDEBUG_ASSERT(bucket_size > 0, "Buckets must hold at least one entry!\n");
+    comm_reducer_t* new_reducer = (comm_reducer_t*) calloc(1, sizeof(comm_reducer_t));
+    NDEBUG_ASSERT(new_reducer != NULL, "Failed to allocate reducer.\n");
+    new_reducer->comm = comm;
+    new_reducer->module = module;
+    new_reducer->compress = compress;
+    int num_parameters = module_get_num_parameters(module);
+    new_reducer->num_parameters = num_parameters;
+    new_reducer->buckets = (bucket_t*) malloc(MAX(num_parameters, 1) * sizeof(bucket_t));
+    new_reducer->order = (int*) malloc(MAX(num_parameters, 1) * sizeof(int));
+    new_reducer->parameter_buckets = (parameter_bucket_t*) malloc(MAX(num_parameters, 1) * sizeof(parameter_bucket_t));
+    new_reducer->parameter_positions = (int*) malloc(MAX(num_parameters, 1) * sizeof(int));
+    NDEBUG_ASSERT(new_reducer->buckets && new_reducer->order && new_reducer->parameter_buckets && new_reducer->parameter_positions, "Failed to allocate reducer.\n");
+    // parameters are laid out in the gradient bucket in the order of the module
+    size_t offset = 0;
+    for(int parameter_index = 0; parameter_index < num_parameters; parameter_index++){
+        size_t size = module_get_parameter(module, parameter_index)->tensor->shape->size;
+        bucket_t* bucket = &new_reducer->buckets[new_reducer->num_buckets - 1];
+        if(new_reducer->num_buckets == 0 || bucket->end - bucket->begin + size > bucket_size){
+            bucket = &new_reducer->buckets[new_reducer->num_buckets++];
+            *bucket = (bucket_t) {offset, offset, parameter_index, parameter_index, 0, -1};
+        }
+        bucket->end += size;
+        bucket->end_parameter = parameter_index + 1;
+        new_reducer->parameter_buckets[parameter_index] = (parameter_bucket_t) {module_get_parameter(module, parameter_index), new_reducer->num_buckets - 1};
+        offset += size;
+    }
+    qsort(new_reducer->parameter_buckets, num_parameters, sizeof(parameter_bucket_t), compare_parameters);
+    pthread_mutex_init(&new_reducer->mutex, NULL);
+    pthread_cond_init(&new_reducer->started, NULL);
+    pthread_cond_init(&new_reducer->finalized, NULL);
+    pthread_cond_init(&new_reducer->reduced, NULL);
+    NDEBUG_ASSERT(pthread_create(&new_reducer->thread, NULL, &run_reducer, new_reducer) == 0, "Failed to start reducer thread.\n");
+    return new_reducer;
+}
+
+void comm_reducer_free(comm_reducer_t* reducer){
+    pthread_mutex_lock(&reducer->mutex);
+    reducer->stopping = true;
+    pthread_cond_broadcast(&reducer->started);
+    pthread_mutex_unlock(&reducer->mutex);
+    pthread_join(reducer->thread, NULL);
+    pthread_mutex_destroy(&reducer->mutex);
+    pthread_cond_destroy(&reducer->started);
+    pthread_cond_destroy(&reducer->finalized);
+    pthread_cond_destroy(&reducer->reduced);
+    free(reducer->buckets);
+    free(reducer->order);
+    free(reducer->parameter_buckets);
+    free(reducer->parameter_positions);
+    free(reducer);
+}
+
+int comm_reducer_get_num_buckets(comm_reducer_t* reducer){
+    return reducer->num_buckets;
+}
+
+// index into parameter_buckets, -1 when variable is not a parameter of the module
+static int find_parameter(comm_reducer_t* reducer, variable_t* variable){
+    parameter_bucket_t key = {variable, 0};
+    parameter_bucket_t* found = (parameter_bucket_t*) bsearch(&key, reducer->parameter_buckets, reducer->num_parameters, sizeof(parameter_bucket_t), compare_parameters);
+    return found ? (int) (found - reducer->parameter_buckets) : -1;
+}
+
+static void finalize_leaf(void* raw_reducer, variable_t* leaf){
+    comm_reducer_t* reducer = (comm_reducer_t*) raw_reducer;
+    int parameter = find_parameter(reducer, leaf);
+    if(parameter < 0){
+        return;
+    }
+    pthread_mutex_lock(&reducer->mutex);
+    if(--reducer->buckets[reducer->parameter_buckets[parameter].bucket].num_pending == 0){
+        pthread_cond_signal(&reducer->finalized);
+    }
+    pthread_mutex_unlock(&reducer->mutex);
+}
+
+// buckets by when they are ready, then by index, so that every process orders them the same way
+static inline bool ready_before(const bucket_t* buckets, int left, int right){
+    int left_position = buckets[left].ready_position;
+    int right_position = buckets[right].ready_position;
+    return left_position < right_position || (left_position == right_position && left < right);
+}
+
+// insertion sort, buckets are few
+static void sort_order(comm_reducer_t* reducer){
+    for(int position = 1; position < reducer->num_buckets; position++){
+        int bucket = reducer->order[position];
+        int insert = position;
+        while(insert > 0 && ready_before(reducer->buckets, bucket, reducer->order[insert - 1])){
+            reducer->order[insert] = reducer->order[insert - 1];
+            insert--;
+        }
+        reducer->order[insert] = bucket;
+    }
+}
+
+void comm_reducer_attach(comm_reducer_t* reducer, backward_plan_t* plan){
+    pthread_mutex_lock(&reducer->mutex);
+    NDEBUG_ASSERT(reducer->plan == NULL, "comm_reducer_wait must be called before attaching the next run!\n");
+    // leaves join the order of the plan when their last consumer propagates into them, as they are finalized
+    // (frozen parameters never are, so their buckets do not wait on them)
+    for(int parameter = 0; parameter < reducer->num_parameters; parameter++){
+        reducer->parameter_positions[parameter] = -1;
+    }
+    for(int position = 0; position < backward_plan_get_num_nodes(plan); position++){
+        variable_t* node = backward_plan_get_node(plan, position);
+        int parameter = find_parameter(reducer, node);
+        if(parameter >= 0 && node->requires_grad){
+            reducer->parameter_positions[parameter] = position;
+        }
+    }
+    for(int bucket_index = 0; bucket_index < reducer->num_buckets; bucket_index++){
+        reducer->buckets[bucket_index].num_pending = 0;
+        reducer->buckets[bucket_index].ready_position = -1;
+        reducer->order[bucket_index] = bucket_index;
+    }
+    for(int parameter = 0; parameter < reducer->num_parameters; parameter++){
+        int position = reducer->parameter_positions[parameter];
+        bucket_t* bucket = &reducer->buckets[reducer->parameter_buckets[parameter].bucket];
+        if(position >= 0){
+            bucket->num_pending++;
+            bucket->ready_position = MAX(bucket->ready_position, position);
+        }
+    }
+    sort_order(reducer);
+    reducer->plan = plan;
+    reducer->num_reduced = 0;
+    reducer->failed = false;
+    reducer->generation++;
+    backward_plan_set_leaf_fn(plan, &finalize_leaf, reducer);
+    pthread_cond_signal(&reducer->started);
+    pthread_mutex_unlock(&reducer->mutex);
+}
+
+bool comm_reducer_wait(comm_reducer_t* reducer){
+    PROFILE_SCOPE("comm", "wait", 0);
+    pthread_mutex_lock(&reducer->mutex);
+    NDEBUG_ASSERT(reducer->plan != NULL, "No run was attached!\n");
+    while(reducer->num_reduced < reducer->num_buckets){
+        pthread_cond_wait(&reducer->reduced, &reducer->mutex);
+    }
+    backward_plan_set_leaf_fn(reducer->plan, NULL, NULL);
+    reducer->plan = NULL;
+    bool succeeded = !reducer->failed;
+    pthread_mutex_unlock(&reducer->mutex);
+    return succeeded;
+}
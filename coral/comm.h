@@ -0,0 +1,60 @@
+#ifndef COMM_H
+#define COMM_H
+
+#include "tensor.h"
+#include "module.h"
+#include "grad.h"
+#include <stdbool.h>
+
+/**
+ * data-parallel training across processes (or nodes)
+ * the processes of a world, numbered by rank, are connected in a ring over TCP: each one to the next, and
+ * from the previous, and average buffers with a ring all-reduce (a reduce-scatter, then an all-gather, of
+ * world_size chunks), so every process sends and receives about twice the buffer whatever the world size
+ * with compression, entries go over the wire as float16 (see dtype.h), halving the traffic, and every
+ * process ends with the same (rounded) average; gradients past the float16 range become infinite
+ *
+ *     comm_t* comm = comm_new_from_env(); // or comm_new(rank, world_size, hosts, port)
+ *     comm_reducer_t* reducer = comm_reducer_new(comm, model, COMM_DEFAULT_BUCKET_SIZE, false);
+ *     every step: forward; comm_reducer_attach(reducer, plan); backward_plan_run(plan); comm_reducer_wait(reducer); optimizer_step(optimizer);
+ *
+ * BUCKETS
+ * a reducer splits the gradient bucket of a flat module (see module_flatten) into buckets of whole parameters,
+ * each of about bucket_size entries, and averages them on a communication thread while the backward pass runs:
+ * a bucket is reduced as soon as the last of its parameters is final (see backward_plan_set_leaf_fn)
+ * buckets are reduced in the order the plan finalizes them, which every process agrees on as their graphs
+ * have the same structure; adding parameters to the module in the order of the forward pass makes the last
+ * parameters (the first finalized) share buckets, so that communication starts early
+*/
+
+typedef struct comm comm_t;
+typedef struct comm_reducer comm_reducer_t;
+
+// entries per bucket
+#define COMM_DEFAULT_BUCKET_SIZE ((size_t) 1 << 20)
+// how long comm_new waits for the next process to listen
+#define COMM_CONNECT_TIMEOUT_MS 30000
+
+// hosts[r] is the address of rank r, which listens on base_port + r, NULL on failure to connect
+comm_t* comm_new(int rank, int world_size, const char** hosts, int base_port);
+// from CORAL_RANK, CORAL_WORLD_SIZE, CORAL_HOSTS (comma separated, default all 127.0.0.1) and CORAL_PORT (default 29500),
+// a world of 1 when they are not set
+comm_t* comm_new_from_env(void);
+void comm_free(comm_t* comm);
+int comm_get_rank(comm_t* comm);
+int comm_get_world_size(comm_t* comm);
+// sets the count entries at data to their average over the world, every process must call it with the same count
+// false when the connection fails, leaving data partially reduced
+bool comm_all_reduce_mean(comm_t* comm, tensor_entry_t* data, size_t count, bool compress);
+
+// the module must be flat, the reducer uses comm until it is freed
+comm_reducer_t* comm_reducer_new(comm_t* comm, module_t* module, size_t bucket_size, bool compress);
+void comm_reducer_free(comm_reducer_t* reducer);
+int comm_reducer_get_num_buckets(comm_reducer_t* reducer);
+// before every run of plan (a graph over the parameters of the module), after which comm_reducer_wait must be called
+void comm_reducer_attach(comm_reducer_t* reducer, backward_plan_t* plan);
+// blocks until every bucket of the run has been averaged, false when communication failed
+// parameters the plan does not reach are final from the start, and so also averaged
+bool comm_reducer_wait(comm_reducer_t* reducer);
+
+#endif // COMM_H
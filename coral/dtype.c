@@ -0,0 +1,111 @@
+#include "dtype.h"
+#include "utils.h"
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// entries converted at a time between two dtypes neither of which is float32
+#define DTYPE_CONVERT_BLOCK 256
+
+const char* dtype_get_name(tensor_dtype_t dtype){
+    switch(dtype){
+        case TENSOR_FLOAT64: return "float64";
+        case TENSOR_FLOAT16: return "float16";
+        case TENSOR_BFLOAT16: return "bfloat16";
+        case TENSOR_INT8: return "int8";
+        default: return "float32";
+    }
+}
+
+// dest <- source, widened to float32
+static void load_entries(float* dest, const void* source, tensor_dtype_t dtype, quantization_t quantization, size_t size){
+    size_t index = 0;
+    switch(dtype){
+        case TENSOR_FLOAT64:
+            for(; index < size; index++){
+                dest[index] = (float) ((const double*) source)[index];
+            }
+            break;
+        case TENSOR_FLOAT16:
+#if defined(__F16C__)
+            for(; index + 8 <= size; index += 8){
+                __m128i entries = _mm_loadu_si128((const __m128i*) ((const uint16_t*) source + index));
+                _mm256_storeu_ps(dest + index, _mm256_cvtph_ps(entries));
+            }
+#endif
+            for(; index < size; index++){
+                dest[index] = float16_to_float(((const uint16_t*) source)[index]);
+            }
+            break;
+        case TENSOR_BFLOAT16:
+            for(; index < size; index++){
+                dest[index] = bfloat16_to_float(((const uint16_t*) source)[index]);
+            }
+            break;
+        case TENSOR_INT8:
+            for(; index < size; index++){
+                dest[index] = int8_to_float(((const int8_t*) source)[index], quantization);
+            }
+            break;
+        default:
+            memcpy(dest, source, size * sizeof(float));
+    }
+}
+
+// dest <- source, narrowed from float32
+static void store_entries(void* dest, tensor_dtype_t dtype, quantization_t quantization, const float* source, size_t size){
+    size_t index = 0;
+    switch(dtype){
+        case TENSOR_FLOAT64:
+            for(; index < size; index++){
+                ((double*) dest)[index] = source[index];
+            }
+            break;
+        case TENSOR_FLOAT16:
+#if defined(__F16C__)
+            for(; index + 8 <= size; index += 8){
+                __m128i entries = _mm256_cvtps_ph(_mm256_loadu_ps(source + index), _MM_FROUND_TO_NEAREST_INT);
+                _mm_storeu_si128((__m128i*) ((uint16_t*) dest + index), entries);
+            }
+#endif
+            for(; index < size; index++){
+                ((uint16_t*) dest)[index] = float_to_float16(source[index]);
+            }
+            break;
+        case TENSOR_BFLOAT16:
+            for(; index < size; index++){
+                ((uint16_t*) dest)[index] = float_to_bfloat16(source[index]);
+            }
+            break;
+        case TENSOR_INT8:
+            for(; index < size; index++){
+                ((int8_t*) dest)[index] = float_to_int8(source[index], quantization);
+            }
+            break;
+        default:
+            memcpy(dest, source, size * sizeof(float));
+    }
+}
+
+void dtype_convert(void* dest, tensor_dtype_t dest_dtype, quantization_t dest_quantization,
+                   const void* source, tensor_dtype_t source_dtype, quantization_t source_quantization, size_t size){
+    bool same_quantization = source_quantization.scale == dest_quantization.scale && source_quantization.zero_point == dest_quantization.zero_point;
+    if(source_dtype == dest_dtype && (dest_dtype != TENSOR_INT8 || same_quantization)){
+        memcpy(dest, source, size * dtype_get_size(dest_dtype));
+    }else if(source_dtype == TENSOR_FLOAT32){
+        store_entries(dest, dest_dtype, dest_quantization, (const float*) source, size);
+    }else if(dest_dtype == TENSOR_FLOAT32){
+        load_entries((float*) dest, source, source_dtype, source_quantization, size);
+    }else{
+        // through float32, a block at a time
+        float block[DTYPE_CONVERT_BLOCK];
+        size_t source_size = dtype_get_size(source_dtype);
+        size_t dest_size = dtype_get_size(dest_dtype);
+        for(size_t offset = 0; offset < size; offset += DTYPE_CONVERT_BLOCK){
+            size_t block_size = MIN(DTYPE_CONVERT_BLOCK, size - offset);
+            load_entries(block, (const char*) source + offset * source_size, source_dtype, source_quantization, block_size);
+            store_entries((char*) dest + offset * dest_size, dest_dtype, dest_quantization, block, block_size);
+        }
+    }
+}
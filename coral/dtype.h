@@ -0,0 +1,160 @@
+#ifndef DTYPE_H
+#define DTYPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * tensor dtypes
+ * float32 is the compute type: every kernel, and the whole autograd graph, runs on it
+ * float64 backs the elementwise ops, sums and matmuls for gradient checks, computed in double throughout
+ * float16 and bfloat16 are storage types, widened to float32 by the ops that read them (so that they
+ * accumulate in float32) and narrowed back when they are written, halving the memory and bandwidth of the tensor
+ * int8 tensors are quantized with a per tensor scale and zero point, entry = scale * (q - zero_point),
+ * and are multiplied with int32 accumulation (see tensor_matmul)
+*/
+
+typedef enum {
+    TENSOR_FLOAT32 = 0, // zeroed tensors are float32
+    TENSOR_FLOAT64,
+    TENSOR_FLOAT16,
+    TENSOR_BFLOAT16,
+    TENSOR_INT8
+} tensor_dtype_t;
+
+typedef struct {
+    float scale;
+    int32_t zero_point;
+} quantization_t;
+
+#define QUANTIZATION_NONE ((quantization_t) {1, 0})
+#define QUANTIZATION_MIN -128
+#define QUANTIZATION_MAX 127
+
+static inline size_t dtype_get_size(tensor_dtype_t dtype){
+    switch(dtype){
+        case TENSOR_FLOAT64: return sizeof(double);
+        case TENSOR_FLOAT16: return sizeof(uint16_t);
+        case TENSOR_BFLOAT16: return sizeof(uint16_t);
+        case TENSOR_INT8: return sizeof(int8_t);
+        default: return sizeof(float);
+    }
+}
+
+const char* dtype_get_name(tensor_dtype_t dtype);
+
+/**
+ * SCALAR CONVERSIONS
+ * narrowing rounds to nearest, ties to even, and saturates int8
+*/
+
+static inline uint32_t float_bits(float value){
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float float_from_bits(uint32_t bits){
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline float bfloat16_to_float(uint16_t entry){
+    return float_from_bits((uint32_t) entry << 16);
+}
+
+static inline uint16_t float_to_bfloat16(float value){
+    uint32_t bits = float_bits(value);
+    if((bits & 0x7FFFFFFF) > 0x7F800000){
+        // quiet nan, rounding could carry it into infinity
+        return (uint16_t) ((bits >> 16) | 0x40);
+    }
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (uint16_t) (bits >> 16);
+}
+
+static inline float float16_to_float(uint16_t entry){
+    uint32_t sign = (uint32_t) (entry & 0x8000) << 16;
+    uint32_t exponent = (entry >> 10) & 0x1F;
+    uint32_t mantissa = entry & 0x3FF;
+    if(exponent == 0x1F){
+        return float_from_bits(sign | 0x7F800000 | (mantissa << 13));
+    }
+    if(exponent == 0){
+        // subnormal, mantissa * 2^-24
+        float magnitude = mantissa * (1.0f / 16777216);
+        return sign ? -magnitude : magnitude;
+    }
+    return float_from_bits(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+static inline uint16_t float_to_float16(float value){
+    uint32_t bits = float_bits(value);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+    if(magnitude > 0x7F800000){
+        return sign | 0x7E00;
+    }
+    if(magnitude >= 0x47800000){
+        // at least 2^16, past the largest float16
+        return sign | 0x7C00;
+    }
+    if(magnitude < 0x38800000){
+        // below 2^-14, a float16 subnormal
+        int shift = 126 - (int) (magnitude >> 23);
+        if(shift > 24){
+            return sign;
+        }
+        uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+        uint32_t entry = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        entry += (remainder > halfway || (remainder == halfway && (entry & 1)));
+        return sign | (uint16_t) entry;
+    }
+    // rebias the exponent, a carry out of the mantissa rounds up to the next exponent (or infinity)
+    uint32_t entry = (magnitude - 0x38000000) >> 13;
+    uint32_t remainder = magnitude & 0x1FFF;
+    entry += (remainder > 0x1000 || (remainder == 0x1000 && (entry & 1)));
+    return sign | (uint16_t) entry;
+}
+
+// clamped while still a float, as converting NaN or an out of range float to an integer is undefined
+static inline int8_t float_to_int8(float value, quantization_t quantization){
+    float quantized = nearbyintf(value / quantization.scale) + quantization.zero_point;
+    if(isnan(quantized)){
+        return (int8_t) quantization.zero_point;
+    }
+    quantized = quantized < QUANTIZATION_MIN ? QUANTIZATION_MIN : quantized;
+    quantized = quantized > QUANTIZATION_MAX ? QUANTIZATION_MAX : quantized;
+    return (int8_t) quantized;
+}
+
+static inline float int8_to_float(int8_t entry, quantization_t quantization){
+    return quantization.scale * (entry - quantization.zero_point);
+}
+
+// entries[index] of an array of dtype, as a double
+static inline double dtype_get_value(const void* entries, tensor_dtype_t dtype, quantization_t quantization, size_t index){
+    switch(dtype){
+        case TENSOR_FLOAT64: return ((const double*) entries)[index];
+        case TENSOR_FLOAT16: return float16_to_float(((const uint16_t*) entries)[index]);
+        case TENSOR_BFLOAT16: return bfloat16_to_float(((const uint16_t*) entries)[index]);
+        case TENSOR_INT8: return int8_to_float(((const int8_t*) entries)[index], quantization);
+        default: return ((const float*) entries)[index];
+    }
+}
+
+/**
+ * BULK CONVERSIONS
+ * dest <- source over size contiguous entries, either dtype may be any of them
+ * the quantizations are those of int8 operands, and are ignored for other dtypes
+*/
+void dtype_convert(void* dest, tensor_dtype_t dest_dtype, quantization_t dest_quantization,
+                   const void* source, tensor_dtype_t source_dtype, quantization_t source_quantization, size_t size);
+
+#endif // DTYPE_H
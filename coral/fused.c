@@ -0,0 +1,364 @@
+#include "fused.h"
+#include "arena.h"
+#include "parallel.h"
+#include "simd.h"
+#include "utils.h"
+#include "assert.h"
+#include <stdlib.h>
+#include <string.h>
+// the entry expressions of the op tables are type generic (see ops.h)
+#include <tgmath.h>
+
+// entries processed by each instruction at a time
+#define FUSED_CHUNK_SIZE 256
+// upper bound on the number of distinct nodes in an expression
+#define FUSED_MAX_NODES 32
+
+// the ops of the op tables (see ops.h) follow the leaves
+#define FUSED_UNARY_OP_TAG(name, TAG, entry_expression) FUSED_##TAG,
+#define FUSED_BINARY_OP_TAG(name, TAG, simd_fn, entry_expression, check_nonzero_right) FUSED_##TAG,
+
+typedef enum {
+    FUSED_INPUT,
+    FUSED_CONSTANT,
+    CORAL_BINARY_OPS(FUSED_BINARY_OP_TAG)
+    CORAL_UNARY_OPS(FUSED_UNARY_OP_TAG)
+} fused_op_t;
+
+struct fused_expr {
+    fused_op_t op;
+    fused_expr_t* operands[2];
+    tensor_t* tensor; // FUSED_INPUT
+    tensor_entry_t value; // FUSED_CONSTANT
+    shape_t* shape; // NULL for constants, which broadcast against anything
+    bool in_arena; // freed with the graph arena rather than by fused_expr_free
+};
+
+static fused_expr_t* expr_new(fused_op_t op, fused_expr_t* left_expr, fused_expr_t* right_expr){
+    fused_expr_t* new_expr = (fused_expr_t*) arena_malloc(sizeof(fused_expr_t));
+    new_expr->op = op;
+    new_expr->operands[0] = left_expr;
+    new_expr->operands[1] = right_expr;
+    new_expr->tensor = NULL;
+    new_expr->value = 0;
+    new_expr->in_arena = arena_is_active();
+    if(!right_expr){
+        new_expr->shape = left_expr ? left_expr->shape : NULL;
+    }else if(!left_expr->shape || !right_expr->shape){
+        new_expr->shape = left_expr->shape ? left_expr->shape : right_expr->shape;
+    }else{
+        NDEBUG_ASSERT(shape_broadcast_compatible(left_expr->shape, right_expr->shape), "Tensors are not broadcast compatible!\n");
+        new_expr->shape = shape_equal(left_expr->shape, right_expr->shape) ? left_expr->shape : shape_get_broadcast_shape(left_expr->shape, right_expr->shape);
+    }
+    return new_expr;
+}
+
+fused_expr_t* fused_input(tensor_t* tensor){
+    fused_expr_t* new_expr = expr_new(FUSED_INPUT, NULL, NULL);
+    new_expr->tensor = tensor;
+    new_expr->shape = tensor->shape;
+    return new_expr;
+}
+
+fused_expr_t* fused_constant(tensor_entry_t value){
+    fused_expr_t* new_expr = expr_new(FUSED_CONSTANT, NULL, NULL);
+    new_expr->value = value;
+    return new_expr;
+}
+
+#define DEFINE_FUSED_UNARY_OP(name, TAG, entry_expression)                              \
+    fused_expr_t* fused_##name(fused_expr_t* expr){                                     \
+        return expr_new(FUSED_##TAG, expr, NULL);                                       \
+    }
+#define DEFINE_FUSED_BINARY_OP(name, TAG, simd_fn, entry_expression, check_nonzero_right) \
+    fused_expr_t* fused_##name(fused_expr_t* left_expr, fused_expr_t* right_expr){      \
+        return expr_new(FUSED_##TAG, left_expr, right_expr);                            \
+    }
+
+CORAL_BINARY_OPS(DEFINE_FUSED_BINARY_OP)
+CORAL_UNARY_OPS(DEFINE_FUSED_UNARY_OP)
+
+// the distinct nodes of the dag under expr, after the num_nodes already in nodes
+static int collect_nodes(fused_expr_t* expr, fused_expr_t** nodes, int num_nodes){
+    for(int index = 0; index < num_nodes; index++){
+        if(nodes[index] == expr){
+            return num_nodes;
+        }
+    }
+    NDEBUG_ASSERT(num_nodes < FUSED_MAX_NODES, "Fused expression has too many nodes!\n");
+    nodes[num_nodes++] = expr;
+    for(int operand = 0; operand < 2; operand++){
+        if(expr->operands[operand]){
+            num_nodes = collect_nodes(expr->operands[operand], nodes, num_nodes);
+        }
+    }
+    return num_nodes;
+}
+
+void fused_expr_free(fused_expr_t* expr){
+    fused_expr_t* nodes[FUSED_MAX_NODES];
+    int num_nodes = collect_nodes(expr, nodes, 0);
+    for(int index = 0; index < num_nodes; index++){
+        if(!nodes[index]->in_arena){
+            free(nodes[index]);
+        }
+    }
+}
+
+// expressions of constants only are scalars
+shape_t* fused_get_shape(fused_expr_t* expr){
+    if(!expr->shape){
+        size_t dims = 1;
+        expr->shape = shape_new(1, &dims);
+    }
+    return expr->shape;
+}
+
+/**
+ * PROGRAMS
+ * instructions are in dependency order, each writes into its own chunk of scratch space, and the
+ * last instruction is the root of the expression
+ * inputs with the shape of the expression are read in place, scalar inputs become constants
+*/
+
+typedef struct {
+    fused_op_t op;
+    int operands[2];
+    const tensor_entry_t* data; // FUSED_INPUT
+    tensor_entry_t value; // FUSED_CONSTANT
+} fused_instruction_t;
+
+typedef struct {
+    int num_instructions;
+    fused_instruction_t instructions[FUSED_MAX_NODES];
+    fused_expr_t* nodes[FUSED_MAX_NODES]; // node compiled into each instruction, so shared nodes are compiled once
+    size_t size;
+    // copies of inputs made by compile, released with the program
+    int num_temporaries;
+    tensor_t* temporaries[FUSED_MAX_NODES];
+} fused_program_t;
+
+static int compile_node(fused_program_t* program, fused_expr_t* expr, shape_t* shape){
+    for(int index = 0; index < program->num_instructions; index++){
+        if(program->nodes[index] == expr){
+            return index;
+        }
+    }
+    fused_instruction_t instruction = {expr->op, {-1, -1}, NULL, expr->value};
+    for(int operand = 0; operand < 2; operand++){
+        if(expr->operands[operand]){
+            instruction.operands[operand] = compile_node(program, expr->operands[operand], shape);
+        }
+    }
+    if(expr->op == FUSED_INPUT){
+        tensor_t* tensor = expr->tensor;
+        if(tensor_is_scalar(tensor)){
+            instruction.op = FUSED_CONSTANT;
+            instruction.value = tensor_get_entry(tensor, 0);
+        }else{
+            tensor_t* input_tensor = tensor;
+            if(tensor->shape->size != program->size){
+                // uncommon broadcasts are materialized up front
+                tensor = tensor_new(shape);
+                tensor_in_place_add(tensor, input_tensor);
+            }else{
+                // strided views are read in row-major order
+                tensor = tensor_contiguous(tensor);
+            }
+            if(tensor != input_tensor){
+                program->temporaries[program->num_temporaries++] = tensor;
+            }
+            instruction.data = tensor->data;
+        }
+    }
+    NDEBUG_ASSERT(program->num_instructions < FUSED_MAX_NODES, "Fused expression has too many nodes!\n");
+    program->instructions[program->num_instructions] = instruction;
+    program->nodes[program->num_instructions] = expr;
+    return program->num_instructions++;
+}
+
+static void compile(fused_program_t* program, fused_expr_t* expr){
+    shape_t* shape = fused_get_shape(expr);
+    program->num_instructions = 0;
+    program->size = shape->size;
+    program->num_temporaries = 0;
+    compile_node(program, expr, shape);
+}
+
+static void release_program(fused_program_t* program){
+    for(int index = 0; index < program->num_temporaries; index++){
+        tensor_release(program->temporaries[index]);
+    }
+}
+
+#define FUSED_BINARY_LOOP(simd_fn, entry_expression)                                 \
+    for(; index + SIMD_WIDTH <= length; index += SIMD_WIDTH){                        \
+        simd_store(out + index, simd_fn(simd_load(left + index), simd_load(right + index))); \
+    }                                                                                \
+    for(; index < length; index++){                                                  \
+        tensor_entry_t x = left[index];                                              \
+        tensor_entry_t y = right[index];                                             \
+        out[index] = (entry_expression);                                             \
+    }
+
+#define FUSED_UNARY_LOOP(entry_expression)                                           \
+    for(; index < length; index++){                                                  \
+        tensor_entry_t x = left[index];                                              \
+        out[index] = (entry_expression);                                             \
+    }
+
+#define FUSED_BINARY_CASE(name, TAG, simd_fn, entry_expression, check_nonzero_right)   \
+    case FUSED_##TAG:                                                                \
+        FUSED_BINARY_LOOP(simd_fn, entry_expression)                                 \
+        break;
+#define FUSED_UNARY_CASE(name, TAG, entry_expression)                                \
+    case FUSED_##TAG:                                                                \
+        FUSED_UNARY_LOOP(entry_expression)                                           \
+        break;
+
+// constants are written into their scratch chunks once per thread
+static void fill_constants(const fused_program_t* program, tensor_entry_t* scratch){
+    for(int index = 0; index < program->num_instructions; index++){
+        if(program->instructions[index].op == FUSED_CONSTANT){
+            tensor_entry_t* out = scratch + index * FUSED_CHUNK_SIZE;
+            for(size_t entry = 0; entry < FUSED_CHUNK_SIZE; entry++){
+                out[entry] = program->instructions[index].value;
+            }
+        }
+    }
+}
+
+// evaluates entries [offset, offset + length) of the program, returns the values of the root
+static const tensor_entry_t* run_chunk(const fused_program_t* program, size_t offset, size_t length, tensor_entry_t* scratch){
+    const tensor_entry_t* values[FUSED_MAX_NODES];
+    for(int instruction_index = 0; instruction_index < program->num_instructions; instruction_index++){
+        const fused_instruction_t* instruction = &program->instructions[instruction_index];
+        tensor_entry_t* out = scratch + instruction_index * FUSED_CHUNK_SIZE;
+        const tensor_entry_t* left = (instruction->operands[0] >= 0) ? values[instruction->operands[0]] : NULL;
+        const tensor_entry_t* right = (instruction->operands[1] >= 0) ? values[instruction->operands[1]] : NULL;
+        size_t index = 0;
+        switch(instruction->op){
+            case FUSED_INPUT:
+                values[instruction_index] = instruction->data + offset;
+                continue;
+            case FUSED_CONSTANT:
+                break;
+            CORAL_BINARY_OPS(FUSED_BINARY_CASE)
+            CORAL_UNARY_OPS(FUSED_UNARY_CASE)
+        }
+        values[instruction_index] = out;
+    }
+    return values[program->num_instructions - 1];
+}
+
+typedef struct {
+    const fused_program_t* program;
+    tensor_entry_t* dest;
+    bool accumulate;
+    size_t chunks_per_block;
+    double* block_sums;
+} fused_context_t;
+
+static inline size_t chunk_length(const fused_program_t* program, size_t chunk){
+    size_t offset = chunk * FUSED_CHUNK_SIZE;
+    return (offset + FUSED_CHUNK_SIZE < program->size) ? FUSED_CHUNK_SIZE : program->size - offset;
+}
+
+static void evaluate_range(void* raw_context, size_t begin, size_t end){
+    fused_context_t* context = (fused_context_t*) raw_context;
+    tensor_entry_t scratch[FUSED_MAX_NODES * FUSED_CHUNK_SIZE];
+    fill_constants(context->program, scratch);
+    for(size_t chunk = begin; chunk < end; chunk++){
+        size_t offset = chunk * FUSED_CHUNK_SIZE;
+        size_t length = chunk_length(context->program, chunk);
+        const tensor_entry_t* values = run_chunk(context->program, offset, length, scratch);
+        tensor_entry_t* dest = context->dest + offset;
+        if(context->accumulate){
+            size_t index = 0;
+            for(; index + SIMD_WIDTH <= length; index += SIMD_WIDTH){
+                simd_store(dest + index, simd_add(simd_load(dest + index), simd_load(values + index)));
+            }
+            for(; index < length; index++){
+                dest[index] += values[index];
+            }
+        }else{
+            memcpy(dest, values, length * sizeof(tensor_entry_t));
+        }
+    }
+}
+
+// each chunk is summed with vector accumulators, and the chunks of a block in double precision
+static void sum_range(void* raw_context, size_t begin, size_t end){
+    fused_context_t* context = (fused_context_t*) raw_context;
+    tensor_entry_t scratch[FUSED_MAX_NODES * FUSED_CHUNK_SIZE];
+    fill_constants(context->program, scratch);
+    size_t num_chunks = (context->program->size + FUSED_CHUNK_SIZE - 1) / FUSED_CHUNK_SIZE;
+    for(size_t block = begin; block < end; block++){
+        double block_sum = 0;
+        size_t last_chunk = MIN((block + 1) * context->chunks_per_block, num_chunks);
+        for(size_t chunk = block * context->chunks_per_block; chunk < last_chunk; chunk++){
+            size_t length = chunk_length(context->program, chunk);
+            const tensor_entry_t* values = run_chunk(context->program, chunk * FUSED_CHUNK_SIZE, length, scratch);
+            simd_vec_t accumulator = simd_set1(0);
+            size_t index = 0;
+            for(; index + SIMD_WIDTH <= length; index += SIMD_WIDTH){
+                accumulator = simd_add(accumulator, simd_load(values + index));
+            }
+            tensor_entry_t lanes[SIMD_WIDTH];
+            simd_store(lanes, accumulator);
+            tensor_entry_t chunk_sum = 0;
+            for(int lane = 0; lane < SIMD_WIDTH; lane++){
+                chunk_sum += lanes[lane];
+            }
+            for(; index < length; index++){
+                chunk_sum += values[index];
+            }
+            block_sum += chunk_sum;
+        }
+        context->block_sums[block] = block_sum;
+    }
+}
+
+static void run_program(const fused_program_t* program, tensor_entry_t* dest, bool accumulate){
+    size_t num_chunks = (program->size + FUSED_CHUNK_SIZE - 1) / FUSED_CHUNK_SIZE;
+    fused_context_t context = {program, dest, accumulate, 0, NULL};
+    size_t grain_size = MAX(parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE) / FUSED_CHUNK_SIZE, 1);
+    parallel_for(num_chunks, grain_size, &evaluate_range, &context);
+}
+
+tensor_t* fused_evaluate(fused_expr_t* expr){
+    fused_program_t program;
+    compile(&program, expr);
+    tensor_t* new_tensor = tensor_empty(fused_get_shape(expr));
+    run_program(&program, new_tensor->data, false);
+    release_program(&program);
+    return new_tensor;
+}
+
+void fused_evaluate_into(tensor_t* dest_tensor, fused_expr_t* expr, bool accumulate){
+    NDEBUG_ASSERT(tensor_is_contiguous(dest_tensor) && dest_tensor->dtype == TENSOR_FLOAT32, "Fused expressions are written into contiguous float32 tensors!\n");
+    NDEBUG_ASSERT(shape_equal(dest_tensor->shape, fused_get_shape(expr)) || (!expr->shape && dest_tensor->shape->size == 1), "Destination tensor has improper shape!");
+    fused_program_t program;
+    compile(&program, expr);
+    run_program(&program, dest_tensor->data, accumulate);
+    release_program(&program);
+}
+
+// blocks do not depend on the number of threads, so neither does the result
+tensor_entry_t fused_evaluate_sum(fused_expr_t* expr){
+    fused_program_t program;
+    compile(&program, expr);
+    size_t num_chunks = (program.size + FUSED_CHUNK_SIZE - 1) / FUSED_CHUNK_SIZE;
+    size_t chunks_per_block = MAX(parallel_get_grain_size(PARALLEL_OP_REDUCTION) / FUSED_CHUNK_SIZE, 1);
+    size_t num_blocks = (num_chunks + chunks_per_block - 1) / chunks_per_block;
+    double* block_sums = (double*) malloc(num_blocks * sizeof(double));
+    fused_context_t context = {&program, NULL, false, chunks_per_block, block_sums};
+    parallel_for(num_blocks, 1, &sum_range, &context);
+    release_program(&program);
+    double sum = 0;
+    for(size_t block = 0; block < num_blocks; block++){
+        sum += block_sums[block];
+    }
+    free(block_sums);
+    return (tensor_entry_t) sum;
+}
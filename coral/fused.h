@@ -0,0 +1,41 @@
+#ifndef FUSED_H
+#define FUSED_H
+
+#include <stdbool.h>
+#include "tensor.h"
+
+/**
+ * lazy elementwise expressions
+ * a chain of elementwise ops is recorded as a small dag of fused_expr_t nodes, and only evaluated
+ * when it is materialized (fused_evaluate, fused_evaluate_into) or reduced (fused_evaluate_sum)
+ * evaluation compiles the dag into a straight line program which is run over chunks of entries
+ * small enough to stay in L1, so every intermediate lives in a chunk-sized scratch buffer rather than
+ * a full-size temporary tensor
+ * inputs must (after broadcasting) either have the shape of the expression or be scalars,
+ * other broadcasts are materialized once before the fused loop
+ * nodes are allocated with arena_malloc, and are meant to be built, evaluated and freed with fused_expr_free
+ * (which leaves nodes allocated from the graph arena to it)
+*/
+
+typedef struct fused_expr fused_expr_t;
+
+fused_expr_t* fused_input(tensor_t* tensor);
+fused_expr_t* fused_constant(tensor_entry_t value);
+
+// fused_<name> for every op of the op tables (see ops.h)
+#define DECLARE_FUSED_UNARY_OP(name, TAG, entry_expression) fused_expr_t* fused_##name(fused_expr_t* expr);
+#define DECLARE_FUSED_BINARY_OP(name, TAG, simd_fn, entry_expression, check_nonzero_right) fused_expr_t* fused_##name(fused_expr_t* left_expr, fused_expr_t* right_expr);
+
+CORAL_BINARY_OPS(DECLARE_FUSED_BINARY_OP)
+CORAL_UNARY_OPS(DECLARE_FUSED_UNARY_OP)
+
+// frees every node of expr, which must not be shared with another expression that is still in use
+void fused_expr_free(fused_expr_t* expr);
+shape_t* fused_get_shape(fused_expr_t* expr);
+tensor_t* fused_evaluate(fused_expr_t* expr);
+// dest <- expr, or dest <- dest + expr when accumulate is set, expr must have the shape of dest
+// which must be a contiguous float32 tensor (not a view)
+void fused_evaluate_into(tensor_t* dest_tensor, fused_expr_t* expr, bool accumulate);
+tensor_entry_t fused_evaluate_sum(fused_expr_t* expr);
+
+#endif // FUSED_H
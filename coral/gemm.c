@@ -0,0 +1,356 @@
+#include "gemm.h"
+#include "parallel.h"
+#include "simd.h"
+#include "assert.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CORAL_USE_BLAS
+#include <cblas.h>
+
+void gemm_multiply(bool transpose_a, bool transpose_b, size_t m, size_t n, size_t k,
+                   float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                   float beta, float* c, size_t ldc){
+    if(m == 0 || n == 0){
+        return;
+    }
+    cblas_sgemm(CblasRowMajor, transpose_a ? CblasTrans : CblasNoTrans, transpose_b ? CblasTrans : CblasNoTrans,
+                m, n, k, alpha, a, lda ? lda : 1, b, ldb ? ldb : 1, beta, c, ldc ? ldc : 1);
+}
+
+#else
+
+/**
+ * goto/BLIS-style blocking:
+ * op(b) is packed into kc x nc panels of GEMM_NR wide column slivers (shared by all threads),
+ * op(a) is packed into mc x kc blocks of GEMM_MR tall row slivers (one per thread),
+ * and a GEMM_MR x GEMM_NR register tile is accumulated by the microkernel
+ * the mc blocks of each panel are distributed over the thread pool
+*/
+
+#define GEMM_MR 6
+#define GEMM_NR (2 * SIMD_WIDTH)
+#define GEMM_MC 96 // multiple of GEMM_MR, a block of op(a) stays in L2
+#define GEMM_KC 256 // a sliver of op(b) stays in L1
+#define GEMM_NC 3072 // multiple of GEMM_NR, a panel of op(b) stays in L3
+#define GEMM_ALIGNMENT 64
+
+typedef struct {
+    bool transpose_a;
+    const float* a;
+    size_t lda;
+    float alpha;
+    size_t m;
+    size_t pc; // first row of the panel of op(b), i.e. column of op(a)
+    size_t kc;
+    size_t nc;
+    size_t num_column_groups; // columns of the panel are split when there are too few blocks to go around
+    size_t column_group_width; // multiple of GEMM_NR
+    const float* b_packed;
+    float* c; // points at column jc of c
+    size_t ldc;
+} gemm_block_context_t;
+
+typedef struct {
+    bool transpose_b;
+    const float* b;
+    size_t ldb;
+    size_t pc;
+    size_t kc;
+    size_t jc;
+    size_t nc;
+    float* b_packed;
+} gemm_pack_context_t;
+
+static inline size_t min_size(size_t left, size_t right){
+    return (left < right) ? left : right;
+}
+
+static inline size_t round_up(size_t value, size_t multiple){
+    return ((value + multiple - 1) / multiple) * multiple;
+}
+
+static float* aligned_floats(size_t count){
+    void* buffer = NULL;
+    int error = posix_memalign(&buffer, GEMM_ALIGNMENT, count * sizeof(float));
+    NDEBUG_ASSERT(error == 0, "Failed to allocate gemm packing buffer.\n");
+    return (float*) buffer;
+}
+
+static inline float element(bool transpose, const float* matrix, size_t stride, size_t row, size_t column){
+    return transpose ? matrix[column * stride + row] : matrix[row * stride + column];
+}
+
+// packs rows [ic, ic + mc) and columns [pc, pc + kc) of alpha * op(a), zero padding the last sliver
+static void pack_a(const gemm_block_context_t* context, size_t ic, size_t mc, float* a_packed){
+    for(size_t ir = 0; ir < mc; ir += GEMM_MR){
+        size_t mr = min_size(GEMM_MR, mc - ir);
+        for(size_t p = 0; p < context->kc; p++){
+            for(size_t i = 0; i < mr; i++){
+                a_packed[i] = context->alpha * element(context->transpose_a, context->a, context->lda, ic + ir + i, context->pc + p);
+            }
+            for(size_t i = mr; i < GEMM_MR; i++){
+                a_packed[i] = 0;
+            }
+            a_packed += GEMM_MR;
+        }
+    }
+}
+
+// packs slivers [begin, end) of the panel of op(b), zero padding the last sliver
+static void pack_b_range(void* raw_context, size_t begin, size_t end){
+    gemm_pack_context_t* context = (gemm_pack_context_t*) raw_context;
+    for(size_t sliver = begin; sliver < end; sliver++){
+        size_t jr = sliver * GEMM_NR;
+        size_t nr = min_size(GEMM_NR, context->nc - jr);
+        float* b_packed = context->b_packed + jr * context->kc;
+        for(size_t p = 0; p < context->kc; p++){
+            size_t row = context->pc + p;
+            if(!context->transpose_b && nr == GEMM_NR){
+                memcpy(b_packed, context->b + row * context->ldb + context->jc + jr, GEMM_NR * sizeof(float));
+            }else{
+                for(size_t j = 0; j < nr; j++){
+                    b_packed[j] = element(context->transpose_b, context->b, context->ldb, row, context->jc + jr + j);
+                }
+                for(size_t j = nr; j < GEMM_NR; j++){
+                    b_packed[j] = 0;
+                }
+            }
+            b_packed += GEMM_NR;
+        }
+    }
+}
+
+// c[0:mr, 0:nr] += a_sliver * b_sliver
+static void microkernel(size_t kc, const float* a_packed, const float* b_packed, float* c, size_t ldc, size_t mr, size_t nr){
+    simd_vec_t accumulators0[GEMM_MR];
+    simd_vec_t accumulators1[GEMM_MR];
+    for(int i = 0; i < GEMM_MR; i++){
+        accumulators0[i] = simd_set1(0);
+        accumulators1[i] = simd_set1(0);
+    }
+    for(size_t p = 0; p < kc; p++){
+        simd_vec_t b0 = simd_load(b_packed);
+        simd_vec_t b1 = simd_load(b_packed + SIMD_WIDTH);
+        for(int i = 0; i < GEMM_MR; i++){
+            simd_vec_t a_broadcast = simd_set1(a_packed[i]);
+            accumulators0[i] = simd_fmadd(a_broadcast, b0, accumulators0[i]);
+            accumulators1[i] = simd_fmadd(a_broadcast, b1, accumulators1[i]);
+        }
+        a_packed += GEMM_MR;
+        b_packed += GEMM_NR;
+    }
+    if(mr == GEMM_MR && nr == GEMM_NR){
+        for(int i = 0; i < GEMM_MR; i++){
+            float* c_row = c + i * ldc;
+            simd_store(c_row, simd_add(simd_load(c_row), accumulators0[i]));
+            simd_store(c_row + SIMD_WIDTH, simd_add(simd_load(c_row + SIMD_WIDTH), accumulators1[i]));
+        }
+        return;
+    }
+    // edge tile
+    float tile[GEMM_MR * GEMM_NR];
+    for(int i = 0; i < GEMM_MR; i++){
+        simd_store(tile + i * GEMM_NR, accumulators0[i]);
+        simd_store(tile + i * GEMM_NR + SIMD_WIDTH, accumulators1[i]);
+    }
+    for(size_t i = 0; i < mr; i++){
+        for(size_t j = 0; j < nr; j++){
+            c[i * ldc + j] += tile[i * GEMM_NR + j];
+        }
+    }
+}
+
+// multiplies (block, column group) pairs [begin, end) of op(a) against the packed panel of op(b)
+static void multiply_block_range(void* raw_context, size_t begin, size_t end){
+    gemm_block_context_t* context = (gemm_block_context_t*) raw_context;
+    float* a_packed = aligned_floats(GEMM_MC * context->kc);
+    size_t packed_block = SIZE_MAX;
+    for(size_t task = begin; task < end; task++){
+        size_t block = task / context->num_column_groups;
+        size_t column_begin = (task % context->num_column_groups) * context->column_group_width;
+        size_t column_end = min_size(column_begin + context->column_group_width, context->nc);
+        size_t ic = block * GEMM_MC;
+        size_t mc = min_size(GEMM_MC, context->m - ic);
+        if(block != packed_block){
+            pack_a(context, ic, mc, a_packed);
+            packed_block = block;
+        }
+        for(size_t jr = column_begin; jr < column_end; jr += GEMM_NR){
+            size_t nr = min_size(GEMM_NR, context->nc - jr);
+            const float* b_sliver = context->b_packed + jr * context->kc;
+            for(size_t ir = 0; ir < mc; ir += GEMM_MR){
+                size_t mr = min_size(GEMM_MR, mc - ir);
+                float* c_tile = context->c + (ic + ir) * context->ldc + jr;
+                microkernel(context->kc, a_packed + ir * context->kc, b_sliver, c_tile, context->ldc, mr, nr);
+            }
+        }
+    }
+    free(a_packed);
+}
+
+static void scale_c(size_t m, size_t n, float beta, float* c, size_t ldc){
+    if(beta == 1){
+        return;
+    }
+    for(size_t i = 0; i < m; i++){
+        float* c_row = c + i * ldc;
+        if(beta == 0){
+            // overwrite rather than scale, so that nan/inf in c do not propagate
+            memset(c_row, 0, n * sizeof(float));
+        }else{
+            for(size_t j = 0; j < n; j++){
+                c_row[j] *= beta;
+            }
+        }
+    }
+}
+
+void gemm_multiply(bool transpose_a, bool transpose_b, size_t m, size_t n, size_t k,
+                   float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                   float beta, float* c, size_t ldc){
+    if(m == 0 || n == 0){
+        return;
+    }
+    scale_c(m, n, beta, c, ldc);
+    if(k == 0 || alpha == 0){
+        return;
+    }
+    size_t max_kc = min_size(GEMM_KC, k);
+    size_t max_nc = min_size(GEMM_NC, round_up(n, GEMM_NR));
+    float* b_packed = aligned_floats(max_kc * max_nc);
+    size_t num_blocks = (m + GEMM_MC - 1) / GEMM_MC;
+    size_t num_threads = parallel_in_worker() ? 1 : (size_t) parallel_get_num_threads();
+    for(size_t jc = 0; jc < n; jc += GEMM_NC){
+        size_t nc = min_size(GEMM_NC, n - jc);
+        size_t num_slivers = (nc + GEMM_NR - 1) / GEMM_NR;
+        size_t num_column_groups = min_size((num_threads + num_blocks - 1) / num_blocks, num_slivers);
+        size_t column_group_width = ((num_slivers + num_column_groups - 1) / num_column_groups) * GEMM_NR;
+        num_column_groups = (nc + column_group_width - 1) / column_group_width;
+        for(size_t pc = 0; pc < k; pc += GEMM_KC){
+            size_t kc = min_size(GEMM_KC, k - pc);
+            gemm_pack_context_t pack_context = {transpose_b, b, ldb, pc, kc, jc, nc, b_packed};
+            parallel_for(num_slivers, 16, &pack_b_range, &pack_context);
+            gemm_block_context_t block_context = {
+                transpose_a, a, lda, alpha, m, pc, kc, nc, num_column_groups, column_group_width, b_packed, c + jc, ldc
+            };
+            parallel_for(num_blocks * num_column_groups, 1, &multiply_block_range, &block_context);
+        }
+    }
+    free(b_packed);
+}
+
+#endif // CORAL_USE_BLAS
+
+/**
+ * FLOAT64 AND INT8
+ * float64 products back gradient checks rather than training, so rows of c are accumulated a row of op(b)
+ * at a time without blocking
+ * int8 products accumulate (a - a_zero_point)(b - b_zero_point) exactly in int32, a row of c at a time,
+ * flushed into c (scaled) every GEMM_I8_KC terms, before they could overflow
+ * rows of c are split over the thread pool
+*/
+
+#define GEMM_I8_KC 32768 // 255 * 255 * GEMM_I8_KC < 2^31
+#define GEMM_ROWS_GRAIN_SIZE (1 << 16) // multiply-adds per task
+
+typedef struct {
+    bool transpose_a;
+    bool transpose_b;
+    size_t n;
+    size_t k;
+    const void* a;
+    size_t lda;
+    const void* b;
+    size_t ldb;
+    void* c;
+    size_t ldc;
+    double alpha; // float64
+    double beta; // float64
+    float scale; // int8
+    int32_t a_zero_point; // int8
+    int32_t b_zero_point; // int8
+} gemm_rows_context_t;
+
+static void multiply_f64_rows_range(void* raw_context, size_t begin, size_t end){
+    const gemm_rows_context_t* context = (const gemm_rows_context_t*) raw_context;
+    const double* a = (const double*) context->a;
+    const double* b = (const double*) context->b;
+    size_t n = context->n;
+    for(size_t i = begin; i < end; i++){
+        double* c_row = (double*) context->c + i * context->ldc;
+        for(size_t j = 0; j < n; j++){
+            c_row[j] = (context->beta == 0) ? 0 : context->beta * c_row[j];
+        }
+        for(size_t p = 0; p < context->k; p++){
+            double a_entry = context->alpha * (context->transpose_a ? a[p * context->lda + i] : a[i * context->lda + p]);
+            if(context->transpose_b){
+                for(size_t j = 0; j < n; j++){
+                    c_row[j] += a_entry * b[j * context->ldb + p];
+                }
+            }else{
+                const double* b_row = b + p * context->ldb;
+                for(size_t j = 0; j < n; j++){
+                    c_row[j] += a_entry * b_row[j];
+                }
+            }
+        }
+    }
+}
+
+static void multiply_i8_rows_range(void* raw_context, size_t begin, size_t end){
+    const gemm_rows_context_t* context = (const gemm_rows_context_t*) raw_context;
+    const int8_t* a = (const int8_t*) context->a;
+    const int8_t* b = (const int8_t*) context->b;
+    size_t n = context->n;
+    int32_t* accumulators = (int32_t*) malloc(n * sizeof(int32_t));
+    NDEBUG_ASSERT(accumulators != NULL, "Out of memory for int8 accumulators!\n");
+    for(size_t i = begin; i < end; i++){
+        float* c_row = (float*) context->c + i * context->ldc;
+        memset(c_row, 0, n * sizeof(float));
+        for(size_t pc = 0; pc < context->k; pc += GEMM_I8_KC){
+            size_t pc_end = (pc + GEMM_I8_KC < context->k) ? pc + GEMM_I8_KC : context->k;
+            memset(accumulators, 0, n * sizeof(int32_t));
+            for(size_t p = pc; p < pc_end; p++){
+                int32_t a_entry = (context->transpose_a ? a[p * context->lda + i] : a[i * context->lda + p]) - context->a_zero_point;
+                if(a_entry == 0){
+                    continue;
+                }
+                if(context->transpose_b){
+                    for(size_t j = 0; j < n; j++){
+                        accumulators[j] += a_entry * (b[j * context->ldb + p] - context->b_zero_point);
+                    }
+                }else{
+                    const int8_t* b_row = b + p * context->ldb;
+                    for(size_t j = 0; j < n; j++){
+                        accumulators[j] += a_entry * (b_row[j] - context->b_zero_point);
+                    }
+                }
+            }
+            for(size_t j = 0; j < n; j++){
+                c_row[j] += context->scale * accumulators[j];
+            }
+        }
+    }
+    free(accumulators);
+}
+
+static inline size_t rows_grain_size(size_t n, size_t k){
+    size_t row_size = (n * k > 0) ? n * k : 1;
+    return (row_size < GEMM_ROWS_GRAIN_SIZE) ? GEMM_ROWS_GRAIN_SIZE / row_size : 1;
+}
+
+void gemm_multiply_f64(bool transpose_a, bool transpose_b, size_t m, size_t n, size_t k,
+                       double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+                       double beta, double* c, size_t ldc){
+    gemm_rows_context_t context = {transpose_a, transpose_b, n, k, a, lda, b, ldb, c, ldc, alpha, beta, 0, 0, 0};
+    parallel_for(m, rows_grain_size(n, k), &multiply_f64_rows_range, &context);
+}
+
+void gemm_multiply_i8(bool transpose_a, bool transpose_b, size_t m, size_t n, size_t k,
+                      float scale, const int8_t* a, size_t lda, int32_t a_zero_point,
+                      const int8_t* b, size_t ldb, int32_t b_zero_point, float* c, size_t ldc){
+    gemm_rows_context_t context = {transpose_a, transpose_b, n, k, a, lda, b, ldb, c, ldc, 0, 0, scale, a_zero_point, b_zero_point};
+    parallel_for(m, rows_grain_size(n, k), &multiply_i8_rows_range, &context);
+}
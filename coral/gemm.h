@@ -0,0 +1,29 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * single precision general matrix multiply on row-major matrices
+ * c <- alpha * op(a) op(b) + beta * c, where op(x) is x or its transpose
+ * op(a) is m x k, op(b) is k x n and c is m x n
+ * lda, ldb, ldc are the row strides of a, b, c as stored (before transposition)
+ * build with BLAS=1 to forward to cblas_sgemm instead of the native kernel
+*/
+void gemm_multiply(bool transpose_a, bool transpose_b, size_t m, size_t n, size_t k,
+                   float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                   float beta, float* c, size_t ldc);
+
+// double precision, as gemm_multiply, for gradient checks
+void gemm_multiply_f64(bool transpose_a, bool transpose_b, size_t m, size_t n, size_t k,
+                       double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+                       double beta, double* c, size_t ldc);
+
+// c <- scale * (op(a) - a_zero_point) (op(b) - b_zero_point) of quantized int8 matrices, accumulated exactly in int32
+void gemm_multiply_i8(bool transpose_a, bool transpose_b, size_t m, size_t n, size_t k,
+                      float scale, const int8_t* a, size_t lda, int32_t a_zero_point,
+                      const int8_t* b, size_t ldb, int32_t b_zero_point, float* c, size_t ldc);
+
+#endif // GEMM_H
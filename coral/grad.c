@@ -1,10 +1,13 @@
 #include "grad.h"
 #include "variable.h"
 #include "assert.h"
-
-static inline void increment_ref_count(variable_t* variable){
-    variable->grad_meta->ref_count++;
-}
+#include "utils.h"
+#include "parallel.h"
+#include "profile.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 static inline void decrement_ref_count(variable_t* variable){
     variable->grad_meta->ref_count--;
@@ -14,86 +17,680 @@ static inline int get_ref_count(variable_t* variable){
     return variable->grad_meta->ref_count;
 }
 
+/**
+ * concurrent backward passes accumulate into shared gradients under striped per-node locks
+ * only the accumulation is locked, gradient updates which need a reduction are computed outside of the lock
+*/
+
+#define GRAD_NUM_LOCKS 64
+
+static pthread_once_t gradient_locks_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t gradient_locks[GRAD_NUM_LOCKS];
+
+static void gradient_locks_init(void){
+    for(int index = 0; index < GRAD_NUM_LOCKS; index++){
+        pthread_mutex_init(&gradient_locks[index], NULL);
+    }
+}
+
+static inline pthread_mutex_t* gradient_lock(variable_t* variable){
+    uintptr_t hash = ((uintptr_t) variable) >> 4;
+    return &gradient_locks[(hash ^ (hash >> 6)) % GRAD_NUM_LOCKS];
+}
+
+static inline void lock_gradient(variable_t* variable, bool concurrent){
+    if(concurrent){
+        pthread_mutex_lock(gradient_lock(variable));
+    }
+}
+
+static inline void unlock_gradient(variable_t* variable, bool concurrent){
+    if(concurrent){
+        pthread_mutex_unlock(gradient_lock(variable));
+    }
+}
+
+// grad ops return fresh tensors, which are handed back to the buffer pool once accumulated
+static inline void release_gradient_update(tensor_t* gradient_update, tensor_t* reduced_gradient_update){
+    if(reduced_gradient_update != gradient_update){
+        tensor_release(reduced_gradient_update);
+    }
+    tensor_release(gradient_update);
+}
+
 // propogate gradient update from output into input
 // here, output = fn(input)
-static void update_unary_grad(input_t* input, variable_t* output){
-    variable_unary_grad_op_t gradient_fn = (variable_unary_grad_op_t) (input->grad_op);
-    tensor_t* gradient_update = (*gradient_fn)(input->variable, output);
-    tensor_t* reduced_gradient_update = tensor_reduce_to_shape(gradient_update, input->variable->gradient->shape);
-    tensor_in_place_add(input->variable->gradient, reduced_gradient_update);
-    decrement_ref_count(input->variable);
+// the gradient of input is allocated on its first update
+static void update_unary_grad(input_t* input, variable_t* output, bool concurrent){
+    variable_unary_accumulate_grad_op_t accumulate_fn = (variable_unary_accumulate_grad_op_t) (input->accumulate_grad_op);
+    lock_gradient(input->variable, concurrent);
+    variable_get_gradient(input->variable);
+    bool accumulated = accumulate_fn && (*accumulate_fn)(input->variable, output);
+    unlock_gradient(input->variable, concurrent);
+    if(!accumulated){
+        variable_unary_grad_op_t gradient_fn = (variable_unary_grad_op_t) (input->grad_op);
+        tensor_t* gradient_update = (*gradient_fn)(input->variable, output);
+        tensor_t* reduced_gradient_update = tensor_reduce_to_shape(gradient_update, input->variable->tensor->shape);
+        lock_gradient(input->variable, concurrent);
+        tensor_in_place_add(input->variable->gradient, reduced_gradient_update);
+        unlock_gradient(input->variable, concurrent);
+        release_gradient_update(gradient_update, reduced_gradient_update);
+    }
 }
 
 // propogate gradient update from output into input
 // here, output = fn(input, other_input)
-static void update_binary_grad(input_t* input, input_t* other_input, variable_t* output){
-    variable_binary_grad_op_t gradient_fn = (variable_binary_grad_op_t) (input->grad_op);
-    tensor_t* gradient_update = (*gradient_fn)(input->variable, other_input->variable, output);
-    tensor_t* reduced_gradient_update = tensor_reduce_to_shape(gradient_update, input->variable->gradient->shape);
-    printf("REDUCED GRADIENT:\n\n");
-    tensor_display(reduced_gradient_update);
-    tensor_in_place_add(input->variable->gradient, reduced_gradient_update);
-    decrement_ref_count(input->variable);
-}
-
-// accumulate gradient updates into argument gradients
-static inline void update_binary_grads(input_t* left_input, input_t* right_input, variable_t* output){
-    update_binary_grad(left_input, right_input, output);
-    update_binary_grad(right_input, left_input, output);
-}
-
-// accumulates gradient update into argument(s') gradient
-// for arguments with ref_count zero, call _backwards an arguments
-// so as recurse in a way that respects gradient
-// graph's topological ordering
-static void actual_backwards(variable_t* root){
-    if(root->grad_meta->num_inputs == 1){
-        input_t* input = root->grad_meta->inputs[0];
-        update_unary_grad(input, root);
-        if(get_ref_count(input->variable) == 0){
-            actual_backwards(input->variable);
-        } 
-    }else if(root->grad_meta->num_inputs == 2){
-        input_t* input1 = root->grad_meta->inputs[0];
-        input_t* input2 = root->grad_meta->inputs[1];
-        update_binary_grads(input1, input2, root);
-        if(get_ref_count(input1->variable) == 0){
-            actual_backwards(input1->variable);
-        }
-        if(get_ref_count(input2->variable) == 0){
-            actual_backwards(input2->variable);
+static void update_binary_grad(input_t* input, input_t* other_input, variable_t* output, bool concurrent){
+    variable_binary_accumulate_grad_op_t accumulate_fn = (variable_binary_accumulate_grad_op_t) (input->accumulate_grad_op);
+    lock_gradient(input->variable, concurrent);
+    variable_get_gradient(input->variable);
+    bool accumulated = accumulate_fn && (*accumulate_fn)(input->variable, other_input->variable, output);
+    unlock_gradient(input->variable, concurrent);
+    if(!accumulated){
+        variable_binary_grad_op_t gradient_fn = (variable_binary_grad_op_t) (input->grad_op);
+        tensor_t* gradient_update = (*gradient_fn)(input->variable, other_input->variable, output);
+        tensor_t* reduced_gradient_update = tensor_reduce_to_shape(gradient_update, input->variable->tensor->shape);
+        lock_gradient(input->variable, concurrent);
+        tensor_in_place_add(input->variable->gradient, reduced_gradient_update);
+        unlock_gradient(input->variable, concurrent);
+        release_gradient_update(gradient_update, reduced_gradient_update);
+    }
+}
+
+// whether the grad op of input runs in a backward pass through its output
+static inline bool runs_grad_op(input_t* input){
+    return input->variable->requires_grad || input->always_runs;
+}
+
+// runs the grad op of an input which does not require grad for what it accumulates elsewhere, its own update is dropped
+// here, output = fn(input) when other_input is NULL, output = fn(input, other_input) otherwise
+static void run_detached_grad_op(input_t* input, input_t* other_input, variable_t* output){
+    tensor_t* gradient_update;
+    if(other_input == NULL){
+        gradient_update = (*(variable_unary_grad_op_t) (input->grad_op))(input->variable, output);
+    }else{
+        gradient_update = (*(variable_binary_grad_op_t) (input->grad_op))(input->variable, other_input->variable, output);
+    }
+    tensor_release(gradient_update);
+}
+
+/**
+ * BACKWARD PLANS
+ * a plan holds the subgraph reachable from its root:
+ * nodes in discovery (breadth first) order, with nodes[0] the root,
+ * the number of consumers of each node within the subgraph (its ref count at the start of a pass),
+ * the edges and grad ops of each node (its signature, used by backward_plan_rebind),
+ * a topological order of the nodes, computed once,
+ * and the largest number of interior nodes which are ready at once in that order (the width of the graph)
+ * plans are malloc'ed rather than arena allocated so that they can be cached across iterations
+ *
+ * MEMORY PLANNING
+ * with memory planning enabled, a run frees memory as soon as the backward pass is done with it:
+ * the gradient of an interior node is allocated on its first update and released once it has been propagated,
+ * and the activation (forward value) of an interior node is released after its last use in the order,
+ * right away when no grad op reads it (see grad_needs_t)
+ * released buffers go back to the buffer pool, where the next tensors allocated reuse them, so a planned
+ * run can only be made once per forward pass, and only interior nodes other than the root are touched
+*/
+
+struct backward_plan {
+    int num_nodes;
+    int capacity;
+    variable_t** nodes;
+    int* ref_counts;
+    int* input_indices; // GRAD_MAX_INPUTS per node, -1 for missing inputs
+    variable_grad_op_t* grad_ops; // GRAD_MAX_INPUTS per node
+    int* order;
+    int width;
+    bool memory_planning;
+    int* last_uses; // position in order after which the activation of a node is no longer read, -1 if never (see LAST_USE_NEVER)
+    backward_leaf_fn_t leaf_fn; // see backward_plan_set_leaf_fn
+    void* leaf_context;
+};
+
+// marks nodes discovered by the current plan traversal, plans are not built concurrently
+static unsigned long plan_epoch = 0;
+
+static void plan_reserve(backward_plan_t* plan, int num_nodes){
+    if(num_nodes <= plan->capacity){
+        return;
+    }
+    int capacity = plan->capacity ? plan->capacity : 16;
+    while(capacity < num_nodes){
+        capacity *= 2;
+    }
+    plan->nodes = (variable_t**) realloc(plan->nodes, capacity * sizeof(variable_t*));
+    plan->ref_counts = (int*) realloc(plan->ref_counts, capacity * sizeof(int));
+    plan->input_indices = (int*) realloc(plan->input_indices, GRAD_MAX_INPUTS * capacity * sizeof(int));
+    plan->grad_ops = (variable_grad_op_t*) realloc(plan->grad_ops, GRAD_MAX_INPUTS * capacity * sizeof(variable_grad_op_t));
+    plan->order = (int*) realloc(plan->order, capacity * sizeof(int));
+    plan->last_uses = (int*) realloc(plan->last_uses, capacity * sizeof(int));
+    NDEBUG_ASSERT(plan->nodes && plan->ref_counts && plan->input_indices && plan->grad_ops && plan->order && plan->last_uses, "Failed to allocate backward plan.\n");
+    plan->capacity = capacity;
+}
+
+// returns the index of variable within the plan, appending it if it has not been discovered yet
+static int plan_discover(backward_plan_t* plan, variable_t* variable){
+    variable_ensure_grad_meta(variable);
+    grad_meta_t* grad_meta = variable->grad_meta;
+    if(grad_meta->plan_epoch == plan_epoch){
+        return grad_meta->plan_index;
+    }
+    plan_reserve(plan, plan->num_nodes + 1);
+    int index = plan->num_nodes++;
+    grad_meta->plan_epoch = plan_epoch;
+    grad_meta->plan_index = index;
+    plan->nodes[index] = variable;
+    return index;
+}
+
+// kahn's algorithm, the root is the only node without consumers
+static void plan_sort(backward_plan_t* plan){
+    int* remaining_consumers = (int*) malloc(plan->num_nodes * sizeof(int));
+    memcpy(remaining_consumers, plan->ref_counts, plan->num_nodes * sizeof(int));
+    int head = 0;
+    int tail = 0;
+    int num_ready_interior = (plan->nodes[0]->grad_meta->num_inputs > 0) ? 1 : 0;
+    plan->width = 1;
+    plan->order[tail++] = 0;
+    while(head < tail){
+        int index = plan->order[head++];
+        if(plan->nodes[index]->grad_meta->num_inputs > 0){
+            num_ready_interior--;
+        }
+        for(int input_index = 0; input_index < GRAD_MAX_INPUTS; input_index++){
+            int input_node = plan->input_indices[GRAD_MAX_INPUTS * index + input_index];
+            if(input_node >= 0 && --remaining_consumers[input_node] == 0){
+                plan->order[tail++] = input_node;
+                if(plan->nodes[input_node]->grad_meta->num_inputs > 0){
+                    num_ready_interior++;
+                }
+            }
+        }
+        plan->width = MAX(plan->width, num_ready_interior);
+    }
+    NDEBUG_ASSERT(tail == plan->num_nodes, "Computation graph contains a cycle.\n");
+    free(remaining_consumers);
+}
+
+// of activations the root views, which outlive the run
+#define LAST_USE_NEVER INT32_MAX
+
+// whether the activation of node is a view of that of input (see tensor_transpose and friends), which owns the data
+static inline bool views_activation(variable_t* node, variable_t* input){
+    return !node->tensor->owns_data && tensor_shares_memory(node->tensor, input->tensor);
+}
+
+// liveness of the activations: the last position in order at which a grad op reads each of them
+// a view reads the activation it views for as long as it is read itself, so that activation lives at least until
+// the position of the view, whose consumers all come before it
+static void plan_liveness(backward_plan_t* plan){
+    for(int index = 0; index < plan->num_nodes; index++){
+        plan->last_uses[index] = -1;
+    }
+    for(int position = 0; position < plan->num_nodes; position++){
+        int index = plan->order[position];
+        grad_meta_t* grad_meta = plan->nodes[index]->grad_meta;
+        for(int input_index = 0; input_index < grad_meta->num_inputs; input_index++){
+            // the grad ops of inputs which do not require grad never run, unless they always do
+            if(!runs_grad_op(grad_meta->inputs[input_index])){
+                continue;
+            }
+            grad_needs_t grad_needs = grad_meta->inputs[input_index]->grad_needs;
+            int other_index = (input_index + 1) % grad_meta->num_inputs;
+            if(grad_needs & GRAD_NEEDS_INPUT){
+                plan->last_uses[plan->input_indices[GRAD_MAX_INPUTS * index + input_index]] = position;
+            }
+            if((grad_needs & GRAD_NEEDS_OTHER_INPUT) && grad_meta->num_inputs > 1){
+                plan->last_uses[plan->input_indices[GRAD_MAX_INPUTS * index + other_index]] = position;
+            }
+            if(grad_needs & GRAD_NEEDS_OUTPUT){
+                plan->last_uses[index] = position;
+            }
+        }
+    }
+    for(int position = 0; position < plan->num_nodes; position++){
+        int index = plan->order[position];
+        variable_t* node = plan->nodes[index];
+        for(int input_index = 0; input_index < node->grad_meta->num_inputs; input_index++){
+            int input_node = plan->input_indices[GRAD_MAX_INPUTS * index + input_index];
+            if(!views_activation(node, plan->nodes[input_node])){
+                continue;
+            }
+            if(index == 0 || plan->last_uses[index] == LAST_USE_NEVER){
+                plan->last_uses[input_node] = LAST_USE_NEVER;
+            }else if(plan->last_uses[index] >= 0 && plan->last_uses[input_node] != LAST_USE_NEVER){
+                plan->last_uses[input_node] = MAX(plan->last_uses[input_node], position);
+            }
+        }
+    }
+}
+
+// (re)builds plan from scratch, reusing its buffers
+static void plan_build(backward_plan_t* plan, variable_t* root){
+    plan_epoch++;
+    plan->num_nodes = 0;
+    plan_discover(plan, root);
+    for(int index = 0; index < plan->num_nodes; index++){
+        grad_meta_t* grad_meta = plan->nodes[index]->grad_meta;
+        for(int input_index = 0; input_index < GRAD_MAX_INPUTS; input_index++){
+            int edge = GRAD_MAX_INPUTS * index + input_index;
+            if(input_index < grad_meta->num_inputs){
+                input_t* input = grad_meta->inputs[input_index];
+                int input_node = plan_discover(plan, input->variable);
+                plan->input_indices[edge] = input_node;
+                plan->grad_ops[edge] = input->grad_op;
+            }else{
+                plan->input_indices[edge] = -1;
+                plan->grad_ops[edge] = NULL;
+            }
+        }
+    }
+    memset(plan->ref_counts, 0, plan->num_nodes * sizeof(int));
+    for(int edge = 0; edge < GRAD_MAX_INPUTS * plan->num_nodes; edge++){
+        if(plan->input_indices[edge] >= 0){
+            plan->ref_counts[plan->input_indices[edge]]++;
+        }
+    }
+    plan_sort(plan);
+    plan_liveness(plan);
+}
+
+backward_plan_t* backward_plan_new(variable_t* root){
+    backward_plan_t* new_plan = (backward_plan_t*) calloc(1, sizeof(backward_plan_t));
+    plan_build(new_plan, root);
+    return new_plan;
+}
+
+void backward_plan_free(backward_plan_t* plan){
+    free(plan->nodes);
+    free(plan->ref_counts);
+    free(plan->input_indices);
+    free(plan->grad_ops);
+    free(plan->order);
+    free(plan->last_uses);
+    free(plan);
+}
+
+/**
+ * points plan at the graph rooted at root
+ * when the graph has the same structure as the one plan was built for (as when the same forward
+ * pass is repeated every iteration) only the nodes are swapped in and true is returned,
+ * otherwise plan is rebuilt for the new graph and false is returned
+*/
+bool backward_plan_rebind(backward_plan_t* plan, variable_t* root){
+    int expected_num_nodes = plan->num_nodes;
+    plan_epoch++;
+    plan->num_nodes = 0;
+    plan_discover(plan, root);
+    bool matches = true;
+    for(int index = 0; index < plan->num_nodes && matches; index++){
+        grad_meta_t* grad_meta = plan->nodes[index]->grad_meta;
+        for(int input_index = 0; input_index < GRAD_MAX_INPUTS && matches; input_index++){
+            int edge = GRAD_MAX_INPUTS * index + input_index;
+            if(input_index < grad_meta->num_inputs){
+                input_t* input = grad_meta->inputs[input_index];
+                matches = (plan->grad_ops[edge] == input->grad_op) && (plan_discover(plan, input->variable) == plan->input_indices[edge]);
+            }else{
+                matches = (plan->input_indices[edge] == -1);
+            }
+        }
+        matches = matches && (plan->num_nodes <= expected_num_nodes);
+    }
+    matches = matches && (plan->num_nodes == expected_num_nodes);
+    if(!matches){
+        plan_build(plan, root);
+        return false;
+    }
+    return true;
+}
+
+int backward_plan_get_num_nodes(backward_plan_t* plan){
+    return plan->num_nodes;
+}
+
+variable_t* backward_plan_get_root(backward_plan_t* plan){
+    return plan->nodes[0];
+}
+
+// the node at position in the topological order, which starts at the root
+variable_t* backward_plan_get_node(backward_plan_t* plan, int position){
+    NDEBUG_ASSERT(0 <= position && position < plan->num_nodes, "Position out of range of the plan.\n");
+    return plan->nodes[plan->order[position]];
+}
+
+void backward_plan_set_memory_planning(backward_plan_t* plan, bool enabled){
+    plan->memory_planning = enabled;
+}
+
+void backward_plan_set_leaf_fn(backward_plan_t* plan, backward_leaf_fn_t leaf_fn, void* context){
+    plan->leaf_fn = leaf_fn;
+    plan->leaf_context = context;
+}
+
+// called once the last consumer of node index has propagated into it
+static inline void finalize_gradient(backward_plan_t* plan, int index){
+    variable_t* node = plan->nodes[index];
+    if(plan->leaf_fn && node->grad_meta->num_inputs == 0 && node->requires_grad){
+        (*plan->leaf_fn)(plan->leaf_context, node);
+    }
+}
+
+// interior nodes other than the root are the only ones whose memory a planned run releases
+static inline bool is_releasable(backward_plan_t* plan, int index){
+    return index > 0 && plan->nodes[index]->grad_meta->num_inputs > 0;
+}
+
+static inline void release_gradient(backward_plan_t* plan, int index){
+    variable_t* node = plan->nodes[index];
+    if(plan->memory_planning && is_releasable(plan, index) && node->gradient){
+        tensor_release(node->gradient);
+        node->gradient = NULL;
+    }
+}
+
+// releases the activation of node index once the run is past its last use
+static inline void release_activation(backward_plan_t* plan, int index, int position){
+    if(plan->memory_planning && is_releasable(plan, index) && plan->last_uses[index] == position && position != LAST_USE_NEVER){
+        tensor_release(plan->nodes[index]->tensor);
+    }
+}
+
+// bytes recorded by the profiler for propagating node: its gradient is read, and the gradient of each input updated
+static inline size_t backward_bytes_touched(variable_t* node){
+    grad_meta_t* grad_meta = node->grad_meta;
+    size_t bytes_touched = 0;
+    for(int input_index = 0; input_index < grad_meta->num_inputs; input_index++){
+        size_t input_size = grad_meta->inputs[input_index]->variable->tensor->shape->size;
+        bytes_touched += (node->tensor->shape->size + 2 * input_size) * sizeof(tensor_entry_t);
+    }
+    return bytes_touched;
+}
+
+/**
+ * PASSING GRADIENTS THROUGH
+ * when the gradient of an input is the gradient of the output (add, reshape), and the output is the only consumer of
+ * the input, the input takes the gradient of the output as its own rather than accumulating a copy of it: with memory
+ * planning its buffer is handed over (the output is done with it), without the two share it (their gradients are equal)
+ * only interior nodes other than the root do, as the gradients of leaves are theirs (e.g. read by optimizers)
+*/
+
+static bool can_pass_gradient(backward_plan_t* plan, int index, int input_index){
+    input_t* input = plan->nodes[index]->grad_meta->inputs[input_index];
+    int input_node = plan->input_indices[GRAD_MAX_INPUTS * index + input_index];
+    tensor_t* gradient = plan->nodes[index]->gradient;
+    return input->passes_gradient && index > 0 && input_node >= 0 && is_releasable(plan, input_node) && plan->ref_counts[input_node] == 1
+           && tensor_is_contiguous(gradient) && gradient->dtype == TENSOR_FLOAT32 && gradient->shape->size == input->variable->tensor->shape->size;
+}
+
+static void pass_gradient(backward_plan_t* plan, int index, int input_index){
+    variable_t* node = plan->nodes[index];
+    variable_t* input = node->grad_meta->inputs[input_index]->variable;
+    tensor_t* gradient = node->gradient;
+    // the gradient the input would have accumulated into, all zeros as the node is its only consumer
+    if(input->gradient && input->gradient->data != gradient->data){
+        tensor_release(input->gradient);
+    }
+    if(plan->memory_planning){
+        tensor_in_place_view_as_shape(gradient, input->tensor->shape);
+        node->gradient = NULL;
+        input->gradient = gradient;
+    }else if(input->gradient == NULL || input->gradient->data != gradient->data){
+        input->gradient = shape_equal(gradient->shape, input->tensor->shape) ? gradient : tensor_view_as_shape(gradient, input->tensor->shape);
+    }
+}
+
+// accumulates node's gradient into the gradients of its inputs which require grad
+// an input the gradient is passed through to takes it last, once the other input has read it
+// the grad ops which always run are run for the other inputs
+static void propagate_grads(backward_plan_t* plan, int index, bool concurrent){
+    variable_t* node = plan->nodes[index];
+    grad_meta_t* grad_meta = node->grad_meta;
+    if(grad_meta->num_inputs == 0 || !node->requires_grad){
+        return;
+    }
+    PROFILE_SCOPE("backward", grad_meta->op_name ? grad_meta->op_name : "unnamed", backward_bytes_touched(node));
+    int passed_input_index = -1;
+    for(int input_index = 0; input_index < grad_meta->num_inputs && passed_input_index < 0; input_index++){
+        if(grad_meta->inputs[input_index]->variable->requires_grad && can_pass_gradient(plan, index, input_index)){
+            passed_input_index = input_index;
+        }
+    }
+    for(int input_index = 0; input_index < grad_meta->num_inputs; input_index++){
+        input_t* input = grad_meta->inputs[input_index];
+        if(input_index == passed_input_index || !runs_grad_op(input)){
+            continue;
+        }
+        if(!input->variable->requires_grad){
+            run_detached_grad_op(input, grad_meta->num_inputs == 1 ? NULL : grad_meta->inputs[1 - input_index], node);
+        }else if(grad_meta->num_inputs == 1){
+            update_unary_grad(input, node, concurrent);
+        }else{
+            update_binary_grad(input, grad_meta->inputs[1 - input_index], node, concurrent);
+        }
+    }
+    if(passed_input_index >= 0){
+        pass_gradient(plan, index, passed_input_index);
+    }
+}
+
+static void run_serial(backward_plan_t* plan){
+    for(int position = 0; position < plan->num_nodes; position++){
+        int index = plan->order[position];
+        // leaves may be shared with other plans run in between (see checkpoint.c), so only interior nodes are checked
+        DEBUG_ASSERT(plan->nodes[index]->grad_meta->num_inputs == 0 || get_ref_count(plan->nodes[index]) == 0, "Node scheduled before all of its consumers.\n");
+        propagate_grads(plan, index, false);
+        release_gradient(plan, index);
+        // the activations read at this position are those of the node and its inputs
+        release_activation(plan, index, position);
+        for(int input_index = 0; input_index < GRAD_MAX_INPUTS; input_index++){
+            int input_node = plan->input_indices[GRAD_MAX_INPUTS * index + input_index];
+            if(input_node >= 0){
+                decrement_ref_count(plan->nodes[input_node]);
+                release_activation(plan, input_node, position);
+                if(get_ref_count(plan->nodes[input_node]) == 0){
+                    finalize_gradient(plan, input_node);
+                }
+            }
+        }
+    }
+}
+
+// a node becomes ready once its last consumer has propagated into it, leaves have nothing to propagate
+static void run_backward_task(void* context, size_t task, parallel_task_queue_t* queue){
+    backward_plan_t* plan = (backward_plan_t*) context;
+    propagate_grads(plan, task, true);
+    release_gradient(plan, task);
+    for(int input_index = 0; input_index < GRAD_MAX_INPUTS; input_index++){
+        int input_node = plan->input_indices[GRAD_MAX_INPUTS * task + input_index];
+        if(input_node < 0){
+            continue;
+        }
+        grad_meta_t* grad_meta = plan->nodes[input_node]->grad_meta;
+        if(__atomic_sub_fetch(&grad_meta->ref_count, 1, __ATOMIC_ACQ_REL) == 0){
+            if(grad_meta->num_inputs > 0){
+                parallel_task_queue_push(queue, input_node);
+            }else{
+                finalize_gradient(plan, input_node);
+            }
+        }
+    }
+}
+
+// seeds the root gradient with root_gradient, or with 1 when it is NULL
+static void run_plan(backward_plan_t* plan, tensor_t* root_gradient){
+    variable_t* root = plan->nodes[0];
+    for(int index = 0; index < plan->num_nodes; index++){
+        variable_t* node = plan->nodes[index];
+        node->grad_meta->ref_count = plan->ref_counts[index];
+        if(!plan->memory_planning && node->requires_grad){
+            variable_get_gradient(node);
+        }
+        // interior gradients may hold the result of an earlier pass (over this or an overlapping graph)
+        if(is_releasable(plan, index) && node->gradient){
+            tensor_set_to_scalar_value(node->gradient, 0);
+        }
+        // activations no grad op reads
+        release_activation(plan, index, -1);
+    }
+    if(root_gradient){
+        tensor_set_to_scalar_value(variable_get_gradient(root), 0);
+        tensor_in_place_add(root->gradient, root_gradient);
+    }else{
+        tensor_set_to_scalar_value(variable_get_gradient(root), 1);
+    }
+    if(plan->width > 1 && !parallel_in_worker() && parallel_get_num_threads() > 1){
+        pthread_once(&gradient_locks_once, &gradient_locks_init);
+        size_t root_task = 0;
+        parallel_run_tasks(1, &root_task, &run_backward_task, plan);
+        // the order in which tasks run is not known ahead of time, so activations are released at the end
+        for(int index = 0; index < plan->num_nodes; index++){
+            release_activation(plan, index, plan->last_uses[index]);
+        }
+    }else{
+        run_serial(plan);
+    }
+}
+
+// runs a backward pass over plan, may be called repeatedly (once per forward pass with memory planning)
+// leaf gradients accumulate across passes, interior gradients are recomputed
+// independent branches run concurrently on the worker pool when the graph is wide enough
+void backward_plan_run(backward_plan_t* plan){
+    NDEBUG_ASSERT(is_scalar(plan->nodes[0]), "Error: root variable is not a scalar.");
+    run_plan(plan, NULL);
+}
+
+// as backward_plan_run, but the root (which need not be a scalar) starts with gradient root_gradient
+void backward_plan_run_from_gradient(backward_plan_t* plan, tensor_t* root_gradient){
+    NDEBUG_ASSERT(shape_broadcasts_to(root_gradient->shape, plan->nodes[0]->tensor->shape), "Root gradient does not match the root.\n");
+    run_plan(plan, root_gradient);
+}
+
+// releases the activations of the interior nodes other than the root, for graphs which are not differentiated through
+// (but those the root views)
+void backward_plan_release_activations(backward_plan_t* plan){
+    for(int index = 0; index < plan->num_nodes; index++){
+        if(is_releasable(plan, index) && plan->last_uses[index] != LAST_USE_NEVER){
+            tensor_release(plan->nodes[index]->tensor);
         }
     }
 }
 
+int backward_plan_get_width(backward_plan_t* plan){
+    return plan->width;
+}
+
 void backwards(variable_t* root){
-    NDEBUG_ASSERT(is_scalar(root), "Error: root variable is not a scalar.");
-    // set root gradient to 1
-    tensor_set_to_scalar_value(root->gradient, 1);
-    actual_backwards(root);
+    backward_plan_t* plan = backward_plan_new(root);
+    backward_plan_run(plan);
+    backward_plan_free(plan);
+}
+
+/**
+ * NO-GRAD MODE
+ * while active on a thread, the variable_* functions compute values only: results get neither a
+ * gradient buffer nor grad meta, and no graph is recorded
+*/
+
+static __thread int no_grad_depth = 0; // coral_no_grad_begin calls may nest
+
+void coral_no_grad_begin(void){
+    no_grad_depth++;
 }
 
+void coral_no_grad_end(void){
+    NDEBUG_ASSERT(no_grad_depth > 0, "coral_no_grad_end called without matching coral_no_grad_begin!\n");
+    no_grad_depth--;
+}
 
-void set_unary_grad_meta(variable_t* output, variable_t* parent, variable_unary_grad_op_t grad_op){
+bool coral_is_grad_enabled(void){
+    return no_grad_depth == 0;
+}
+
+void set_unary_grad_meta(variable_t* output, variable_t* parent, variable_unary_grad_op_t grad_op, const char* op_name){
     input_t* input = input_new(parent, (variable_grad_op_t) grad_op);
-    grad_meta_t* new_grad_meta = (grad_meta_t*) malloc(sizeof(grad_meta_t));
-    new_grad_meta->ref_count = 0;
-    new_grad_meta->num_inputs = 1;
-    new_grad_meta->inputs[0] = input;
-    output->grad_meta = new_grad_meta;
-    increment_ref_count(parent);
+    variable_ensure_grad_meta(output);
+    // reuse the (leaf) grad meta allocated alongside the output variable
+    grad_meta_t* grad_meta = output->grad_meta;
+    grad_meta->ref_count = 0;
+    grad_meta->num_inputs = 1;
+    grad_meta->inputs[0] = input;
+    grad_meta->op_context = NULL;
+    grad_meta->op_name = op_name;
+    grad_meta->forward_op = NULL;
+    output->requires_grad = parent->requires_grad;
 }
 
 
-void set_binary_grad_meta(variable_t* output, variable_t* input1, variable_t* input2, variable_binary_grad_op_t grad_op1, variable_binary_grad_op_t grad_op2){
+void set_binary_grad_meta(variable_t* output, variable_t* input1, variable_t* input2, variable_binary_grad_op_t grad_op1, variable_binary_grad_op_t grad_op2, const char* op_name){
     input_t* diff_input1 = input_new(input1, (variable_grad_op_t) grad_op1);
     input_t* diff_input2 = input_new(input2, (variable_grad_op_t) grad_op2);
-    grad_meta_t* new_grad_meta = (grad_meta_t*) malloc(sizeof(grad_meta_t));
-    new_grad_meta->ref_count = 0;
-    new_grad_meta->num_inputs = 2;
-    new_grad_meta->inputs[0] = diff_input1;
-    new_grad_meta->inputs[1] = diff_input2;
-    output->grad_meta = new_grad_meta;
-    increment_ref_count(input1);
-    increment_ref_count(input2);
+    variable_ensure_grad_meta(output);
+    grad_meta_t* grad_meta = output->grad_meta;
+    grad_meta->ref_count = 0;
+    grad_meta->num_inputs = 2;
+    grad_meta->inputs[0] = diff_input1;
+    grad_meta->inputs[1] = diff_input2;
+    grad_meta->op_context = NULL;
+    grad_meta->op_name = op_name;
+    grad_meta->forward_op = NULL;
+    output->requires_grad = input1->requires_grad || input2->requires_grad;
+}
+
+// must be called after set_unary_grad_meta
+void set_unary_accumulate_grad_op(variable_t* output, variable_unary_accumulate_grad_op_t accumulate_grad_op){
+    NDEBUG_ASSERT(output->grad_meta->num_inputs == 1, "Output is not the result of a unary op.");
+    output->grad_meta->inputs[0]->accumulate_grad_op = (variable_grad_op_t) accumulate_grad_op;
+}
+
+// must be called after set_binary_grad_meta
+void set_binary_accumulate_grad_ops(variable_t* output, variable_binary_accumulate_grad_op_t accumulate_grad_op1, variable_binary_accumulate_grad_op_t accumulate_grad_op2){
+    NDEBUG_ASSERT(output->grad_meta->num_inputs == 2, "Output is not the result of a binary op.");
+    output->grad_meta->inputs[0]->accumulate_grad_op = (variable_grad_op_t) accumulate_grad_op1;
+    output->grad_meta->inputs[1]->accumulate_grad_op = (variable_grad_op_t) accumulate_grad_op2;
+}
+
+// must be called after set_unary_grad_meta or set_binary_grad_meta
+void set_forward_op(variable_t* output, variable_forward_op_t forward_op){
+    NDEBUG_ASSERT(output->grad_meta->num_inputs > 0, "Output is not the result of an op.");
+    output->grad_meta->forward_op = forward_op;
+}
+
+// must be called after set_unary_grad_meta
+void set_unary_grad_needs(variable_t* output, grad_needs_t grad_needs){
+    NDEBUG_ASSERT(output->grad_meta->num_inputs == 1, "Output is not the result of a unary op.");
+    output->grad_meta->inputs[0]->grad_needs = grad_needs;
+}
+
+// must be called after set_binary_grad_meta
+void set_binary_grad_needs(variable_t* output, grad_needs_t grad_needs1, grad_needs_t grad_needs2){
+    NDEBUG_ASSERT(output->grad_meta->num_inputs == 2, "Output is not the result of a binary op.");
+    output->grad_meta->inputs[0]->grad_needs = grad_needs1;
+    output->grad_meta->inputs[1]->grad_needs = grad_needs2;
+}
+
+// must be called after set_unary_grad_meta
+void set_unary_passes_gradient(variable_t* output, bool passes_gradient){
+    NDEBUG_ASSERT(output->grad_meta->num_inputs == 1, "Output is not the result of a unary op.");
+    output->grad_meta->inputs[0]->passes_gradient = passes_gradient;
+}
+
+// must be called after set_binary_grad_meta
+void set_binary_passes_gradient(variable_t* output, bool passes_gradient1, bool passes_gradient2){
+    NDEBUG_ASSERT(output->grad_meta->num_inputs == 2, "Output is not the result of a binary op.");
+    output->grad_meta->inputs[0]->passes_gradient = passes_gradient1;
+    output->grad_meta->inputs[1]->passes_gradient = passes_gradient2;
+}
+
+// must be called after set_unary_grad_meta
+void set_unary_always_runs(variable_t* output, bool always_runs){
+    NDEBUG_ASSERT(output->grad_meta->num_inputs == 1, "Output is not the result of a unary op.");
+    output->grad_meta->inputs[0]->always_runs = always_runs;
+}
+
+// must be called after set_binary_grad_meta
+void set_binary_always_runs(variable_t* output, bool always_runs1, bool always_runs2){
+    NDEBUG_ASSERT(output->grad_meta->num_inputs == 2, "Output is not the result of a binary op.");
+    output->grad_meta->inputs[0]->always_runs = always_runs1;
+    output->grad_meta->inputs[1]->always_runs = always_runs2;
 }
@@ -3,8 +3,52 @@
 
 #include "variable.h"
 
+/**
+ * backward passes are scheduled over a plan: the subgraph reachable from a root variable in topological order
+ * backwards builds, runs and discards a plan, while a plan kept across iterations can be rebound to each new
+ * graph so that the traversal and sort are skipped whenever the graph has the same structure
+ * plans whose graphs have independent branches (width > 1) run them concurrently on the worker pool,
+ * see parallel_run_tasks
+*/
+typedef struct backward_plan backward_plan_t;
+
+backward_plan_t* backward_plan_new(variable_t* root);
+bool backward_plan_rebind(backward_plan_t* plan, variable_t* root);
+void backward_plan_run(backward_plan_t* plan);
+void backward_plan_run_from_gradient(backward_plan_t* plan, tensor_t* root_gradient);
+void backward_plan_release_activations(backward_plan_t* plan);
+void backward_plan_free(backward_plan_t* plan);
+int backward_plan_get_num_nodes(backward_plan_t* plan);
+variable_t* backward_plan_get_root(backward_plan_t* plan);
+// the node at position in the topological order, which starts at the root
+variable_t* backward_plan_get_node(backward_plan_t* plan, int position);
+int backward_plan_get_width(backward_plan_t* plan);
+// off by default, see grad.c
+void backward_plan_set_memory_planning(backward_plan_t* plan, bool enabled);
+/**
+ * called during each run of the plan once the gradient of a leaf is final, i.e. every one of its consumers has
+ * propagated into it, so that work on the gradient (e.g. reducing it across processes, see comm.h) overlaps the
+ * rest of the pass; called on whichever thread finalized the leaf, in the order of the plan for serial runs
+*/
+typedef void (* backward_leaf_fn_t)(void* context, variable_t* leaf);
+// NULL to stop calling it
+void backward_plan_set_leaf_fn(backward_plan_t* plan, backward_leaf_fn_t leaf_fn, void* context);
+
 void backwards(variable_t* root);
-void set_unary_grad_meta(variable_t* child, variable_t* parent, variable_unary_grad_op_t grad_op);
-void set_binary_grad_meta(variable_t* child, variable_t* parent1, variable_t* parent2, variable_binary_grad_op_t grad_op1, variable_binary_grad_op_t grad_op2);
+
+void coral_no_grad_begin(void);
+void coral_no_grad_end(void);
+bool coral_is_grad_enabled(void);
+void set_unary_grad_meta(variable_t* child, variable_t* parent, variable_unary_grad_op_t grad_op, const char* op_name);
+void set_binary_grad_meta(variable_t* child, variable_t* parent1, variable_t* parent2, variable_binary_grad_op_t grad_op1, variable_binary_grad_op_t grad_op2, const char* op_name);
+void set_unary_accumulate_grad_op(variable_t* output, variable_unary_accumulate_grad_op_t accumulate_grad_op);
+void set_binary_accumulate_grad_ops(variable_t* output, variable_binary_accumulate_grad_op_t accumulate_grad_op1, variable_binary_accumulate_grad_op_t accumulate_grad_op2);
+void set_unary_grad_needs(variable_t* output, grad_needs_t grad_needs);
+void set_binary_grad_needs(variable_t* output, grad_needs_t grad_needs1, grad_needs_t grad_needs2);
+void set_unary_passes_gradient(variable_t* output, bool passes_gradient);
+void set_binary_passes_gradient(variable_t* output, bool passes_gradient1, bool passes_gradient2);
+void set_unary_always_runs(variable_t* output, bool always_runs);
+void set_binary_always_runs(variable_t* output, bool always_runs1, bool always_runs2);
+void set_forward_op(variable_t* output, variable_forward_op_t forward_op);
 
 #endif // GRAD_H
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include "graph.h"
+#include "grad.h"
+#include "arena.h"
+#include "assert.h"
+#include <stdlib.h>
+
+struct graph {
+    backward_plan_t* plan;
+    int num_ops;
+    variable_t** ops; // interior nodes in forward (reverse topological) order
+};
+
+// a node, its tensor and its gradient outlive the iteration only if none of them came from the graph arena
+static inline bool outlives_arena(variable_t* node){
+    arena_t* graph_arena = arena_get_graph_arena();
+    return !arena_contains(graph_arena, node) && !arena_contains(graph_arena, node->tensor)
+        && !arena_contains(graph_arena, node->tensor->data) && !arena_contains(graph_arena, node->gradient->data);
+}
+
+graph_t* graph_capture(variable_t* root){
+    NDEBUG_ASSERT(is_scalar(root), "Error: root variable is not a scalar.");
+    graph_t* new_graph = (graph_t*) malloc(sizeof(graph_t));
+    NDEBUG_ASSERT(new_graph != NULL, "Failed to allocate graph.\n");
+    new_graph->plan = backward_plan_new(root);
+    int num_nodes = backward_plan_get_num_nodes(new_graph->plan);
+    new_graph->ops = (variable_t**) malloc(num_nodes * sizeof(variable_t*));
+    NDEBUG_ASSERT(new_graph->ops != NULL, "Failed to allocate graph.\n");
+    new_graph->num_ops = 0;
+    // the inputs of a node come after it in the topological order, so walking it backwards computes them first
+    for(int position = num_nodes - 1; position >= 0; position--){
+        variable_t* node = backward_plan_get_node(new_graph->plan, position);
+        variable_get_gradient(node);
+        NDEBUG_ASSERT(outlives_arena(node), "Captured graphs must be built outside of the graph arena!\n");
+        grad_meta_t* grad_meta = node->grad_meta;
+        if(grad_meta->num_inputs > 0){
+            NDEBUG_ASSERT(grad_meta->forward_op != NULL, "Op %s cannot be replayed!\n", grad_meta->op_name ? grad_meta->op_name : "unnamed");
+            new_graph->ops[new_graph->num_ops++] = node;
+        }
+    }
+    return new_graph;
+}
+
+void graph_replay_forward(graph_t* graph){
+    for(int op_index = 0; op_index < graph->num_ops; op_index++){
+        variable_t* node = graph->ops[op_index];
+        (*node->grad_meta->forward_op)(node);
+    }
+}
+
+void graph_replay(graph_t* graph){
+    graph_replay_forward(graph);
+    backward_plan_run(graph->plan);
+}
+
+variable_t* graph_get_root(graph_t* graph){
+    return backward_plan_get_root(graph->plan);
+}
+
+int graph_get_num_ops(graph_t* graph){
+    return graph->num_ops;
+}
+
+void graph_free(graph_t* graph){
+    backward_plan_free(graph->plan);
+    free(graph->ops);
+    free(graph);
+}
@@ -0,0 +1,39 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "variable.h"
+
+/**
+ * static graphs
+ * a training loop which builds the same graph every iteration can capture it once and replay it instead:
+ * capture records the interior nodes in the order they were computed and the backward plan of the graph,
+ * and allocates every gradient the backward pass accumulates into
+ * a replay recomputes each node into its existing tensor (see variable_forward_op_t) and runs the plan,
+ * so no variables, grad meta, shapes or activations are created, and broadcast plans are served from the
+ * per thread plan cache (see broadcast_plan_get)
+ *
+ *     variable_t* loss = forward(input, weight); graph_t* graph = graph_capture(loss);
+ *     for(...){ ... write the next batch into input->tensor ...; graph_replay(graph); ... update weight in place ...; }
+ *
+ * leaves (inputs and parameters) must be updated in place, as the nodes read their tensors; leaf gradients
+ * accumulate across replays, as across backward passes
+ * the graph must be built outside of the graph arena, as an arena reset would free it, and from ops which
+ * can be replayed (checkpointed segments cannot)
+ * the temporaries of grad ops which cannot accumulate in place are still allocated, replay inside the graph
+ * arena to reclaim them with arena_reset
+*/
+
+typedef struct graph graph_t;
+
+graph_t* graph_capture(variable_t* root);
+// forward pass, then backward pass from the (scalar) root
+void graph_replay(graph_t* graph);
+// recomputes the nodes only, e.g. for evaluation
+void graph_replay_forward(graph_t* graph);
+variable_t* graph_get_root(graph_t* graph);
+// interior nodes recomputed by a replay
+int graph_get_num_ops(graph_t* graph);
+// the variables of the graph are left alone
+void graph_free(graph_t* graph);
+
+#endif // GRAPH_H
@@ -0,0 +1,97 @@
+#include "iter.h"
+#include "assert.h"
+#include <stdint.h>
+#include <string.h>
+
+void broadcast_plan_init(broadcast_plan_t* plan, shape_t* shape, int num_operands, shape_t* const* operand_shapes, const size_t* const* operand_strides){
+    NDEBUG_ASSERT(0 < num_operands && num_operands <= ITER_MAX_OPERANDS, "Broadcast plans take between 1 and ITER_MAX_OPERANDS operands!\n");
+    plan->num_operands = num_operands;
+    plan->num_dims = 0;
+    for(int dim_index = 0; dim_index < shape->num_dims; dim_index++){
+        size_t dim = shape->dims[dim_index];
+        if(dim == 1){
+            continue;
+        }
+        size_t strides[ITER_MAX_OPERANDS];
+        bool mergeable = plan->num_dims > 0;
+        for(int operand = 0; operand < num_operands; operand++){
+            shape_t* operand_shape = operand_shapes[operand];
+            int operand_dim_index = dim_index - (shape->num_dims - operand_shape->num_dims);
+            bool broadcast = operand_dim_index < 0 || operand_shape->dims[operand_dim_index] == 1;
+            strides[operand] = broadcast ? 0 : operand_strides[operand][operand_dim_index];
+            // the previous dimension steps over exactly one run of this one
+            mergeable = mergeable && plan->strides[operand][plan->num_dims - 1] == strides[operand] * dim;
+        }
+        if(mergeable){
+            plan->dims[plan->num_dims - 1] *= dim;
+        }else{
+            plan->num_dims++;
+            plan->dims[plan->num_dims - 1] = dim;
+        }
+        for(int operand = 0; operand < num_operands; operand++){
+            plan->strides[operand][plan->num_dims - 1] = strides[operand];
+        }
+    }
+    if(plan->num_dims == 0){
+        // a single entry
+        plan->num_dims = 1;
+        plan->dims[0] = 1;
+        for(int operand = 0; operand < num_operands; operand++){
+            plan->strides[operand][0] = 0;
+        }
+    }
+    plan->row_length = plan->dims[plan->num_dims - 1];
+    plan->num_rows = shape->size / plan->row_length;
+}
+
+/**
+ * PLAN CACHE
+ * shapes are interned, so the shapes of a plan of contiguous operands identify it
+*/
+
+#define BROADCAST_PLAN_CACHE_SIZE 64
+
+typedef struct {
+    shape_t* shape;
+    int num_operands;
+    shape_t* operand_shapes[ITER_MAX_OPERANDS];
+    broadcast_plan_t plan;
+} plan_cache_entry_t;
+
+static __thread plan_cache_entry_t plan_cache[BROADCAST_PLAN_CACHE_SIZE];
+
+const broadcast_plan_t* broadcast_plan_get(shape_t* shape, int num_operands, shape_t* const* operand_shapes){
+    uintptr_t key = (uintptr_t) shape >> 4;
+    for(int operand = 0; operand < num_operands; operand++){
+        key = key * 31 + ((uintptr_t) operand_shapes[operand] >> 4);
+    }
+    plan_cache_entry_t* entry = &plan_cache[(key ^ (key >> 9)) % BROADCAST_PLAN_CACHE_SIZE];
+    bool hit = entry->shape == shape && entry->num_operands == num_operands;
+    for(int operand = 0; operand < num_operands && hit; operand++){
+        hit = entry->operand_shapes[operand] == operand_shapes[operand];
+    }
+    if(!hit){
+        const size_t* operand_strides[ITER_MAX_OPERANDS];
+        for(int operand = 0; operand < num_operands; operand++){
+            operand_strides[operand] = operand_shapes[operand]->strides;
+            entry->operand_shapes[operand] = operand_shapes[operand];
+        }
+        broadcast_plan_init(&entry->plan, shape, num_operands, operand_shapes, operand_strides);
+        entry->shape = shape;
+        entry->num_operands = num_operands;
+    }
+    return &entry->plan;
+}
+
+void tensor_iter_init(tensor_iter_t* iter, const broadcast_plan_t* plan, size_t row){
+    NDEBUG_ASSERT(row <= plan->num_rows, "Row out of range!\n");
+    iter->plan = plan;
+    memset(iter->offsets, 0, sizeof(iter->offsets));
+    for(int dim_index = plan->num_dims - 2; dim_index >= 0; dim_index--){
+        iter->counters[dim_index] = row % plan->dims[dim_index];
+        row /= plan->dims[dim_index];
+        for(int operand = 0; operand < plan->num_operands; operand++){
+            iter->offsets[operand] += iter->counters[dim_index] * plan->strides[operand][dim_index];
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef ITER_H
+#define ITER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "shape.h"
+
+/**
+ * broadcast plans and iterators
+ * a broadcast plan describes a walk over the entries of an iteration shape, together with the entries
+ * which every operand (broadcast to that shape) holds at each of them, as the smallest loop nest:
+ * dimensions of length 1 are dropped, dimensions along which an operand is broadcast get stride 0 for it,
+ * and adjacent dimensions which every operand walks contiguously are merged into one
+ * the innermost loop of the nest is a row, which kernels run over directly (see tensor.c), while
+ * tensor_iter_t steps through the rows without recursion
+ * plans of contiguous operands are memoized per (interned) shapes, see broadcast_plan_get
+*/
+
+#define ITER_MAX_OPERANDS 3
+
+typedef struct {
+    int num_operands;
+    int num_dims; // at least 1, the last is the row
+    size_t dims[SHAPE_MAX_DIMS];
+    size_t strides[ITER_MAX_OPERANDS][SHAPE_MAX_DIMS];
+    size_t row_length;
+    size_t num_rows;
+} broadcast_plan_t;
+
+// each operand_shapes[operand] must broadcast to shape, and is walked with operand_strides[operand] (one stride per dimension)
+void broadcast_plan_init(broadcast_plan_t* plan, shape_t* shape, int num_operands, shape_t* const* operand_shapes, const size_t* const* operand_strides);
+// the plan of contiguous operands, owned by a per thread cache (valid until the next call on the same thread)
+const broadcast_plan_t* broadcast_plan_get(shape_t* shape, int num_operands, shape_t* const* operand_shapes);
+
+typedef struct {
+    const broadcast_plan_t* plan;
+    size_t counters[SHAPE_MAX_DIMS]; // position along each dimension but the row
+    size_t offsets[ITER_MAX_OPERANDS]; // of the first entry of the current row, per operand
+} tensor_iter_t;
+
+// positions iter at the start of row
+void tensor_iter_init(tensor_iter_t* iter, const broadcast_plan_t* plan, size_t row);
+
+// moves iter to the start of the next row
+// most plans coalesce to one or two dimensions, which step without the loop over dimensions
+static inline void tensor_iter_next(tensor_iter_t* iter){
+    const broadcast_plan_t* plan = iter->plan;
+    if(plan->num_dims == 1){
+        // a single row
+        return;
+    }
+    if(plan->num_dims == 2){
+        for(int operand = 0; operand < plan->num_operands; operand++){
+            iter->offsets[operand] += plan->strides[operand][0];
+        }
+        iter->counters[0]++;
+        return;
+    }
+    for(int dim_index = plan->num_dims - 2; dim_index >= 0; dim_index--){
+        for(int operand = 0; operand < plan->num_operands; operand++){
+            iter->offsets[operand] += plan->strides[operand][dim_index];
+        }
+        if(++iter->counters[dim_index] < plan->dims[dim_index]){
+            return;
+        }
+        for(int operand = 0; operand < plan->num_operands; operand++){
+            iter->offsets[operand] -= plan->dims[dim_index] * plan->strides[operand][dim_index];
+        }
+        iter->counters[dim_index] = 0;
+    }
+}
+
+#endif // ITER_H
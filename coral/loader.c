@@ -0,0 +1,230 @@
+#include "loader.h"
+#include "pool.h"
+#include "profile.h"
+#include "assert.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef enum {
+    BUFFER_EMPTY, // free to fill
+    BUFFER_READY, // filled, waiting to be handed out
+    BUFFER_IN_USE, // handed out, until the next batch is
+    BUFFER_END, // the fill function ran out of batches
+} buffer_state_t;
+
+typedef struct {
+    buffer_state_t state;
+    void* data;
+    tensor_t* tensors[LOADER_MAX_TENSORS]; // pointing into data
+} buffer_t;
+
+struct loader {
+    int num_tensors;
+    int num_buffers;
+    size_t buffer_size; // bytes
+    buffer_t buffers[LOADER_MAX_BUFFERS];
+    loader_fill_fn_t fill_fn;
+    void* context;
+    void (* free_context_fn)(void* context);
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t filled; // a buffer became ready (or the end was reached)
+    pthread_cond_t emptied; // a buffer was handed back, or the loader is stopping
+    bool stopping;
+    size_t next_batch; // handed out next
+    int buffer_in_use; // -1 when none is
+};
+
+/**
+ * LOADER THREAD
+ * fills batch i into buffer i mod num_buffers, once the batch which was last in it has been handed back
+*/
+
+static void* run_loader(void* raw_loader){
+    loader_t* loader = (loader_t*) raw_loader;
+    for(size_t batch_index = 0;; batch_index++){
+        buffer_t* buffer = &loader->buffers[batch_index % loader->num_buffers];
+        pthread_mutex_lock(&loader->mutex);
+        while(buffer->state != BUFFER_EMPTY && !loader->stopping){
+            pthread_cond_wait(&loader->emptied, &loader->mutex);
+        }
+        bool stopping = loader->stopping;
+        pthread_mutex_unlock(&loader->mutex);
+        if(stopping){
+            return NULL;
+        }
+        bool filled;
+        {
+            PROFILE_SCOPE("loader", "fill", loader->buffer_size);
+            filled = (*loader->fill_fn)(loader->context, batch_index, buffer->tensors);
+        }
+        pthread_mutex_lock(&loader->mutex);
+        buffer->state = filled ? BUFFER_READY : BUFFER_END;
+        pthread_cond_signal(&loader->filled);
+        pthread_mutex_unlock(&loader->mutex);
+        if(!filled){
+            return NULL;
+        }
+    }
+}
+
+static inline size_t align_up(size_t size){
+    return (size + TENSOR_ALIGNMENT - 1) / TENSOR_ALIGNMENT * TENSOR_ALIGNMENT;
+}
+
+loader_t* loader_new(int num_tensors, shape_t** shapes, int num_buffers, loader_fill_fn_t fill_fn, void* context){
+    NDEBUG_ASSERT(0 < num_tensors && num_tensors <= LOADER_MAX_TENSORS, "Batches hold between 1 and %d tensors!\n", LOADER_MAX_TENSORS);
+    NDEBUG_ASSERT(0 < num_buffers && num_buffers <= LOADER_MAX_BUFFERS, "Loaders have between 1 and %d buffers!\n", LOADER_MAX_BUFFERS);
+    loader_t* new_loader = (loader_t*) calloc(1, sizeof(loader_t));
+    NDEBUG_ASSERT(new_loader != NULL, "Failed to allocate loader.\n");
+    new_loader->num_tensors = num_tensors;
+    new_loader->num_buffers = num_buffers;
+    new_loader->fill_fn = fill_fn;
+    new_loader->context = context;
+    new_loader->buffer_in_use = -1;
+    // each tensor of a batch starts on an aligned offset into its buffer
+    for(int tensor_index = 0; tensor_index < num_tensors; tensor_index++){
+        new_loader->buffer_size += align_up(shapes[tensor_index]->size * sizeof(tensor_entry_t));
+    }
+    for(int buffer_index = 0; buffer_index < num_buffers; buffer_index++){
+        buffer_t* buffer = &new_loader->buffers[buffer_index];
+        buffer->state = BUFFER_EMPTY;
+        buffer->data = pool_calloc(new_loader->buffer_size, 1);
+        size_t offset = 0;
+        for(int tensor_index = 0; tensor_index < num_tensors; tensor_index++){
+            // malloc'ed rather than arena allocated, as they outlive any iteration
+            buffer->tensors[tensor_index] = (tensor_t*) malloc(sizeof(tensor_t));
+            NDEBUG_ASSERT(buffer->tensors[tensor_index] != NULL, "Failed to allocate loader.\n");
+            *buffer->tensors[tensor_index] = (tensor_t) {(tensor_entry_t*) ((char*) buffer->data + offset), shapes[tensor_index], false, NULL, TENSOR_FLOAT32, QUANTIZATION_NONE};
+            offset += align_up(shapes[tensor_index]->size * sizeof(tensor_entry_t));
+        }
+    }
+    pthread_mutex_init(&new_loader->mutex, NULL);
+    pthread_cond_init(&new_loader->filled, NULL);
+    pthread_cond_init(&new_loader->emptied, NULL);
+    NDEBUG_ASSERT(pthread_create(&new_loader->thread, NULL, &run_loader, new_loader) == 0, "Failed to start loader thread.\n");
+    return new_loader;
+}
+
+bool loader_next(loader_t* loader, tensor_t** batch){
+    PROFILE_SCOPE("loader", "wait", 0);
+    pthread_mutex_lock(&loader->mutex);
+    if(loader->buffer_in_use >= 0){
+        loader->buffers[loader->buffer_in_use].state = BUFFER_EMPTY;
+        loader->buffer_in_use = -1;
+        pthread_cond_signal(&loader->emptied);
+    }
+    int buffer_index = loader->next_batch % loader->num_buffers;
+    buffer_t* buffer = &loader->buffers[buffer_index];
+    while(buffer->state != BUFFER_READY && buffer->state != BUFFER_END){
+        pthread_cond_wait(&loader->filled, &loader->mutex);
+    }
+    bool ready = buffer->state == BUFFER_READY;
+    if(ready){
+        buffer->state = BUFFER_IN_USE;
+        loader->buffer_in_use = buffer_index;
+        loader->next_batch++;
+        memcpy(batch, buffer->tensors, loader->num_tensors * sizeof(tensor_t*));
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    return ready;
+}
+
+void loader_free(loader_t* loader){
+    pthread_mutex_lock(&loader->mutex);
+    loader->stopping = true;
+    pthread_cond_broadcast(&loader->emptied);
+    pthread_mutex_unlock(&loader->mutex);
+    pthread_join(loader->thread, NULL);
+    pthread_mutex_destroy(&loader->mutex);
+    pthread_cond_destroy(&loader->filled);
+    pthread_cond_destroy(&loader->emptied);
+    for(int buffer_index = 0; buffer_index < loader->num_buffers; buffer_index++){
+        buffer_t* buffer = &loader->buffers[buffer_index];
+        pool_free(buffer->data, loader->buffer_size);
+        for(int tensor_index = 0; tensor_index < loader->num_tensors; tensor_index++){
+            free(buffer->tensors[tensor_index]);
+        }
+    }
+    if(loader->free_context_fn){
+        (*loader->free_context_fn)(loader->context);
+    }
+    free(loader);
+}
+
+/**
+ * RECORD FILES
+*/
+
+typedef struct {
+    const tensor_entry_t* records;
+    size_t mapping_size;
+    size_t num_records;
+    size_t record_size; // entries
+    size_t batch_size;
+    int num_tensors;
+    size_t sample_sizes[LOADER_MAX_TENSORS]; // entries of each tensor per record
+} record_source_t;
+
+// decodes a batch of records into the rows of the tensors
+static bool fill_from_records(void* raw_source, size_t batch_index, tensor_t** batch){
+    record_source_t* source = (record_source_t*) raw_source;
+    if((batch_index + 1) * source->batch_size > source->num_records){
+        return false;
+    }
+    const tensor_entry_t* record = source->records + batch_index * source->batch_size * source->record_size;
+    for(size_t sample = 0; sample < source->batch_size; sample++){
+        for(int tensor_index = 0; tensor_index < source->num_tensors; tensor_index++){
+            size_t sample_size = source->sample_sizes[tensor_index];
+            memcpy(batch[tensor_index]->data + sample * sample_size, record, sample_size * sizeof(tensor_entry_t));
+            record += sample_size;
+        }
+    }
+    return true;
+}
+
+static void free_record_source(void* raw_source){
+    record_source_t* source = (record_source_t*) raw_source;
+    munmap((void*) source->records, source->mapping_size);
+    free(source);
+}
+
+loader_t* loader_new_from_records(const char* path, int num_tensors, shape_t** shapes, int num_buffers){
+    NDEBUG_ASSERT(0 < num_tensors && num_tensors <= LOADER_MAX_TENSORS, "Batches hold between 1 and %d tensors!\n", LOADER_MAX_TENSORS);
+    size_t batch_size = shapes[0]->dims[0];
+    size_t sample_sizes[LOADER_MAX_TENSORS];
+    size_t record_size = 0;
+    for(int tensor_index = 0; tensor_index < num_tensors; tensor_index++){
+        NDEBUG_ASSERT(shapes[tensor_index]->dims[0] == batch_size, "Tensors of a batch must have the same first dimension!\n");
+        sample_sizes[tensor_index] = shapes[tensor_index]->size / batch_size;
+        record_size += sample_sizes[tensor_index];
+    }
+    int descriptor = open(path, O_RDONLY);
+    if(descriptor < 0){
+        return NULL;
+    }
+    struct stat status;
+    size_t record_bytes = record_size * sizeof(tensor_entry_t);
+    bool valid = fstat(descriptor, &status) == 0 && status.st_size > 0;
+    size_t remainder = valid ? (size_t) status.st_size % record_bytes : 1;
+    void* mapping = (valid && remainder == 0) ? mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0) : MAP_FAILED;
+    close(descriptor);
+    if(mapping == MAP_FAILED){
+        return NULL;
+    }
+    // records are read front to back
+    madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+    record_source_t* source = (record_source_t*) malloc(sizeof(record_source_t));
+    NDEBUG_ASSERT(source != NULL, "Failed to allocate loader.\n");
+    *source = (record_source_t) {(const tensor_entry_t*) mapping, status.st_size, status.st_size / record_bytes, record_size, batch_size, num_tensors, {0}};
+    memcpy(source->sample_sizes, sample_sizes, num_tensors * sizeof(size_t));
+    loader_t* new_loader = loader_new(num_tensors, shapes, num_buffers, &fill_from_records, source);
+    new_loader->free_context_fn = &free_record_source;
+    return new_loader;
+}
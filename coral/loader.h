@@ -0,0 +1,44 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "tensor.h"
+#include <stdbool.h>
+
+/**
+ * streaming data loader
+ * batches of one or more contiguous float32 tensors (e.g. inputs and targets) are filled on a background
+ * thread, ahead of the training loop, into a ring of num_buffers preallocated buffers (2 for double
+ * buffering, 3 for triple), so that reading and decoding the next batches overlaps computing on this one
+ * the tensors of a batch live in its buffer and are handed out as they are, nothing is copied or allocated
+ * per batch; they are valid until the next call to loader_next, which recycles their buffer
+ *
+ *     loader_t* loader = loader_new_from_records("train.bin", 2, shapes, 2);
+ *     tensor_t* batch[2];
+ *     while(loader_next(loader, batch)){ input->tensor = batch[0]; target->tensor = batch[1]; graph_replay(graph); ... }
+ *
+ * (leaves read their tensor when a graph is replayed, so batches are swapped in rather than copied)
+*/
+
+typedef struct loader loader_t;
+
+// writes batch batch_index into the tensors of a batch, returns false once there is no such batch
+// runs on the loader thread, and so should only write entries (not allocate tensors, or use the graph arena)
+typedef bool (* loader_fill_fn_t)(void* context, size_t batch_index, tensor_t** batch);
+
+#define LOADER_MAX_TENSORS 8
+#define LOADER_MAX_BUFFERS 8
+
+loader_t* loader_new(int num_tensors, shape_t** shapes, int num_buffers, loader_fill_fn_t fill_fn, void* context);
+/**
+ * batches read from a file of float32 records, where a record holds the entries of one sample (a row along the
+ * first dimension) of each tensor in turn, and batch i is records [i * batch_size, (i + 1) * batch_size)
+ * (the first dimension of the shapes), a last partial batch is dropped
+ * the file is mapped into memory, NULL when it cannot be, or does not hold a whole number of records
+*/
+loader_t* loader_new_from_records(const char* path, int num_tensors, shape_t** shapes, int num_buffers);
+// false (and batch left alone) once every batch has been handed out
+bool loader_next(loader_t* loader, tensor_t** batch);
+// stops the loader thread, tensors handed out are no longer valid
+void loader_free(loader_t* loader);
+
+#endif // LOADER_H
@@ -0,0 +1,223 @@
+#include "module.h"
+#include "parallel.h"
+#include "assert.h"
+#include "utils.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct module {
+    int num_parameters;
+    int capacity;
+    variable_t** parameters;
+    char** names;
+    module_span_t* spans; // by offset, adjacent spans are merged when they are contiguous
+    int num_spans;
+    size_t num_entries;
+    tensor_t* data_bucket; // NULL until flattened
+    tensor_t* gradient_bucket;
+};
+
+module_t* module_new(void){
+    module_t* new_module = (module_t*) calloc(1, sizeof(module_t));
+    NDEBUG_ASSERT(new_module != NULL, "Failed to allocate module.\n");
+    return new_module;
+}
+
+void module_free(module_t* module){
+    for(int index = 0; index < module->num_parameters; index++){
+        free(module->names[index]);
+    }
+    free(module->parameters);
+    free(module->names);
+    free(module->spans);
+    free(module);
+}
+
+static void module_reserve(module_t* module, int num_parameters){
+    if(num_parameters <= module->capacity){
+        return;
+    }
+    int capacity = module->capacity ? 2 * module->capacity : 16;
+    module->parameters = (variable_t**) realloc(module->parameters, capacity * sizeof(variable_t*));
+    module->names = (char**) realloc(module->names, capacity * sizeof(char*));
+    module->spans = (module_span_t*) realloc(module->spans, capacity * sizeof(module_span_t));
+    NDEBUG_ASSERT(module->parameters && module->names && module->spans, "Failed to allocate module.\n");
+    module->capacity = capacity;
+}
+
+static void append_span(module_t* module, module_span_t span){
+    module_span_t* last_span = module->num_spans > 0 ? &module->spans[module->num_spans - 1] : NULL;
+    if(last_span && last_span->data + last_span->size == span.data && last_span->gradient + last_span->size == span.gradient){
+        last_span->size += span.size;
+    }else{
+        module->spans[module->num_spans++] = span;
+    }
+}
+
+void module_add_parameter(module_t* module, const char* name, variable_t* parameter){
+    tensor_t* gradient = variable_get_gradient(parameter);
+    NDEBUG_ASSERT(parameter->tensor->dtype == TENSOR_FLOAT32 && tensor_is_contiguous(parameter->tensor), "Parameters must be contiguous float32 tensors!\n");
+    NDEBUG_ASSERT(gradient->dtype == TENSOR_FLOAT32 && tensor_is_contiguous(gradient), "Parameter gradients must be contiguous float32 tensors!\n");
+    NDEBUG_ASSERT(module_find_parameter(module, name) == NULL, "Module already has a parameter called %s!\n", name);
+    NDEBUG_ASSERT(!module_is_flat(module), "Parameters cannot be added to a flattened module!\n");
+    module_reserve(module, module->num_parameters + 1);
+    module->parameters[module->num_parameters] = parameter;
+    module->names[module->num_parameters] = strdup(name);
+    module->num_parameters++;
+    size_t size = parameter->tensor->shape->size;
+    module_span_t span = {parameter->tensor->data, gradient->data, module->num_entries, size};
+    append_span(module, span);
+    module->num_entries += size;
+}
+
+void module_set_parameter_data(module_t* module, int index, tensor_entry_t* data){
+    NDEBUG_ASSERT(!module_is_flat(module), "Parameters of a flat module live in its bucket!\n");
+    tensor_t* tensor = module_get_parameter(module, index)->tensor;
+    tensor_release(tensor);
+    tensor->data = data;
+    // the spans are laid out again, as the parameter may no longer be next to its neighbours
+    module->num_spans = 0;
+    size_t offset = 0;
+    for(int parameter = 0; parameter < module->num_parameters; parameter++){
+        variable_t* variable = module->parameters[parameter];
+        module_span_t span = {variable->tensor->data, variable->gradient->data, offset, variable->tensor->shape->size};
+        append_span(module, span);
+        offset += span.size;
+    }
+}
+
+int module_get_num_parameters(module_t* module){
+    return module->num_parameters;
+}
+
+variable_t* module_get_parameter(module_t* module, int index){
+    NDEBUG_ASSERT(0 <= index && index < module->num_parameters, "Parameter index out of range.\n");
+    return module->parameters[index];
+}
+
+const char* module_get_parameter_name(module_t* module, int index){
+    NDEBUG_ASSERT(0 <= index && index < module->num_parameters, "Parameter index out of range.\n");
+    return module->names[index];
+}
+
+variable_t* module_find_parameter(module_t* module, const char* name){
+    for(int index = 0; index < module->num_parameters; index++){
+        if(strcmp(module->names[index], name) == 0){
+            return module->parameters[index];
+        }
+    }
+    return NULL;
+}
+
+size_t module_get_num_entries(module_t* module){
+    return module->num_entries;
+}
+
+int module_get_num_spans(module_t* module){
+    return module->num_spans;
+}
+
+/**
+ * FLAT LOOPS
+ * the entries of the module are split into chunks regardless of which parameter they belong to,
+ * each chunk finds the span its first entry is in and walks on from there
+*/
+
+typedef struct {
+    module_t* module;
+    module_range_fn_t range_fn;
+    void* context;
+} module_loop_t;
+
+// the last span starting at or before offset
+static int find_span(module_t* module, size_t offset){
+    int low = 0;
+    int high = module->num_spans - 1;
+    while(low < high){
+        int middle = (low + high + 1) / 2;
+        if(module->spans[middle].offset <= offset){
+            low = middle;
+        }else{
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+static void module_range(void* raw_loop, size_t begin, size_t end){
+    module_loop_t* loop = (module_loop_t*) raw_loop;
+    module_t* module = loop->module;
+    for(int span_index = find_span(module, begin); span_index < module->num_spans && begin < end; span_index++){
+        const module_span_t* span = &module->spans[span_index];
+        size_t span_end = MIN(end, span->offset + span->size);
+        if(span_end > begin){
+            (*loop->range_fn)(loop->context, span, begin - span->offset, span_end - span->offset);
+            begin = span_end;
+        }
+    }
+}
+
+void module_parallel_for(module_t* module, module_range_fn_t range_fn, void* context){
+    if(module->num_entries == 0){
+        return;
+    }
+    module_loop_t loop = {module, range_fn, context};
+    parallel_for(module->num_entries, parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE), &module_range, &loop);
+}
+
+static void zero_grad_range(void* context, const module_span_t* span, size_t begin, size_t end){
+    UNUSED(context);
+    memset(span->gradient + begin, 0, (end - begin) * sizeof(tensor_entry_t));
+}
+
+// a memset per chunk
+void module_zero_grad(module_t* module){
+    module_parallel_for(module, &zero_grad_range, NULL);
+}
+
+/**
+ * FLAT PARAMETERS
+ * the buckets come from the buffer pool and are aliased by the parameters, so they are never recycled
+*/
+
+// points tensor at entries [offset, offset + size) of bucket, releasing its own buffer
+static void move_into_bucket(tensor_t* tensor, tensor_t* bucket, size_t offset){
+    memcpy(bucket->data + offset, tensor->data, tensor->shape->size * sizeof(tensor_entry_t));
+    tensor_release(tensor);
+    tensor->data = bucket->data + offset;
+}
+
+void module_flatten(module_t* module){
+    NDEBUG_ASSERT(!arena_is_active(), "Modules must be flattened outside of the graph arena!\n");
+    NDEBUG_ASSERT(!module_is_flat(module), "Module is already flat!\n");
+    shape_t* shape = shape_new(1, &module->num_entries);
+    module->data_bucket = tensor_empty(shape);
+    module->gradient_bucket = tensor_empty(shape);
+    module->num_spans = 0;
+    size_t offset = 0;
+    for(int index = 0; index < module->num_parameters; index++){
+        variable_t* parameter = module->parameters[index];
+        size_t size = parameter->tensor->shape->size;
+        move_into_bucket(parameter->tensor, module->data_bucket, offset);
+        move_into_bucket(parameter->gradient, module->gradient_bucket, offset);
+        module_span_t span = {parameter->tensor->data, parameter->gradient->data, offset, size};
+        append_span(module, span);
+        offset += size;
+    }
+    module->data_bucket->owns_data = false;
+    module->gradient_bucket->owns_data = false;
+    NDEBUG_ASSERT(module->num_spans <= 1, "Flat module should be a single span.\n");
+}
+
+bool module_is_flat(module_t* module){
+    return module->data_bucket != NULL;
+}
+
+tensor_t* module_get_data_bucket(module_t* module){
+    return module->data_bucket;
+}
+
+tensor_t* module_get_gradient_bucket(module_t* module){
+    return module->gradient_bucket;
+}
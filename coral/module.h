@@ -0,0 +1,67 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "variable.h"
+
+/**
+ * parameter registry
+ * a module holds the named parameters (leaf variables) of a model, and the spans of contiguous entries
+ * they are laid out in: the parameters are numbered entry after entry, in the order they were added,
+ * so that anything which walks every parameter (zeroing gradients, optimizer steps, see optim.h) does so
+ * as one parallel loop over the total number of entries rather than one op per parameter
+ *
+ *     module_t* model = module_new();
+ *     module_add_parameter(model, "weight", weight); module_add_parameter(model, "bias", bias);
+ *
+ * parameters are contiguous float32 variables which keep their tensor and gradient buffers while registered
+ *
+ * FLAT PARAMETERS
+ * module_flatten moves the entries of every parameter, and of its gradient, into a single contiguous bucket in
+ * the order of the module, and points the parameter tensors into it (as views, see tensor_view_as_shape),
+ * so that the module is a single span: zeroing its gradients is one memset, an optimizer step one flat loop,
+ * and the buckets can be written or reduced across processes in one go
+ * flatten once every parameter has been added, and before building graphs from (or taking views of) the parameters
+*/
+
+typedef struct module module_t;
+
+// entries [offset, offset + size) of the module, laid out at data and gradient
+typedef struct {
+    tensor_entry_t* data;
+    tensor_entry_t* gradient;
+    size_t offset;
+    size_t size;
+} module_span_t;
+
+// processes entries [begin, end) of span, relative to its start
+typedef void (* module_range_fn_t)(void* context, const module_span_t* span, size_t begin, size_t end);
+
+module_t* module_new(void);
+// the variables are left alone, the names are copied
+void module_free(module_t* module);
+void module_add_parameter(module_t* module, const char* name, variable_t* parameter);
+int module_get_num_parameters(module_t* module);
+variable_t* module_get_parameter(module_t* module, int index);
+const char* module_get_parameter_name(module_t* module, int index);
+// NULL when there is no parameter called name
+variable_t* module_find_parameter(module_t* module, const char* name);
+// entries of all parameters
+size_t module_get_num_entries(module_t* module);
+int module_get_num_spans(module_t* module);
+
+// calls range_fn on every entry of the module, in parallel chunks which may cross from span to span
+void module_parallel_for(module_t* module, module_range_fn_t range_fn, void* context);
+void module_zero_grad(module_t* module);
+
+// points parameter index at size entries at data, which it does not own, releasing its own buffer
+// (e.g. to load it from a file mapping, see weights.h), the module must not be flat
+void module_set_parameter_data(module_t* module, int index, tensor_entry_t* data);
+
+// outside of the graph arena, may only be called once
+void module_flatten(module_t* module);
+bool module_is_flat(module_t* module);
+// 1 dimensional tensors of every entry of the module (and of its gradient), NULL unless it is flat
+tensor_t* module_get_data_bucket(module_t* module);
+tensor_t* module_get_gradient_bucket(module_t* module);
+
+#endif // MODULE_H
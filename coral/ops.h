@@ -0,0 +1,40 @@
+#ifndef OPS_H
+#define OPS_H
+
+#include <math.h>
+#include "utils.h"
+
+/**
+ * ELEMENTWISE OP TABLES
+ * every elementwise op is registered once here, and both the tensor kernels (tensor.c) and the fused
+ * instructions (fused.c) are generated from these tables, so each op gets dedicated loops with its entry
+ * expression inlined into them rather than a call through a function pointer per entry
+ * registering an op gives it tensor_<name>, tensor_in_place_<name> and fused_<name>
+ *
+ * X(name, TAG, entry_expression) for unary ops, with the entry in x
+ * X(name, TAG, simd_fn, entry_expression, check_nonzero_right) for binary ops, with the entries in x and y,
+ * where simd_fn (see simd.h) computes the entry expression a vector at a time
+ * entry expressions are type generic, as they are also instantiated with float64 entries, so the files which
+ * instantiate the tables include tgmath.h themselves (rather than this header leaking it to every file)
+*/
+
+#define CORAL_UNARY_OPS(X)                          \
+    X(negate, NEGATE, -x)                           \
+    X(square, SQUARE, x * x)                        \
+    X(abs, ABS, x >= 0 ? x : -x)                    \
+    X(abs_grad, ABS_GRAD, x >= 0 ? 1 : -1)          \
+    X(relu, RELU, x > 0 ? x : 0)                    \
+    X(relu_grad, RELU_GRAD, x > 0 ? 1 : 0)          \
+    X(exp, EXP, exp(x))                             \
+    X(log, LOG, log(x))                             \
+    X(tanh, TANH, tanh(x))                          \
+    X(tanh_grad, TANH_GRAD, 1 - x * x) /* of the output of tanh */
+
+#define CORAL_BINARY_OPS(X)                                     \
+    X(add, ADD, simd_add, x + y, false)                         \
+    X(subtract, SUBTRACT, simd_subtract, x - y, false)          \
+    X(multiply, MULTIPLY, simd_multiply, x * y, false)          \
+    X(divide, DIVIDE, simd_divide, x / y, true)                 \
+    X(max, MAX, simd_max, MAX(x, y), false)
+
+#endif // OPS_H
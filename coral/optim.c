@@ -0,0 +1,169 @@
+#include "optim.h"
+#include "pool.h"
+#include "profile.h"
+#include "simd.h"
+#include "assert.h"
+#include <math.h>
+#include <stdlib.h>
+
+typedef enum {
+    OPTIMIZER_SGD,
+    OPTIMIZER_ADAM,
+} optimizer_kind_t;
+
+#define OPTIMIZER_MAX_STATES 2
+
+struct optimizer {
+    optimizer_kind_t kind;
+    module_t* module;
+    size_t num_entries; // of the module when the optimizer was created
+    int num_states;
+    tensor_entry_t* states[OPTIMIZER_MAX_STATES]; // num_entries each, sgd: momentum, adam: first and second moments
+    tensor_entry_t learning_rate;
+    tensor_entry_t momentum; // sgd
+    tensor_entry_t beta1, beta2, epsilon; // adam
+    size_t num_steps;
+};
+
+static optimizer_t* optimizer_new(optimizer_kind_t kind, module_t* module, tensor_entry_t learning_rate, int num_states){
+    optimizer_t* new_optimizer = (optimizer_t*) calloc(1, sizeof(optimizer_t));
+    NDEBUG_ASSERT(new_optimizer != NULL, "Failed to allocate optimizer.\n");
+    new_optimizer->kind = kind;
+    new_optimizer->module = module;
+    new_optimizer->num_entries = module_get_num_entries(module);
+    new_optimizer->learning_rate = learning_rate;
+    new_optimizer->num_states = num_states;
+    for(int state = 0; state < num_states; state++){
+        new_optimizer->states[state] = (tensor_entry_t*) pool_calloc(new_optimizer->num_entries, sizeof(tensor_entry_t));
+    }
+    return new_optimizer;
+}
+
+optimizer_t* optimizer_new_sgd(module_t* module, tensor_entry_t learning_rate, tensor_entry_t momentum){
+    optimizer_t* new_optimizer = optimizer_new(OPTIMIZER_SGD, module, learning_rate, momentum != 0 ? 1 : 0);
+    new_optimizer->momentum = momentum;
+    return new_optimizer;
+}
+
+optimizer_t* optimizer_new_adam(module_t* module, tensor_entry_t learning_rate, tensor_entry_t beta1, tensor_entry_t beta2, tensor_entry_t epsilon){
+    NDEBUG_ASSERT(0 <= beta1 && beta1 < 1 && 0 <= beta2 && beta2 < 1, "Adam rates must lie in [0, 1)!\n");
+    optimizer_t* new_optimizer = optimizer_new(OPTIMIZER_ADAM, module, learning_rate, 2);
+    new_optimizer->beta1 = beta1;
+    new_optimizer->beta2 = beta2;
+    new_optimizer->epsilon = epsilon;
+    return new_optimizer;
+}
+
+void optimizer_free(optimizer_t* optimizer){
+    for(int state = 0; state < optimizer->num_states; state++){
+        pool_free(optimizer->states[state], optimizer->num_entries * sizeof(tensor_entry_t));
+    }
+    free(optimizer);
+}
+
+void optimizer_set_learning_rate(optimizer_t* optimizer, tensor_entry_t learning_rate){
+    optimizer->learning_rate = learning_rate;
+}
+
+size_t optimizer_get_num_steps(optimizer_t* optimizer){
+    return optimizer->num_steps;
+}
+
+/**
+ * KERNELS
+ * over entries [begin, end) of a span, whose state starts at its offset into the state buffers
+*/
+
+typedef struct {
+    optimizer_t* optimizer;
+    tensor_entry_t step_size; // adam: learning_rate / (1 - beta1^t)
+    tensor_entry_t second_moment_scale; // adam: 1 / (1 - beta2^t)
+} step_context_t;
+
+static void sgd_range(void* raw_context, const module_span_t* span, size_t begin, size_t end){
+    optimizer_t* optimizer = ((step_context_t*) raw_context)->optimizer;
+    tensor_entry_t* data = span->data + begin;
+    const tensor_entry_t* gradient = span->gradient + begin;
+    size_t size = end - begin;
+    simd_vec_t negative_learning_rate = simd_set1(-optimizer->learning_rate);
+    size_t index = 0;
+    for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){
+        simd_store(data + index, simd_fmadd(simd_load(gradient + index), negative_learning_rate, simd_load(data + index)));
+    }
+    for(; index < size; index++){
+        data[index] -= optimizer->learning_rate * gradient[index];
+    }
+}
+
+static void sgd_momentum_range(void* raw_context, const module_span_t* span, size_t begin, size_t end){
+    optimizer_t* optimizer = ((step_context_t*) raw_context)->optimizer;
+    tensor_entry_t* data = span->data + begin;
+    const tensor_entry_t* gradient = span->gradient + begin;
+    tensor_entry_t* velocity = optimizer->states[0] + span->offset + begin;
+    size_t size = end - begin;
+    simd_vec_t momentum = simd_set1(optimizer->momentum);
+    simd_vec_t negative_learning_rate = simd_set1(-optimizer->learning_rate);
+    size_t index = 0;
+    for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){
+        simd_vec_t new_velocity = simd_fmadd(simd_load(velocity + index), momentum, simd_load(gradient + index));
+        simd_store(velocity + index, new_velocity);
+        simd_store(data + index, simd_fmadd(new_velocity, negative_learning_rate, simd_load(data + index)));
+    }
+    for(; index < size; index++){
+        velocity[index] = optimizer->momentum * velocity[index] + gradient[index];
+        data[index] -= optimizer->learning_rate * velocity[index];
+    }
+}
+
+static void adam_range(void* raw_context, const module_span_t* span, size_t begin, size_t end){
+    step_context_t* context = (step_context_t*) raw_context;
+    optimizer_t* optimizer = context->optimizer;
+    tensor_entry_t* data = span->data + begin;
+    const tensor_entry_t* gradient = span->gradient + begin;
+    tensor_entry_t* first_moment = optimizer->states[0] + span->offset + begin;
+    tensor_entry_t* second_moment = optimizer->states[1] + span->offset + begin;
+    size_t size = end - begin;
+    tensor_entry_t beta1 = optimizer->beta1;
+    tensor_entry_t beta2 = optimizer->beta2;
+    simd_vec_t beta1_vec = simd_set1(beta1);
+    simd_vec_t beta2_vec = simd_set1(beta2);
+    simd_vec_t one_minus_beta1 = simd_set1(1 - beta1);
+    simd_vec_t one_minus_beta2 = simd_set1(1 - beta2);
+    simd_vec_t negative_step_size = simd_set1(-context->step_size);
+    simd_vec_t second_moment_scale = simd_set1(context->second_moment_scale);
+    simd_vec_t epsilon = simd_set1(optimizer->epsilon);
+    size_t index = 0;
+    for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){
+        simd_vec_t gradient_vec = simd_load(gradient + index);
+        simd_vec_t new_first_moment = simd_fmadd(simd_load(first_moment + index), beta1_vec, simd_multiply(gradient_vec, one_minus_beta1));
+        simd_vec_t new_second_moment = simd_fmadd(simd_load(second_moment + index), beta2_vec, simd_multiply(simd_multiply(gradient_vec, gradient_vec), one_minus_beta2));
+        simd_store(first_moment + index, new_first_moment);
+        simd_store(second_moment + index, new_second_moment);
+        simd_vec_t denominator = simd_add(simd_sqrt(simd_multiply(new_second_moment, second_moment_scale)), epsilon);
+        simd_store(data + index, simd_fmadd(simd_divide(new_first_moment, denominator), negative_step_size, simd_load(data + index)));
+    }
+    for(; index < size; index++){
+        tensor_entry_t entry_gradient = gradient[index];
+        first_moment[index] = beta1 * first_moment[index] + (1 - beta1) * entry_gradient;
+        second_moment[index] = beta2 * second_moment[index] + (1 - beta2) * entry_gradient * entry_gradient;
+        data[index] -= context->step_size * first_moment[index] / (sqrtf(second_moment[index] * context->second_moment_scale) + optimizer->epsilon);
+    }
+}
+
+void optimizer_step(optimizer_t* optimizer){
+    NDEBUG_ASSERT(module_get_num_entries(optimizer->module) == optimizer->num_entries, "Parameters were added to the module after the optimizer was created!\n");
+    optimizer->num_steps++;
+    step_context_t context = {optimizer, 0, 0};
+    module_range_fn_t range_fn = NULL;
+    // parameters and gradients, plus the states, which are read and written
+    PROFILE_SCOPE("optimizer", optimizer->kind == OPTIMIZER_ADAM ? "adam" : "sgd", (3 + 2 * optimizer->num_states) * optimizer->num_entries * sizeof(tensor_entry_t));
+    if(optimizer->kind == OPTIMIZER_SGD){
+        range_fn = optimizer->num_states > 0 ? &sgd_momentum_range : &sgd_range;
+    }else{
+        double num_steps = (double) optimizer->num_steps;
+        context.step_size = optimizer->learning_rate / (1 - pow(optimizer->beta1, num_steps));
+        context.second_moment_scale = 1 / (1 - pow(optimizer->beta2, num_steps));
+        range_fn = &adam_range;
+    }
+    module_parallel_for(optimizer->module, range_fn, &context);
+}
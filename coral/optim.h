@@ -0,0 +1,33 @@
+#ifndef OPTIM_H
+#define OPTIM_H
+
+#include "module.h"
+
+/**
+ * optimizers
+ * update the parameters of a module in place from their gradients, each step is a single fused pass
+ * over every entry of the module (see module_parallel_for), reading the parameter, its gradient and its
+ * state, and writing the parameter and its state
+ * the state (momentum, or the Adam moments) of all parameters is kept in one zero initialized buffer per
+ * kind, laid out in the order of the entries of the module
+ *
+ *     optimizer_t* optimizer = optimizer_new_adam(model, 1e-3, 0.9, 0.999, 1e-8);
+ *     for(...){ module_zero_grad(model); backwards(forward(...)); optimizer_step(optimizer); }
+ *
+ * parameters must all have been added to the module before the optimizer is created
+*/
+
+typedef struct optimizer optimizer_t;
+
+// p <- p - learning_rate * v, with v <- momentum * v + g (v = g when momentum is 0, and no state is kept)
+optimizer_t* optimizer_new_sgd(module_t* module, tensor_entry_t learning_rate, tensor_entry_t momentum);
+// p <- p - learning_rate * m_hat / (sqrt(v_hat) + epsilon), where m and v are running averages of g and g^2 (with
+// rates beta1 and beta2), and m_hat and v_hat correct them for starting at zero
+optimizer_t* optimizer_new_adam(module_t* module, tensor_entry_t learning_rate, tensor_entry_t beta1, tensor_entry_t beta2, tensor_entry_t epsilon);
+void optimizer_free(optimizer_t* optimizer);
+void optimizer_step(optimizer_t* optimizer);
+void optimizer_set_learning_rate(optimizer_t* optimizer, tensor_entry_t learning_rate);
+// steps taken so far
+size_t optimizer_get_num_steps(optimizer_t* optimizer);
+
+#endif // OPTIM_H
@@ -0,0 +1,293 @@
+#include "parallel.h"
+#include "assert.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    parallel_range_fn_t range_fn;
+    void* context;
+    size_t count;
+    size_t grain_size;
+    size_t next_index; // updated atomically
+    int num_pending_workers; // guarded by pool_mutex
+} parallel_job_t;
+
+// held by the thread which owns the pool for the duration of a job (or a resize)
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+
+static pthread_t workers[PARALLEL_MAX_THREADS];
+static int num_workers = 0;
+static int num_threads = 0; // 0 until the pool is initialized
+static unsigned long job_generation = 0;
+static parallel_job_t* current_job = NULL;
+static bool shutting_down = false;
+
+static __thread bool in_parallel_region = false;
+
+// large enough that a chunk amortizes waking a worker, small enough to split a few MB across the pool
+static size_t grain_sizes[PARALLEL_NUM_OPS] = {
+    [PARALLEL_OP_ELEMENTWISE] = 1 << 16,
+    [PARALLEL_OP_BROADCAST] = 1 << 15,
+    [PARALLEL_OP_APPLY] = 1 << 13,
+    [PARALLEL_OP_REDUCTION] = 1 << 16,
+};
+
+size_t parallel_get_grain_size(parallel_op_t op){
+    NDEBUG_ASSERT(op < PARALLEL_NUM_OPS, "Unknown parallel op.\n");
+    return __atomic_load_n(&grain_sizes[op], __ATOMIC_RELAXED);
+}
+
+void parallel_set_grain_size(parallel_op_t op, size_t grain_size){
+    NDEBUG_ASSERT(op < PARALLEL_NUM_OPS, "Unknown parallel op.\n");
+    NDEBUG_ASSERT(grain_size >= 1, "Grain size must be positive.\n");
+    __atomic_store_n(&grain_sizes[op], grain_size, __ATOMIC_RELAXED);
+}
+
+static void run_chunks(parallel_job_t* job){
+    for(;;){
+        size_t begin = __atomic_fetch_add(&job->next_index, job->grain_size, __ATOMIC_RELAXED);
+        if(begin >= job->count){
+            return;
+        }
+        size_t end = (begin + job->grain_size < job->count) ? begin + job->grain_size : job->count;
+        (*job->range_fn)(job->context, begin, end);
+    }
+}
+
+static void* worker_main(void* arg){
+    unsigned long seen_generation = (unsigned long) (uintptr_t) arg;
+    in_parallel_region = true;
+    pthread_mutex_lock(&pool_mutex);
+    for(;;){
+        while(job_generation == seen_generation && !shutting_down){
+            pthread_cond_wait(&pool_wake, &pool_mutex);
+        }
+        if(shutting_down){
+            break;
+        }
+        seen_generation = job_generation;
+        parallel_job_t* job = current_job;
+        pthread_mutex_unlock(&pool_mutex);
+        run_chunks(job);
+        pthread_mutex_lock(&pool_mutex);
+        if(--job->num_pending_workers == 0){
+            pthread_cond_signal(&pool_done);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+static int default_num_threads(void){
+    char* env_threads = getenv("CORAL_NUM_THREADS");
+    long requested = env_threads ? atol(env_threads) : sysconf(_SC_NPROCESSORS_ONLN);
+    return (requested >= 1) ? (int) requested : 1;
+}
+
+// must be called with job_mutex held
+static void resize_pool(int new_num_threads){
+    pthread_mutex_lock(&pool_mutex);
+    shutting_down = true;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_mutex);
+    for(int index = 0; index < num_workers; index++){
+        pthread_join(workers[index], NULL);
+    }
+    shutting_down = false;
+    num_workers = 0;
+    num_threads = (new_num_threads > PARALLEL_MAX_THREADS) ? PARALLEL_MAX_THREADS : new_num_threads;
+    for(int index = 0; index < num_threads - 1; index++){
+        int error = pthread_create(&workers[index], NULL, &worker_main, (void*) (uintptr_t) job_generation);
+        NDEBUG_ASSERT(error == 0, "Failed to spawn worker thread.\n");
+        num_workers++;
+    }
+}
+
+int parallel_get_num_threads(void){
+    if(num_threads == 0){
+        pthread_mutex_lock(&job_mutex);
+        if(num_threads == 0){
+            resize_pool(default_num_threads());
+        }
+        pthread_mutex_unlock(&job_mutex);
+    }
+    return num_threads;
+}
+
+void parallel_set_num_threads(int new_num_threads){
+    NDEBUG_ASSERT(new_num_threads >= 1, "Number of threads must be positive.\n");
+    NDEBUG_ASSERT(!in_parallel_region, "Cannot resize the thread pool from inside a parallel region.\n");
+    pthread_mutex_lock(&job_mutex);
+    if(new_num_threads != num_threads){
+        resize_pool(new_num_threads);
+    }
+    pthread_mutex_unlock(&job_mutex);
+}
+
+bool parallel_in_worker(void){
+    return in_parallel_region;
+}
+
+void parallel_for(size_t count, size_t grain_size, parallel_range_fn_t range_fn, void* context){
+    if(count == 0){
+        return;
+    }
+    if(grain_size == 0){
+        grain_size = 1;
+    }
+    // nested regions, single chunks and concurrent callers run serially on the calling thread
+    if(count <= grain_size || in_parallel_region || parallel_get_num_threads() == 1 || pthread_mutex_trylock(&job_mutex) != 0){
+        (*range_fn)(context, 0, count);
+        return;
+    }
+    parallel_job_t job = {range_fn, context, count, grain_size, 0, num_workers};
+    pthread_mutex_lock(&pool_mutex);
+    current_job = &job;
+    job_generation++;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_mutex);
+
+    in_parallel_region = true;
+    run_chunks(&job);
+    in_parallel_region = false;
+
+    pthread_mutex_lock(&pool_mutex);
+    while(job.num_pending_workers > 0){
+        pthread_cond_wait(&pool_done, &pool_mutex);
+    }
+    current_job = NULL;
+    pthread_mutex_unlock(&pool_mutex);
+    pthread_mutex_unlock(&job_mutex);
+}
+
+/**
+ * TASK GRAPHS
+*/
+
+typedef struct {
+    pthread_mutex_t mutex;
+    size_t* tasks; // ready tasks are tasks[head, tail)
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} task_deque_t;
+
+typedef struct task_graph task_graph_t;
+
+struct parallel_task_queue {
+    task_graph_t* graph;
+    int slot;
+};
+
+struct task_graph {
+    parallel_task_fn_t task_fn;
+    void* context;
+    int num_slots;
+    task_deque_t* deques;
+    parallel_task_queue_t* queues;
+    size_t num_outstanding; // pushed but not yet finished, updated atomically
+};
+
+static void deque_push(task_deque_t* deque, size_t task){
+    pthread_mutex_lock(&deque->mutex);
+    if(deque->tail == deque->capacity){
+        if(deque->head > 0){
+            memmove(deque->tasks, deque->tasks + deque->head, (deque->tail - deque->head) * sizeof(size_t));
+            deque->tail -= deque->head;
+            deque->head = 0;
+        }else{
+            deque->capacity = deque->capacity ? 2 * deque->capacity : 64;
+            deque->tasks = (size_t*) realloc(deque->tasks, deque->capacity * sizeof(size_t));
+            NDEBUG_ASSERT(deque->tasks != NULL, "Failed to allocate task deque.\n");
+        }
+    }
+    deque->tasks[deque->tail++] = task;
+    pthread_mutex_unlock(&deque->mutex);
+}
+
+// the owner takes the most recently pushed task (whose inputs are likely still in cache)
+static bool deque_pop_back(task_deque_t* deque, size_t* task){
+    pthread_mutex_lock(&deque->mutex);
+    bool found = deque->tail > deque->head;
+    if(found){
+        *task = deque->tasks[--deque->tail];
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+// thieves take the oldest task
+static bool deque_steal_front(task_deque_t* deque, size_t* task){
+    pthread_mutex_lock(&deque->mutex);
+    bool found = deque->tail > deque->head;
+    if(found){
+        *task = deque->tasks[deque->head++];
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+void parallel_task_queue_push(parallel_task_queue_t* queue, size_t task){
+    __atomic_add_fetch(&queue->graph->num_outstanding, 1, __ATOMIC_RELAXED);
+    deque_push(&queue->graph->deques[queue->slot], task);
+}
+
+static bool find_task(task_graph_t* graph, int slot, size_t* task){
+    if(deque_pop_back(&graph->deques[slot], task)){
+        return true;
+    }
+    for(int offset = 1; offset < graph->num_slots; offset++){
+        if(deque_steal_front(&graph->deques[(slot + offset) % graph->num_slots], task)){
+            return true;
+        }
+    }
+    return false;
+}
+
+// each slot is served by one thread until every task has finished
+// (a thread which picks up a second slot finds nothing left to do)
+static void run_task_slots(void* raw_graph, size_t begin, size_t end){
+    task_graph_t* graph = (task_graph_t*) raw_graph;
+    for(size_t slot = begin; slot < end; slot++){
+        for(;;){
+            size_t task;
+            if(find_task(graph, (int) slot, &task)){
+                (*graph->task_fn)(graph->context, task, &graph->queues[slot]);
+                __atomic_sub_fetch(&graph->num_outstanding, 1, __ATOMIC_ACQ_REL);
+            }else if(__atomic_load_n(&graph->num_outstanding, __ATOMIC_ACQUIRE) == 0){
+                break;
+            }else{
+                sched_yield();
+            }
+        }
+    }
+}
+
+void parallel_run_tasks(size_t num_tasks, const size_t* tasks, parallel_task_fn_t task_fn, void* context){
+    int num_slots = in_parallel_region ? 1 : parallel_get_num_threads();
+    task_graph_t graph = {task_fn, context, num_slots, NULL, NULL, num_tasks};
+    graph.deques = (task_deque_t*) calloc(num_slots, sizeof(task_deque_t));
+    graph.queues = (parallel_task_queue_t*) malloc(num_slots * sizeof(parallel_task_queue_t));
+    for(int slot = 0; slot < num_slots; slot++){
+        pthread_mutex_init(&graph.deques[slot].mutex, NULL);
+        graph.queues[slot].graph = &graph;
+        graph.queues[slot].slot = slot;
+    }
+    for(size_t index = 0; index < num_tasks; index++){
+        deque_push(&graph.deques[index % num_slots], tasks[index]);
+    }
+    parallel_for(num_slots, 1, &run_task_slots, &graph);
+    for(int slot = 0; slot < num_slots; slot++){
+        pthread_mutex_destroy(&graph.deques[slot].mutex);
+        free(graph.deques[slot].tasks);
+    }
+    free(graph.deques);
+    free(graph.queues);
+}
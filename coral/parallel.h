@@ -0,0 +1,51 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// upper bound on the size of the worker pool
+#define PARALLEL_MAX_THREADS 64
+
+// processes iterations [begin, end) of a parallel loop
+typedef void (* parallel_range_fn_t)(void* context, size_t begin, size_t end);
+
+/**
+ * kinds of tensor kernel with a tunable grain size: the number of entries (or, for apply, function calls)
+ * given to a thread at a time, kernels over fewer entries than their grain size run serially
+*/
+typedef enum {
+    PARALLEL_OP_ELEMENTWISE, // set, scale, contiguous and scalar broadcasts
+    PARALLEL_OP_BROADCAST, // strided broadcasts
+    PARALLEL_OP_APPLY, // entry and index functions
+    PARALLEL_OP_REDUCTION, // sums, also fixes the blocks whose partial sums are combined, so results do not depend on the number of threads
+    PARALLEL_NUM_OPS
+} parallel_op_t;
+
+size_t parallel_get_grain_size(parallel_op_t op);
+void parallel_set_grain_size(parallel_op_t op, size_t grain_size);
+
+int parallel_get_num_threads(void);
+void parallel_set_num_threads(int num_threads);
+bool parallel_in_worker(void);
+
+/**
+ * splits [0, count) into chunks of (at most) grain_size iterations and runs them on a
+ * persistent pool of worker threads, the calling thread also participates
+ * runs serially when called from inside another parallel region
+*/
+void parallel_for(size_t count, size_t grain_size, parallel_range_fn_t range_fn, void* context);
+
+/**
+ * runs a dynamic set of tasks (identified by integers) on the worker pool
+ * each thread owns a deque of ready tasks, taking from its back and stealing from the front of the others
+ * a task may make further tasks ready with parallel_task_queue_push, parallel_run_tasks returns once
+ * every task has run
+*/
+typedef struct parallel_task_queue parallel_task_queue_t;
+typedef void (* parallel_task_fn_t)(void* context, size_t task, parallel_task_queue_t* queue);
+
+void parallel_run_tasks(size_t num_tasks, const size_t* tasks, parallel_task_fn_t task_fn, void* context);
+void parallel_task_queue_push(parallel_task_queue_t* queue, size_t task);
+
+#endif // PARALLEL_H
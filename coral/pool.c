@@ -0,0 +1,184 @@
+#include "pool.h"
+#include "assert.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// classes 2^6 ... 2^(6 + POOL_NUM_CLASSES - 1) bytes
+#define POOL_NUM_CLASSES 42
+
+typedef struct free_buffer free_buffer_t;
+
+// free buffers are chained through their first bytes
+struct free_buffer {
+    free_buffer_t* next;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static free_buffer_t* free_lists[POOL_NUM_CLASSES];
+static size_t bytes_cached = 0;
+static size_t bytes_in_use = 0;
+
+/**
+ * DEFAULT ALLOCATOR
+*/
+
+static bool huge_pages = true;
+
+static void* default_alloc(size_t size, bool zeroed, void* context){
+    UNUSED(context);
+    if(size < POOL_HUGE_PAGE_THRESHOLD){
+        void* buffer = NULL;
+        int error = posix_memalign(&buffer, POOL_ALIGNMENT, size);
+        NDEBUG_ASSERT(error == 0, "Pool out of memory!\n");
+        if(zeroed){
+            memset(buffer, 0, size);
+        }
+        return buffer;
+    }
+    // over-allocate by a huge page and unmap the slack around the aligned range, so that every huge page
+    // of the buffer can be backed by one
+    size_t mapped_size = size + POOL_HUGE_PAGE_THRESHOLD;
+    char* mapping = (char*) mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    NDEBUG_ASSERT(mapping != MAP_FAILED, "Pool out of memory!\n");
+    char* buffer = (char*) (((uintptr_t) mapping + POOL_HUGE_PAGE_THRESHOLD - 1) & ~(uintptr_t) (POOL_HUGE_PAGE_THRESHOLD - 1));
+    if(buffer > mapping){
+        munmap(mapping, buffer - mapping);
+    }
+    if(buffer + size < mapping + mapped_size){
+        munmap(buffer + size, mapping + mapped_size - (buffer + size));
+    }
+#ifdef MADV_HUGEPAGE
+    if(__atomic_load_n(&huge_pages, __ATOMIC_RELAXED)){
+        madvise(buffer, size, MADV_HUGEPAGE);
+    }
+#endif
+    return buffer;
+}
+
+static void default_free(void* ptr, size_t size, void* context){
+    UNUSED(context);
+    if(size < POOL_HUGE_PAGE_THRESHOLD){
+        free(ptr);
+    }else{
+        munmap(ptr, size);
+    }
+}
+
+static const pool_allocator_t default_allocator = {&default_alloc, &default_free, NULL};
+static pool_allocator_t allocator = {&default_alloc, &default_free, NULL};
+
+void pool_set_huge_pages(bool enabled){
+    __atomic_store_n(&huge_pages, enabled, __ATOMIC_RELAXED);
+}
+
+static inline int size_class(size_t size){
+    int class_index = 0;
+    size_t class_size = POOL_MIN_BUFFER_SIZE;
+    while(class_size < size){
+        class_size <<= 1;
+        class_index++;
+    }
+    NDEBUG_ASSERT(class_index < POOL_NUM_CLASSES, "Buffer is too large for the pool!\n");
+    return class_index;
+}
+
+static inline size_t class_size(int class_index){
+    return ((size_t) POOL_MIN_BUFFER_SIZE) << class_index;
+}
+
+// returns a (possibly dirty) buffer of the class, and whether it was reused
+static void* take_buffer(int class_index, int* reused){
+    pthread_mutex_lock(&pool_mutex);
+    free_buffer_t* buffer = free_lists[class_index];
+    if(buffer){
+        free_lists[class_index] = buffer->next;
+        bytes_cached -= class_size(class_index);
+    }
+    bytes_in_use += class_size(class_index);
+    pthread_mutex_unlock(&pool_mutex);
+    *reused = (buffer != NULL);
+    return buffer;
+}
+
+void* pool_alloc(size_t size){
+    int class_index = size_class(size);
+    int reused;
+    void* buffer = take_buffer(class_index, &reused);
+    if(!reused){
+        buffer = (*allocator.alloc)(class_size(class_index), false, allocator.context);
+        NDEBUG_ASSERT(buffer != NULL, "Pool out of memory!\n");
+    }
+    return buffer;
+}
+
+void* pool_calloc(size_t count, size_t size){
+    int class_index = size_class(count * size);
+    int reused;
+    void* buffer = take_buffer(class_index, &reused);
+    if(reused){
+        memset(buffer, 0, count * size);
+    }else{
+        buffer = (*allocator.alloc)(class_size(class_index), true, allocator.context);
+        NDEBUG_ASSERT(buffer != NULL, "Pool out of memory!\n");
+    }
+    return buffer;
+}
+
+void pool_free(void* ptr, size_t size){
+    if(!ptr){
+        return;
+    }
+    int class_index = size_class(size);
+    free_buffer_t* buffer = (free_buffer_t*) ptr;
+    pthread_mutex_lock(&pool_mutex);
+    buffer->next = free_lists[class_index];
+    free_lists[class_index] = buffer;
+    bytes_cached += class_size(class_index);
+    bytes_in_use -= class_size(class_index);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+static void trim_locked(void){
+    for(int class_index = 0; class_index < POOL_NUM_CLASSES; class_index++){
+        free_buffer_t* buffer = free_lists[class_index];
+        while(buffer){
+            free_buffer_t* next = buffer->next;
+            (*allocator.free)(buffer, class_size(class_index), allocator.context);
+            buffer = next;
+        }
+        free_lists[class_index] = NULL;
+    }
+    bytes_cached = 0;
+}
+
+void pool_trim(void){
+    pthread_mutex_lock(&pool_mutex);
+    trim_locked();
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void pool_set_allocator(const pool_allocator_t* new_allocator){
+    pthread_mutex_lock(&pool_mutex);
+    NDEBUG_ASSERT(bytes_in_use == 0, "Cannot replace the allocator of buffers in use!\n");
+    trim_locked();
+    allocator = new_allocator ? *new_allocator : default_allocator;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+size_t pool_get_bytes_cached(void){
+    pthread_mutex_lock(&pool_mutex);
+    size_t bytes = bytes_cached;
+    pthread_mutex_unlock(&pool_mutex);
+    return bytes;
+}
+
+size_t pool_get_bytes_in_use(void){
+    pthread_mutex_lock(&pool_mutex);
+    size_t bytes = bytes_in_use;
+    pthread_mutex_unlock(&pool_mutex);
+    return bytes;
+}
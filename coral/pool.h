@@ -0,0 +1,53 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * size-class buffer pool for tensor data
+ * requests are rounded up to a power of two (at least POOL_MIN_BUFFER_SIZE bytes), and freed buffers
+ * are kept on a free list per size class so that the next request of that class reuses them
+ * instead of going back to calloc
+*/
+
+#define POOL_MIN_BUFFER_SIZE 64
+
+// every buffer is aligned to (at least) a cache line, which also covers the widest vector loads
+#define POOL_ALIGNMENT 64
+
+// contents are undefined
+void* pool_alloc(size_t size);
+void* pool_calloc(size_t count, size_t size);
+// size must be the size the buffer was requested with
+void pool_free(void* ptr, size_t size);
+// returns every cached buffer to the system
+void pool_trim(void);
+
+/**
+ * STORAGE ALLOCATORS
+ * the pool takes the buffers it has no free one for from a pluggable allocator, and gives them back on pool_trim
+ * sizes are those of size classes, and buffers must be aligned to POOL_ALIGNMENT
+ * the default allocator serves buffers of at least POOL_HUGE_PAGE_THRESHOLD bytes straight from mmap,
+ * aligned to and advised for transparent huge pages (see pool_set_huge_pages), and smaller ones from posix_memalign
+*/
+
+#define POOL_HUGE_PAGE_THRESHOLD ((size_t) 2 << 20)
+
+typedef struct {
+    // zeroed requests must come back filled with zeros, which fresh mmap'd pages already are
+    void* (* alloc)(size_t size, bool zeroed, void* context);
+    void (* free)(void* ptr, size_t size, void* context);
+    void* context;
+} pool_allocator_t;
+
+// NULL restores the default allocator
+// the cached buffers are trimmed first, and no buffer may be in use, as it would be freed by the wrong allocator
+void pool_set_allocator(const pool_allocator_t* allocator);
+// whether the default allocator advises large buffers for transparent huge pages (on by default, where supported)
+void pool_set_huge_pages(bool enabled);
+
+size_t pool_get_bytes_cached(void);
+size_t pool_get_bytes_in_use(void);
+
+#endif // POOL_H
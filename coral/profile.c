@@ -0,0 +1,216 @@
+#include "profile.h"
+#include "assert.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// distinct (category, name) pairs in the summary
+#define PROFILE_MAX_OPS 256
+// events kept for the trace, later ones are still summarized
+#define PROFILE_MAX_EVENTS ((size_t) 1 << 20)
+
+typedef struct {
+    const char* category;
+    const char* name;
+    profile_op_stats_t stats;
+} op_entry_t;
+
+typedef struct {
+    int op_index;
+    int thread_id;
+    double start_ns;
+    double duration_ns;
+    size_t bytes_allocated;
+    size_t bytes_touched;
+} profile_event_t;
+
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static op_entry_t ops[PROFILE_MAX_OPS];
+static int num_ops = 0;
+static profile_event_t* events = NULL;
+static size_t num_events = 0;
+static size_t num_dropped_events = 0;
+static double epoch_ns = 0;
+static bool enabled = true;
+
+#ifdef CORAL_PROFILE
+
+static size_t events_capacity = 0;
+static int num_threads = 0;
+static __thread int thread_id = -1;
+static __thread profile_scope_t* current_scope = NULL;
+static __thread size_t thread_bytes_allocated = 0;
+
+static double now_ns(void){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// must hold profile_mutex
+static int find_op_locked(const char* category, const char* name, bool insert){
+    for(int op_index = 0; op_index < num_ops; op_index++){
+        // names are mostly string literals, so compare pointers before contents
+        bool same_name = ops[op_index].name == name || strcmp(ops[op_index].name, name) == 0;
+        if(same_name && strcmp(ops[op_index].category, category) == 0){
+            return op_index;
+        }
+    }
+    if(!insert){
+        return -1;
+    }
+    NDEBUG_ASSERT(num_ops < PROFILE_MAX_OPS, "Too many profiled ops!\n");
+    op_entry_t* entry = &ops[num_ops];
+    entry->category = category;
+    entry->name = name;
+    memset(&entry->stats, 0, sizeof(entry->stats));
+    return num_ops++;
+}
+
+static void append_event_locked(profile_event_t event){
+    if(num_events == events_capacity){
+        if(events_capacity == PROFILE_MAX_EVENTS){
+            num_dropped_events++;
+            return;
+        }
+        events_capacity = events_capacity ? 2 * events_capacity : 1024;
+        events = (profile_event_t*) realloc(events, events_capacity * sizeof(profile_event_t));
+        NDEBUG_ASSERT(events != NULL, "Out of memory for profile events!\n");
+    }
+    events[num_events++] = event;
+}
+
+void profile_scope_begin(profile_scope_t* scope, const char* category, const char* name, size_t bytes_touched){
+    scope->category = category;
+    scope->name = name;
+    scope->child_ns = 0;
+    scope->bytes_touched = bytes_touched;
+    scope->bytes_allocated = thread_bytes_allocated;
+    scope->parent = current_scope;
+    current_scope = scope;
+    // after the bookkeeping, so that it is not charged to the op
+    scope->start_ns = now_ns();
+}
+
+void profile_scope_end(profile_scope_t* scope){
+    double end_ns = now_ns();
+    double duration_ns = end_ns - scope->start_ns;
+    current_scope = scope->parent;
+    if(current_scope){
+        current_scope->child_ns += duration_ns;
+    }
+    if(!__atomic_load_n(&enabled, __ATOMIC_RELAXED)){
+        return;
+    }
+    size_t bytes_allocated = thread_bytes_allocated - scope->bytes_allocated;
+    pthread_mutex_lock(&profile_mutex);
+    if(thread_id < 0){
+        thread_id = num_threads++;
+    }
+    int op_index = find_op_locked(scope->category, scope->name, true);
+    profile_op_stats_t* stats = &ops[op_index].stats;
+    stats->num_calls++;
+    stats->total_ns += duration_ns;
+    stats->self_ns += duration_ns - scope->child_ns;
+    stats->bytes_allocated += bytes_allocated;
+    stats->bytes_touched += scope->bytes_touched;
+    if(epoch_ns == 0){
+        epoch_ns = scope->start_ns;
+    }
+    profile_event_t event = {op_index, thread_id, scope->start_ns, duration_ns, bytes_allocated, scope->bytes_touched};
+    append_event_locked(event);
+    pthread_mutex_unlock(&profile_mutex);
+}
+
+void profile_record_allocation(size_t bytes){
+    thread_bytes_allocated += bytes;
+}
+
+#endif // CORAL_PROFILE
+
+void profile_set_enabled(bool value){
+    __atomic_store_n(&enabled, value, __ATOMIC_RELAXED);
+}
+
+void profile_reset(void){
+    pthread_mutex_lock(&profile_mutex);
+    num_ops = 0;
+    num_events = 0;
+    num_dropped_events = 0;
+    epoch_ns = 0;
+    pthread_mutex_unlock(&profile_mutex);
+}
+
+bool profile_get_op_stats(const char* category, const char* name, profile_op_stats_t* stats){
+    bool found = false;
+    pthread_mutex_lock(&profile_mutex);
+    for(int op_index = 0; op_index < num_ops; op_index++){
+        if(strcmp(ops[op_index].category, category) == 0 && strcmp(ops[op_index].name, name) == 0){
+            *stats = ops[op_index].stats;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&profile_mutex);
+    return found;
+}
+
+/**
+ * OUTPUT
+*/
+
+static int compare_self_time(const void* left, const void* right){
+    double difference = ((const op_entry_t*) right)->stats.self_ns - ((const op_entry_t*) left)->stats.self_ns;
+    return (difference > 0) - (difference < 0);
+}
+
+void profile_print_summary(FILE* file){
+#ifndef CORAL_PROFILE
+    fprintf(file, "Profiling is disabled, build with PROFILE=1.\n");
+    return;
+#endif
+    pthread_mutex_lock(&profile_mutex);
+    op_entry_t sorted_ops[PROFILE_MAX_OPS];
+    memcpy(sorted_ops, ops, num_ops * sizeof(op_entry_t));
+    int num_sorted_ops = num_ops;
+    size_t num_dropped = num_dropped_events;
+    pthread_mutex_unlock(&profile_mutex);
+    qsort(sorted_ops, num_sorted_ops, sizeof(op_entry_t), compare_self_time);
+
+    fprintf(file, "%-9s %-40s %9s %12s %12s %10s %12s %12s %9s\n",
+            "category", "op", "calls", "total ms", "self ms", "us/call", "MB alloc", "MB touched", "GB/s");
+    for(int op_index = 0; op_index < num_sorted_ops; op_index++){
+        op_entry_t* entry = &sorted_ops[op_index];
+        profile_op_stats_t* stats = &entry->stats;
+        fprintf(file, "%-9s %-40s %9zu %12.3f %12.3f %10.2f %12.3f %12.3f %9.2f\n",
+                entry->category, entry->name, stats->num_calls, stats->total_ns / 1e6, stats->self_ns / 1e6,
+                stats->total_ns / 1e3 / stats->num_calls, stats->bytes_allocated / 1e6, stats->bytes_touched / 1e6,
+                stats->total_ns > 0 ? stats->bytes_touched / stats->total_ns : 0);
+    }
+    if(num_dropped > 0){
+        fprintf(file, "(%zu events past the first %zu were summarized but left out of the trace)\n", num_dropped, PROFILE_MAX_EVENTS);
+    }
+}
+
+bool profile_write_trace(const char* path){
+    FILE* file = fopen(path, "w");
+    if(!file){
+        return false;
+    }
+    pthread_mutex_lock(&profile_mutex);
+    fprintf(file, "{\"traceEvents\": [\n");
+    for(size_t event_index = 0; event_index < num_events; event_index++){
+        profile_event_t* event = &events[event_index];
+        // complete events, timestamps in microseconds
+        fprintf(file, "  {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 0, \"tid\": %d, "
+                      "\"args\": {\"bytes_allocated\": %zu, \"bytes_touched\": %zu}}%s\n",
+                ops[event->op_index].name, ops[event->op_index].category, (event->start_ns - epoch_ns) / 1e3,
+                event->duration_ns / 1e3, event->thread_id, event->bytes_allocated, event->bytes_touched,
+                event_index + 1 < num_events ? "," : "");
+    }
+    fprintf(file, "], \"displayTimeUnit\": \"ms\"}\n");
+    pthread_mutex_unlock(&profile_mutex);
+    return fclose(file) == 0;
+}
@@ -0,0 +1,75 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * opt-in op profiler, compiled in with PROFILE=1 (-DCORAL_PROFILE)
+ * every tensor op (category "tensor") and the backward pass of every graph node (category "backward",
+ * named after the op which produced the node) is timed, along with the bytes of tensor data it allocated
+ * and the bytes of its operands and result it touched
+ * ops which call other ops are charged their total time, and their own time excluding those calls (self time)
+ *
+ *     loss = forward(...); backwards(loss);
+ *     profile_print_summary(stdout); profile_write_trace("trace.json");
+ *
+ * writes a per op table, and a Chrome trace (chrome://tracing, ui.perfetto.dev) timeline of every op on every thread
+ * without CORAL_PROFILE the scopes compile to nothing, and nothing is recorded
+*/
+
+typedef struct profile_scope profile_scope_t;
+
+struct profile_scope {
+    const char* category;
+    const char* name;
+    double start_ns;
+    double child_ns; // spent in nested scopes
+    size_t bytes_touched;
+    size_t bytes_allocated; // by the thread when the scope began
+    profile_scope_t* parent;
+};
+
+typedef struct {
+    size_t num_calls;
+    double total_ns;
+    double self_ns;
+    size_t bytes_allocated;
+    size_t bytes_touched;
+} profile_op_stats_t;
+
+#ifdef CORAL_PROFILE
+
+void profile_scope_begin(profile_scope_t* scope, const char* category, const char* name, size_t bytes_touched);
+void profile_scope_end(profile_scope_t* scope);
+void profile_record_allocation(size_t bytes);
+
+// times the rest of the enclosing block, at most one scope per block
+#define PROFILE_SCOPE(category, name, bytes_touched)                                    \
+    profile_scope_t profile_scope __attribute__((cleanup(profile_scope_end)));          \
+    profile_scope_begin(&profile_scope, (category), (name), (bytes_touched))
+#define PROFILE_RECORD_ALLOCATION(bytes) profile_record_allocation(bytes)
+
+#else
+
+#define PROFILE_SCOPE(category, name, bytes_touched)
+#define PROFILE_RECORD_ALLOCATION(bytes)
+
+#endif // CORAL_PROFILE
+
+// a tensor op, named after the enclosing function
+#define PROFILE_TENSOR_OP(bytes_touched) PROFILE_SCOPE("tensor", __func__, bytes_touched)
+
+// recording is on from the start, pausing it leaves the scopes already open to finish
+void profile_set_enabled(bool enabled);
+// discards everything recorded so far
+void profile_reset(void);
+// false when nothing has been recorded for the op
+bool profile_get_op_stats(const char* category, const char* name, profile_op_stats_t* stats);
+// ops by descending self time
+void profile_print_summary(FILE* file);
+// Chrome trace event format, false if the file cannot be written
+bool profile_write_trace(const char* path);
+
+#endif // PROFILE_H
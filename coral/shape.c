@@ -1,45 +1,129 @@
 #include "shape.h"
 #include "assert.h"
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 
-shape_t* shape_new(int num_dims, size_t* dims){
-    shape_t* new_shape = (shape_t*) malloc(sizeof(shape_t));
-    new_shape->num_dims = num_dims;
-    new_shape->dims = (size_t*) malloc(num_dims * sizeof(size_t));
-    new_shape->strides = (size_t*) malloc(num_dims * sizeof(size_t));
+/**
+ * SHAPE INTERNING
+ * interned shapes are kept in a hash table behind a mutex, with a small per thread cache of the
+ * most recently returned shapes in front of it, so that the common lookup takes no lock
+*/
+
+#define SHAPE_CACHE_SIZE 64
+#define SHAPE_TABLE_MIN_BUCKETS 64
+
+typedef struct interned_shape interned_shape_t;
+
+// shape must stay the first member, interned shapes are handed out as shape_t pointers
+struct interned_shape {
+    shape_t shape;
+    uint64_t hash;
+    interned_shape_t* next;
+};
+
+static pthread_mutex_t shape_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static interned_shape_t** shape_table = NULL;
+static size_t shape_table_num_buckets = 0;
+static size_t shape_table_num_shapes = 0;
+
+static __thread interned_shape_t* shape_cache[SHAPE_CACHE_SIZE];
+
+// fnv-1a over the dimensions
+static inline uint64_t hash_dims(int num_dims, const size_t* dims){
+    uint64_t hash = 14695981039346656037ULL ^ (uint64_t) num_dims;
     for(int index = 0; index < num_dims; index++){
-        new_shape->dims[index] = dims[index];
-    }
-    size_t stride = 1;
-    for(int stride_index = num_dims-1; stride_index >=0; stride_index--){
-        new_shape->strides[stride_index] = stride;
-        stride *= new_shape->dims[stride_index];
+        hash = (hash ^ dims[index]) * 1099511628211ULL;
     }
-    new_shape->size = new_shape->dims[0] * new_shape->strides[0];
-    return new_shape;
+    return hash;
 }
 
-shape_t* shape_copy(shape_t* shape){
-    return shape_new(shape->num_dims, shape->dims);
+static inline bool has_dims(interned_shape_t* interned, uint64_t hash, int num_dims, const size_t* dims){
+    return interned->hash == hash && interned->shape.num_dims == num_dims && memcmp(interned->shape.dims, dims, num_dims * sizeof(size_t)) == 0;
 }
 
-bool shape_equal(shape_t* left_shape, shape_t* right_shape){
-    if((left_shape->size != right_shape->size) || (left_shape->num_dims != right_shape->num_dims)){
-        return 0;
+static void shape_table_grow(void){
+    size_t num_buckets = shape_table_num_buckets ? 2 * shape_table_num_buckets : SHAPE_TABLE_MIN_BUCKETS;
+    interned_shape_t** buckets = (interned_shape_t**) calloc(num_buckets, sizeof(interned_shape_t*));
+    NDEBUG_ASSERT(buckets != NULL, "Failed to allocate shape table!\n");
+    for(size_t bucket = 0; bucket < shape_table_num_buckets; bucket++){
+        interned_shape_t* interned = shape_table[bucket];
+        while(interned){
+            interned_shape_t* next = interned->next;
+            interned->next = buckets[interned->hash % num_buckets];
+            buckets[interned->hash % num_buckets] = interned;
+            interned = next;
+        }
     }
-    // otherwise, both shapse have the same size and dimensions
-    for(int dim_index = 0; dim_index < left_shape->num_dims; dim_index++){
-        if(left_shape->dims[dim_index] != right_shape->dims[dim_index]){
-            return 0;
+    free(shape_table);
+    shape_table = buckets;
+    shape_table_num_buckets = num_buckets;
+}
+
+static interned_shape_t* shape_table_intern(uint64_t hash, int num_dims, const size_t* dims){
+    pthread_mutex_lock(&shape_table_mutex);
+    interned_shape_t* interned = shape_table ? shape_table[hash % shape_table_num_buckets] : NULL;
+    while(interned && !has_dims(interned, hash, num_dims, dims)){
+        interned = interned->next;
+    }
+    if(!interned){
+        if(shape_table_num_shapes >= shape_table_num_buckets){
+            shape_table_grow();
         }
+        interned = (interned_shape_t*) calloc(1, sizeof(interned_shape_t));
+        NDEBUG_ASSERT(interned != NULL, "Failed to allocate shape!\n");
+        shape_t* shape = &interned->shape;
+        shape->num_dims = num_dims;
+        size_t stride = 1;
+        for(int index = num_dims - 1; index >= 0; index--){
+            shape->dims[index] = dims[index];
+            shape->strides[index] = stride;
+            stride *= dims[index];
+        }
+        shape->size = stride;
+        interned->hash = hash;
+        interned->next = shape_table[hash % shape_table_num_buckets];
+        shape_table[hash % shape_table_num_buckets] = interned;
+        shape_table_num_shapes++;
     }
-    return 1;
+    pthread_mutex_unlock(&shape_table_mutex);
+    return interned;
 }
 
-shape_t* shape_get_broadcast_shape(shape_t* left_shape, shape_t* right_shape){
+shape_t* shape_new(int num_dims, size_t* dims){
+    NDEBUG_ASSERT(0 < num_dims && num_dims <= SHAPE_MAX_DIMS, "Shapes have between 1 and SHAPE_MAX_DIMS dimensions!\n");
+    uint64_t hash = hash_dims(num_dims, dims);
+    interned_shape_t** cached = &shape_cache[hash % SHAPE_CACHE_SIZE];
+    if(!*cached || !has_dims(*cached, hash, num_dims, dims)){
+        *cached = shape_table_intern(hash, num_dims, dims);
+    }
+    return &(*cached)->shape;
+}
+
+// shapes are immutable, so a copy is the shape itself
+shape_t* shape_copy(shape_t* shape){
+    return shape;
+}
+
+/**
+ * BROADCAST SHAPES
+ * the broadcast shape of each pair of (interned) shapes is memoized in a small per thread cache
+*/
+
+#define BROADCAST_CACHE_SIZE 64
+
+typedef struct {
+    shape_t* left_shape;
+    shape_t* right_shape;
+    shape_t* broadcast_shape;
+} broadcast_cache_entry_t;
+
+static __thread broadcast_cache_entry_t broadcast_cache[BROADCAST_CACHE_SIZE];
+
+static shape_t* compute_broadcast_shape(shape_t* left_shape, shape_t* right_shape){
     if(left_shape->num_dims < right_shape->num_dims){
-        return shape_get_broadcast_shape(right_shape, left_shape);
+        return compute_broadcast_shape(right_shape, left_shape);
     }
     int num_dims = left_shape->num_dims;
     size_t dims[num_dims];
@@ -53,6 +137,20 @@ shape_t* shape_get_broadcast_shape(shape_t* left_shape, shape_t* right_shape){
     return shape_new(num_dims, dims);
 }
 
+shape_t* shape_get_broadcast_shape(shape_t* left_shape, shape_t* right_shape){
+    if(left_shape == right_shape){
+        return left_shape;
+    }
+    uintptr_t key = ((uintptr_t) left_shape >> 4) * 31 + ((uintptr_t) right_shape >> 4);
+    broadcast_cache_entry_t* entry = &broadcast_cache[(key ^ (key >> 7)) % BROADCAST_CACHE_SIZE];
+    if(entry->left_shape != left_shape || entry->right_shape != right_shape){
+        entry->broadcast_shape = compute_broadcast_shape(left_shape, right_shape);
+        entry->left_shape = left_shape;
+        entry->right_shape = right_shape;
+    }
+    return entry->broadcast_shape;
+}
+
 bool shape_broadcast_compatible(shape_t* left_shape, shape_t* right_shape){
     if(left_shape->num_dims < right_shape->num_dims){
         return shape_broadcast_compatible(right_shape, left_shape);
@@ -69,6 +167,59 @@ bool shape_broadcast_compatible(shape_t* left_shape, shape_t* right_shape){
     return 1;
 }
 
+// returns true iff shape can be broadcast to target_shape, i.e. the broadcast of the two is target_shape
+bool shape_broadcasts_to(shape_t* shape, shape_t* target_shape){
+    if(shape->num_dims > target_shape->num_dims){
+        return 0;
+    }
+    int dim_offset = target_shape->num_dims - shape->num_dims;
+    for(int dim_index = 0; dim_index < shape->num_dims; dim_index++){
+        size_t dim = shape->dims[dim_index];
+        if(dim != 1 && dim != target_shape->dims[dim_offset + dim_index]){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// returns true iff shape is the broadcast shape of left_shape and right_shape
+// equivalent to shape_equal(shape_get_broadcast_shape(left_shape, right_shape), shape), without allocating
+bool shape_is_broadcast_of(shape_t* shape, shape_t* left_shape, shape_t* right_shape){
+    if(shape->num_dims != MAX(left_shape->num_dims, right_shape->num_dims)){
+        return 0;
+    }
+    int left_offset = shape->num_dims - left_shape->num_dims;
+    int right_offset = shape->num_dims - right_shape->num_dims;
+    for(int dim_index = 0; dim_index < shape->num_dims; dim_index++){
+        size_t left_dim = (dim_index < left_offset) ? 1 : left_shape->dims[dim_index - left_offset];
+        size_t right_dim = (dim_index < right_offset) ? 1 : right_shape->dims[dim_index - right_offset];
+        if(shape->dims[dim_index] != MAX(left_dim, right_dim)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// returns true iff shape, ignoring its leading dimensions of length 1, matches the trailing dimensions of target_shape
+// in which case broadcasting shape to target_shape repeats its data contiguously
+bool shape_is_trailing_suffix(shape_t* shape, shape_t* target_shape){
+    int first_dim = 0;
+    while(first_dim < shape->num_dims && shape->dims[first_dim] == 1){
+        first_dim++;
+    }
+    int num_suffix_dims = shape->num_dims - first_dim;
+    if(num_suffix_dims > target_shape->num_dims){
+        return 0;
+    }
+    int target_offset = target_shape->num_dims - num_suffix_dims;
+    for(int index = 0; index < num_suffix_dims; index++){
+        if(shape->dims[first_dim + index] != target_shape->dims[target_offset + index]){
+            return 0;
+        }
+    }
+    return 1;
+}
+
 // packs the shape to num_dims number of dimensions
 shape_t* shape_extend_to_dims(shape_t* shape, int num_dims){
     NDEBUG_ASSERT(shape->num_dims <= num_dims, "Cannot reduce the number of dimensions of a shape.\n");
@@ -7,22 +7,36 @@
 #include <stdbool.h>
 #include "utils.h"
 
+// enough for batched attention (batch x heads x queries x keys) and convolutions (N x C x H x W) with room to spare
+#define SHAPE_MAX_DIMS 8
+
+/**
+ * shapes are interned: shape_new returns the same (immutable) shape for the same dimensions, so shapes
+ * are shared rather than copied, and two shapes are equal iff they are the same pointer
+ * interned shapes are never freed (they live outside of the graph arena), there are only ever a few of them
+*/
 typedef struct {
     int num_dims;
     size_t size;
-    size_t* dims;
-    size_t* strides;
+    size_t dims[SHAPE_MAX_DIMS];
+    size_t strides[SHAPE_MAX_DIMS];
 } shape_t;
 
 shape_t* shape_new(int num_dims, size_t* dims);
 shape_t* shape_copy(shape_t* shape);
-bool shape_equal(shape_t* left_shape, shape_t* right_shape);
 shape_t* shape_get_broadcast_shape(shape_t* left_shape, shape_t* right_shape);
 bool shape_broadcast_compatible(shape_t* left_shape, shape_t* right_shape);
+bool shape_is_trailing_suffix(shape_t* shape, shape_t* target_shape);
+bool shape_broadcasts_to(shape_t* shape, shape_t* target_shape);
+bool shape_is_broadcast_of(shape_t* shape, shape_t* left_shape, shape_t* right_shape);
 shape_t* shape_extend_to_dims(shape_t* shape, int num_dims);
 void shape_verbose_display(shape_t* shape);
 void shape_display(shape_t* shape);
 
+static inline bool shape_equal(shape_t* left_shape, shape_t* right_shape){
+    return left_shape == right_shape;
+}
+
 static inline bool shape_is_scalar(shape_t* shape){
     return shape->size == 1;
 }
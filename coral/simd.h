@@ -0,0 +1,118 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/**
+ * thin wrapper over the widest vector extension enabled at compile time
+ * kernels are written once against simd_vec_t, build with NATIVE=1 to pick up AVX2/AVX-512
+ * comparisons (simd_equal) give 1 where they hold and 0 elsewhere, as the entry comparisons do
+ * NOTE: assumes tensor_entry_t is float
+*/
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define SIMD_WIDTH 16
+typedef __m512 simd_vec_t;
+#define simd_load(ptr) _mm512_loadu_ps(ptr)
+#define simd_store(ptr, vec) _mm512_storeu_ps((ptr), (vec))
+#define simd_set1(value) _mm512_set1_ps(value)
+#define simd_add(left, right) _mm512_add_ps((left), (right))
+#define simd_subtract(left, right) _mm512_sub_ps((left), (right))
+#define simd_multiply(left, right) _mm512_mul_ps((left), (right))
+#define simd_divide(left, right) _mm512_div_ps((left), (right))
+#define simd_max(left, right) _mm512_max_ps((left), (right))
+#define simd_equal(left, right) _mm512_maskz_mov_ps(_mm512_cmp_ps_mask((left), (right), _CMP_EQ_OQ), _mm512_set1_ps(1))
+#define simd_fmadd(left, right, acc) _mm512_fmadd_ps((left), (right), (acc))
+#define simd_sqrt(vec) _mm512_sqrt_ps(vec)
+
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 simd_vec_t;
+#define simd_load(ptr) _mm256_loadu_ps(ptr)
+#define simd_store(ptr, vec) _mm256_storeu_ps((ptr), (vec))
+#define simd_set1(value) _mm256_set1_ps(value)
+#define simd_add(left, right) _mm256_add_ps((left), (right))
+#define simd_subtract(left, right) _mm256_sub_ps((left), (right))
+#define simd_multiply(left, right) _mm256_mul_ps((left), (right))
+#define simd_divide(left, right) _mm256_div_ps((left), (right))
+#define simd_max(left, right) _mm256_max_ps((left), (right))
+#define simd_equal(left, right) _mm256_and_ps(_mm256_cmp_ps((left), (right), _CMP_EQ_OQ), _mm256_set1_ps(1))
+#define simd_sqrt(vec) _mm256_sqrt_ps(vec)
+#ifdef __FMA__
+#define simd_fmadd(left, right, acc) _mm256_fmadd_ps((left), (right), (acc))
+#else
+#define simd_fmadd(left, right, acc) _mm256_add_ps(_mm256_mul_ps((left), (right)), (acc))
+#endif
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 simd_vec_t;
+#define simd_load(ptr) _mm_loadu_ps(ptr)
+#define simd_store(ptr, vec) _mm_storeu_ps((ptr), (vec))
+#define simd_set1(value) _mm_set1_ps(value)
+#define simd_add(left, right) _mm_add_ps((left), (right))
+#define simd_subtract(left, right) _mm_sub_ps((left), (right))
+#define simd_multiply(left, right) _mm_mul_ps((left), (right))
+#define simd_divide(left, right) _mm_div_ps((left), (right))
+#define simd_max(left, right) _mm_max_ps((left), (right))
+#define simd_equal(left, right) _mm_and_ps(_mm_cmpeq_ps((left), (right)), _mm_set1_ps(1))
+#define simd_sqrt(vec) _mm_sqrt_ps(vec)
+#define simd_fmadd(left, right, acc) _mm_add_ps(_mm_mul_ps((left), (right)), (acc))
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_WIDTH 4
+typedef float32x4_t simd_vec_t;
+#define simd_load(ptr) vld1q_f32(ptr)
+#define simd_store(ptr, vec) vst1q_f32((ptr), (vec))
+#define simd_set1(value) vdupq_n_f32(value)
+#define simd_add(left, right) vaddq_f32((left), (right))
+#define simd_subtract(left, right) vsubq_f32((left), (right))
+#define simd_multiply(left, right) vmulq_f32((left), (right))
+#define simd_max(left, right) vmaxq_f32((left), (right))
+#define simd_equal(left, right) vreinterpretq_f32_u32(vandq_u32(vceqq_f32((left), (right)), vreinterpretq_u32_f32(vdupq_n_f32(1))))
+#ifdef __aarch64__
+#define simd_divide(left, right) vdivq_f32((left), (right))
+#define simd_fmadd(left, right, acc) vfmaq_f32((acc), (left), (right))
+#define simd_sqrt(vec) vsqrtq_f32(vec)
+#else
+// armv7 neon has no vector divide, use reciprocal estimate refined by two newton steps
+static inline float32x4_t simd_neon_divide(float32x4_t left, float32x4_t right){
+    float32x4_t reciprocal = vrecpeq_f32(right);
+    reciprocal = vmulq_f32(vrecpsq_f32(right, reciprocal), reciprocal);
+    reciprocal = vmulq_f32(vrecpsq_f32(right, reciprocal), reciprocal);
+    return vmulq_f32(left, reciprocal);
+}
+#define simd_divide(left, right) simd_neon_divide((left), (right))
+#define simd_fmadd(left, right, acc) vmlaq_f32((acc), (left), (right))
+// nor a vector square root, as x * rsqrt(x) is off at zero use an estimate of sqrt(x + tiny) refined by two newton steps
+static inline float32x4_t simd_neon_sqrt(float32x4_t vec){
+    float32x4_t shifted = vaddq_f32(vec, vdupq_n_f32(1e-30f));
+    float32x4_t reciprocal_sqrt = vrsqrteq_f32(shifted);
+    reciprocal_sqrt = vmulq_f32(vrsqrtsq_f32(vmulq_f32(shifted, reciprocal_sqrt), reciprocal_sqrt), reciprocal_sqrt);
+    reciprocal_sqrt = vmulq_f32(vrsqrtsq_f32(vmulq_f32(shifted, reciprocal_sqrt), reciprocal_sqrt), reciprocal_sqrt);
+    return vmulq_f32(vec, reciprocal_sqrt);
+}
+#define simd_sqrt(vec) simd_neon_sqrt(vec)
+#endif
+
+#else
+// scalar fallback, keeps kernels portable
+#include <math.h>
+#define SIMD_WIDTH 1
+typedef float simd_vec_t;
+#define simd_load(ptr) (*(ptr))
+#define simd_store(ptr, vec) (*(ptr) = (vec))
+#define simd_set1(value) (value)
+#define simd_add(left, right) ((left) + (right))
+#define simd_subtract(left, right) ((left) - (right))
+#define simd_multiply(left, right) ((left) * (right))
+#define simd_divide(left, right) ((left) / (right))
+#define simd_max(left, right) (((left) > (right)) ? (left) : (right))
+#define simd_equal(left, right) ((left) == (right) ? 1.0f : 0.0f)
+#define simd_fmadd(left, right, acc) ((left) * (right) + (acc))
+#define simd_sqrt(vec) sqrtf(vec)
+#endif
+
+#endif // SIMD_H
@@ -1,10 +1,21 @@
 #include "tensor.h"
 #include "utils.h"
 #include "assert.h"
+#include "simd.h"
+#include "gemm.h"
+#include "parallel.h"
+#include "arena.h"
+#include "pool.h"
+#include "iter.h"
+#include "profile.h"
 #include <stdio.h>
 #include <stdlib.h> 
 #include <stdbool.h>
 #include <string.h>
+// the entry expressions of the op tables are type generic (see ops.h)
+#include <tgmath.h>
+
+_Static_assert(TENSOR_ALIGNMENT <= POOL_ALIGNMENT, "Pooled tensor data must be aligned to TENSOR_ALIGNMENT!");
 
 // NOTE: for now using static inline over macro for type safety
 // macro doesn't feel right here
@@ -19,72 +30,180 @@ static inline size_t tensor_get_size(tensor_t* tensor){
 // }
 
 static inline size_t tensor_get_size_in_bytes(tensor_t* tensor){
-    return tensor_get_size(tensor) * sizeof(tensor_entry_t);
+    return tensor_get_size(tensor) * dtype_get_size(tensor->dtype);
+}
+
+// bytes of both operands and of the broadcast result, as recorded by the profiler
+static inline size_t broadcast_bytes_touched(tensor_t* left_tensor, tensor_t* right_tensor){
+    shape_t* shape = shape_get_broadcast_shape(left_tensor->shape, right_tensor->shape);
+    return tensor_get_size_in_bytes(left_tensor) + tensor_get_size_in_bytes(right_tensor) + shape->size * dtype_get_size(left_tensor->dtype);
+}
+
+// ops which only compute in float32
+#define ASSERT_FLOAT32(tensor) NDEBUG_ASSERT((tensor)->dtype == TENSOR_FLOAT32, "Op computes in float32, convert the tensor with tensor_to_dtype first!\n")
+
+// the entry offset entries past the first entry of tensor, whatever its dtype
+static inline tensor_entry_t* tensor_get_data_at(tensor_t* tensor, size_t offset){
+    return (tensor_entry_t*) ((char*) tensor->data + offset * dtype_get_size(tensor->dtype));
+}
+
+static size_t num_allocations = 0;
+
+size_t tensor_get_num_allocations(void){
+    return __atomic_load_n(&num_allocations, __ATOMIC_RELAXED);
+}
+
+// outside of the graph arena, data comes from the buffer pool so that released tensors are recycled
+// either way it is aligned to TENSOR_ALIGNMENT bytes
+static tensor_t* tensor_alloc(shape_t* shape, tensor_dtype_t dtype, bool zeroed){
+    __atomic_add_fetch(&num_allocations, 1, __ATOMIC_RELAXED);
+    PROFILE_RECORD_ALLOCATION(shape->size * dtype_get_size(dtype));
+    bool pooled = !arena_is_active();
+    size_t entry_size = dtype_get_size(dtype);
+    void* data;
+    if(pooled){
+        data = zeroed ? pool_calloc(shape->size, entry_size) : pool_alloc(shape->size * entry_size);
+    }else{
+        data = arena_alloc_aligned(arena_get_graph_arena(), shape->size * entry_size, TENSOR_ALIGNMENT);
+        if(zeroed){
+            // blocks are reused after a rewind, so they must be cleared explicitly
+            memset(data, 0, shape->size * entry_size);
+        }
+    }
+    tensor_t* new_tensor = (tensor_t*) arena_malloc(sizeof(tensor_t));
+    new_tensor->data = data;
+    new_tensor->shape = shape;
+    new_tensor->owns_data = pooled;
+    new_tensor->strides = NULL;
+    new_tensor->dtype = dtype;
+    new_tensor->quantization = QUANTIZATION_NONE;
+    return new_tensor;
 }
 
 // create new tensor
 // entries are set to zero by default
+tensor_t* tensor_new_with_dtype(shape_t* shape, tensor_dtype_t dtype){
+    return tensor_alloc(shape, dtype, true);
+}
+
 tensor_t* tensor_new(shape_t* shape){
-    tensor_entry_t* data = (tensor_entry_t*) calloc(shape->size, sizeof(tensor_entry_t));
-    tensor_t* new_tensor = (tensor_t*) malloc(sizeof(tensor_t));
-    new_tensor->data = data;
-    new_tensor->shape = shape_copy(shape);
+    return tensor_new_with_dtype(shape, TENSOR_FLOAT32);
+}
+
+tensor_t* tensor_empty_with_dtype(shape_t* shape, tensor_dtype_t dtype){
+    return tensor_alloc(shape, dtype, false);
+}
+
+tensor_t* tensor_empty(shape_t* shape){
+    return tensor_empty_with_dtype(shape, TENSOR_FLOAT32);
+}
+
+tensor_t* tensor_empty_like(tensor_t* tensor){
+    tensor_t* new_tensor = tensor_empty_with_dtype(tensor->shape, tensor->dtype);
+    new_tensor->quantization = tensor->quantization;
     return new_tensor;
 }
 
-// TODO - ensure this is inlined
+// has the dtype (and quantization) of tensor
 tensor_t* tensor_new_like(tensor_t* tensor){
-    return tensor_new(tensor->shape);
+    tensor_t* new_tensor = tensor_new_with_dtype(tensor->shape, tensor->dtype);
+    new_tensor->quantization = tensor->quantization;
+    return new_tensor;
 }
 
 tensor_t* tensor_new_like_with_value(tensor_t* tensor, tensor_entry_t value){
-    tensor_t* new_tensor = tensor_new_like(tensor);
+    tensor_t* new_tensor = tensor_empty_like(tensor);
     tensor_set_to_scalar_value(new_tensor, value);
     return new_tensor;
 }
 
 // the same as tensor_new_like (for now)
 tensor_t* tensor_new_zeros_like(tensor_t* tensor){
-    return tensor_new(tensor->shape);
+    return tensor_new_like(tensor);
 }
 
 tensor_t* tensor_new_from_entry(tensor_entry_t entry){
     size_t dims = 1;
-    tensor_t* new_tensor = tensor_new(shape_new(1, &dims));
+    tensor_t* new_tensor = tensor_empty(shape_new(1, &dims));
     tensor_set_entry(new_tensor, 0, entry);
     return new_tensor;
 }
 
 
+// the copy is contiguous
 tensor_t* tensor_copy(tensor_t* old_tensor){
-    tensor_t* new_tensor = tensor_new_like(old_tensor);
+    if(!tensor_is_contiguous(old_tensor)){
+        return tensor_contiguous(old_tensor);
+    }
+    PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(old_tensor));
+    tensor_t* new_tensor = tensor_empty_like(old_tensor);
     memcpy(new_tensor->data, old_tensor->data, tensor_get_size_in_bytes(old_tensor));
     return new_tensor;
 }
 
 void tensor_in_place_view_as_shape(tensor_t* tensor, shape_t* new_shape){
     NDEBUG_ASSERT(new_shape->size == tensor->shape->size, "Tensor cannot be viewed in that shape!\n");
-    tensor->shape = shape_copy(new_shape);
+    NDEBUG_ASSERT(tensor_is_contiguous(tensor), "Only contiguous tensors can be reshaped in place!\n");
+    tensor->shape = new_shape;
 }
 
-// creates new tensor with desired shape pointing to the same underlying data
+// creates new tensor with desired shape pointing to the same underlying data, which tensor keeps owning
+// a non-contiguous tensor is copied instead, as its entries are not in row-major order, and the copy is returned
 tensor_t* tensor_view_as_shape(tensor_t* tensor, shape_t* new_shape){
     NDEBUG_ASSERT(new_shape->size == tensor->shape->size, "Tensor cannot be viewed in that shape!\n");
-    tensor_t* new_tensor = (tensor_t*) malloc(sizeof(tensor_t));
+    if(!tensor_is_contiguous(tensor)){
+        tensor_t* new_tensor = tensor_contiguous(tensor);
+        new_tensor->shape = new_shape;
+        return new_tensor;
+    }
+    tensor_t* new_tensor = (tensor_t*) arena_malloc(sizeof(tensor_t));
     new_tensor->data = tensor->data;
-    new_tensor->shape = shape_copy(new_shape);
+    new_tensor->shape = new_shape;
+    new_tensor->owns_data = false;
+    new_tensor->strides = NULL;
+    new_tensor->dtype = tensor->dtype;
+    new_tensor->quantization = tensor->quantization;
+    return new_tensor;
+}
+
+// the tensor aliases data, which it never owns (so releasing it leaves data to its owner)
+tensor_t* tensor_new_from_data(void* data, shape_t* shape, tensor_dtype_t dtype, quantization_t quantization){
+    tensor_t* new_tensor = (tensor_t*) arena_malloc(sizeof(tensor_t));
+    *new_tensor = (tensor_t) {(tensor_entry_t*) data, shape, false, NULL, dtype, quantization};
     return new_tensor;
 }
 
+// hands the data of tensor back to the buffer pool, tensor must not be read afterwards
+// a no-op for tensors which do not own their data (views, or tensors allocated from the graph arena)
+void tensor_release(tensor_t* tensor){
+    if(tensor->owns_data){
+        pool_free(tensor->data, tensor_get_size_in_bytes(tensor));
+        tensor->owns_data = false;
+    }
+    tensor->data = NULL;
+}
+
+// releases a temporary made from tensor, e.g. by tensor_contiguous, unless it is tensor itself
+static inline void release_temporary(tensor_t* temporary, tensor_t* tensor){
+    if(temporary != tensor){
+        tensor_release(temporary);
+    }
+}
+
 /**
  * COMPARATORS
 */
 
+// compares entries, regardless of the strides they are laid out with
 bool tensor_equal(tensor_t* left_tensor, tensor_t* right_tensor){
-    if(!shape_equal(left_tensor->shape, right_tensor->shape)){
+    if(!shape_equal(left_tensor->shape, right_tensor->shape) || left_tensor->dtype != right_tensor->dtype){
         return 0;
     }
-    int cmp = memcmp(left_tensor->data, right_tensor->data, tensor_get_size_in_bytes(left_tensor)); 
+    tensor_t* left_contiguous = tensor_contiguous(left_tensor);
+    tensor_t* right_contiguous = tensor_contiguous(right_tensor);
+    int cmp = memcmp(left_contiguous->data, right_contiguous->data, tensor_get_size_in_bytes(left_tensor)); 
+    release_temporary(left_contiguous, left_tensor);
+    release_temporary(right_contiguous, right_tensor);
     return (cmp == 0);
 }
 
@@ -102,30 +221,66 @@ bool tensor_is_scalar(tensor_t* tensor){
  * NON-INLINED SETTERS/MUTATORS
 */
 
-void tensor_set_to_scalar_value(tensor_t* tensor, tensor_entry_t value){
-    size_t tensor_size = tensor_get_size(tensor);
-    for(size_t index = 0; index < tensor_size; index++){
-        tensor_set_entry(tensor, index, value);
+/**
+ * kernels over more entries than the grain size of their op are split over the worker pool
+*/
+
+typedef struct {
+    tensor_t* tensor;
+    tensor_entry_t value;
+    tensor_index_fn_t index_fn;
+    tensor_entry_unary_fn_t entry_fn;
+} apply_context_t;
+
+static void set_to_scalar_value_range(void* raw_context, size_t begin, size_t end){
+    apply_context_t* context = (apply_context_t*) raw_context;
+    for(size_t index = begin; index < end; index++){
+        tensor_set_entry(context->tensor, index, context->value);
     }
 }
 
-void tensor_in_place_apply_index_fn(tensor_t* tensor, tensor_index_fn_t index_fn){
-    size_t tensor_size = tensor_get_size(tensor);
-    for(size_t index = 0; index < tensor_size; index++){
-        tensor_entry_t entry_value = (*index_fn)(index);
-        tensor_set_entry(tensor, index, entry_value);
+static void apply_index_fn_range(void* raw_context, size_t begin, size_t end){
+    apply_context_t* context = (apply_context_t*) raw_context;
+    for(size_t index = begin; index < end; index++){
+        tensor_entry_t entry_value = (*context->index_fn)(index);
+        tensor_set_entry(context->tensor, index, entry_value);
     }
 }
 
-void tensor_in_place_apply_entry_fn(tensor_t* tensor, tensor_entry_unary_fn_t entry_fn){
-    size_t tensor_size = tensor_get_size(tensor);
-    for(size_t index = 0; index < tensor_size; index++){
-        tensor_entry_t entry_old_value = tensor_get_entry(tensor, index);
-        tensor_entry_t entry_new_value = (*entry_fn)(entry_old_value);
-        tensor_set_entry(tensor, index, entry_new_value);
+static void apply_entry_fn_range(void* raw_context, size_t begin, size_t end){
+    apply_context_t* context = (apply_context_t*) raw_context;
+    for(size_t index = begin; index < end; index++){
+        tensor_entry_t entry_old_value = tensor_get_entry(context->tensor, index);
+        tensor_entry_t entry_new_value = (*context->entry_fn)(entry_old_value);
+        tensor_set_entry(context->tensor, index, entry_new_value);
     }
 }
 
+void tensor_set_to_scalar_value(tensor_t* tensor, tensor_entry_t value){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
+    NDEBUG_ASSERT(tensor_is_contiguous(tensor), "Cannot set the entries of a strided view!\n");
+    ASSERT_FLOAT32(tensor);
+    apply_context_t context = {tensor, value, NULL, NULL};
+    parallel_for(tensor_get_size(tensor), parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE), &set_to_scalar_value_range, &context);
+}
+
+// index_fn and entry_fn may be called concurrently, so must not have side effects
+void tensor_in_place_apply_index_fn(tensor_t* tensor, tensor_index_fn_t index_fn){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
+    NDEBUG_ASSERT(tensor_is_contiguous(tensor), "Cannot set the entries of a strided view!\n");
+    ASSERT_FLOAT32(tensor);
+    apply_context_t context = {tensor, 0, index_fn, NULL};
+    parallel_for(tensor_get_size(tensor), parallel_get_grain_size(PARALLEL_OP_APPLY), &apply_index_fn_range, &context);
+}
+
+void tensor_in_place_apply_entry_fn(tensor_t* tensor, tensor_entry_unary_fn_t entry_fn){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
+    NDEBUG_ASSERT(tensor_is_contiguous(tensor), "Cannot set the entries of a strided view!\n");
+    ASSERT_FLOAT32(tensor);
+    apply_context_t context = {tensor, 0, NULL, entry_fn};
+    parallel_for(tensor_get_size(tensor), parallel_get_grain_size(PARALLEL_OP_APPLY), &apply_entry_fn_range, &context);
+}
+
 // static inline tensor_t* tensor_apply_index_fn(tensor_t* tensor, tensor_index_fn_t index_fn){
 //     tensor_t* new_tensor = tensor_copy(tensor);
 //     tensor_in_place_apply_index_fn(new_tensor, index_fn);
@@ -145,57 +300,296 @@ void tensor_in_place_apply_entry_fn(tensor_t* tensor, tensor_entry_unary_fn_t en
  * PRINTING
 */
 
-void tensor_display_dim_1(tensor_t* tensor){
-    for(size_t dim0_index = 0; dim0_index < tensor->shape->dims[0]; dim0_index++){
-        printf("%f ", tensor->data[dim0_index]);
+// displays the entries of dimensions dim_index onwards, starting at offset into the (contiguous) data
+// the innermost dimension is a row, each further dimension outwards is followed by a blank line
+static void display_dims(tensor_t* tensor, int dim_index, size_t offset){
+    size_t dim = tensor->shape->dims[dim_index];
+    size_t stride = tensor->shape->strides[dim_index];
+    if(dim_index == TENSOR_NUM_DIMS(tensor) - 1){
+        for(size_t index = 0; index < dim; index++){
+            printf("%f ", tensor->data[offset + index]);
+        }
+        printf("\n");
+        return;
+    }
+    for(size_t index = 0; index < dim; index++){
+        display_dims(tensor, dim_index + 1, offset + index * stride);
     }
-    printf("\n\n");
+    printf("\n");
 }
 
-void tensor_display_dim_2(tensor_t* tensor){
-    for(size_t dim0_index = 0; dim0_index < tensor->shape->dims[0]; dim0_index++){
-        for(size_t dim1_index = 0; dim1_index < tensor->shape->dims[1]; dim1_index++){
-            size_t index = dim0_index * tensor->shape->dims[1] + dim1_index;
-            printf("%f ", tensor->data[index]);
-        }
+// other dtypes are displayed through a float32 copy
+void tensor_display(tensor_t* tensor){
+    shape_display(tensor->shape);
+    tensor_t* contiguous_tensor = tensor_contiguous(tensor);
+    tensor_t* float_tensor = tensor_to_dtype(contiguous_tensor, TENSOR_FLOAT32);
+    display_dims(float_tensor, 0, 0);
+    if(TENSOR_NUM_DIMS(tensor) == 1){
         printf("\n");
-    } 
-    printf("\n");
+    }
+    release_temporary(float_tensor, contiguous_tensor);
+    release_temporary(contiguous_tensor, tensor);
 }
 
-void tensor_display_dim_3(tensor_t* tensor){
-    for(size_t dim0_index = 0; dim0_index < tensor->shape->dims[0]; dim0_index++){
-        for(size_t dim1_index = 0; dim1_index < tensor->shape->dims[1]; dim1_index++){
-            for(size_t dim2_index = 0; dim2_index < tensor->shape->dims[2]; dim2_index++){
-                size_t index = dim0_index * tensor->shape->dims[1] * tensor->shape->dims[2] + dim1_index * tensor->shape->dims[2] + dim2_index;
-                printf("%f ", tensor->data[index]);
+/**
+ * STRIDED VIEWS
+ * a view holds its own strides and points at its first entry, so the storage offset is folded into data
+ * dimensions of length 1 are never stepped along, so their strides are irrelevant to contiguity
+*/
+
+static tensor_t* strided_view(tensor_t* tensor, shape_t* shape, const size_t* strides, size_t offset){
+    tensor_t* new_tensor = (tensor_t*) arena_malloc(sizeof(tensor_t));
+    new_tensor->data = tensor_get_data_at(tensor, offset);
+    new_tensor->shape = shape;
+    new_tensor->owns_data = false;
+    new_tensor->dtype = tensor->dtype;
+    new_tensor->quantization = tensor->quantization;
+    bool contiguous = true;
+    for(int dim_index = 0; dim_index < shape->num_dims; dim_index++){
+        contiguous = contiguous && (shape->dims[dim_index] == 1 || strides[dim_index] == shape->strides[dim_index]);
+    }
+    new_tensor->strides = NULL;
+    if(!contiguous){
+        new_tensor->strides = (size_t*) arena_malloc(shape->num_dims * sizeof(size_t));
+        memcpy(new_tensor->strides, strides, shape->num_dims * sizeof(size_t));
+    }
+    return new_tensor;
+}
+
+tensor_t* tensor_permute(tensor_t* tensor, int* dims){
+    int num_dims = TENSOR_NUM_DIMS(tensor);
+    const size_t* strides = tensor_get_strides(tensor);
+    bool seen[TENSOR_MAX_DIMS] = {false};
+    size_t new_dims[TENSOR_MAX_DIMS];
+    size_t new_strides[TENSOR_MAX_DIMS];
+    for(int dim_index = 0; dim_index < num_dims; dim_index++){
+        NDEBUG_ASSERT(0 <= dims[dim_index] && dims[dim_index] < num_dims && !seen[dims[dim_index]], "Dimensions must be a permutation of those of the tensor!\n");
+        seen[dims[dim_index]] = true;
+        new_dims[dim_index] = tensor->shape->dims[dims[dim_index]];
+        new_strides[dim_index] = strides[dims[dim_index]];
+    }
+    return strided_view(tensor, shape_new(num_dims, new_dims), new_strides, 0);
+}
+
+tensor_t* tensor_transpose(tensor_t* tensor, int dim0, int dim1){
+    int num_dims = TENSOR_NUM_DIMS(tensor);
+    NDEBUG_ASSERT(0 <= dim0 && dim0 < num_dims && 0 <= dim1 && dim1 < num_dims, "Transposed dimension out of range!\n");
+    int dims[TENSOR_MAX_DIMS];
+    for(int dim_index = 0; dim_index < num_dims; dim_index++){
+        dims[dim_index] = dim_index;
+    }
+    dims[dim0] = dim1;
+    dims[dim1] = dim0;
+    return tensor_permute(tensor, dims);
+}
+
+tensor_t* tensor_slice(tensor_t* tensor, int dim, size_t start, size_t end){
+    int num_dims = TENSOR_NUM_DIMS(tensor);
+    NDEBUG_ASSERT(0 <= dim && dim < num_dims, "Sliced dimension out of range!\n");
+    NDEBUG_ASSERT(start < end && end <= tensor->shape->dims[dim], "Slice out of range!\n");
+    const size_t* strides = tensor_get_strides(tensor);
+    size_t new_dims[TENSOR_MAX_DIMS];
+    memcpy(new_dims, tensor->shape->dims, num_dims * sizeof(size_t));
+    new_dims[dim] = end - start;
+    return strided_view(tensor, shape_new(num_dims, new_dims), strides, start * strides[dim]);
+}
+
+tensor_t* tensor_expand(tensor_t* tensor, shape_t* shape){
+    NDEBUG_ASSERT(shape_broadcasts_to(tensor->shape, shape), "Tensor cannot be expanded to that shape!\n");
+    const size_t* strides = tensor_get_strides(tensor);
+    int num_padded_dims = shape->num_dims - TENSOR_NUM_DIMS(tensor);
+    size_t new_strides[TENSOR_MAX_DIMS];
+    for(int dim_index = 0; dim_index < shape->num_dims; dim_index++){
+        int tensor_dim_index = dim_index - num_padded_dims;
+        bool broadcast = tensor_dim_index < 0 || tensor->shape->dims[tensor_dim_index] != shape->dims[dim_index];
+        new_strides[dim_index] = broadcast ? 0 : strides[tensor_dim_index];
+    }
+    return strided_view(tensor, shape, new_strides, 0);
+}
+
+typedef struct {
+    broadcast_plan_t plan;
+    char* dest;
+    const char* source;
+    size_t entry_size; // copies are bytewise, so work for every dtype
+} copy_context_t;
+
+#define COPY_STRIDED(type)                                                            \
+    for(size_t index = 0; index < length; index++){                                   \
+        ((type*) dest)[index] = ((const type*) source)[index * source_stride];        \
+    }
+
+// dest <- length entries of entry_size bytes, stepped over with source_stride
+static inline void copy_strided(void* dest, const void* source, size_t source_stride, size_t length, size_t entry_size){
+    switch(entry_size){
+        case 1: COPY_STRIDED(uint8_t) break;
+        case 2: COPY_STRIDED(uint16_t) break;
+        case 8: COPY_STRIDED(uint64_t) break;
+        default: COPY_STRIDED(uint32_t)
+    }
+}
+
+#undef COPY_STRIDED
+
+static void copy_rows_range(void* raw_context, size_t begin, size_t end){
+    copy_context_t* context = (copy_context_t*) raw_context;
+    const broadcast_plan_t* plan = &context->plan;
+    size_t entry_size = context->entry_size;
+    size_t source_stride = plan->strides[1][plan->num_dims - 1];
+    tensor_iter_t iter;
+    tensor_iter_init(&iter, plan, begin);
+    for(size_t row = begin; row < end; row++){
+        // dest is contiguous, so its rows are
+        char* dest = context->dest + iter.offsets[0] * entry_size;
+        const char* source = context->source + iter.offsets[1] * entry_size;
+        if(source_stride == 1){
+            memcpy(dest, source, plan->row_length * entry_size);
+        }else{
+            copy_strided(dest, source, source_stride, plan->row_length, entry_size);
+        }
+        tensor_iter_next(&iter);
+    }
+}
+
+tensor_t* tensor_contiguous(tensor_t* tensor){
+    if(tensor_is_contiguous(tensor)){
+        return tensor;
+    }
+    PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(tensor));
+    tensor_t* new_tensor = tensor_empty_like(tensor);
+    shape_t* operand_shapes[2] = {tensor->shape, tensor->shape};
+    const size_t* operand_strides[2] = {tensor->shape->strides, tensor->strides};
+    copy_context_t context = {.dest = (char*) new_tensor->data, .source = (const char*) tensor->data, .entry_size = dtype_get_size(tensor->dtype)};
+    broadcast_plan_init(&context.plan, tensor->shape, 2, operand_shapes, operand_strides);
+    size_t grain_size = MAX(parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE) / context.plan.row_length, 1);
+    parallel_for(context.plan.num_rows, grain_size, &copy_rows_range, &context);
+    return new_tensor;
+}
+
+/**
+ * DTYPES
+ * conversions read contiguous sources, split over the worker pool like elementwise kernels, and write
+ * strided destinations (views of a storage dtype tensor, say) a row of their plan at a time
+ * ops read float16, bfloat16 and int8 operands through float32 temporaries (see widen) and narrow
+ * their results back into the destination
+*/
+
+typedef struct {
+    broadcast_plan_t plan; // only for a strided destination
+    tensor_t* dest;
+    tensor_t* source;
+} convert_context_t;
+
+static void convert_range(void* raw_context, size_t begin, size_t end){
+    convert_context_t* context = (convert_context_t*) raw_context;
+    dtype_convert(tensor_get_data_at(context->dest, begin), context->dest->dtype, context->dest->quantization,
+                  tensor_get_data_at(context->source, begin), context->source->dtype, context->source->quantization, end - begin);
+}
+
+static void convert_rows_range(void* raw_context, size_t begin, size_t end){
+    convert_context_t* context = (convert_context_t*) raw_context;
+    const broadcast_plan_t* plan = &context->plan;
+    tensor_t* dest_tensor = context->dest;
+    tensor_t* source_tensor = context->source;
+    size_t dest_stride = plan->strides[0][plan->num_dims - 1];
+    tensor_iter_t iter;
+    tensor_iter_init(&iter, plan, begin);
+    for(size_t row = begin; row < end; row++){
+        // source is contiguous, so its rows are
+        if(dest_stride == 1){
+            dtype_convert(tensor_get_data_at(dest_tensor, iter.offsets[0]), dest_tensor->dtype, dest_tensor->quantization,
+                          tensor_get_data_at(source_tensor, iter.offsets[1]), source_tensor->dtype, source_tensor->quantization, plan->row_length);
+        }else{
+            for(size_t index = 0; index < plan->row_length; index++){
+                dtype_convert(tensor_get_data_at(dest_tensor, iter.offsets[0] + index * dest_stride), dest_tensor->dtype, dest_tensor->quantization,
+                              tensor_get_data_at(source_tensor, iter.offsets[1] + index), source_tensor->dtype, source_tensor->quantization, 1);
             }
-            printf("\n");
         }
-        printf("\n");
-    } 
-    printf("\n");
+        tensor_iter_next(&iter);
+    }
 }
 
-void tensor_display(tensor_t* tensor){
-    shape_display(tensor->shape);
-    switch(TENSOR_NUM_DIMS(tensor)){
-        case 1:
-            tensor_display_dim_1(tensor);
-            break;
-        case 2:
-            tensor_display_dim_2(tensor);
-            break;
-        case 3:
-            tensor_display_dim_3(tensor);
-            break;
-        default:
-            NDEBUG(0, "Display not supported for tensors of dimension greater than three!");
+// dest <- source, converted to the dtype of dest
+static void convert_into(tensor_t* dest_tensor, tensor_t* source_tensor){
+    NDEBUG_ASSERT(shape_equal(dest_tensor->shape, source_tensor->shape), "Converted tensors must have the same shape!\n");
+    tensor_t* contiguous_tensor = tensor_contiguous(source_tensor);
+    convert_context_t context = {.dest = dest_tensor, .source = contiguous_tensor};
+    if(tensor_is_contiguous(dest_tensor)){
+        parallel_for(tensor_get_size(dest_tensor), parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE), &convert_range, &context);
+    }else{
+        shape_t* operand_shapes[2] = {dest_tensor->shape, dest_tensor->shape};
+        const size_t* operand_strides[2] = {dest_tensor->strides, dest_tensor->shape->strides};
+        broadcast_plan_init(&context.plan, dest_tensor->shape, 2, operand_shapes, operand_strides);
+        size_t grain_size = MAX(parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE) / context.plan.row_length, 1);
+        parallel_for(context.plan.num_rows, grain_size, &convert_rows_range, &context);
+    }
+    release_temporary(contiguous_tensor, source_tensor);
+}
+
+static tensor_t* convert(tensor_t* tensor, tensor_dtype_t dtype, quantization_t quantization){
+    tensor_t* new_tensor = tensor_empty_with_dtype(tensor->shape, dtype);
+    new_tensor->quantization = quantization;
+    convert_into(new_tensor, tensor);
+    return new_tensor;
+}
+
+tensor_t* tensor_to_dtype(tensor_t* tensor, tensor_dtype_t dtype){
+    if(tensor->dtype == dtype){
+        return tensor;
+    }
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor) + tensor_get_size(tensor) * dtype_get_size(dtype));
+    NDEBUG_ASSERT(dtype != TENSOR_INT8, "Tensors are converted to int8 with tensor_quantize!\n");
+    return convert(tensor, dtype, QUANTIZATION_NONE);
+}
+
+tensor_t* tensor_quantize(tensor_t* tensor, float scale, int32_t zero_point){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor) + tensor_get_size(tensor) * sizeof(int8_t));
+    NDEBUG_ASSERT(scale > 0, "Quantization scale must be positive!\n");
+    NDEBUG_ASSERT(QUANTIZATION_MIN <= zero_point && zero_point <= QUANTIZATION_MAX, "Quantization zero point must be an int8!\n");
+    return convert(tensor, TENSOR_INT8, (quantization_t) {scale, zero_point});
+}
+
+// zero is always in range, so that it is represented exactly
+quantization_t tensor_choose_quantization(tensor_t* tensor){
+    tensor_t* float_tensor = tensor_to_dtype(tensor, TENSOR_FLOAT32);
+    tensor_t* contiguous_tensor = tensor_contiguous(float_tensor);
+    float min = 0;
+    float max = 0;
+    for(size_t index = 0; index < tensor_get_size(tensor); index++){
+        min = MIN(min, contiguous_tensor->data[index]);
+        max = MAX(max, contiguous_tensor->data[index]);
     }
+    release_temporary(contiguous_tensor, float_tensor);
+    release_temporary(float_tensor, tensor);
+    float scale = (max - min) / (QUANTIZATION_MAX - QUANTIZATION_MIN);
+    if(scale == 0){
+        return QUANTIZATION_NONE;
+    }
+    int32_t zero_point = (int32_t) nearbyintf(QUANTIZATION_MIN - min / scale);
+    return (quantization_t) {scale, MAX(QUANTIZATION_MIN, MIN(QUANTIZATION_MAX, zero_point))};
+}
+
+double tensor_get_entry_as_double(tensor_t* tensor, size_t index){
+    return dtype_get_value(tensor->data, tensor->dtype, tensor->quantization, index);
+}
+
+// float16, bfloat16 and int8 are only stored, ops compute on them in float32
+static inline bool is_storage_dtype(tensor_dtype_t dtype){
+    return dtype != TENSOR_FLOAT32 && dtype != TENSOR_FLOAT64;
+}
+
+// returns tensor itself unless it has a storage dtype, and a float32 copy of it otherwise
+static inline tensor_t* widen(tensor_t* tensor){
+    return is_storage_dtype(tensor->dtype) ? tensor_to_dtype(tensor, TENSOR_FLOAT32) : tensor;
+}
+
+// of the result of an op on operands of left_dtype and right_dtype
+static inline tensor_dtype_t result_dtype(tensor_dtype_t left_dtype, tensor_dtype_t right_dtype){
+    return (left_dtype == right_dtype && left_dtype != TENSOR_INT8) ? left_dtype : TENSOR_FLOAT32;
 }
 
 /**
- * VIEWS - TODO
+ * BROADCAST COMPATIBILITY
 */
 
 // returns true if and only if tensor dimensions match exactly
@@ -217,177 +611,709 @@ bool tensor_broadcast_compatible(tensor_t* left_tensor, tensor_t* right_tensor){
     return shape_broadcast_compatible(left_tensor->shape, right_tensor->shape);
 }
 
+static bool entries_contain_zero(const tensor_entry_t* entries, size_t size){
+    bool contains_zero = false;
+    for(size_t index = 0; index < size; index++){
+        contains_zero |= (entries[index] == 0);
+    }
+    return contains_zero;
+}
+
+/**
+ * BINARY KERNELS
+ * generated per op from the op tables (see ops.h), with the op fixed at compile time so that the inner
+ * loops are inlined and vectorize, whether the operands are contiguous, scalar or strided
+ * loads happen before stores, so dest may alias either source exactly
+*/
+
+// dest <- op(left, right), all of which hold size contiguous entries
+typedef void (* contiguous_binary_kernel_t)(tensor_entry_t* dest, const tensor_entry_t* left, const tensor_entry_t* right, size_t size);
+// dest <- op(entries, value) or dest <- op(value, entries)
+typedef void (* scalar_binary_kernel_t)(tensor_entry_t* dest, const tensor_entry_t* entries, tensor_entry_t value, size_t size);
+// dest <- op(left, right) along size entries, each stepped over with its own stride
+typedef void (* strided_binary_kernel_t)(tensor_entry_t* dest, const tensor_entry_t* left, const tensor_entry_t* right, size_t dest_stride, size_t left_stride, size_t right_stride, size_t size);
+// the strided kernel of float64 entries
+typedef void (* f64_binary_kernel_t)(double* dest, const double* left, const double* right, size_t dest_stride, size_t left_stride, size_t right_stride, size_t size);
+
+typedef struct {
+    strided_binary_kernel_t strided_kernel;
+    contiguous_binary_kernel_t contiguous_kernel;
+    scalar_binary_kernel_t scalar_right_kernel;
+    scalar_binary_kernel_t scalar_left_kernel;
+    f64_binary_kernel_t f64_kernel;
+    bool check_nonzero_right; // right entries must be non-zero (division)
+} binary_kernels_t;
+
+#define DEFINE_BINARY_KERNELS(op, TAG, simd_fn, entry_expression, check_nonzero_right)                                       \
+    static inline tensor_entry_t op##_entry(tensor_entry_t x, tensor_entry_t y){                                         \
+        return (entry_expression);                                                                                       \
+    }                                                                                                                    \
+    static void op##_contiguous_kernel(tensor_entry_t* dest, const tensor_entry_t* left, const tensor_entry_t* right, size_t size){ \
+        size_t index = 0;                                                                                                \
+        for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){                                                          \
+            simd_store(dest + index, simd_fn(simd_load(left + index), simd_load(right + index)));                        \
+        }                                                                                                                \
+        for(; index < size; index++){                                                                                    \
+            dest[index] = op##_entry(left[index], right[index]);                                                         \
+        }                                                                                                                \
+    }                                                                                                                    \
+    static void op##_scalar_right_kernel(tensor_entry_t* dest, const tensor_entry_t* entries, tensor_entry_t value, size_t size){ \
+        simd_vec_t value_vec = simd_set1(value);                                                                         \
+        size_t index = 0;                                                                                                \
+        for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){                                                          \
+            simd_store(dest + index, simd_fn(simd_load(entries + index), value_vec));                                    \
+        }                                                                                                                \
+        for(; index < size; index++){                                                                                    \
+            dest[index] = op##_entry(entries[index], value);                                                             \
+        }                                                                                                                \
+    }                                                                                                                    \
+    static void op##_scalar_left_kernel(tensor_entry_t* dest, const tensor_entry_t* entries, tensor_entry_t value, size_t size){ \
+        simd_vec_t value_vec = simd_set1(value);                                                                         \
+        size_t index = 0;                                                                                                \
+        for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){                                                          \
+            simd_store(dest + index, simd_fn(value_vec, simd_load(entries + index)));                                    \
+        }                                                                                                                \
+        for(; index < size; index++){                                                                                    \
+            dest[index] = op##_entry(value, entries[index]);                                                             \
+        }                                                                                                                \
+    }                                                                                                                    \
+    static void op##_strided_kernel(tensor_entry_t* dest, const tensor_entry_t* left, const tensor_entry_t* right, size_t dest_stride, size_t left_stride, size_t right_stride, size_t size){ \
+        for(size_t index = 0; index < size; index++){                                                                    \
+            dest[index * dest_stride] = op##_entry(left[index * left_stride], right[index * right_stride]);              \
+        }                                                                                                                \
+    }                                                                                                                    \
+    static inline double op##_f64_entry(double x, double y){                                                             \
+        return (entry_expression);                                                                                       \
+    }                                                                                                                    \
+    static void op##_f64_kernel(double* dest, const double* left, const double* right, size_t dest_stride, size_t left_stride, size_t right_stride, size_t size){ \
+        for(size_t index = 0; index < size; index++){                                                                    \
+            dest[index * dest_stride] = op##_f64_entry(left[index * left_stride], right[index * right_stride]);          \
+        }                                                                                                                \
+    }                                                                                                                    \
+    static const binary_kernels_t op##_kernels = {                                                                       \
+        &op##_strided_kernel, &op##_contiguous_kernel, &op##_scalar_right_kernel, &op##_scalar_left_kernel,              \
+        &op##_f64_kernel, check_nonzero_right                                                                            \
+    };
+
+CORAL_BINARY_OPS(DEFINE_BINARY_KERNELS)
+
 /**
- * tensor_entry_t x tensor_entry_t -> tensor_entry_t
- * tensor_entry_t -> tensor_entry_t
+ * PARALLEL KERNELS
+ * run a contiguous or scalar kernel over chunks of PARALLEL_OP_ELEMENTWISE entries
 */
 
-static inline tensor_entry_t tensor_entry_add(tensor_entry_t left_entry, tensor_entry_t right_entry) {
-    return left_entry + right_entry;
+typedef struct {
+    contiguous_binary_kernel_t contiguous_kernel;
+    scalar_binary_kernel_t scalar_kernel;
+    tensor_entry_t* dest;
+    const tensor_entry_t* left;
+    const tensor_entry_t* right; // unused by scalar kernels
+    tensor_entry_t value;
+    size_t block_size; // length of the repeated right (or left) block of a suffix broadcast
+} kernel_context_t;
+
+static void contiguous_kernel_range(void* raw_context, size_t begin, size_t end){
+    kernel_context_t* context = (kernel_context_t*) raw_context;
+    (*context->contiguous_kernel)(context->dest + begin, context->left + begin, context->right + begin, end - begin);
 }
 
-static inline tensor_entry_t tensor_entry_multiply(tensor_entry_t left_entry, tensor_entry_t right_entry) {
-    return left_entry * right_entry;
+static void scalar_kernel_range(void* raw_context, size_t begin, size_t end){
+    kernel_context_t* context = (kernel_context_t*) raw_context;
+    (*context->scalar_kernel)(context->dest + begin, context->left + begin, context->value, end - begin);
 }
 
-static inline tensor_entry_t tensor_entry_subtract(tensor_entry_t left_entry, tensor_entry_t right_entry) {
-    return left_entry - right_entry;
+// [begin, end) are blocks, the block is read from right
+static void suffix_right_kernel_range(void* raw_context, size_t begin, size_t end){
+    kernel_context_t* context = (kernel_context_t*) raw_context;
+    for(size_t offset = begin * context->block_size; offset < end * context->block_size; offset += context->block_size){
+        (*context->contiguous_kernel)(context->dest + offset, context->left + offset, context->right, context->block_size);
+    }
 }
 
-static inline tensor_entry_t tensor_entry_divide(tensor_entry_t left_entry, tensor_entry_t right_entry) {
-    NDEBUG_ASSERT(right_entry != 0, "Cannot divide by zero!");
-    return left_entry / right_entry;
+// [begin, end) are blocks, the block is read from left
+static void suffix_left_kernel_range(void* raw_context, size_t begin, size_t end){
+    kernel_context_t* context = (kernel_context_t*) raw_context;
+    for(size_t offset = begin * context->block_size; offset < end * context->block_size; offset += context->block_size){
+        (*context->contiguous_kernel)(context->dest + offset, context->left, context->right + offset, context->block_size);
+    }
 }
 
-static inline tensor_entry_t tensor_entry_abs_grad(tensor_entry_t entry){
-    return entry >= 0 ? 1 : -1;
+static void parallel_contiguous_kernel(contiguous_binary_kernel_t kernel, tensor_entry_t* dest, const tensor_entry_t* left, const tensor_entry_t* right, size_t size){
+    kernel_context_t context = {kernel, NULL, dest, left, right, 0, 0};
+    parallel_for(size, parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE), &contiguous_kernel_range, &context);
 }
 
-static inline tensor_entry_t tensor_entry_abs(tensor_entry_t entry){
-    return entry >= 0 ? entry : -entry;
+static void parallel_scalar_kernel(scalar_binary_kernel_t kernel, tensor_entry_t* dest, const tensor_entry_t* entries, tensor_entry_t value, size_t size){
+    kernel_context_t context = {NULL, kernel, dest, entries, NULL, value, 0};
+    parallel_for(size, parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE), &scalar_kernel_range, &context);
 }
 
-// called when dim_index + 1 = dest_tensor->shape->num_dims
-void base_in_place_broadcast(tensor_t* dest_tensor, tensor_t* source_tensor1, tensor_t* source_tensor2, size_t dest_offset, size_t offset1, size_t offset2, int dim_index, tensor_entry_binary_fn_t tensor_entry_binary_fn){
-    size_t offset1_diff = (source_tensor1->shape->dims[dim_index] > 1) ? source_tensor1->shape->strides[dim_index] : 0;
-    size_t offset2_diff = (source_tensor2->shape->dims[dim_index] > 1) ? source_tensor2->shape->strides[dim_index] : 0;
-    size_t dest_offset_diff = (dest_tensor->shape->dims[dim_index] > 1) ? dest_tensor->shape->strides[dim_index] : 0; 
-    size_t dim_length = MAX(source_tensor1->shape->dims[dim_index], source_tensor2->shape->dims[dim_index]);
-    for(size_t index = 0; index < dim_length; index++){
-        tensor_entry_t source_entry1 = tensor_get_entry(source_tensor1, offset1 + index * offset1_diff);
-        tensor_entry_t source_entry2 = tensor_get_entry(source_tensor2, offset2 + index * offset2_diff);
-        tensor_entry_t new_entry = (*tensor_entry_binary_fn)(source_entry1, source_entry2);
-        tensor_set_entry(dest_tensor, dest_offset + index * dest_offset_diff, new_entry);
-    }    
-    return;
+static void parallel_suffix_kernel(contiguous_binary_kernel_t kernel, tensor_entry_t* dest, const tensor_entry_t* left, const tensor_entry_t* right, size_t size, size_t block_size, bool block_on_right){
+    kernel_context_t context = {kernel, NULL, dest, left, right, 0, block_size};
+    size_t grain_size = MAX(parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE) / block_size, 1);
+    parallel_for(size / block_size, grain_size, block_on_right ? &suffix_right_kernel_range : &suffix_left_kernel_range, &context);
 }
 
-void recursive_in_place_broadcast_fn(tensor_t* dest_tensor, tensor_t* source_tensor1, tensor_t* source_tensor2, size_t dest_offset, size_t offset1, size_t offset2, int dim_index, tensor_entry_binary_fn_t tensor_entry_binary_fn){
-    // base case
-    if(dim_index + 1 == TENSOR_NUM_DIMS(dest_tensor)){
-        base_in_place_broadcast(dest_tensor, source_tensor1, source_tensor2, dest_offset, offset1, offset2, dim_index, tensor_entry_binary_fn);
-        return;
+/**
+ * handles the broadcasts which reduce to flat loops, namely when
+ * (1) both sources have the shape of dest
+ * (2) one of the sources is a scalar
+ * (3) one source has the shape of dest, and the other matches a trailing suffix of it
+ * returns false if the strided fallback is needed
+*/
+// right_tensor must be contiguous when kernels check it for zeros
+static bool fast_in_place_broadcast(tensor_t* dest_tensor, tensor_t* left_tensor, tensor_t* right_tensor, const binary_kernels_t* kernels){
+    size_t size = tensor_get_size(dest_tensor);
+    size_t left_size = tensor_get_size(left_tensor);
+    size_t right_size = tensor_get_size(right_tensor);
+    if(kernels->check_nonzero_right){
+        NDEBUG_ASSERT(!entries_contain_zero(right_tensor->data, right_size), "Cannot divide by zero!");
     }
-    size_t offset1_diff = (source_tensor1->shape->dims[dim_index] > 1) ? source_tensor1->shape->strides[dim_index] : 0;
-    size_t offset2_diff = (source_tensor2->shape->dims[dim_index] > 1) ? source_tensor2->shape->strides[dim_index] : 0;
-    size_t dest_offset_diff = (dest_tensor->shape->dims[dim_index] > 1) ? dest_tensor->shape->strides[dim_index] : 0;
-    size_t dim_length = MAX(source_tensor1->shape->dims[dim_index], source_tensor2->shape->dims[dim_index]);
-    for(size_t index = 0; index < dim_length; index++){
-        recursive_in_place_broadcast_fn(dest_tensor, source_tensor1, source_tensor2, dest_offset + index * dest_offset_diff, offset1 + index * offset1_diff, offset2 + index * offset2_diff, dim_index + 1, tensor_entry_binary_fn);
+    if(!tensor_is_contiguous(dest_tensor) || !tensor_is_contiguous(left_tensor) || !tensor_is_contiguous(right_tensor)){
+        return false;
     }
-}
-
-void in_place_broadcast_fn(tensor_t* dest_tensor, tensor_t* source_tensor1, tensor_t* source_tensor2, tensor_entry_binary_fn_t tensor_entry_binary_fn){
-    NDEBUG_ASSERT(dest_tensor != source_tensor1 && dest_tensor != source_tensor2, "Destination and source tensors cannot alias the same memory - undefined behavior!");
-    NDEBUG_ASSERT(shape_equal(shape_get_broadcast_shape(source_tensor1->shape, source_tensor2->shape), dest_tensor->shape), "Destination tensor has improper shape!");
-    shape_display(source_tensor1->shape);
-    shape_display(source_tensor2->shape);
-    NDEBUG_ASSERT(tensor_broadcast_compatible(source_tensor1, source_tensor2), "Tensors are not broadcast compatible!\n");
-    int source_dims1 = TENSOR_NUM_DIMS(source_tensor1);
-    int source_dims2 = TENSOR_NUM_DIMS(source_tensor2);
-    // pad the smaller tensor with leading dimensions of length 1 so that both tensors have the same number of dimensions
-    if(source_dims1 < source_dims2){
-        source_tensor1 = tensor_view_as_shape(source_tensor1, shape_extend_to_dims(source_tensor1->shape, source_dims2));
-    }else if(source_dims1 > source_dims2){
-        source_tensor2 = tensor_view_as_shape(source_tensor2, shape_extend_to_dims(source_tensor2->shape, source_dims1));
-    }
-    recursive_in_place_broadcast_fn(dest_tensor, source_tensor1, source_tensor2, 0, 0, 0, 0, tensor_entry_binary_fn);
-}
-
-// TODO : allow for broadcasting of different sizes
-tensor_t* tensor_broadcast_fn(tensor_t* left_tensor, tensor_t* right_tensor, tensor_entry_binary_fn_t tensor_entry_binary_fn){
-    // ensure that left_tensor->num_dims >= right_tensor->num_dims
-    tensor_t* new_tensor = tensor_new(shape_get_broadcast_shape(left_tensor->shape, right_tensor->shape));
-    in_place_broadcast_fn(new_tensor, left_tensor, right_tensor, tensor_entry_binary_fn);
-    return new_tensor;
+    if(left_size == size && right_size == size){
+        parallel_contiguous_kernel(kernels->contiguous_kernel, dest_tensor->data, left_tensor->data, right_tensor->data, size);
+    }else if(right_size == 1){
+        parallel_scalar_kernel(kernels->scalar_right_kernel, dest_tensor->data, left_tensor->data, right_tensor->data[0], size);
+    }else if(left_size == 1){
+        parallel_scalar_kernel(kernels->scalar_left_kernel, dest_tensor->data, right_tensor->data, left_tensor->data[0], size);
+    }else if(left_size == size && shape_is_trailing_suffix(right_tensor->shape, dest_tensor->shape)){
+        parallel_suffix_kernel(kernels->contiguous_kernel, dest_tensor->data, left_tensor->data, right_tensor->data, size, right_size, true);
+    }else if(right_size == size && shape_is_trailing_suffix(left_tensor->shape, dest_tensor->shape)){
+        parallel_suffix_kernel(kernels->contiguous_kernel, dest_tensor->data, left_tensor->data, right_tensor->data, size, left_size, false);
+    }else{
+        return false;
+    }
+    return true;
 }
 
 /**
- * sums along a subset of the dimensions so that the resulting tensor has shape target_shape
+ * ACCUMULATING KERNELS
+ * dest <- dest + left * right, where left and right are broadcast to the shape of dest
 */
-tensor_t* tensor_reduce_to_shape(tensor_t* tensor, shape_t* target_shape){
-    NDEBUG_ASSERT(shape_broadcast_compatible(tensor->shape, target_shape), "Tensor is not compatible with target shape.");
-    NDEBUG_ASSERT(target_shape->num_dims <= TENSOR_NUM_DIMS(tensor), "Target shape has too many dimensions.");
-    shape_t* extended_target_shape = shape_extend_to_dims(target_shape, TENSOR_NUM_DIMS(tensor));
-    tensor_t* reduced_tensor = tensor_new(extended_target_shape);
-    recursive_in_place_broadcast_fn(reduced_tensor, reduced_tensor, tensor, 0, 0, 0, 0, &tensor_entry_add);
-    return tensor_view_as_shape(reduced_tensor, target_shape);
+
+static void add_multiply_contiguous_kernel(tensor_entry_t* dest, const tensor_entry_t* left, const tensor_entry_t* right, size_t size){
+    size_t index = 0;
+    for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){
+        simd_store(dest + index, simd_fmadd(simd_load(left + index), simd_load(right + index), simd_load(dest + index)));
+    }
+    for(; index < size; index++){
+        dest[index] += left[index] * right[index];
+    }
+}
+
+static void add_multiply_scalar_kernel(tensor_entry_t* dest, const tensor_entry_t* entries, tensor_entry_t value, size_t size){
+    simd_vec_t value_vec = simd_set1(value);
+    size_t index = 0;
+    for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){
+        simd_store(dest + index, simd_fmadd(simd_load(entries + index), value_vec, simd_load(dest + index)));
+    }
+    for(; index < size; index++){
+        dest[index] += entries[index] * value;
+    }
 }
 
 /**
- * MUTATING FUNCTIONS
- * tensor_in_place_op(left_tensor, right_tensor) sets
- * left_tensor <- op(left_tensor, right_tensor)
+ * STRIDED BROADCASTS
+ * broadcasts without a flat loop run over the rows of their broadcast plan (see iter.h), split over the
+ * worker pool, with the contiguous and scalar kernels used for every row they apply to
 */
 
+typedef struct {
+    broadcast_plan_t plan; // copied, the cached plan may be replaced by nested ops
+    tensor_entry_t* dest;
+    const tensor_entry_t* left;
+    const tensor_entry_t* right;
+    const binary_kernels_t* kernels; // NULL to accumulate dest <- dest + left * right
+} broadcast_context_t;
+
+// dest <- op(left, right) along a row of length entries
+static inline void binary_row(const binary_kernels_t* kernels, tensor_entry_t* dest, const tensor_entry_t* left, const tensor_entry_t* right, size_t dest_stride, size_t left_stride, size_t right_stride, size_t length){
+    if(dest_stride == 1 && left_stride == 1 && right_stride == 1){
+        (*kernels->contiguous_kernel)(dest, left, right, length);
+    }else if(dest_stride == 1 && left_stride == 1 && right_stride == 0){
+        (*kernels->scalar_right_kernel)(dest, left, right[0], length);
+    }else if(dest_stride == 1 && left_stride == 0 && right_stride == 1){
+        (*kernels->scalar_left_kernel)(dest, right, left[0], length);
+    }else{
+        (*kernels->strided_kernel)(dest, left, right, dest_stride, left_stride, right_stride, length);
+    }
+}
+
+// dest <- dest + left * right along a row
+static inline void add_multiply_row(tensor_entry_t* dest, const tensor_entry_t* left, const tensor_entry_t* right, size_t dest_stride, size_t left_stride, size_t right_stride, size_t length){
+    if(dest_stride == 1 && left_stride == 1 && right_stride == 1){
+        add_multiply_contiguous_kernel(dest, left, right, length);
+    }else if(dest_stride == 1 && left_stride == 1 && right_stride == 0){
+        add_multiply_scalar_kernel(dest, left, right[0], length);
+    }else if(dest_stride == 1 && left_stride == 0 && right_stride == 1){
+        add_multiply_scalar_kernel(dest, right, left[0], length);
+    }else{
+        for(size_t index = 0; index < length; index++){
+            dest[index * dest_stride] += left[index * left_stride] * right[index * right_stride];
+        }
+    }
+}
+
+static void broadcast_rows_range(void* raw_context, size_t begin, size_t end){
+    broadcast_context_t* context = (broadcast_context_t*) raw_context;
+    const broadcast_plan_t* plan = &context->plan;
+    int row_dim = plan->num_dims - 1;
+    size_t dest_stride = plan->strides[0][row_dim];
+    size_t left_stride = plan->strides[1][row_dim];
+    size_t right_stride = plan->strides[2][row_dim];
+    tensor_iter_t iter;
+    tensor_iter_init(&iter, plan, begin);
+    for(size_t row = begin; row < end; row++){
+        tensor_entry_t* dest = context->dest + iter.offsets[0];
+        const tensor_entry_t* left = context->left + iter.offsets[1];
+        const tensor_entry_t* right = context->right + iter.offsets[2];
+        if(context->kernels){
+            binary_row(context->kernels, dest, left, right, dest_stride, left_stride, right_stride, plan->row_length);
+        }else{
+            add_multiply_row(dest, left, right, dest_stride, left_stride, right_stride, plan->row_length);
+        }
+        tensor_iter_next(&iter);
+    }
+}
+
+// true when several indices of tensor address the same entry, as in an expanded view
+static bool tensor_repeats_entries(tensor_t* tensor){
+    if(tensor_is_contiguous(tensor)){
+        return false;
+    }
+    for(int dim_index = 0; dim_index < TENSOR_NUM_DIMS(tensor); dim_index++){
+        if(tensor->shape->dims[dim_index] > 1 && tensor->strides[dim_index] == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+// dest is never broadcast, so its rows are disjoint and can be split over the worker pool
+// (dest may be a strided view, but not an expanded one)
+static void parallel_broadcast(tensor_t* dest_tensor, tensor_t* left_tensor, tensor_t* right_tensor, const binary_kernels_t* kernels){
+    NDEBUG_ASSERT(!tensor_repeats_entries(dest_tensor), "Destination tensor cannot be an expanded view!\n");
+    shape_t* operand_shapes[3] = {dest_tensor->shape, left_tensor->shape, right_tensor->shape};
+    broadcast_context_t context = {.dest = dest_tensor->data, .left = left_tensor->data, .right = right_tensor->data, .kernels = kernels};
+    if(tensor_is_contiguous(dest_tensor) && tensor_is_contiguous(left_tensor) && tensor_is_contiguous(right_tensor)){
+        context.plan = *broadcast_plan_get(dest_tensor->shape, 3, operand_shapes);
+    }else{
+        const size_t* operand_strides[3] = {tensor_get_strides(dest_tensor), tensor_get_strides(left_tensor), tensor_get_strides(right_tensor)};
+        broadcast_plan_init(&context.plan, dest_tensor->shape, 3, operand_shapes, operand_strides);
+    }
+    size_t grain_size = MAX(parallel_get_grain_size(PARALLEL_OP_BROADCAST) / context.plan.row_length, 1);
+    parallel_for(context.plan.num_rows, grain_size, &broadcast_rows_range, &context);
+}
+
+// number of entries from the first entry of tensor to its last one, inclusive
+static size_t tensor_get_extent(tensor_t* tensor){
+    if(tensor_is_contiguous(tensor) || tensor_get_size(tensor) == 0){
+        return tensor_get_size(tensor);
+    }
+    size_t extent = 1;
+    for(int dim_index = 0; dim_index < TENSOR_NUM_DIMS(tensor); dim_index++){
+        extent += (tensor->shape->dims[dim_index] - 1) * tensor->strides[dim_index];
+    }
+    return extent;
+}
+
+bool tensor_shares_memory(tensor_t* left_tensor, tensor_t* right_tensor){
+    if(!left_tensor->data || !right_tensor->data){
+        return false;
+    }
+    const char* left_begin = (const char*) left_tensor->data;
+    const char* left_end = (const char*) tensor_get_data_at(left_tensor, tensor_get_extent(left_tensor));
+    const char* right_begin = (const char*) right_tensor->data;
+    const char* right_end = (const char*) tensor_get_data_at(right_tensor, tensor_get_extent(right_tensor));
+    return left_begin < right_end && right_begin < left_end;
+}
+
+// the destination may share memory with a source only if it is exactly that source (laid out the same way),
+// in which case every entry is read before it is overwritten
+static bool alias_safe(tensor_t* dest_tensor, tensor_t* source_tensor){
+    if(!tensor_shares_memory(dest_tensor, source_tensor)){
+        return true;
+    }
+    if(!shape_equal(dest_tensor->shape, source_tensor->shape)){
+        return false;
+    }
+    const size_t* dest_strides = tensor_get_strides(dest_tensor);
+    const size_t* source_strides = tensor_get_strides(source_tensor);
+    for(int dim_index = 0; dim_index < TENSOR_NUM_DIMS(dest_tensor); dim_index++){
+        if(dest_tensor->shape->dims[dim_index] > 1 && dest_strides[dim_index] != source_strides[dim_index]){
+            return false;
+        }
+    }
+    return source_tensor->data == dest_tensor->data;
+}
 
 /**
- * Adds right_tensor to left_tensor
- */
-void tensor_in_place_add(tensor_t* left_tensor, tensor_t* right_tensor){
-    NDEBUG_ASSERT(shape_equal(shape_get_broadcast_shape(left_tensor->shape, right_tensor->shape), left_tensor->shape), "Left tensor has improper shape for in place operation!");
-    left_tensor->data = tensor_add(left_tensor, right_tensor)->data;
+ * FLOAT64 BROADCASTS
+ * float64 is for gradient checks rather than throughput, so it runs serially over the rows of its plan
+*/
+
+// right_tensor must be contiguous when kernels check it for zeros
+static void f64_broadcast(tensor_t* dest_tensor, tensor_t* left_tensor, tensor_t* right_tensor, const binary_kernels_t* kernels){
+    if(kernels->check_nonzero_right){
+        bool contains_zero = false;
+        for(size_t index = 0; index < tensor_get_size(right_tensor); index++){
+            contains_zero |= (((const double*) right_tensor->data)[index] == 0);
+        }
+        NDEBUG_ASSERT(!contains_zero, "Cannot divide by zero!");
+    }
+    shape_t* operand_shapes[3] = {dest_tensor->shape, left_tensor->shape, right_tensor->shape};
+    const size_t* operand_strides[3] = {tensor_get_strides(dest_tensor), tensor_get_strides(left_tensor), tensor_get_strides(right_tensor)};
+    broadcast_plan_t plan;
+    broadcast_plan_init(&plan, dest_tensor->shape, 3, operand_shapes, operand_strides);
+    int row_dim = plan.num_dims - 1;
+    tensor_iter_t iter;
+    tensor_iter_init(&iter, &plan, 0);
+    for(size_t row = 0; row < plan.num_rows; row++){
+        (*kernels->f64_kernel)((double*) dest_tensor->data + iter.offsets[0], (const double*) left_tensor->data + iter.offsets[1], (const double*) right_tensor->data + iter.offsets[2],
+                               plan.strides[0][row_dim], plan.strides[1][row_dim], plan.strides[2][row_dim], plan.row_length);
+        tensor_iter_next(&iter);
+    }
 }
 
-void tensor_in_place_subtract(tensor_t* left_tensor, tensor_t* right_tensor){
-    NDEBUG_ASSERT(shape_equal(shape_get_broadcast_shape(left_tensor->shape, right_tensor->shape), left_tensor->shape), "Left tensor has improper shape for in place operation!");
-    left_tensor->data = tensor_subtract(left_tensor, right_tensor)->data;
+void in_place_broadcast_fn(tensor_t* dest_tensor, tensor_t* source_tensor1, tensor_t* source_tensor2, const binary_kernels_t* kernels);
+
+// computes in float32, a destination of a storage dtype is narrowed from a float32 temporary
+// an in place op (dest_tensor is source_tensor1) computes into the widened source
+static void widened_broadcast(tensor_t* dest_tensor, tensor_t* source_tensor1, tensor_t* source_tensor2, const binary_kernels_t* kernels){
+    tensor_t* left_tensor = widen(source_tensor1);
+    tensor_t* right_tensor = widen(source_tensor2);
+    tensor_t* wide_dest_tensor = dest_tensor;
+    if(is_storage_dtype(dest_tensor->dtype)){
+        wide_dest_tensor = (dest_tensor == source_tensor1) ? left_tensor : tensor_empty(dest_tensor->shape);
+    }
+    in_place_broadcast_fn(wide_dest_tensor, left_tensor, right_tensor, kernels);
+    if(wide_dest_tensor != dest_tensor){
+        convert_into(dest_tensor, wide_dest_tensor);
+        release_temporary(wide_dest_tensor, left_tensor);
+    }
+    release_temporary(left_tensor, source_tensor1);
+    release_temporary(right_tensor, source_tensor2);
 }
 
-void tensor_in_place_multiply(tensor_t* left_tensor, tensor_t* right_tensor){
-    NDEBUG_ASSERT(shape_equal(shape_get_broadcast_shape(left_tensor->shape, right_tensor->shape), left_tensor->shape), "Left tensor has improper shape for in place operation!");
-    left_tensor = tensor_multiply(left_tensor, right_tensor);
+// dest_tensor <- op(source_tensor1, source_tensor2), writes into dest_tensor's buffer without allocating
+// (unless an operand has a storage dtype)
+void in_place_broadcast_fn(tensor_t* dest_tensor, tensor_t* source_tensor1, tensor_t* source_tensor2, const binary_kernels_t* kernels){
+    NDEBUG_ASSERT(!tensor_repeats_entries(dest_tensor), "Destination tensor cannot be an expanded view!\n");
+    NDEBUG_ASSERT(alias_safe(dest_tensor, source_tensor1) && alias_safe(dest_tensor, source_tensor2), "Destination tensor may only alias a source of the same shape - undefined behavior!");
+    NDEBUG_ASSERT(tensor_broadcast_compatible(source_tensor1, source_tensor2), "Tensors are not broadcast compatible!\n");
+    NDEBUG_ASSERT(shape_is_broadcast_of(dest_tensor->shape, source_tensor1->shape, source_tensor2->shape), "Destination tensor has improper shape!");
+    if(is_storage_dtype(dest_tensor->dtype) || is_storage_dtype(source_tensor1->dtype) || is_storage_dtype(source_tensor2->dtype)){
+        widened_broadcast(dest_tensor, source_tensor1, source_tensor2, kernels);
+        return;
+    }
+    if(source_tensor1->dtype != dest_tensor->dtype || source_tensor2->dtype != dest_tensor->dtype){
+        // mixed float32 and float64, computed in the dtype of the destination
+        tensor_t* left_tensor = tensor_to_dtype(source_tensor1, dest_tensor->dtype);
+        tensor_t* right_tensor = tensor_to_dtype(source_tensor2, dest_tensor->dtype);
+        in_place_broadcast_fn(dest_tensor, left_tensor, right_tensor, kernels);
+        release_temporary(left_tensor, source_tensor1);
+        release_temporary(right_tensor, source_tensor2);
+        return;
+    }
+    // the zero check reads the entries of the right source in memory order
+    tensor_t* right_tensor = kernels->check_nonzero_right ? tensor_contiguous(source_tensor2) : source_tensor2;
+    if(dest_tensor->dtype == TENSOR_FLOAT64){
+        f64_broadcast(dest_tensor, source_tensor1, right_tensor, kernels);
+    }else if(!fast_in_place_broadcast(dest_tensor, source_tensor1, right_tensor, kernels)){
+        parallel_broadcast(dest_tensor, source_tensor1, right_tensor, kernels);
+    }
+    release_temporary(right_tensor, source_tensor2);
 }
 
-void tensor_in_place_divide(tensor_t* left_tensor, tensor_t* right_tensor){
-    NDEBUG_ASSERT(shape_equal(shape_get_broadcast_shape(left_tensor->shape, right_tensor->shape), left_tensor->shape), "Left tensor has improper shape for in place operation!");
-    left_tensor = tensor_divide(left_tensor, right_tensor);
+/**
+ * dest_tensor <- dest_tensor + left_tensor * right_tensor
+ * used to accumulate gradients without materializing the product
+*/
+void tensor_in_place_add_multiply(tensor_t* dest_tensor, tensor_t* left_tensor, tensor_t* right_tensor){
+    PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(dest_tensor) + tensor_get_size_in_bytes(left_tensor) + tensor_get_size_in_bytes(right_tensor));
+    ASSERT_FLOAT32(dest_tensor);
+    ASSERT_FLOAT32(left_tensor);
+    ASSERT_FLOAT32(right_tensor);
+    NDEBUG_ASSERT(alias_safe(dest_tensor, left_tensor) && alias_safe(dest_tensor, right_tensor), "Destination tensor may only alias a source of the same shape - undefined behavior!");
+    NDEBUG_ASSERT(shape_broadcasts_to(left_tensor->shape, dest_tensor->shape) && shape_broadcasts_to(right_tensor->shape, dest_tensor->shape), "Destination tensor has improper shape for accumulation!");
+    size_t size = tensor_get_size(dest_tensor);
+    size_t left_size = tensor_get_size(left_tensor);
+    size_t right_size = tensor_get_size(right_tensor);
+    if(!tensor_is_contiguous(dest_tensor) || !tensor_is_contiguous(left_tensor) || !tensor_is_contiguous(right_tensor)){
+        parallel_broadcast(dest_tensor, left_tensor, right_tensor, NULL);
+    }else if(left_size == size && right_size == size){
+        parallel_contiguous_kernel(&add_multiply_contiguous_kernel, dest_tensor->data, left_tensor->data, right_tensor->data, size);
+    }else if(left_size == 1 && right_size == 1){
+        parallel_scalar_kernel(&add_scalar_right_kernel, dest_tensor->data, dest_tensor->data, left_tensor->data[0] * right_tensor->data[0], size);
+    }else if(right_size == 1 && left_size == size){
+        parallel_scalar_kernel(&add_multiply_scalar_kernel, dest_tensor->data, left_tensor->data, right_tensor->data[0], size);
+    }else if(left_size == 1 && right_size == size){
+        parallel_scalar_kernel(&add_multiply_scalar_kernel, dest_tensor->data, right_tensor->data, left_tensor->data[0], size);
+    }else{
+        parallel_broadcast(dest_tensor, left_tensor, right_tensor, NULL);
+    }
 }
 
-void tensor_in_place_multiply_by_scalar(tensor_t* tensor, tensor_entry_t value){
+/**
+ * dest_tensor <- dest_tensor + alpha * tensor
+*/
+void tensor_in_place_add_scaled(tensor_t* dest_tensor, tensor_t* tensor, tensor_entry_t alpha){
+    PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(dest_tensor) + tensor_get_size_in_bytes(tensor));
+    ASSERT_FLOAT32(dest_tensor);
+    ASSERT_FLOAT32(tensor);
+    NDEBUG_ASSERT(alias_safe(dest_tensor, tensor), "Destination tensor may only alias a source of the same shape - undefined behavior!");
+    NDEBUG_ASSERT(shape_broadcasts_to(tensor->shape, dest_tensor->shape), "Destination tensor has improper shape for accumulation!");
+    size_t size = tensor_get_size(dest_tensor);
     size_t tensor_size = tensor_get_size(tensor);
-    for(size_t index = 0; index < tensor_size; index++){
-        tensor_entry_t new_value = tensor_entry_multiply(tensor_get_entry(tensor, index), value);
-        tensor_set_entry(tensor, index, new_value);
+    bool contiguous = tensor_is_contiguous(dest_tensor) && tensor_is_contiguous(tensor);
+    if(contiguous && tensor_size == size){
+        parallel_scalar_kernel(&add_multiply_scalar_kernel, dest_tensor->data, tensor->data, alpha, size);
+    }else if(contiguous && tensor_size == 1){
+        parallel_scalar_kernel(&add_scalar_right_kernel, dest_tensor->data, dest_tensor->data, alpha * tensor->data[0], size);
+    }else{
+        // wrap alpha in a stack allocated scalar tensor for the strided fallback
+        size_t scalar_dims[1] = {1};
+        tensor_t scalar_tensor = {&alpha, shape_new(1, scalar_dims), false, NULL, TENSOR_FLOAT32, QUANTIZATION_NONE};
+        parallel_broadcast(dest_tensor, tensor, &scalar_tensor, NULL);
     }
 }
 
-void tensor_in_place_divide_by_scalar(tensor_t* tensor, tensor_entry_t value){
-    size_t tensor_size = tensor_get_size(tensor);
-    for(size_t index = 0; index < tensor_size; index++){
-        tensor_entry_t new_value = tensor_entry_divide(tensor_get_entry(tensor, index), value);
-        tensor_set_entry(tensor, index, new_value);
+tensor_t* tensor_broadcast_fn(tensor_t* left_tensor, tensor_t* right_tensor, const binary_kernels_t* kernels){
+    shape_t* shape = shape_get_broadcast_shape(left_tensor->shape, right_tensor->shape);
+    tensor_t* new_tensor = tensor_empty_with_dtype(shape, result_dtype(left_tensor->dtype, right_tensor->dtype));
+    in_place_broadcast_fn(new_tensor, left_tensor, right_tensor, kernels);
+    return new_tensor;
+}
+
+/**
+ * MATRIX MULTIPLICATION
+ * the last two dimensions are matrix dimensions, any leading dimensions are batch dimensions
+ * (... x) m x k @ (... x) k x n -> (... x) m x n
+ * a 2-D operand is broadcast across the batch dimensions of the other
+ * float64 operands multiply in float64, int8 ones with int32 accumulation into a float32 result, and
+ * other storage dtypes (or mixed int8 ones) are widened to float32
+*/
+
+// batches whose products are at least this many multiply-adds are parallelized inside gemm instead
+#define MATMUL_PARALLEL_GEMM_THRESHOLD (1 << 18)
+
+typedef struct {
+    bool transpose_left;
+    bool transpose_right;
+    size_t m;
+    size_t n;
+    size_t k;
+    tensor_t* left_tensor;
+    size_t left_stride;
+    size_t left_batch_stride;
+    tensor_t* right_tensor;
+    size_t right_stride;
+    size_t right_batch_stride;
+    tensor_t* dest_tensor;
+    size_t dest_batch_stride;
+} batched_matmul_context_t;
+
+static void batched_matmul_range(void* raw_context, size_t begin, size_t end){
+    batched_matmul_context_t* context = (batched_matmul_context_t*) raw_context;
+    tensor_t* left_tensor = context->left_tensor;
+    tensor_t* right_tensor = context->right_tensor;
+    for(size_t batch = begin; batch < end; batch++){
+        const void* left_data = tensor_get_data_at(left_tensor, batch * context->left_batch_stride);
+        const void* right_data = tensor_get_data_at(right_tensor, batch * context->right_batch_stride);
+        void* dest_data = tensor_get_data_at(context->dest_tensor, batch * context->dest_batch_stride);
+        switch(left_tensor->dtype){
+            case TENSOR_FLOAT64:
+                gemm_multiply_f64(context->transpose_left, context->transpose_right, context->m, context->n, context->k,
+                                  1, (const double*) left_data, context->left_stride, (const double*) right_data, context->right_stride,
+                                  0, (double*) dest_data, context->n);
+                break;
+            case TENSOR_INT8:
+                gemm_multiply_i8(context->transpose_left, context->transpose_right, context->m, context->n, context->k,
+                                 left_tensor->quantization.scale * right_tensor->quantization.scale,
+                                 (const int8_t*) left_data, context->left_stride, left_tensor->quantization.zero_point,
+                                 (const int8_t*) right_data, context->right_stride, right_tensor->quantization.zero_point,
+                                 (float*) dest_data, context->n);
+                break;
+            default:
+                gemm_multiply(context->transpose_left, context->transpose_right, context->m, context->n, context->k,
+                              1, (const float*) left_data, context->left_stride, (const float*) right_data, context->right_stride,
+                              0, (float*) dest_data, context->n);
+        }
     }
 }
 
 /**
- *  NON-MUTATING FUNCTIONS
+ * gemm reads row-major matrices, or their transposes, so an operand which is a transposed view of a contiguous
+ * tensor (see tensor_transpose) is multiplied through its contiguous storage with the transpose flag flipped,
+ * and any other strided operand is copied
 */
+static tensor_t* matmul_operand(tensor_t* tensor, bool* transpose){
+    if(tensor_is_contiguous(tensor)){
+        return tensor;
+    }
+    int num_dims = TENSOR_NUM_DIMS(tensor);
+    size_t rows = tensor->shape->dims[num_dims - 2];
+    size_t columns = tensor->shape->dims[num_dims - 1];
+    bool transposed = tensor->strides[num_dims - 2] == 1 && tensor->strides[num_dims - 1] == rows;
+    size_t batch_stride = rows * columns;
+    for(int dim_index = num_dims - 3; dim_index >= 0; dim_index--){
+        transposed = transposed && (tensor->shape->dims[dim_index] == 1 || tensor->strides[dim_index] == batch_stride);
+        batch_stride *= tensor->shape->dims[dim_index];
+    }
+    if(!transposed){
+        return tensor_contiguous(tensor);
+    }
+    size_t dims[TENSOR_MAX_DIMS];
+    memcpy(dims, tensor->shape->dims, num_dims * sizeof(size_t));
+    dims[num_dims - 2] = columns;
+    dims[num_dims - 1] = rows;
+    tensor_t* storage = (tensor_t*) arena_malloc(sizeof(tensor_t));
+    *storage = (tensor_t) {tensor->data, shape_new(num_dims, dims), false, NULL, tensor->dtype, tensor->quantization};
+    *transpose = !*transpose;
+    return storage;
+}
 
-// return new tensor which is the result of component-wise addition 
-// of left_tensor and right_tensor
-// assumes that left_tensor and right_tensor are compatible
-tensor_t* tensor_add(tensor_t* left_tensor, tensor_t* right_tensor){
-    return tensor_broadcast_fn(left_tensor, right_tensor, &tensor_entry_add);
+// writes the product into dest_tensor, or into a new tensor when it is NULL
+static tensor_t* matmul_into(tensor_t* dest_tensor, tensor_t* left_operand, tensor_t* right_operand, bool transpose_left, bool transpose_right){
+    NDEBUG_ASSERT(TENSOR_NUM_DIMS(left_operand) >= 2 && TENSOR_NUM_DIMS(right_operand) >= 2, "Matrix multiplication requires tensors with at least two dimensions!\n");
+    bool quantized = left_operand->dtype == TENSOR_INT8 && right_operand->dtype == TENSOR_INT8;
+    // float64 when both operands are, and float32 otherwise
+    bool both_float64 = left_operand->dtype == TENSOR_FLOAT64 && right_operand->dtype == TENSOR_FLOAT64;
+    tensor_dtype_t operand_dtype = both_float64 ? TENSOR_FLOAT64 : TENSOR_FLOAT32;
+    tensor_t* wide_left_operand = quantized ? left_operand : tensor_to_dtype(left_operand, operand_dtype);
+    tensor_t* wide_right_operand = quantized ? right_operand : tensor_to_dtype(right_operand, operand_dtype);
+    tensor_t* left_tensor = matmul_operand(wide_left_operand, &transpose_left);
+    tensor_t* right_tensor = matmul_operand(wide_right_operand, &transpose_right);
+    int left_dims = TENSOR_NUM_DIMS(left_tensor);
+    int right_dims = TENSOR_NUM_DIMS(right_tensor);
+    NDEBUG_ASSERT(left_dims >= 2 && right_dims >= 2, "Matrix multiplication requires tensors with at least two dimensions!\n");
+    size_t left_rows = left_tensor->shape->dims[left_dims - 2];
+    size_t left_columns = left_tensor->shape->dims[left_dims - 1];
+    size_t right_rows = right_tensor->shape->dims[right_dims - 2];
+    size_t right_columns = right_tensor->shape->dims[right_dims - 1];
+    size_t m = transpose_left ? left_columns : left_rows;
+    size_t k = transpose_left ? left_rows : left_columns;
+    size_t n = transpose_right ? right_rows : right_columns;
+    NDEBUG_ASSERT(k == (transpose_right ? right_columns : right_rows), "Inner dimensions of matrix multiplication do not match!\n");
+    NDEBUG_ASSERT(left_dims == 2 || right_dims == 2 || left_dims == right_dims, "Batch dimensions of matrix multiplication do not match!\n");
+    // batch dimensions are taken from the operand with more dimensions
+    shape_t* batch_shape = (left_dims >= right_dims) ? left_tensor->shape : right_tensor->shape;
+    int num_dims = batch_shape->num_dims;
+    size_t dims[num_dims];
+    size_t batch_count = 1;
+    for(int dim_index = 0; dim_index < num_dims - 2; dim_index++){
+        NDEBUG_ASSERT(left_dims == 2 || right_dims == 2 || left_tensor->shape->dims[dim_index] == right_tensor->shape->dims[dim_index], "Batch dimensions of matrix multiplication do not match!\n");
+        dims[dim_index] = batch_shape->dims[dim_index];
+        batch_count *= dims[dim_index];
+    }
+    dims[num_dims - 2] = m;
+    dims[num_dims - 1] = n;
+    // gemm overwrites the product (beta is 0)
+    shape_t* shape = shape_new(num_dims, dims);
+    tensor_dtype_t dtype = quantized ? TENSOR_FLOAT32 : left_tensor->dtype;
+    tensor_t* new_tensor = dest_tensor ? dest_tensor : tensor_empty_with_dtype(shape, dtype);
+    NDEBUG_ASSERT(shape_equal(new_tensor->shape, shape) && new_tensor->dtype == dtype && tensor_is_contiguous(new_tensor), "Destination tensor has improper shape for the matrix product!\n");
+    batched_matmul_context_t context = {
+        transpose_left, transpose_right, m, n, k,
+        left_tensor, left_columns, (left_dims > 2) ? left_rows * left_columns : 0,
+        right_tensor, right_columns, (right_dims > 2) ? right_rows * right_columns : 0,
+        new_tensor, m * n
+    };
+    if(batch_count > 1 && !transpose_left && context.right_batch_stride == 0){
+        // the batch of left matrices is one tall matrix when the right matrix is shared
+        context.m *= batch_count;
+        batch_count = 1;
+    }
+    if(batch_count == 1 || context.m * n * k >= MATMUL_PARALLEL_GEMM_THRESHOLD){
+        batched_matmul_range(&context, 0, batch_count);
+    }else{
+        parallel_for(batch_count, 1, &batched_matmul_range, &context);
+    }
+    release_temporary(left_tensor, wide_left_operand);
+    release_temporary(right_tensor, wide_right_operand);
+    release_temporary(wide_left_operand, left_operand);
+    release_temporary(wide_right_operand, right_operand);
+    return new_tensor;
 }
 
-tensor_t* tensor_subtract(tensor_t* left_tensor, tensor_t* right_tensor){
-    return tensor_broadcast_fn(left_tensor, right_tensor, &tensor_entry_subtract);
+// as tensor_matmul, but multiplies the transpose of the last two dimensions of either operand if requested
+tensor_t* tensor_matmul_transposed(tensor_t* left_operand, tensor_t* right_operand, bool transpose_left, bool transpose_right){
+    // the product is counted as allocated
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(left_operand) + tensor_get_size_in_bytes(right_operand));
+    return matmul_into(NULL, left_operand, right_operand, transpose_left, transpose_right);
 }
 
-tensor_t* tensor_multiply(tensor_t* left_tensor, tensor_t* right_tensor){
-    return tensor_broadcast_fn(left_tensor, right_tensor, &tensor_entry_multiply);
+tensor_t* tensor_matmul(tensor_t* left_tensor, tensor_t* right_tensor){
+    return tensor_matmul_transposed(left_tensor, right_tensor, false, false);
 }
 
-tensor_t* tensor_divide(tensor_t* left_tensor, tensor_t* right_tensor){
-    return tensor_broadcast_fn(left_tensor, right_tensor, &tensor_entry_divide);
+void tensor_matmul_into(tensor_t* dest_tensor, tensor_t* left_tensor, tensor_t* right_tensor){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(left_tensor) + tensor_get_size_in_bytes(right_tensor) + tensor_get_size_in_bytes(dest_tensor));
+    matmul_into(dest_tensor, left_tensor, right_tensor, false, false);
 }
 
+/**
+ * MUTATING FUNCTIONS
+ * tensor_in_place_op(left_tensor, right_tensor) sets
+ * left_tensor <- op(left_tensor, right_tensor)
+*/
+
+
+// the result is written straight into left_tensor's buffer, no temporaries are allocated
+#define DEFINE_BINARY_IN_PLACE_OP(op, TAG, simd_fn, entry_expression, check_nonzero_right)                               \
+    void tensor_in_place_##op(tensor_t* left_tensor, tensor_t* right_tensor){                                            \
+        PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(left_tensor) + tensor_get_size_in_bytes(right_tensor));           \
+        NDEBUG_ASSERT(shape_broadcasts_to(right_tensor->shape, left_tensor->shape), "Left tensor has improper shape for in place operation!"); \
+        in_place_broadcast_fn(left_tensor, left_tensor, right_tensor, &op##_kernels);                                    \
+    }
+
+CORAL_BINARY_OPS(DEFINE_BINARY_IN_PLACE_OP)
+
+#define DEFINE_BINARY_INTO_OP(op, TAG, simd_fn, entry_expression, check_nonzero_right)                                   \
+    void tensor_##op##_into(tensor_t* dest_tensor, tensor_t* left_tensor, tensor_t* right_tensor){                       \
+        PROFILE_TENSOR_OP(tensor_get_size_in_bytes(dest_tensor) + tensor_get_size_in_bytes(left_tensor) + tensor_get_size_in_bytes(right_tensor)); \
+        in_place_broadcast_fn(dest_tensor, left_tensor, right_tensor, &op##_kernels);                                    \
+    }
+
+CORAL_BINARY_OPS(DEFINE_BINARY_INTO_OP)
+
+void tensor_in_place_multiply_by_scalar(tensor_t* tensor, tensor_entry_t value){
+    PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(tensor));
+    NDEBUG_ASSERT(tensor_is_contiguous(tensor), "Cannot set the entries of a strided view!\n");
+    ASSERT_FLOAT32(tensor);
+    parallel_scalar_kernel(&multiply_scalar_right_kernel, tensor->data, tensor->data, value, tensor_get_size(tensor));
+}
+
+void tensor_in_place_divide_by_scalar(tensor_t* tensor, tensor_entry_t value){
+    PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(tensor));
+    NDEBUG_ASSERT(value != 0, "Cannot divide by zero!");
+    NDEBUG_ASSERT(tensor_is_contiguous(tensor), "Cannot set the entries of a strided view!\n");
+    ASSERT_FLOAT32(tensor);
+    parallel_scalar_kernel(&divide_scalar_right_kernel, tensor->data, tensor->data, value, tensor_get_size(tensor));
+}
+
+/**
+ *  NON-MUTATING FUNCTIONS
+*/
+
+// return new tensor which is the result of component-wise op of left_tensor and right_tensor
+// assumes that left_tensor and right_tensor are compatible
+#define DEFINE_BINARY_OP(op, TAG, simd_fn, entry_expression, check_nonzero_right)                                        \
+    tensor_t* tensor_##op(tensor_t* left_tensor, tensor_t* right_tensor){                                                \
+        PROFILE_TENSOR_OP(broadcast_bytes_touched(left_tensor, right_tensor));                                           \
+        return tensor_broadcast_fn(left_tensor, right_tensor, &op##_kernels);                                            \
+    }
+
+CORAL_BINARY_OPS(DEFINE_BINARY_OP)
+
 tensor_t* tensor_multiply_by_scalar_grad(tensor_t* tensor, tensor_entry_t value){
     return tensor_new_like_with_value(tensor, value);
 }
 
 tensor_t* tensor_multiply_by_scalar(tensor_t* tensor, tensor_entry_t value){
+    PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(tensor));
     tensor_t* new_tensor = tensor_copy(tensor);
     tensor_in_place_multiply_by_scalar(new_tensor, value);
     return new_tensor;
@@ -399,41 +1325,563 @@ tensor_t* tensor_divide_by_scalar_grad(tensor_t* tensor, tensor_entry_t value){
 }
 
 tensor_t* tensor_divide_by_scalar(tensor_t* tensor, tensor_entry_t value){
+    PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(tensor));
     tensor_t* new_tensor = tensor_copy(tensor);
     tensor_in_place_divide_by_scalar(new_tensor, value);
     return new_tensor;
 }
 
-tensor_t* tensor_abs_grad(tensor_t* tensor){
-    tensor_t* grad_tensor = tensor_copy(tensor);
-    tensor_in_place_apply_entry_fn(grad_tensor, &tensor_entry_abs_grad);
-    return grad_tensor;
+/**
+ * UNARY OPS
+ * generated per op from the op tables (see ops.h), like the binary kernels
+ * contiguous tensors are a single flat loop, strided ones run over the rows of their plan
+*/
+
+// dest <- op(source) along size entries, stepped over with dest_stride and source_stride
+typedef void (* unary_kernel_t)(tensor_entry_t* dest, const tensor_entry_t* source, size_t dest_stride, size_t source_stride, size_t size);
+typedef void (* f64_unary_kernel_t)(double* dest, const double* source, size_t dest_stride, size_t source_stride, size_t size);
+
+typedef struct {
+    unary_kernel_t contiguous_kernel; // ignores the strides, which are 1
+    unary_kernel_t strided_kernel;
+    f64_unary_kernel_t f64_kernel;
+} unary_kernels_t;
+
+typedef struct {
+    const unary_kernels_t* kernels;
+    broadcast_plan_t plan; // strided tensors only
+    tensor_entry_t* dest;
+    const tensor_entry_t* source;
+} unary_context_t;
+
+static void unary_contiguous_range(void* raw_context, size_t begin, size_t end){
+    unary_context_t* context = (unary_context_t*) raw_context;
+    (*context->kernels->contiguous_kernel)(context->dest + begin, context->source + begin, 1, 1, end - begin);
 }
 
-tensor_t* tensor_abs(tensor_t* tensor){
-    tensor_t* new_tensor = tensor_copy(tensor);
-    tensor_in_place_apply_entry_fn(new_tensor, &tensor_entry_abs);
-    return new_tensor;
+static void unary_rows_range(void* raw_context, size_t begin, size_t end){
+    unary_context_t* context = (unary_context_t*) raw_context;
+    const broadcast_plan_t* plan = &context->plan;
+    size_t dest_stride = plan->strides[0][plan->num_dims - 1];
+    size_t source_stride = plan->strides[1][plan->num_dims - 1];
+    unary_kernel_t kernel = (dest_stride == 1 && source_stride == 1) ? context->kernels->contiguous_kernel : context->kernels->strided_kernel;
+    tensor_iter_t iter;
+    tensor_iter_init(&iter, plan, begin);
+    for(size_t row = begin; row < end; row++){
+        (*kernel)(context->dest + iter.offsets[0], context->source + iter.offsets[1], dest_stride, source_stride, plan->row_length);
+        tensor_iter_next(&iter);
+    }
 }
 
+// serially, as f64_broadcast
+static void f64_unary_apply(tensor_t* dest_tensor, tensor_t* source_tensor, const unary_kernels_t* kernels){
+    shape_t* operand_shapes[2] = {dest_tensor->shape, source_tensor->shape};
+    const size_t* operand_strides[2] = {tensor_get_strides(dest_tensor), tensor_get_strides(source_tensor)};
+    broadcast_plan_t plan;
+    broadcast_plan_init(&plan, dest_tensor->shape, 2, operand_shapes, operand_strides);
+    int row_dim = plan.num_dims - 1;
+    tensor_iter_t iter;
+    tensor_iter_init(&iter, &plan, 0);
+    for(size_t row = 0; row < plan.num_rows; row++){
+        (*kernels->f64_kernel)((double*) dest_tensor->data + iter.offsets[0], (const double*) source_tensor->data + iter.offsets[1],
+                               plan.strides[0][row_dim], plan.strides[1][row_dim], plan.row_length);
+        tensor_iter_next(&iter);
+    }
+}
+
+// dest <- op(source), where dest and source have the same shape, and dest is either source or does not overlap it
+// storage dtypes compute in float32, as widened_broadcast
+static void unary_apply(tensor_t* dest_tensor, tensor_t* source_tensor, const unary_kernels_t* kernels){
+    NDEBUG_ASSERT(!tensor_repeats_entries(dest_tensor), "Destination tensor cannot be an expanded view!\n");
+    if(is_storage_dtype(dest_tensor->dtype) || is_storage_dtype(source_tensor->dtype)){
+        tensor_t* wide_source_tensor = widen(source_tensor);
+        tensor_t* wide_dest_tensor = dest_tensor;
+        if(is_storage_dtype(dest_tensor->dtype)){
+            wide_dest_tensor = (dest_tensor == source_tensor) ? wide_source_tensor : tensor_empty(dest_tensor->shape);
+        }
+        unary_apply(wide_dest_tensor, wide_source_tensor, kernels);
+        if(wide_dest_tensor != dest_tensor){
+            convert_into(dest_tensor, wide_dest_tensor);
+            release_temporary(wide_dest_tensor, wide_source_tensor);
+        }
+        release_temporary(wide_source_tensor, source_tensor);
+        return;
+    }
+    if(source_tensor->dtype != dest_tensor->dtype){
+        tensor_t* converted_tensor = tensor_to_dtype(source_tensor, dest_tensor->dtype);
+        unary_apply(dest_tensor, converted_tensor, kernels);
+        release_temporary(converted_tensor, source_tensor);
+        return;
+    }
+    if(dest_tensor->dtype == TENSOR_FLOAT64){
+        f64_unary_apply(dest_tensor, source_tensor, kernels);
+        return;
+    }
+    unary_context_t context = {.kernels = kernels, .dest = dest_tensor->data, .source = source_tensor->data};
+    if(tensor_is_contiguous(dest_tensor) && tensor_is_contiguous(source_tensor)){
+        parallel_for(tensor_get_size(dest_tensor), parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE), &unary_contiguous_range, &context);
+        return;
+    }
+    shape_t* operand_shapes[2] = {dest_tensor->shape, source_tensor->shape};
+    const size_t* operand_strides[2] = {tensor_get_strides(dest_tensor), tensor_get_strides(source_tensor)};
+    broadcast_plan_init(&context.plan, dest_tensor->shape, 2, operand_shapes, operand_strides);
+    size_t grain_size = MAX(parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE) / context.plan.row_length, 1);
+    parallel_for(context.plan.num_rows, grain_size, &unary_rows_range, &context);
+}
+
+#define DEFINE_UNARY_OP(op, TAG, entry_expression)                                                                       \
+    static inline tensor_entry_t op##_entry(tensor_entry_t x){                                                           \
+        return (entry_expression);                                                                                       \
+    }                                                                                                                    \
+    static void op##_unary_contiguous_kernel(tensor_entry_t* dest, const tensor_entry_t* source, size_t dest_stride, size_t source_stride, size_t size){ \
+        UNUSED(dest_stride);                                                                                             \
+        UNUSED(source_stride);                                                                                           \
+        for(size_t index = 0; index < size; index++){                                                                    \
+            dest[index] = op##_entry(source[index]);                                                                     \
+        }                                                                                                                \
+    }                                                                                                                    \
+    static void op##_unary_strided_kernel(tensor_entry_t* dest, const tensor_entry_t* source, size_t dest_stride, size_t source_stride, size_t size){ \
+        for(size_t index = 0; index < size; index++){                                                                    \
+            dest[index * dest_stride] = op##_entry(source[index * source_stride]);                                       \
+        }                                                                                                                \
+    }                                                                                                                    \
+    static inline double op##_f64_entry(double x){                                                                       \
+        return (entry_expression);                                                                                       \
+    }                                                                                                                    \
+    static void op##_unary_f64_kernel(double* dest, const double* source, size_t dest_stride, size_t source_stride, size_t size){ \
+        for(size_t index = 0; index < size; index++){                                                                    \
+            dest[index * dest_stride] = op##_f64_entry(source[index * source_stride]);                                   \
+        }                                                                                                                \
+    }                                                                                                                    \
+    static const unary_kernels_t op##_unary_kernels = {                                                                  \
+        &op##_unary_contiguous_kernel, &op##_unary_strided_kernel, &op##_unary_f64_kernel                                \
+    };                                                                                                                   \
+    tensor_t* tensor_##op(tensor_t* tensor){                                                                             \
+        PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(tensor));                                                         \
+        tensor_t* new_tensor = tensor_empty_with_dtype(tensor->shape, result_dtype(tensor->dtype, tensor->dtype));       \
+        unary_apply(new_tensor, tensor, &op##_unary_kernels);                                                            \
+        return new_tensor;                                                                                               \
+    }                                                                                                                    \
+    void tensor_in_place_##op(tensor_t* tensor){                                                                         \
+        PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(tensor));                                                         \
+        unary_apply(tensor, tensor, &op##_unary_kernels);                                                                \
+    }                                                                                                                    \
+    void tensor_##op##_into(tensor_t* dest_tensor, tensor_t* tensor){                                                    \
+        PROFILE_TENSOR_OP(tensor_get_size_in_bytes(dest_tensor) + tensor_get_size_in_bytes(tensor));                     \
+        NDEBUG_ASSERT(shape_equal(dest_tensor->shape, tensor->shape), "Destination tensor has improper shape!");         \
+        unary_apply(dest_tensor, tensor, &op##_unary_kernels);                                                           \
+    }
+
+CORAL_UNARY_OPS(DEFINE_UNARY_OP)
+
 tensor_t* tensor_sum_grad(tensor_t* tensor){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
     return tensor_new_like_with_value(tensor, 1.0);
 }
 
-tensor_t* tensor_sum(tensor_t* tensor){
-    size_t tensor_size = tensor_get_size(tensor);
+/**
+ * REDUCTIONS
+ * entries are summed in blocks of PARALLEL_OP_REDUCTION entries, each of which is summed pairwise
+ * down to runs of SUM_PAIRWISE_BLOCK entries with several independent vector accumulators,
+ * and the partial sums of the blocks are combined pairwise
+ * the blocks do not depend on the number of threads, so neither does the result
+*/
+
+#define SUM_NUM_ACCUMULATORS 4
+#define SUM_PAIRWISE_BLOCK 256
+
+static tensor_entry_t sum_entries_block(const tensor_entry_t* entries, size_t size){
+    simd_vec_t accumulators[SUM_NUM_ACCUMULATORS];
+    for(int accumulator = 0; accumulator < SUM_NUM_ACCUMULATORS; accumulator++){
+        accumulators[accumulator] = simd_set1(0);
+    }
+    size_t index = 0;
+    for(; index + SUM_NUM_ACCUMULATORS * SIMD_WIDTH <= size; index += SUM_NUM_ACCUMULATORS * SIMD_WIDTH){
+        for(int accumulator = 0; accumulator < SUM_NUM_ACCUMULATORS; accumulator++){
+            accumulators[accumulator] = simd_add(accumulators[accumulator], simd_load(entries + index + accumulator * SIMD_WIDTH));
+        }
+    }
+    simd_vec_t total = accumulators[0];
+    for(int accumulator = 1; accumulator < SUM_NUM_ACCUMULATORS; accumulator++){
+        total = simd_add(total, accumulators[accumulator]);
+    }
+    tensor_entry_t lanes[SIMD_WIDTH];
+    simd_store(lanes, total);
     tensor_entry_t sum = 0;
-    for(size_t index = 0; index < tensor_size; index++){
-        sum += tensor_get_entry(tensor, index);
+    for(int lane = 0; lane < SIMD_WIDTH; lane++){
+        sum += lanes[lane];
+    }
+    for(; index < size; index++){
+        sum += entries[index];
+    }
+    return sum;
+}
+
+// pairwise summation over halves, so that the error grows with the log of size rather than with size
+static tensor_entry_t sum_entries(const tensor_entry_t* entries, size_t size){
+    if(size <= SUM_PAIRWISE_BLOCK){
+        return sum_entries_block(entries, size);
+    }
+    size_t half = (size / 2 + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    return sum_entries(entries, half) + sum_entries(entries + half, size - half);
+}
+
+typedef struct {
+    const tensor_entry_t* entries;
+    size_t size;
+    size_t block_size;
+    tensor_entry_t* partial_sums;
+} sum_context_t;
+
+static void sum_block_range(void* raw_context, size_t begin, size_t end){
+    sum_context_t* context = (sum_context_t*) raw_context;
+    for(size_t block = begin; block < end; block++){
+        size_t offset = block * context->block_size;
+        size_t block_size = (offset + context->block_size < context->size) ? context->block_size : context->size - offset;
+        context->partial_sums[block] = sum_entries(context->entries + offset, block_size);
+    }
+}
+
+// combines partial sums in a balanced tree, overwriting them
+static tensor_entry_t tree_sum(tensor_entry_t* partial_sums, size_t count){
+    for(size_t stride = 1; stride < count; stride *= 2){
+        for(size_t index = 0; index + stride < count; index += 2 * stride){
+            partial_sums[index] += partial_sums[index + stride];
+        }
+    }
+    return partial_sums[0];
+}
+
+static tensor_entry_t parallel_sum_entries(const tensor_entry_t* entries, size_t size){
+    size_t block_size = parallel_get_grain_size(PARALLEL_OP_REDUCTION);
+    size_t num_blocks = (size + block_size - 1) / block_size;
+    if(num_blocks <= 1){
+        return sum_entries(entries, size);
+    }
+    tensor_entry_t* partial_sums = (tensor_entry_t*) malloc(num_blocks * sizeof(tensor_entry_t));
+    sum_context_t context = {entries, size, block_size, partial_sums};
+    parallel_for(num_blocks, 1, &sum_block_range, &context);
+    tensor_entry_t sum = tree_sum(partial_sums, num_blocks);
+    free(partial_sums);
+    return sum;
+}
+
+// pairwise as sum_entries, serially as float64 ops are
+static double sum_f64_entries(const double* entries, size_t size){
+    if(size <= SUM_PAIRWISE_BLOCK){
+        double sum = 0;
+        for(size_t index = 0; index < size; index++){
+            sum += entries[index];
+        }
+        return sum;
+    }
+    return sum_f64_entries(entries, size / 2) + sum_f64_entries(entries + size / 2, size - size / 2);
+}
+
+// float64 tensors sum to a float64 scalar, the others to a float32 one
+tensor_t* tensor_sum(tensor_t* tensor){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
+    size_t dims = 1;
+    if(tensor->dtype == TENSOR_FLOAT64){
+        tensor_t* contiguous_tensor = tensor_contiguous(tensor);
+        tensor_t* sum = tensor_empty_with_dtype(shape_new(1, &dims), TENSOR_FLOAT64);
+        *((double*) sum->data) = sum_f64_entries((const double*) contiguous_tensor->data, tensor_get_size(tensor));
+        release_temporary(contiguous_tensor, tensor);
+        return sum;
+    }
+    tensor_t* wide_tensor = widen(tensor);
+    tensor_t* contiguous_tensor = tensor_contiguous(wide_tensor);
+    tensor_t* sum = tensor_new_from_entry(parallel_sum_entries(contiguous_tensor->data, tensor_get_size(tensor)));
+    release_temporary(contiguous_tensor, wide_tensor);
+    release_temporary(wide_tensor, tensor);
+    return sum;
+}
+
+static tensor_entry_t max_entries(const tensor_entry_t* entries, size_t size){
+    tensor_entry_t max = entries[0];
+    size_t index = 0;
+    if(size >= SUM_NUM_ACCUMULATORS * SIMD_WIDTH){
+        simd_vec_t accumulators[SUM_NUM_ACCUMULATORS];
+        for(int accumulator = 0; accumulator < SUM_NUM_ACCUMULATORS; accumulator++){
+            accumulators[accumulator] = simd_load(entries + accumulator * SIMD_WIDTH);
+        }
+        for(index = SUM_NUM_ACCUMULATORS * SIMD_WIDTH; index + SUM_NUM_ACCUMULATORS * SIMD_WIDTH <= size; index += SUM_NUM_ACCUMULATORS * SIMD_WIDTH){
+            for(int accumulator = 0; accumulator < SUM_NUM_ACCUMULATORS; accumulator++){
+                accumulators[accumulator] = simd_max(accumulators[accumulator], simd_load(entries + index + accumulator * SIMD_WIDTH));
+            }
+        }
+        simd_vec_t total = accumulators[0];
+        for(int accumulator = 1; accumulator < SUM_NUM_ACCUMULATORS; accumulator++){
+            total = simd_max(total, accumulators[accumulator]);
+        }
+        tensor_entry_t lanes[SIMD_WIDTH];
+        simd_store(lanes, total);
+        for(int lane = 0; lane < SIMD_WIDTH; lane++){
+            max = MAX(max, lanes[lane]);
+        }
+    }
+    for(; index < size; index++){
+        max = MAX(max, entries[index]);
+    }
+    return max;
+}
+
+/**
+ * AXIS REDUCTIONS
+ * reduced dimensions are kept with length 1, so that the result broadcasts against the input
+ * runs of adjacent reduced (or kept) dimensions are merged, and each run of reduced dimensions
+ * is reduced in turn, innermost first, as an (outer x length x inner) tensor:
+ * when inner is 1 the run is contiguous and each result is a multi-accumulator reduction over it,
+ * otherwise rows of inner entries are combined elementwise with contiguous vector loads
+*/
+
+typedef enum {
+    REDUCE_SUM,
+    REDUCE_MAX
+} reduce_op_t;
+
+// rows are summed into a block buffer which is then added to dest, bounding the length of each serial sum
+#define REDUCE_ROW_BLOCK 64
+// columns handed to a thread at a time when rows are combined
+#define REDUCE_COLUMN_BLOCK 1024
+
+typedef struct {
+    const tensor_entry_t* source;
+    tensor_entry_t* dest;
+    size_t length;
+    size_t inner;
+    size_t num_column_blocks;
+    reduce_op_t op;
+} reduce_context_t;
+
+// dest[0:size] <- op(dest[0:size], row[0:size])
+static void combine_row(tensor_entry_t* dest, const tensor_entry_t* row, size_t size, reduce_op_t op){
+    size_t index = 0;
+    if(op == REDUCE_SUM){
+        for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){
+            simd_store(dest + index, simd_add(simd_load(dest + index), simd_load(row + index)));
+        }
+        for(; index < size; index++){
+            dest[index] += row[index];
+        }
+    }else{
+        for(; index + SIMD_WIDTH <= size; index += SIMD_WIDTH){
+            simd_store(dest + index, simd_max(simd_load(dest + index), simd_load(row + index)));
+        }
+        for(; index < size; index++){
+            dest[index] = MAX(dest[index], row[index]);
+        }
     }
-    return tensor_new_from_entry(sum);
+}
+
+// [begin, end) index the outer dimension
+static void reduce_contiguous_range(void* raw_context, size_t begin, size_t end){
+    reduce_context_t* context = (reduce_context_t*) raw_context;
+    for(size_t outer_index = begin; outer_index < end; outer_index++){
+        const tensor_entry_t* entries = context->source + outer_index * context->length;
+        context->dest[outer_index] = (context->op == REDUCE_SUM) ? sum_entries(entries, context->length) : max_entries(entries, context->length);
+    }
+}
+
+// [begin, end) index (outer index, column block) pairs
+static void reduce_rows_range(void* raw_context, size_t begin, size_t end){
+    reduce_context_t* context = (reduce_context_t*) raw_context;
+    tensor_entry_t block[REDUCE_COLUMN_BLOCK];
+    for(size_t task = begin; task < end; task++){
+        size_t outer_index = task / context->num_column_blocks;
+        size_t column = (task % context->num_column_blocks) * REDUCE_COLUMN_BLOCK;
+        size_t width = MIN(REDUCE_COLUMN_BLOCK, context->inner - column);
+        const tensor_entry_t* source = context->source + outer_index * context->length * context->inner + column;
+        tensor_entry_t* dest = context->dest + outer_index * context->inner + column;
+        memcpy(dest, source, width * sizeof(tensor_entry_t));
+        if(context->op == REDUCE_MAX){
+            for(size_t row = 1; row < context->length; row++){
+                combine_row(dest, source + row * context->inner, width, REDUCE_MAX);
+            }
+            continue;
+        }
+        for(size_t row_block = 1; row_block < context->length; row_block += REDUCE_ROW_BLOCK){
+            size_t row_block_end = MIN(row_block + REDUCE_ROW_BLOCK, context->length);
+            memcpy(block, source + row_block * context->inner, width * sizeof(tensor_entry_t));
+            for(size_t row = row_block + 1; row < row_block_end; row++){
+                combine_row(block, source + row * context->inner, width, REDUCE_SUM);
+            }
+            combine_row(dest, block, width, REDUCE_SUM);
+        }
+    }
+}
+
+// dest (outer x inner) <- op over the middle dimension of source (outer x length x inner)
+static void reduce_run(const tensor_entry_t* source, tensor_entry_t* dest, size_t outer, size_t length, size_t inner, reduce_op_t op){
+    size_t grain_size = parallel_get_grain_size(PARALLEL_OP_REDUCTION);
+    if(outer == 1 && inner == 1 && op == REDUCE_SUM){
+        dest[0] = parallel_sum_entries(source, length);
+    }else if(inner == 1){
+        reduce_context_t context = {source, dest, length, inner, 0, op};
+        parallel_for(outer, MAX(grain_size / length, 1), &reduce_contiguous_range, &context);
+    }else{
+        size_t num_column_blocks = (inner + REDUCE_COLUMN_BLOCK - 1) / REDUCE_COLUMN_BLOCK;
+        reduce_context_t context = {source, dest, length, inner, num_column_blocks, op};
+        size_t task_size = length * MIN(inner, REDUCE_COLUMN_BLOCK);
+        parallel_for(outer * num_column_blocks, MAX(grain_size / task_size, 1), &reduce_rows_range, &context);
+    }
+}
+
+// result <- tensor reduced along the dimensions flagged in is_reduced, writing the last run straight into result
+// (a contiguous float32 tensor of the size of the reduction, whatever its shape)
+// storage dtypes are reduced in float32, float64 tensors only by tensor_sum
+static void reduce_masked_into(tensor_t* result, tensor_t* tensor, bool* is_reduced, reduce_op_t op){
+    int num_dims = TENSOR_NUM_DIMS(tensor);
+    NDEBUG_ASSERT(tensor_get_size(tensor) > 0, "Cannot reduce a tensor of size zero!");
+    NDEBUG_ASSERT(tensor->dtype != TENSOR_FLOAT64, "Float64 tensors are only reduced by tensor_sum!\n");
+    NDEBUG_ASSERT(tensor_is_contiguous(result) && result->dtype == TENSOR_FLOAT32, "Reductions are written into contiguous float32 tensors!\n");
+    // (length, inner) of each run of reduced dimensions, innermost first
+    size_t run_lengths[TENSOR_MAX_DIMS];
+    size_t run_inners[TENSOR_MAX_DIMS];
+    int num_runs = 0;
+    size_t inner = 1;
+    for(int dim_index = num_dims - 1; dim_index >= 0;){
+        size_t length = 1;
+        bool reduced = is_reduced[dim_index];
+        for(; dim_index >= 0 && is_reduced[dim_index] == reduced; dim_index--){
+            length *= tensor->shape->dims[dim_index];
+        }
+        if(!reduced){
+            inner *= length;
+        }else if(length > 1){
+            run_lengths[num_runs] = length;
+            run_inners[num_runs] = inner;
+            num_runs++;
+        }
+    }
+    tensor_t* wide_tensor = widen(tensor);
+    tensor_t* contiguous_tensor = tensor_contiguous(wide_tensor);
+    if(num_runs == 0){
+        NDEBUG_ASSERT(tensor_get_size(result) == tensor_get_size(tensor), "Destination tensor has improper size for the reduction!\n");
+        memcpy(result->data, contiguous_tensor->data, tensor_get_size_in_bytes(result));
+        release_temporary(contiguous_tensor, wide_tensor);
+        release_temporary(wide_tensor, tensor);
+        return;
+    }
+    const tensor_entry_t* source = contiguous_tensor->data;
+    tensor_entry_t* buffer = NULL;
+    size_t current_size = tensor_get_size(tensor);
+    for(int run = 0; run < num_runs; run++){
+        size_t outer = current_size / (run_lengths[run] * run_inners[run]);
+        tensor_entry_t* dest = (run + 1 == num_runs) ? result->data : (tensor_entry_t*) malloc(outer * run_inners[run] * sizeof(tensor_entry_t));
+        reduce_run(source, dest, outer, run_lengths[run], run_inners[run], op);
+        free(buffer);
+        buffer = (run + 1 == num_runs) ? NULL : dest;
+        source = dest;
+        current_size = outer * run_inners[run];
+    }
+    NDEBUG_ASSERT(current_size == tensor_get_size(result), "Destination tensor has improper size for the reduction!\n");
+    release_temporary(contiguous_tensor, wide_tensor);
+    release_temporary(wide_tensor, tensor);
+}
+
+static tensor_t* reduce_masked(tensor_t* tensor, bool* is_reduced, reduce_op_t op){
+    int num_dims = TENSOR_NUM_DIMS(tensor);
+    size_t result_dims[TENSOR_MAX_DIMS];
+    for(int dim_index = 0; dim_index < num_dims; dim_index++){
+        result_dims[dim_index] = is_reduced[dim_index] ? 1 : tensor->shape->dims[dim_index];
+    }
+    // every entry of the result is written by the last run
+    tensor_t* result = tensor_empty(shape_new(num_dims, result_dims));
+    reduce_masked_into(result, tensor, is_reduced, op);
+    return result;
+}
+
+static tensor_t* reduce_dims(tensor_t* tensor, int num_reduced_dims, int* reduced_dims, reduce_op_t op){
+    bool is_reduced[TENSOR_MAX_DIMS] = {false};
+    for(int index = 0; index < num_reduced_dims; index++){
+        NDEBUG_ASSERT(0 <= reduced_dims[index] && reduced_dims[index] < TENSOR_NUM_DIMS(tensor), "Reduced dimension out of range!");
+        is_reduced[reduced_dims[index]] = true;
+    }
+    return reduce_masked(tensor, is_reduced, op);
+}
+
+// flags the dimensions of tensor which target_shape was broadcast along to reach the shape of tensor
+static void broadcast_dims_of(tensor_t* tensor, shape_t* target_shape, bool* is_reduced){
+    NDEBUG_ASSERT(shape_broadcasts_to(target_shape, tensor->shape), "Tensor is not compatible with target shape.");
+    int num_dims = TENSOR_NUM_DIMS(tensor);
+    int num_padded_dims = num_dims - target_shape->num_dims;
+    for(int dim_index = 0; dim_index < num_dims; dim_index++){
+        is_reduced[dim_index] = (dim_index < num_padded_dims) || (target_shape->dims[dim_index - num_padded_dims] == 1);
+    }
+}
+
+/**
+ * sums along the dimensions which tensor_shape was broadcast along to reach the shape of tensor,
+ * so that the resulting tensor has shape target_shape
+ * returns tensor itself when it already has shape target_shape
+*/
+tensor_t* tensor_reduce_to_shape(tensor_t* tensor, shape_t* target_shape){
+    if(shape_equal(tensor->shape, target_shape)){
+        return tensor;
+    }
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor) + target_shape->size * dtype_get_size(tensor->dtype));
+    int num_padded_dims = TENSOR_NUM_DIMS(tensor) - target_shape->num_dims;
+    bool is_reduced[TENSOR_MAX_DIMS];
+    broadcast_dims_of(tensor, target_shape, is_reduced);
+    tensor_t* reduced_tensor = reduce_masked(tensor, is_reduced, REDUCE_SUM);
+    if(num_padded_dims > 0){
+        tensor_in_place_view_as_shape(reduced_tensor, target_shape);
+    }
+    return reduced_tensor;
+}
+
+void tensor_reduce_to_shape_into(tensor_t* dest_tensor, tensor_t* tensor){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor) + tensor_get_size_in_bytes(dest_tensor));
+    bool is_reduced[TENSOR_MAX_DIMS];
+    broadcast_dims_of(tensor, dest_tensor->shape, is_reduced);
+    reduce_masked_into(dest_tensor, tensor, is_reduced, REDUCE_SUM);
+}
+
+void tensor_max_to_shape_into(tensor_t* dest_tensor, tensor_t* tensor){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor) + tensor_get_size_in_bytes(dest_tensor));
+    bool is_reduced[TENSOR_MAX_DIMS];
+    broadcast_dims_of(tensor, dest_tensor->shape, is_reduced);
+    reduce_masked_into(dest_tensor, tensor, is_reduced, REDUCE_MAX);
+}
+
+tensor_t* tensor_sum_dims(tensor_t* tensor, int num_reduced_dims, int* reduced_dims){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
+    return reduce_dims(tensor, num_reduced_dims, reduced_dims, REDUCE_SUM);
+}
+
+tensor_t* tensor_mean_dims(tensor_t* tensor, int num_reduced_dims, int* reduced_dims){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
+    tensor_t* sum = reduce_dims(tensor, num_reduced_dims, reduced_dims, REDUCE_SUM);
+    tensor_in_place_divide_by_scalar(sum, (tensor_entry_t) tensor_get_size(tensor) / tensor_get_size(sum));
+    return sum;
+}
+
+tensor_t* tensor_max_dims(tensor_t* tensor, int num_reduced_dims, int* reduced_dims){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
+    return reduce_dims(tensor, num_reduced_dims, reduced_dims, REDUCE_MAX);
+}
+
+// 1 where the entries are equal, 0 elsewhere, kept out of the op tables as tensor_equal compares whole tensors
+DEFINE_BINARY_KERNELS(equal, EQUAL, simd_equal, x == y, false)
+
+// d max / d tensor, where max_tensor = tensor_max_dims(tensor, ...)
+// the gradient is split evenly between entries which tie for the max
+tensor_t* tensor_max_dims_grad(tensor_t* tensor, tensor_t* max_tensor){
+    PROFILE_TENSOR_OP(2 * tensor_get_size_in_bytes(tensor) + tensor_get_size_in_bytes(max_tensor));
+    tensor_t* is_max = tensor_broadcast_fn(tensor, max_tensor, &equal_kernels);
+    tensor_t* num_maxima = tensor_reduce_to_shape(is_max, max_tensor->shape);
+    tensor_in_place_divide(is_max, num_maxima);
+    return is_max;
 }
 
 tensor_t* tensor_mean_grad(tensor_t* tensor){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
     return tensor_divide_by_scalar(tensor_new_like_with_value(tensor, 1), tensor_get_size(tensor));
 }
 
 tensor_t* tensor_mean(tensor_t* tensor){
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(tensor));
     NDEBUG_ASSERT(tensor_get_size(tensor), "Cannot take mean of tensor of size zero!");
     return tensor_divide_by_scalar(tensor_sum(tensor), tensor_get_size(tensor));
 }
@@ -442,3 +1890,117 @@ tensor_t* tensor_mean(tensor_t* tensor){
  * add tensor divide (with appropriate checks
  * add tensor divide in place )
 */
+
+/**
+ * BATCHES
+*/
+
+tensor_batch_t* tensor_batch_new(size_t num_tensors, shape_t* shape){
+    NDEBUG_ASSERT(num_tensors > 0, "Batches hold at least one tensor!\n");
+    NDEBUG_ASSERT(shape->num_dims < TENSOR_MAX_DIMS, "Batched tensors have too many dimensions!\n");
+    size_t dims[TENSOR_MAX_DIMS];
+    memcpy(dims, shape->dims, shape->num_dims * sizeof(size_t));
+    dims[shape->num_dims] = num_tensors;
+    tensor_batch_t* new_batch = (tensor_batch_t*) arena_malloc(sizeof(tensor_batch_t));
+    new_batch->storage = tensor_new(shape_new(shape->num_dims + 1, dims));
+    new_batch->shape = shape;
+    new_batch->num_tensors = num_tensors;
+    return new_batch;
+}
+
+void tensor_batch_release(tensor_batch_t* batch){
+    tensor_release(batch->storage);
+}
+
+tensor_t* tensor_batch_get(tensor_batch_t* batch, size_t index){
+    NDEBUG_ASSERT(index < batch->num_tensors, "Tensor out of range of the batch!\n");
+    size_t strides[TENSOR_MAX_DIMS];
+    for(int dim_index = 0; dim_index < batch->shape->num_dims; dim_index++){
+        strides[dim_index] = batch->shape->strides[dim_index] * batch->num_tensors;
+    }
+    return strided_view(batch->storage, batch->shape, strides, index);
+}
+
+void tensor_batch_set(tensor_batch_t* batch, size_t index, tensor_t* tensor){
+    NDEBUG_ASSERT(index < batch->num_tensors, "Tensor out of range of the batch!\n");
+    NDEBUG_ASSERT(shape_equal(tensor->shape, batch->shape), "Tensor does not have the shape of the batch!\n");
+    NDEBUG_ASSERT(tensor_is_contiguous(tensor), "Batched tensors must be contiguous!\n");
+    ASSERT_FLOAT32(tensor);
+    for(size_t entry = 0; entry < batch->shape->size; entry++){
+        batch->storage->data[entry * batch->num_tensors + index] = tensor->data[entry];
+    }
+}
+
+// as one op over the storage, whose batch dimension broadcasts like any other
+#define DEFINE_UNARY_BATCHED_OP(op, TAG, entry_expression)                                                               \
+    void tensor_##op##_batched(tensor_batch_t* dest_batch, tensor_batch_t* batch){                                       \
+        NDEBUG_ASSERT(dest_batch->num_tensors == batch->num_tensors, "Batches must hold the same number of tensors!\n"); \
+        tensor_##op##_into(dest_batch->storage, batch->storage);                                                         \
+    }
+
+CORAL_UNARY_OPS(DEFINE_UNARY_BATCHED_OP)
+
+#define DEFINE_BINARY_BATCHED_OP(op, TAG, simd_fn, entry_expression, check_nonzero_right)                                \
+    void tensor_##op##_batched(tensor_batch_t* dest_batch, tensor_batch_t* left_batch, tensor_batch_t* right_batch){     \
+        NDEBUG_ASSERT(dest_batch->num_tensors == left_batch->num_tensors, "Batches must hold the same number of tensors!\n"); \
+        NDEBUG_ASSERT(right_batch->num_tensors == left_batch->num_tensors || right_batch->num_tensors == 1, "Batches must hold the same number of tensors!\n"); \
+        NDEBUG_ASSERT(shape_equal(dest_batch->shape, left_batch->shape), "Destination batch has improper shape!\n");   \
+        NDEBUG_ASSERT(shape_broadcasts_to(right_batch->shape, left_batch->shape), "Batches are not broadcast compatible!\n"); \
+        tensor_##op##_into(dest_batch->storage, left_batch->storage, right_batch->storage);                              \
+    }
+
+CORAL_BINARY_OPS(DEFINE_BINARY_BATCHED_OP)
+
+typedef struct {
+    tensor_entry_t* dest;
+    const tensor_entry_t* left;
+    const tensor_entry_t* right;
+    size_t num_rows;
+    size_t inner_dim;
+    size_t num_columns;
+    size_t num_tensors; // stride between consecutive entries of a tensor
+} soa_matmul_context_t;
+
+// tensors [begin, end), each entry of the products a vector across them
+static void soa_matmul_range(void* raw_context, size_t begin, size_t end){
+    soa_matmul_context_t* context = (soa_matmul_context_t*) raw_context;
+    size_t stride = context->num_tensors;
+    for(size_t row = 0; row < context->num_rows; row++){
+        for(size_t column = 0; column < context->num_columns; column++){
+            tensor_entry_t* dest = context->dest + (row * context->num_columns + column) * stride;
+            size_t tensor = begin;
+            for(; tensor + SIMD_WIDTH <= end; tensor += SIMD_WIDTH){
+                simd_vec_t acc = simd_set1(0);
+                for(size_t inner = 0; inner < context->inner_dim; inner++){
+                    const tensor_entry_t* left = context->left + (row * context->inner_dim + inner) * stride;
+                    const tensor_entry_t* right = context->right + (inner * context->num_columns + column) * stride;
+                    acc = simd_fmadd(simd_load(left + tensor), simd_load(right + tensor), acc);
+                }
+                simd_store(dest + tensor, acc);
+            }
+            for(; tensor < end; tensor++){
+                tensor_entry_t acc = 0;
+                for(size_t inner = 0; inner < context->inner_dim; inner++){
+                    acc += context->left[(row * context->inner_dim + inner) * stride + tensor] * context->right[(inner * context->num_columns + column) * stride + tensor];
+                }
+                dest[tensor] = acc;
+            }
+        }
+    }
+}
+
+void tensor_matmul_batched(tensor_batch_t* dest_batch, tensor_batch_t* left_batch, tensor_batch_t* right_batch){
+    shape_t* left_shape = left_batch->shape;
+    shape_t* right_shape = right_batch->shape;
+    NDEBUG_ASSERT(left_shape->num_dims == 2 && right_shape->num_dims == 2 && dest_batch->shape->num_dims == 2, "Batched matmuls are of 2 dimensional tensors!\n");
+    NDEBUG_ASSERT(left_shape->dims[1] == right_shape->dims[0], "Batched tensors are not matmul compatible!\n");
+    NDEBUG_ASSERT(dest_batch->shape->dims[0] == left_shape->dims[0] && dest_batch->shape->dims[1] == right_shape->dims[1], "Destination batch has improper shape!\n");
+    NDEBUG_ASSERT(dest_batch->num_tensors == left_batch->num_tensors && right_batch->num_tensors == left_batch->num_tensors, "Batches must hold the same number of tensors!\n");
+    NDEBUG_ASSERT(dest_batch->storage->data != left_batch->storage->data && dest_batch->storage->data != right_batch->storage->data, "Batched matmuls cannot be in place!\n");
+    PROFILE_TENSOR_OP(tensor_get_size_in_bytes(dest_batch->storage) + tensor_get_size_in_bytes(left_batch->storage) + tensor_get_size_in_bytes(right_batch->storage));
+    soa_matmul_context_t context = {dest_batch->storage->data, left_batch->storage->data, right_batch->storage->data,
+                                        left_shape->dims[0], left_shape->dims[1], right_shape->dims[1], left_batch->num_tensors};
+    size_t work_per_tensor = left_shape->dims[0] * left_shape->dims[1] * right_shape->dims[1];
+    size_t grain_size = MAX(parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE) / work_per_tensor, SIMD_WIDTH);
+    parallel_for(left_batch->num_tensors, grain_size, &soa_matmul_range, &context);
+}
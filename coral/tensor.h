@@ -5,14 +5,20 @@
 #include <stdbool.h>
 #include "assert.h"
 #include "shape.h"
+#include "ops.h"
+#include "dtype.h"
 
 typedef float tensor_entry_t; 
 
-#define TENSOR_MAX_DIMS 3
+#define TENSOR_MAX_DIMS SHAPE_MAX_DIMS
 
 typedef struct {
     tensor_entry_t* data; // ptr to data
     shape_t* shape; //dimensions of data
+    bool owns_data; // data came from the buffer pool, views of the tensor point into it without owning it, see tensor_release
+    size_t* strides; // entries stepped over along each dimension, NULL when contiguous (the row-major strides of shape)
+    tensor_dtype_t dtype; // of the entries data points to, see dtype.h
+    quantization_t quantization; // int8 tensors only
 } tensor_t;
 
 // macros for debugging
@@ -27,12 +33,65 @@ typedef tensor_entry_t (* tensor_entry_unary_fn_t)(tensor_entry_t entry);
 // binary op: index: size_t -> entry: tensor_entry_t, used to populate a tensor
 typedef tensor_entry_t (* tensor_index_fn_t)(size_t index);
 
+// tensor data is aligned to TENSOR_ALIGNMENT bytes (views start wherever their first entry is)
+#define TENSOR_ALIGNMENT 64
+
 tensor_t* tensor_new(shape_t* shape);
+tensor_t* tensor_new_with_dtype(shape_t* shape, tensor_dtype_t dtype);
+// uninitialized, for tensors whose every entry is about to be overwritten
+tensor_t* tensor_empty(shape_t* shape);
+tensor_t* tensor_empty_with_dtype(shape_t* shape, tensor_dtype_t dtype);
+tensor_t* tensor_empty_like(tensor_t* tensor);
 tensor_t* tensor_new_like(tensor_t* old_tensor);
 tensor_t* tensor_new_like_with_value(tensor_t* old_tensor, tensor_entry_t value);
 tensor_t* tensor_new_zeros_like(tensor_t* old_tensor);
+tensor_t* tensor_new_from_entry(tensor_entry_t entry);
 tensor_t* tensor_copy(tensor_t* old_tensor);
 tensor_t* tensor_view_as_shape(tensor_t* tensor, shape_t* new_shape);
+// wraps contiguous entries the tensor does not own, and so never releases (e.g. those of a file mapping, see weights.h)
+tensor_t* tensor_new_from_data(void* data, shape_t* shape, tensor_dtype_t dtype, quantization_t quantization);
+void tensor_release(tensor_t* tensor);
+// tensors whose data has been allocated (from the buffer pool or the graph arena) so far, views excluded
+size_t tensor_get_num_allocations(void);
+
+/**
+ * STRIDED VIEWS
+ * views share the data of tensor, starting at an offset into it and stepping over it with arbitrary strides,
+ * so nothing is copied; see tensor_contiguous for a tensor whose entries are laid out row-major
+ * views never own the data, which tensor keeps owning, so releasing tensor invalidates its views
+ * any view can be read by an op, but an expanded one (a stride of 0 along a dimension longer than 1)
+ * cannot be the destination of an in place or _into op
+*/
+
+// swaps dimensions dim0 and dim1
+tensor_t* tensor_transpose(tensor_t* tensor, int dim0, int dim1);
+// dimension dim_index of the view is dimension dims[dim_index] of tensor
+tensor_t* tensor_permute(tensor_t* tensor, int* dims);
+// entries [start, end) along dimension dim
+tensor_t* tensor_slice(tensor_t* tensor, int dim, size_t start, size_t end);
+// broadcasts tensor to shape, repeating entries with stride 0
+tensor_t* tensor_expand(tensor_t* tensor, shape_t* shape);
+// returns tensor itself when it is contiguous, and a contiguous copy of it otherwise
+tensor_t* tensor_contiguous(tensor_t* tensor);
+// whether the memory spanned by the entries of left_tensor overlaps that spanned by right_tensor
+bool tensor_shares_memory(tensor_t* left_tensor, tensor_t* right_tensor);
+
+/**
+ * DTYPES
+ * tensors are float32 unless created or converted otherwise, see dtype.h for what each dtype supports
+ * the results of ops take the dtype of their operands (float32 when those differ, or are int8)
+ * operands are converted to the dtype of the destination, so mixed float32 and float64 ops run in float32
+ * unless they write into a float64 tensor
+*/
+
+// returns tensor itself when it already has dtype, and a contiguous converted copy of it otherwise
+// int8 tensors convert to any other dtype (dequantizing them), but are created with tensor_quantize
+tensor_t* tensor_to_dtype(tensor_t* tensor, tensor_dtype_t dtype);
+tensor_t* tensor_quantize(tensor_t* tensor, float scale, int32_t zero_point);
+// the asymmetric quantization which covers the range of the entries of tensor (and zero)
+quantization_t tensor_choose_quantization(tensor_t* tensor);
+// entry index (in memory order) of a tensor of any dtype, dequantized if need be
+double tensor_get_entry_as_double(tensor_t* tensor, size_t index);
 
 bool tensor_equal(tensor_t* left_tensor, tensor_t* right_tensor);
 
@@ -41,6 +100,7 @@ bool tensor_is_scalar(tensor_t* tensor);
 void tensor_set_to_scalar_value(tensor_t* tensor, tensor_entry_t value);
 void tensor_in_place_view_as_shape(tensor_t* tensor, shape_t* new_shape);
 void tensor_in_place_apply_index_fn(tensor_t* tensor, tensor_index_fn_t index_fn);
+// calls entry_fn for every entry, ops registered in ops.h run without the call
 void tensor_in_place_apply_entry_fn(tensor_t* tensor, tensor_entry_unary_fn_t entry_fn);
 
 /**
@@ -56,6 +116,17 @@ static inline tensor_entry_t index_identity(size_t index){
  * NOTE: in .h so they'll be inlined
 */
 
+static inline bool tensor_is_contiguous(tensor_t* tensor){
+    return tensor->strides == NULL;
+}
+
+static inline const size_t* tensor_get_strides(tensor_t* tensor){
+    return tensor->strides ? tensor->strides : tensor->shape->strides;
+}
+
+// entries are indexed in memory order from the first entry, i.e. row-major for contiguous tensors
+// and are float32, see tensor_get_entry_as_double for other dtypes
+
 static inline tensor_entry_t tensor_get_entry(tensor_t* tensor, size_t index){
     // DEBUG_ASSERT(!TENSOR_IN_BOUNDS_INDEX(tensor, index), "Out of bounds!\n");
     return tensor->data[index];
@@ -74,24 +145,91 @@ void tensor_display(tensor_t* tensor);
 
 tensor_t* tensor_reduce_to_shape(tensor_t* tensor, shape_t* target_shape);
 
-void tensor_in_place_add(tensor_t* left_tensor, tensor_t* right_tensor);
-void tensor_in_place_subtract(tensor_t* left_tensor, tensor_t* right_tensor);
-void tensor_in_place_multiply(tensor_t* left_tensor, tensor_t* right_tensor);
+/**
+ * ELEMENTWISE OPS
+ * generated from the op tables (see ops.h)
+ * tensor_in_place_op(left_tensor, right_tensor) sets left_tensor <- op(left_tensor, right_tensor), where
+ * right_tensor broadcasts to left_tensor, and tensor_op(left_tensor, right_tensor) returns the broadcast result
+ * tensor_op_into(dest_tensor, ...) writes the result of tensor_op into dest_tensor, which has its shape, without allocating
+*/
+
+#define DECLARE_UNARY_OP(name, TAG, entry_expression)                           \
+    tensor_t* tensor_##name(tensor_t* tensor);                                  \
+    void tensor_in_place_##name(tensor_t* tensor);                              \
+    void tensor_##name##_into(tensor_t* dest_tensor, tensor_t* tensor);
+#define DECLARE_BINARY_OP(name, TAG, simd_fn, entry_expression, check_nonzero_right) \
+    tensor_t* tensor_##name(tensor_t* left_tensor, tensor_t* right_tensor);      \
+    void tensor_in_place_##name(tensor_t* left_tensor, tensor_t* right_tensor);  \
+    void tensor_##name##_into(tensor_t* dest_tensor, tensor_t* left_tensor, tensor_t* right_tensor);
+
+CORAL_UNARY_OPS(DECLARE_UNARY_OP)
+CORAL_BINARY_OPS(DECLARE_BINARY_OP)
+
+void tensor_in_place_add_multiply(tensor_t* dest_tensor, tensor_t* left_tensor, tensor_t* right_tensor);
+void tensor_in_place_add_scaled(tensor_t* dest_tensor, tensor_t* tensor, tensor_entry_t alpha);
 void tensor_in_place_multiply_by_scalar(tensor_t* tensor, tensor_entry_t value);
 void tensor_in_place_divide_by_scalar(tensor_t* tensor, tensor_entry_t value);
 
 
-tensor_t* tensor_add(tensor_t* left_tensor, tensor_t* right_tensor);
-tensor_t* tensor_subtract(tensor_t* left_tensor, tensor_t* right_tensor);
-tensor_t* tensor_multiply(tensor_t* left_tensor, tensor_t* right_tensor);
-tensor_t* tensor_divide(tensor_t* left_tensor, tensor_t* right_tensor);
 tensor_t* tensor_multiply_by_scalar(tensor_t* tensor, tensor_entry_t value);
 tensor_t* tensor_divide_by_scalar(tensor_t* tensor, tensor_entry_t value);
-tensor_t* tensor_abs_grad(tensor_t* tensor);
-tensor_t* tensor_abs(tensor_t* tensor);
 tensor_t* tensor_sum_grad(tensor_t* tensor);
 tensor_t* tensor_sum(tensor_t* tensor);
 tensor_t* tensor_mean_grad(tensor_t* tensor);
 tensor_t* tensor_mean(tensor_t* tensor);
+// reduced dimensions are kept with length 1
+tensor_t* tensor_sum_dims(tensor_t* tensor, int num_reduced_dims, int* reduced_dims);
+tensor_t* tensor_mean_dims(tensor_t* tensor, int num_reduced_dims, int* reduced_dims);
+tensor_t* tensor_max_dims(tensor_t* tensor, int num_reduced_dims, int* reduced_dims);
+tensor_t* tensor_max_dims_grad(tensor_t* tensor, tensor_t* max_tensor);
+tensor_t* tensor_matmul(tensor_t* left_tensor, tensor_t* right_tensor);
+tensor_t* tensor_matmul_transposed(tensor_t* left_tensor, tensor_t* right_tensor, bool transpose_left, bool transpose_right);
+
+/**
+ * INTO A DESTINATION
+ * as the ops above, writing into an existing (contiguous, float32 for reductions) tensor of the shape of the result,
+ * so that a captured graph is replayed without allocating (see graph.h)
+*/
+
+void tensor_matmul_into(tensor_t* dest_tensor, tensor_t* left_tensor, tensor_t* right_tensor);
+// as tensor_reduce_to_shape to the shape of dest_tensor
+void tensor_reduce_to_shape_into(tensor_t* dest_tensor, tensor_t* tensor);
+// the max over the dimensions which the shape of dest_tensor was broadcast along, as tensor_max_dims
+void tensor_max_to_shape_into(tensor_t* dest_tensor, tensor_t* tensor);
+
+/**
+ * BATCHES
+ * num_tensors float32 tensors of the same (small) shape, stored structure-of-arrays in one buffer: entry index of
+ * tensor i is at data[index * num_tensors + i], i.e. the batch is a contiguous tensor of shape (shape..., num_tensors)
+ * a batched op runs one kernel over every tensor of its batches, its shapes checked once, where the same op on each
+ * of thousands of tiny tensors would be dominated by creating, checking and dispatching each of them;
+ * with the tensors along the innermost dimension, the kernels vectorize across them
+ * right operands broadcast to left ones as for tensor_op, a batch of a single tensor broadcasting to every tensor
+*/
+
+typedef struct {
+    tensor_t* storage; // of shape (shape..., num_tensors)
+    shape_t* shape; // of each tensor
+    size_t num_tensors;
+} tensor_batch_t;
+
+tensor_batch_t* tensor_batch_new(size_t num_tensors, shape_t* shape);
+void tensor_batch_release(tensor_batch_t* batch);
+// a strided view of tensor index of batch
+tensor_t* tensor_batch_get(tensor_batch_t* batch, size_t index);
+// copies tensor (of the shape of the batch) into tensor index of batch
+void tensor_batch_set(tensor_batch_t* batch, size_t index, tensor_t* tensor);
+
+// dest_batch <- op(..) tensor by tensor, dest_batch may be left_batch (or batch)
+#define DECLARE_UNARY_BATCHED_OP(name, TAG, entry_expression)                   \
+    void tensor_##name##_batched(tensor_batch_t* dest_batch, tensor_batch_t* batch);
+#define DECLARE_BINARY_BATCHED_OP(name, TAG, simd_fn, entry_expression, check_nonzero_right) \
+    void tensor_##name##_batched(tensor_batch_t* dest_batch, tensor_batch_t* left_batch, tensor_batch_t* right_batch);
+
+CORAL_UNARY_OPS(DECLARE_UNARY_BATCHED_OP)
+CORAL_BINARY_OPS(DECLARE_BINARY_BATCHED_OP)
+
+// matrix products of 2 dimensional tensors, tensor by tensor, dest_batch must not be either operand
+void tensor_matmul_batched(tensor_batch_t* dest_batch, tensor_batch_t* left_batch, tensor_batch_t* right_batch);
 
 #endif // TENSOR_H
\ No newline at end of file
@@ -1,8 +1,286 @@
 #include "tensor.h"
 #include "variable.h"
 #include "assert.h"
+#include "grad.h"
+#include "parallel.h"
+#include "fused.h"
+#include "pool.h"
+#include "checkpoint.h"
+#include "graph.h"
+#include "module.h"
+#include "optim.h"
+#include "weights.h"
+#include "loader.h"
+#include "comm.h"
+#include "profile.h"
+#include "iter.h"
+#include "utils.h"
 #include <stdbool.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+static tensor_t* new_tensor_with_dims(int num_dims, size_t* dims){
+    tensor_t* tensor = tensor_new(shape_new(num_dims, dims));
+    tensor_in_place_apply_index_fn(tensor, index_identity);
+    return tensor;
+}
+
+
+void test_shapes(){
+    printf("Testing shape interning...");
+    size_t dims[3] = {2, 3, 4};
+    size_t other_dims[3] = {2, 3, 4};
+    shape_t* shape = shape_new(3, dims);
+    NDEBUG_ASSERT(shape_new(3, other_dims) == shape, "Equal shapes should be interned to the same shape.");
+    NDEBUG_ASSERT(shape_new(2, dims) != shape, "Shapes of different ranks should differ.");
+    NDEBUG_ASSERT(shape->size == 24 && shape->strides[0] == 12 && shape->strides[1] == 4 && shape->strides[2] == 1, "Interned shape has the wrong strides.");
+    size_t row_dims[2] = {1, 4};
+    shape_t* row_shape = shape_new(2, row_dims);
+    shape_t* broadcast_shape = shape_get_broadcast_shape(shape, row_shape);
+    NDEBUG_ASSERT(broadcast_shape == shape, "Broadcast of a shape with a suffix of it should be the shape.");
+    NDEBUG_ASSERT(shape_get_broadcast_shape(row_shape, shape) == shape, "Broadcast shapes should be symmetric.");
+    NDEBUG_ASSERT(shape_extend_to_dims(row_shape, 3) == shape_new(3, (size_t[]) {1, 1, 4}), "Extended shape should be interned.");
+    printf("PASS.\n");
+}
+
+void test_broadcast_plans(){
+    printf("Testing broadcast plans...");
+    size_t dims[3] = {2, 3, 4};
+    shape_t* shape = shape_new(3, dims);
+    // equal shapes collapse into a single row, a trailing row into one loop over it
+    shape_t* same_shapes[2] = {shape, shape};
+    const broadcast_plan_t* plan = broadcast_plan_get(shape, 2, same_shapes);
+    NDEBUG_ASSERT(plan->num_dims == 1 && plan->row_length == 24 && plan->num_rows == 1, "Equal shapes should coalesce.");
+    shape_t* row_shapes[2] = {shape, shape_new(3, (size_t[]) {1, 1, 4})};
+    plan = broadcast_plan_get(shape, 2, row_shapes);
+    NDEBUG_ASSERT(plan->num_dims == 2 && plan->dims[0] == 6 && plan->strides[1][0] == 0 && plan->strides[1][1] == 1, "Row broadcast should coalesce its outer dimensions.");
+    // broadcasting along a middle dimension keeps it apart
+    shape_t* middle_shapes[2] = {shape, shape_new(3, (size_t[]) {2, 1, 4})};
+    plan = broadcast_plan_get(shape, 2, middle_shapes);
+    NDEBUG_ASSERT(plan->num_dims == 3 && plan->strides[1][0] == 4 && plan->strides[1][1] == 0, "Middle broadcast should not coalesce.");
+    shape_t* padded_shape = shape_new(3, (size_t[]) {2, 1, 4});
+    shape_t* padded_shapes[2] = {padded_shape, shape_new(3, (size_t[]) {2, 1, 1})};
+    plan = broadcast_plan_get(padded_shape, 2, padded_shapes);
+    NDEBUG_ASSERT(plan->num_dims == 2 && plan->dims[0] == 2 && plan->dims[1] == 4, "Dimensions of length 1 should be dropped.");
+    plan = broadcast_plan_get(shape, 2, middle_shapes);
+    // the iterator visits the rows in order
+    tensor_iter_t iter;
+    tensor_iter_init(&iter, plan, 4);
+    NDEBUG_ASSERT(iter.offsets[0] == 16 && iter.offsets[1] == 4, "Iterator starts at the wrong row.");
+    tensor_iter_next(&iter);
+    NDEBUG_ASSERT(iter.offsets[0] == 20 && iter.offsets[1] == 4, "Iterator steps to the wrong row.");
+    // strided kernels: dest <- left - right and dest <- dest + left * right with a middle broadcast
+    tensor_t* left = new_tensor_with_dims(3, dims);
+    tensor_t* right = new_tensor_with_dims(3, (size_t[]) {2, 1, 4});
+    tensor_t* difference = tensor_subtract(left, right);
+    tensor_t* accumulated = tensor_new_like_with_value(left, 1.0);
+    tensor_in_place_add_multiply(accumulated, left, right);
+    for(size_t outer = 0; outer < 2; outer++){
+        for(size_t middle = 0; middle < 3; middle++){
+            for(size_t inner = 0; inner < 4; inner++){
+                size_t index = 12 * outer + 4 * middle + inner;
+                tensor_entry_t right_entry = 4 * outer + inner;
+                NDEBUG_ASSERT(tensor_get_entry(difference, index) == index - right_entry, "Strided broadcast is incorrect.");
+                NDEBUG_ASSERT(tensor_get_entry(accumulated, index) == 1 + index * right_entry, "Strided accumulation is incorrect.");
+            }
+        }
+    }
+    printf("PASS.\n");
+}
+
+void test_views(){
+    printf("Testing strided views...");
+    size_t dims[3] = {2, 3, 4};
+    tensor_t* tensor = new_tensor_with_dims(3, dims);
+    // transpose and permute share the data of tensor
+    tensor_t* transposed = tensor_transpose(tensor, 1, 2);
+    NDEBUG_ASSERT(!tensor_is_contiguous(transposed) && transposed->data == tensor->data, "Transpose should be a view.");
+    tensor_t* permuted = tensor_permute(tensor, (int[]) {2, 0, 1});
+    tensor_t* contiguous_transposed = tensor_contiguous(transposed);
+    tensor_t* contiguous_permuted = tensor_contiguous(permuted);
+    NDEBUG_ASSERT(tensor_contiguous(contiguous_transposed) == contiguous_transposed, "Contiguous tensors should not be copied.");
+    for(size_t outer = 0; outer < 2; outer++){
+        for(size_t middle = 0; middle < 3; middle++){
+            for(size_t inner = 0; inner < 4; inner++){
+                tensor_entry_t entry = 12 * outer + 4 * middle + inner;
+                NDEBUG_ASSERT(tensor_get_entry(contiguous_transposed, 12 * outer + 3 * inner + middle) == entry, "Transpose is incorrect.");
+                NDEBUG_ASSERT(tensor_get_entry(contiguous_permuted, 6 * inner + 3 * outer + middle) == entry, "Permute is incorrect.");
+            }
+        }
+    }
+    NDEBUG_ASSERT(tensor_equal(transposed, contiguous_transposed), "Views should compare by entries.");
+    // slices start at an offset into the data, and are contiguous along the outermost dimension
+    tensor_t* sliced = tensor_slice(tensor, 1, 1, 3);
+    NDEBUG_ASSERT(sliced->data == tensor->data + 4 && !tensor_is_contiguous(sliced), "Slice should be a view.");
+    NDEBUG_ASSERT(tensor_is_contiguous(tensor_slice(tensor, 0, 1, 2)), "Outer slice should be contiguous.");
+    tensor_t* contiguous_sliced = tensor_contiguous(sliced);
+    for(size_t index = 0; index < 16; index++){
+        size_t offset = 12 * (index / 8) + 4 + index % 8;
+        NDEBUG_ASSERT(tensor_get_entry(contiguous_sliced, index) == offset, "Slice is incorrect.");
+    }
+    // expanded entries are repeated with stride 0
+    tensor_t* row = new_tensor_with_dims(1, (size_t[]) {4});
+    tensor_t* expanded = tensor_contiguous(tensor_expand(row, shape_new(2, (size_t[]) {3, 4})));
+    for(size_t index = 0; index < 12; index++){
+        size_t column = index % 4;
+        NDEBUG_ASSERT(tensor_get_entry(expanded, index) == column, "Expand is incorrect.");
+    }
+    // binary ops read and write strided operands in place
+    tensor_t* doubled = tensor_add(transposed, contiguous_transposed);
+    tensor_t* zeros = tensor_new(tensor->shape);
+    tensor_in_place_add(tensor_slice(zeros, 1, 1, 3), sliced);
+    for(size_t index = 0; index < 24; index++){
+        bool in_slice = (index % 12) >= 4;
+        NDEBUG_ASSERT(tensor_get_entry(doubled, index) == 2 * tensor_get_entry(contiguous_transposed, index), "Strided add is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry(zeros, index) == (in_slice ? index : 0), "Add into a slice is incorrect.");
+    }
+    // a transposed matrix is multiplied through its storage, other views are copied
+    tensor_t* matrix = new_tensor_with_dims(2, (size_t[]) {3, 4});
+    NDEBUG_ASSERT(tensor_equal(tensor_matmul(tensor_transpose(matrix, 0, 1), matrix), tensor_matmul_transposed(matrix, matrix, true, false)), "Matmul of a transposed view is incorrect.");
+    tensor_t* sliced_columns = tensor_transpose(tensor_slice(matrix, 1, 1, 3), 0, 1);
+    NDEBUG_ASSERT(tensor_equal(tensor_matmul(sliced_columns, matrix), tensor_matmul(tensor_contiguous(sliced_columns), matrix)), "Matmul of a sliced view is incorrect.");
+    // the gradient of a view is laid back out in the shape of its input
+    variable_t* x = variable_new(2, 2, 3);
+    variable_in_place_apply_index_fn(x, &index_identity);
+    variable_t* loss = variable_sum(variable_square(variable_slice(variable_transpose(x, 0, 1), 0, 1, 3)));
+    backward_plan_t* plan = backward_plan_new(loss);
+    backward_plan_run(plan);
+    backward_plan_free(plan);
+    for(size_t index = 0; index < 6; index++){
+        bool in_slice = (index % 3) != 0;
+        NDEBUG_ASSERT(tensor_get_entry(x->gradient, index) == (in_slice ? 2 * index : 0), "Gradient through a slice of a transpose is incorrect.");
+    }
+    variable_t* y = variable_new(3, 2, 3, 4);
+    variable_t* weights = variable_new(3, 4, 2, 3);
+    variable_in_place_apply_index_fn(weights, &index_identity);
+    variable_t* v = variable_new(1, 3);
+    loss = variable_add(variable_sum(variable_multiply(variable_permute(y, (int[]) {2, 0, 1}), weights)), variable_sum(variable_multiply(variable_expand(v, x->tensor->shape), x)));
+    plan = backward_plan_new(loss);
+    backward_plan_run(plan);
+    backward_plan_free(plan);
+    NDEBUG_ASSERT(tensor_equal(y->gradient, tensor_contiguous(tensor_permute(weights->tensor, (int[]) {1, 2, 0}))), "Gradient through a permute is incorrect.");
+    for(size_t index = 0; index < 3; index++){
+        NDEBUG_ASSERT(tensor_get_entry(v->gradient, index) == 2 * index + 3, "Gradient through an expand is incorrect.");
+    }
+    printf("PASS.\n");
+}
+
+// the flat index into shape of the entry of broadcast_shape at index, shape being broadcast to broadcast_shape
+static size_t broadcast_source_index(shape_t* shape, shape_t* broadcast_shape, size_t index){
+    int num_padded_dims = broadcast_shape->num_dims - shape->num_dims;
+    size_t source_index = 0;
+    for(int dim_index = 0; dim_index < broadcast_shape->num_dims; dim_index++){
+        size_t coordinate = (index / broadcast_shape->strides[dim_index]) % broadcast_shape->dims[dim_index];
+        if(dim_index >= num_padded_dims && shape->dims[dim_index - num_padded_dims] > 1){
+            source_index += coordinate * shape->strides[dim_index - num_padded_dims];
+        }
+    }
+    return source_index;
+}
+
+void test_high_rank(){
+    printf("Testing high rank tensors...");
+    tensor_t* left = new_tensor_with_dims(6, (size_t[]) {2, 1, 3, 1, 2, 3});
+    tensor_t* right = new_tensor_with_dims(4, (size_t[]) {3, 4, 1, 3});
+    tensor_t* sum = tensor_add(left, right);
+    NDEBUG_ASSERT(TENSOR_NUM_DIMS(sum) == 6 && sum->shape->size == 2 * 3 * 4 * 2 * 3, "Broadcast shape of high rank tensors is incorrect.");
+    for(size_t index = 0; index < sum->shape->size; index++){
+        tensor_entry_t expected = broadcast_source_index(left->shape, sum->shape, index) + broadcast_source_index(right->shape, sum->shape, index);
+        NDEBUG_ASSERT(tensor_get_entry(sum, index) == expected, "Broadcast of high rank tensors is incorrect.");
+    }
+    // reducing every other dimension of an 8 dimensional tensor
+    size_t dims[SHAPE_MAX_DIMS] = {2, 3, 1, 2, 2, 1, 3, 2};
+    tensor_t* tensor = new_tensor_with_dims(SHAPE_MAX_DIMS, dims);
+    tensor_t* reduced = tensor_sum_dims(tensor, 4, (int[]) {0, 2, 4, 6});
+    tensor_t* expected_reduced = tensor_new(reduced->shape);
+    for(size_t index = 0; index < tensor->shape->size; index++){
+        size_t reduced_index = broadcast_source_index(reduced->shape, tensor->shape, index);
+        tensor_set_entry(expected_reduced, reduced_index, tensor_get_entry(expected_reduced, reduced_index) + tensor_get_entry(tensor, index));
+    }
+    NDEBUG_ASSERT(tensor_equal(reduced, expected_reduced), "Reduction of a high rank tensor is incorrect.");
+    // gradients broadcast back across all of the dimensions
+    variable_t* x = variable_new(5, 2, 1, 3, 1, 2);
+    variable_t* y = variable_new(4, 4, 3, 2, 1);
+    variable_in_place_apply_index_fn(x, &index_identity);
+    variable_in_place_apply_index_fn(y, &index_identity);
+    variable_t* loss = variable_sum(variable_multiply(x, y));
+    backward_plan_t* plan = backward_plan_new(loss);
+    backward_plan_run(plan);
+    backward_plan_free(plan);
+    shape_t* broadcast_shape = shape_get_broadcast_shape(x->tensor->shape, y->tensor->shape);
+    tensor_t* expected_gradient = tensor_new(x->tensor->shape);
+    for(size_t index = 0; index < broadcast_shape->size; index++){
+        size_t x_index = broadcast_source_index(x->tensor->shape, broadcast_shape, index);
+        size_t y_index = broadcast_source_index(y->tensor->shape, broadcast_shape, index);
+        tensor_set_entry(expected_gradient, x_index, tensor_get_entry(expected_gradient, x_index) + tensor_get_entry(y->tensor, y_index));
+    }
+    NDEBUG_ASSERT(tensor_equal(x->gradient, expected_gradient), "Gradient of a high rank broadcast is incorrect.");
+    printf("PASS.\n");
+}
+
+static bool entries_close(tensor_entry_t entry, tensor_entry_t expected){
+    return fabsf(entry - expected) <= 1e-6f * (1 + fabsf(expected));
+}
+
+static tensor_entry_t index_centered(size_t index){
+    return ((tensor_entry_t) index - 5) / 4;
+}
+
+void test_op_tables(){
+    printf("Testing generated elementwise ops...");
+    size_t dims[2] = {3, 4};
+    tensor_t* tensor = tensor_new(shape_new(2, dims));
+    tensor_in_place_apply_index_fn(tensor, &index_centered);
+    tensor_t* positive = tensor_new(tensor->shape);
+    tensor_in_place_apply_index_fn(positive, &index_identity);
+    tensor_in_place_add(positive, tensor_new_from_entry(1));
+    // unary ops over contiguous tensors, strided views and in place
+    tensor_t* relu = tensor_relu(tensor);
+    tensor_t* exp = tensor_exp(tensor);
+    tensor_t* log = tensor_log(positive);
+    tensor_t* tanh = tensor_contiguous(tensor_transpose(tensor_tanh(tensor_transpose(tensor, 0, 1)), 0, 1));
+    tensor_t* in_place = tensor_copy(tensor);
+    tensor_in_place_negate(tensor_slice(in_place, 1, 1, 3));
+    for(size_t index = 0; index < 12; index++){
+        tensor_entry_t x = tensor_get_entry(tensor, index);
+        bool negated = (index % 4 == 1) || (index % 4 == 2);
+        NDEBUG_ASSERT(tensor_get_entry(relu, index) == (x > 0 ? x : 0), "Relu is incorrect.");
+        NDEBUG_ASSERT(entries_close(tensor_get_entry(exp, index), expf(x)), "Exp is incorrect.");
+        NDEBUG_ASSERT(entries_close(tensor_get_entry(log, index), logf(index + 1)), "Log is incorrect.");
+        NDEBUG_ASSERT(entries_close(tensor_get_entry(tanh, index), tanhf(x)), "Tanh of a strided view is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry(in_place, index) == (negated ? -x : x), "In place negate of a slice is incorrect.");
+    }
+    // binary ops which fall back to the strided kernel
+    tensor_t* maximum = tensor_max(tensor_transpose(tensor, 0, 1), tensor_transpose(positive, 0, 1));
+    tensor_t* quotient = tensor_divide(tensor_transpose(positive, 0, 1), tensor_transpose(tensor_new_like_with_value(positive, 2), 0, 1));
+    for(size_t index = 0; index < 12; index++){
+        size_t transposed_index = (index % 3) * 4 + index / 3;
+        tensor_entry_t left = tensor_get_entry(tensor, transposed_index);
+        tensor_entry_t right = tensor_get_entry(positive, transposed_index);
+        NDEBUG_ASSERT(tensor_get_entry(maximum, index) == MAX(left, right), "Strided max is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry(quotient, index) == right / 2, "Strided divide is incorrect.");
+    }
+    // activations are differentiable
+    variable_t* x = variable_new(2, 3, 4);
+    variable_t* y = variable_new(2, 3, 4);
+    variable_in_place_apply_index_fn(x, &index_centered);
+    variable_in_place_apply_index_fn(y, &index_identity);
+    variable_t* z = variable_add(variable_relu(x), variable_exp(x));
+    z = variable_add(z, variable_add(variable_tanh(x), variable_log(variable_add(y, variable_new_like_with_value(y, 1)))));
+    backward_plan_t* plan = backward_plan_new(variable_sum(z));
+    backward_plan_run(plan);
+    backward_plan_free(plan);
+    for(size_t index = 0; index < 12; index++){
+        tensor_entry_t entry = get_entry(x, index);
+        tensor_entry_t expected = (entry > 0 ? 1 : 0) + expf(entry) + (1 - tanhf(entry) * tanhf(entry));
+        NDEBUG_ASSERT(entries_close(tensor_get_entry(x->gradient, index), expected), "Activation gradient is incorrect.");
+        NDEBUG_ASSERT(entries_close(tensor_get_entry(y->gradient, index), 1 / (tensor_entry_t) (index + 1)), "Log gradient is incorrect.");
+    }
+    printf("PASS.\n");
+}
 
 void test_variable_equality(){
     printf("Testing variable equality...");
@@ -44,19 +322,1536 @@ void test_variable_subtract(){
     printf("PASS.\n");
 }
 
+// small integers keep float products and sums exact
+static tensor_entry_t index_small_integer(size_t index){
+    return (tensor_entry_t) ((index * 7) % 11) - 5;
+}
+
+static tensor_t* new_matrix(int num_dims, size_t* dims){
+    tensor_t* tensor = tensor_new(shape_new(num_dims, dims));
+    tensor_in_place_apply_index_fn(tensor, index_small_integer);
+    return tensor;
+}
+
+// reference triple loop for a single (optionally transposed) matrix product
+static bool matmul_matches_reference(tensor_t* product, size_t product_offset, tensor_t* left, size_t left_offset, tensor_t* right, size_t right_offset,
+                                     size_t m, size_t n, size_t k, bool transpose_left, bool transpose_right){
+    for(size_t row = 0; row < m; row++){
+        for(size_t column = 0; column < n; column++){
+            tensor_entry_t expected = 0;
+            for(size_t inner = 0; inner < k; inner++){
+                size_t left_index = transpose_left ? inner * m + row : row * k + inner;
+                size_t right_index = transpose_right ? column * k + inner : inner * n + column;
+                expected += left->data[left_offset + left_index] * right->data[right_offset + right_index];
+            }
+            if(product->data[product_offset + row * n + column] != expected){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void test_matmul(){
+    printf("Testing matrix multiplication...");
+    parallel_set_num_threads(4);
+    // crosses the mc/kc blocking and leaves edge tiles in both dimensions
+    size_t left_dims[2] = {101, 300};
+    size_t right_dims[2] = {300, 70};
+    tensor_t* left = new_matrix(2, left_dims);
+    tensor_t* right = new_matrix(2, right_dims);
+    NDEBUG_ASSERT(matmul_matches_reference(tensor_matmul(left, right), 0, left, 0, right, 0, 101, 70, 300, false, false), "Matrix product is incorrect.");
+    // crosses the nc blocking
+    size_t short_dims[2] = {7, 20};
+    size_t wide_dims[2] = {20, 3100};
+    tensor_t* short_matrix = new_matrix(2, short_dims);
+    tensor_t* wide_matrix = new_matrix(2, wide_dims);
+    NDEBUG_ASSERT(matmul_matches_reference(tensor_matmul(short_matrix, wide_matrix), 0, short_matrix, 0, wide_matrix, 0, 7, 3100, 20, false, false), "Wide matrix product is incorrect.");
+    // transposed operands
+    size_t transposed_left_dims[2] = {300, 101};
+    size_t transposed_right_dims[2] = {70, 300};
+    tensor_t* transposed_left = new_matrix(2, transposed_left_dims);
+    tensor_t* transposed_right = new_matrix(2, transposed_right_dims);
+    tensor_t* transposed_product = tensor_matmul_transposed(transposed_left, transposed_right, true, true);
+    NDEBUG_ASSERT(matmul_matches_reference(transposed_product, 0, transposed_left, 0, transposed_right, 0, 101, 70, 300, true, true), "Transposed matrix product is incorrect.");
+    // batched, with and without broadcasting a 2-D operand
+    size_t batch_left_dims[3] = {3, 13, 17};
+    size_t batch_right_dims[3] = {3, 17, 5};
+    size_t shared_right_dims[2] = {17, 5};
+    size_t shared_left_dims[2] = {13, 17};
+    tensor_t* batch_left = new_matrix(3, batch_left_dims);
+    tensor_t* batch_right = new_matrix(3, batch_right_dims);
+    tensor_t* shared_right = new_matrix(2, shared_right_dims);
+    tensor_t* shared_left = new_matrix(2, shared_left_dims);
+    tensor_t* batch_product = tensor_matmul(batch_left, batch_right);
+    tensor_t* shared_right_product = tensor_matmul(batch_left, shared_right);
+    tensor_t* shared_left_product = tensor_matmul(shared_left, batch_right);
+    NDEBUG_ASSERT(TENSOR_NUM_DIMS(batch_product) == 3 && batch_product->shape->dims[0] == 3, "Batched product has incorrect shape.");
+    for(size_t batch = 0; batch < 3; batch++){
+        NDEBUG_ASSERT(matmul_matches_reference(batch_product, batch * 65, batch_left, batch * 221, batch_right, batch * 85, 13, 5, 17, false, false), "Batched product is incorrect.");
+        NDEBUG_ASSERT(matmul_matches_reference(shared_right_product, batch * 65, batch_left, batch * 221, shared_right, 0, 13, 5, 17, false, false), "Broadcast right product is incorrect.");
+        NDEBUG_ASSERT(matmul_matches_reference(shared_left_product, batch * 65, shared_left, 0, batch_right, batch * 85, 13, 5, 17, false, false), "Broadcast left product is incorrect.");
+    }
+    parallel_set_num_threads(1);
+    printf("PASS.\n");
+}
+
+void test_matmul_backwards(){
+    printf("Testing matrix multiplication gradient...");
+    variable_t* a = variable_new(2, 4, 3);
+    variable_t* b = variable_new(2, 3, 5);
+    variable_in_place_apply_index_fn(a, index_small_integer);
+    variable_in_place_apply_index_fn(b, index_identity);
+    backwards(variable_sum(variable_matmul(a, b)));
+    // d/da sum(a @ b) = 1 @ b^T, d/db sum(a @ b) = a^T @ 1
+    for(size_t row = 0; row < 4; row++){
+        for(size_t inner = 0; inner < 3; inner++){
+            tensor_entry_t expected = 0;
+            for(size_t column = 0; column < 5; column++){
+                expected += get_entry(b, inner * 5 + column);
+            }
+            NDEBUG_ASSERT(tensor_get_entry(a->gradient, row * 3 + inner) == expected, "Left gradient is incorrect.");
+        }
+    }
+    for(size_t inner = 0; inner < 3; inner++){
+        tensor_entry_t expected = 0;
+        for(size_t row = 0; row < 4; row++){
+            expected += get_entry(a, row * 3 + inner);
+        }
+        for(size_t column = 0; column < 5; column++){
+            NDEBUG_ASSERT(tensor_get_entry(b->gradient, inner * 5 + column) == expected, "Right gradient is incorrect.");
+        }
+    }
+    printf("PASS.\n");
+}
+
+// f(x) = sum(tanh(x) * x), computed in float64
+static double dtype_check_loss(tensor_t* x){
+    tensor_t* sum = tensor_sum(tensor_multiply(tensor_tanh(x), x));
+    return tensor_get_entry_as_double(sum, 0);
+}
+
+void test_dtypes(){
+    printf("Testing dtypes...");
+    // every float16 survives a round trip through float32
+    for(uint32_t bits = 0; bits < 0x10000; bits++){
+        uint16_t entry = (uint16_t) bits;
+        bool nan = (entry & 0x7C00) == 0x7C00 && (entry & 0x3FF);
+        NDEBUG_ASSERT(nan || float_to_float16(float16_to_float(entry)) == entry, "Float16 round trip is incorrect.");
+    }
+    NDEBUG_ASSERT(float_to_float16(1) == 0x3C00 && float_to_float16(65520) == 0x7C00 && float_to_float16(1.0f / 33554432) == 0, "Float16 rounding is incorrect.");
+    quantization_t unit_quantization = {1, 3};
+    NDEBUG_ASSERT(float_to_int8(NAN, unit_quantization) == 3 && float_to_int8(1e30f, unit_quantization) == QUANTIZATION_MAX && float_to_int8(-INFINITY, unit_quantization) == QUANTIZATION_MIN, "Int8 clamping is incorrect.");
+    NDEBUG_ASSERT(float_to_bfloat16(1) == 0x3F80 && float_to_bfloat16(1 + 1.0f / 256) == 0x3F80 && float_to_bfloat16(1 + 3.0f / 256) == 0x3F82, "Bfloat16 rounding is incorrect.");
+    // storage dtypes compute in float32 and keep their dtype
+    size_t dims[2] = {3, 4};
+    tensor_t* tensor = tensor_new(shape_new(2, dims));
+    tensor_in_place_apply_index_fn(tensor, &index_centered);
+    tensor_t* half = tensor_to_dtype(tensor, TENSOR_FLOAT16);
+    tensor_t* brain = tensor_to_dtype(tensor_transpose(tensor, 0, 1), TENSOR_BFLOAT16);
+    tensor_t* half_sum = tensor_add(half, half);
+    tensor_t* mixed = tensor_multiply(tensor_transpose(tensor, 0, 1), brain);
+    tensor_t* half_square = tensor_square(half);
+    tensor_in_place_negate(half);
+    NDEBUG_ASSERT(half_sum->dtype == TENSOR_FLOAT16 && mixed->dtype == TENSOR_FLOAT32 && half_square->dtype == TENSOR_FLOAT16, "Op results have the wrong dtype.");
+    for(size_t index = 0; index < 12; index++){
+        tensor_entry_t x = tensor_get_entry(tensor, index);
+        tensor_entry_t transposed_x = tensor_get_entry(tensor, (index % 3) * 4 + index / 3);
+        NDEBUG_ASSERT(tensor_get_entry_as_double(half_sum, index) == 2 * x, "Float16 add is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry_as_double(half_square, index) == float16_to_float(float_to_float16(x * x)), "Float16 square is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry_as_double(half, index) == -x, "In place float16 negate is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry(mixed, index) == transposed_x * bfloat16_to_float(float_to_bfloat16(transposed_x)), "Mixed float32 and bfloat16 multiply is incorrect.");
+    }
+    NDEBUG_ASSERT(tensor_get_entry(tensor_sum(half_sum), 0) == 2 * tensor_get_entry(tensor_sum(tensor), 0), "Float16 sum is incorrect.");
+    // mixed float32 and float64 operands compute in the dtype of the destination
+    tensor_t* tensor64 = tensor_to_dtype(tensor, TENSOR_FLOAT64);
+    tensor_t* mixed_sum = tensor_add(tensor, tensor64);
+    tensor_t* mixed_negation = tensor_empty_with_dtype(tensor->shape, TENSOR_FLOAT64);
+    tensor_negate_into(mixed_negation, tensor);
+    tensor_in_place_multiply(tensor64, tensor);
+    tensor_t* mixed_product = tensor_matmul(tensor_transpose(tensor64, 0, 1), tensor);
+    NDEBUG_ASSERT(mixed_sum->dtype == TENSOR_FLOAT32 && tensor64->dtype == TENSOR_FLOAT64 && mixed_product->dtype == TENSOR_FLOAT32, "Mixed float32 and float64 results have the wrong dtype.");
+    for(size_t index = 0; index < 12; index++){
+        tensor_entry_t x = tensor_get_entry(tensor, index);
+        NDEBUG_ASSERT(tensor_get_entry(mixed_sum, index) == 2 * x && tensor_get_entry_as_double(mixed_negation, index) == -x, "Mixed float32 and float64 ops are incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry_as_double(tensor64, index) == x * x, "Mixed in place float64 multiply is incorrect.");
+    }
+    // in place ops on views of storage dtypes narrow into the view, leaving the rest of the tensor alone
+    tensor_t* half_view = tensor_to_dtype(tensor, TENSOR_FLOAT16);
+    tensor_in_place_negate(tensor_transpose(half_view, 0, 1));
+    tensor_in_place_add(tensor_slice(half_view, 1, 1, 3), tensor_new_like_with_value(tensor_slice(tensor, 1, 1, 3), 1.0));
+    for(size_t index = 0; index < 12; index++){
+        size_t column = index % 4;
+        tensor_entry_t expected = -tensor_get_entry(tensor, index) + (column == 1 || column == 2);
+        NDEBUG_ASSERT(tensor_get_entry_as_double(half_view, index) == expected, "In place ops on float16 views are incorrect.");
+    }
+    // float64 gradient check of the float32 autograd
+    variable_t* x = variable_new(2, 3, 4);
+    variable_in_place_apply_index_fn(x, &index_centered);
+    backward_plan_t* plan = backward_plan_new(variable_sum(variable_multiply(variable_tanh(x), x)));
+    backward_plan_run(plan);
+    backward_plan_free(plan);
+    tensor_t* x64 = tensor_to_dtype(x->tensor, TENSOR_FLOAT64);
+    double step = 1e-6;
+    for(size_t index = 0; index < 12; index++){
+        double* entry = (double*) x64->data + index;
+        double x_entry = *entry;
+        *entry = x_entry + step;
+        double loss_above = dtype_check_loss(x64);
+        *entry = x_entry - step;
+        double loss_below = dtype_check_loss(x64);
+        *entry = x_entry;
+        double numerical_gradient = (loss_above - loss_below) / (2 * step);
+        NDEBUG_ASSERT(fabs(numerical_gradient - tensor_get_entry(x->gradient, index)) < 1e-5, "Gradient does not match its float64 finite difference.");
+    }
+    // float64 and quantized int8 matrix multiplication
+    size_t left_dims[2] = {5, 7};
+    size_t right_dims[2] = {7, 6};
+    tensor_t* left = tensor_new(shape_new(2, left_dims));
+    tensor_t* right = tensor_new(shape_new(2, right_dims));
+    tensor_in_place_apply_index_fn(left, &index_centered);
+    tensor_in_place_apply_index_fn(right, &index_small_integer);
+    tensor_t* product = tensor_matmul(left, right);
+    tensor_t* product64 = tensor_matmul(tensor_to_dtype(left, TENSOR_FLOAT64), tensor_transpose(tensor_to_dtype(tensor_transpose(right, 0, 1), TENSOR_FLOAT64), 0, 1));
+    tensor_t* quantized_left = tensor_quantize(left, tensor_choose_quantization(left).scale, tensor_choose_quantization(left).zero_point);
+    quantization_t right_quantization = tensor_choose_quantization(right);
+    tensor_t* quantized_right = tensor_quantize(right, right_quantization.scale, right_quantization.zero_point);
+    tensor_t* quantized_product = tensor_matmul(quantized_left, quantized_right);
+    tensor_t* dequantized_product = tensor_matmul(tensor_to_dtype(quantized_left, TENSOR_FLOAT32), tensor_to_dtype(quantized_right, TENSOR_FLOAT32));
+    NDEBUG_ASSERT(product64->dtype == TENSOR_FLOAT64 && quantized_product->dtype == TENSOR_FLOAT32, "Matrix products have the wrong dtype.");
+    for(size_t index = 0; index < 30; index++){
+        NDEBUG_ASSERT(entries_close(tensor_get_entry_as_double(product64, index), tensor_get_entry(product, index)), "Float64 matrix multiplication is incorrect.");
+        // the int8 products are exact, the float32 ones round each multiply-add
+        tensor_entry_t dequantized_entry = tensor_get_entry(dequantized_product, index);
+        NDEBUG_ASSERT(fabsf(tensor_get_entry(quantized_product, index) - dequantized_entry) <= 1e-4f * (1 + fabsf(dequantized_entry)), "Int8 matrix multiplication is incorrect.");
+        NDEBUG_ASSERT(fabsf(tensor_get_entry(quantized_product, index) - tensor_get_entry(product, index)) < 0.5f, "Int8 matrix multiplication is not close to float32.");
+    }
+    printf("PASS.\n");
+}
+
+void test_arena(){
+    printf("Testing graph arena...");
+    arena_t* graph_arena = arena_get_graph_arena();
+    // parameters live outside of the arena
+    variable_t* weight = variable_new(2, 3, 4);
+    variable_t* bias = variable_new(1, 4);
+    variable_set_to_scalar_value(weight, 2.0);
+    variable_set_to_scalar_value(bias, 1.0);
+    size_t bytes_reserved = 0;
+    for(int iteration = 0; iteration < 3; iteration++){
+        arena_begin();
+        variable_t* output = variable_add(variable_multiply(weight, weight), bias);
+        backwards(variable_sum(output));
+        arena_end();
+        NDEBUG_ASSERT(arena_contains(graph_arena, output) && arena_contains(graph_arena, output->tensor->data), "Graph should be allocated from the arena.");
+        NDEBUG_ASSERT(!arena_contains(graph_arena, weight->gradient->data), "Parameter gradients should not be allocated from the arena.");
+        arena_reset();
+        NDEBUG_ASSERT(arena_get_bytes_used(graph_arena) == 0, "Reset should release the arena.");
+        // later iterations reuse the blocks of the first
+        if(iteration == 0){
+            bytes_reserved = arena_get_bytes_reserved(graph_arena);
+        }
+        NDEBUG_ASSERT(arena_get_bytes_reserved(graph_arena) == bytes_reserved, "Arena should reuse its blocks.");
+    }
+    // gradients accumulate over the 3 iterations: d/dw sum(w * w + b) = 2w = 4, d/db = 3 (the number of rows)
+    for(size_t index = 0; index < 12; index++){
+        NDEBUG_ASSERT(tensor_get_entry(weight->gradient, index) == 3 * 4.0, "Weight gradient is incorrect.");
+    }
+    for(size_t index = 0; index < 4; index++){
+        NDEBUG_ASSERT(tensor_get_entry(bias->gradient, index) == 3 * 3.0, "Bias gradient is incorrect.");
+    }
+    printf("PASS.\n");
+}
+
+static bool tensor_is_aligned(tensor_t* tensor){
+    return ((uintptr_t) tensor->data) % TENSOR_ALIGNMENT == 0;
+}
+
+void test_storage_allocator(){
+    printf("Testing storage allocator...");
+    // data is aligned whether it comes from the pool or from the graph arena
+    for(size_t size = 1; size <= 1024; size = 3 * size + 1){
+        tensor_t* pooled = tensor_new(shape_new(1, &size));
+        tensor_t* empty = tensor_empty_with_dtype(shape_new(1, &size), TENSOR_INT8);
+        arena_begin();
+        tensor_t* arena_tensor = tensor_empty(shape_new(1, &size));
+        tensor_t* arena_half = tensor_new_with_dtype(shape_new(1, &size), TENSOR_FLOAT16);
+        arena_end();
+        NDEBUG_ASSERT(tensor_is_aligned(pooled) && tensor_is_aligned(empty) && tensor_is_aligned(arena_tensor) && tensor_is_aligned(arena_half), "Tensor data is not aligned.");
+        NDEBUG_ASSERT(tensor_get_entry_as_double(arena_half, size - 1) == 0, "Arena tensors should be zeroed.");
+        tensor_release(pooled);
+        tensor_release(empty);
+    }
+    arena_reset();
+    // large buffers are mapped on huge page boundaries, and recycled dirty buffers are zeroed by tensor_new
+    size_t large_size = POOL_HUGE_PAGE_THRESHOLD / sizeof(tensor_entry_t);
+    tensor_t* large = tensor_empty(shape_new(1, &large_size));
+    size_t huge_page_offset = ((uintptr_t) large->data) % POOL_HUGE_PAGE_THRESHOLD;
+    NDEBUG_ASSERT(huge_page_offset == 0, "Large buffers should be huge page aligned.");
+    tensor_set_to_scalar_value(large, 1);
+    tensor_entry_t* large_data = large->data;
+    tensor_release(large);
+    tensor_t* zeroed = tensor_new(shape_new(1, &large_size));
+    NDEBUG_ASSERT(zeroed->data == large_data, "The pool should recycle the large buffer.");
+    NDEBUG_ASSERT(tensor_get_entry(zeroed, 0) == 0 && tensor_get_entry(zeroed, large_size - 1) == 0, "Recycled buffers should be zeroed.");
+    tensor_t* copy = tensor_copy(tensor_transpose(new_tensor_with_dims(2, (size_t[]) {3, 5}), 0, 1));
+    NDEBUG_ASSERT(tensor_is_aligned(copy) && tensor_get_entry(copy, 1) == 5, "Copies are not aligned, or incorrect.");
+    // views allocate no data, ops allocate their result
+    size_t num_allocations = tensor_get_num_allocations();
+    tensor_t* view = tensor_slice(tensor_transpose(copy, 0, 1), 0, 1, 2);
+    NDEBUG_ASSERT(tensor_get_num_allocations() == num_allocations, "Views should not allocate.");
+    tensor_t* sum = tensor_sum(copy);
+    NDEBUG_ASSERT(tensor_get_num_allocations() == num_allocations + 1 && view->data == copy->data + 1, "Only the result of the sum should be allocated.");
+    tensor_release(sum);
+    tensor_release(zeroed);
+    printf("PASS.\n");
+}
+
+void test_profiler(){
+    printf("Testing profiler...");
+    size_t dims[2] = {4, 8};
+    variable_t* actual = variable_new_from_tensor(new_tensor_with_dims(2, dims));
+    variable_t* expected = variable_new_from_tensor(tensor_new(shape_new(2, dims)));
+    profile_reset();
+    tensor_t* sum = tensor_add(actual->tensor, expected->tensor);
+    backwards(variable_mse_loss(actual, expected));
+    profile_op_stats_t stats;
+    bool recorded = profile_get_op_stats("tensor", "tensor_add", &stats);
+#ifdef CORAL_PROFILE
+    NDEBUG_ASSERT(recorded && stats.num_calls == 1, "Tensor ops should be recorded.");
+    NDEBUG_ASSERT(stats.bytes_allocated == 32 * sizeof(tensor_entry_t) && stats.bytes_touched == 3 * 32 * sizeof(tensor_entry_t), "Tensor op bytes are incorrect.");
+    NDEBUG_ASSERT(stats.self_ns <= stats.total_ns, "Self time should not exceed total time.");
+    NDEBUG_ASSERT(profile_get_op_stats("backward", "mse_loss", &stats) && stats.num_calls == 1, "Backward nodes should be recorded by op.");
+    char trace_path[] = "/tmp/coral_trace_XXXXXX";
+    int trace_fd = mkstemp(trace_path);
+    NDEBUG_ASSERT(trace_fd >= 0 && profile_write_trace(trace_path), "Trace should be written.");
+    FILE* trace = fdopen(trace_fd, "r");
+    char header[32] = {0};
+    NDEBUG_ASSERT(fgets(header, sizeof(header), trace) && strncmp(header, "{\"traceEvents\": [", 17) == 0, "Trace is not in the Chrome trace format.");
+    fclose(trace);
+    remove(trace_path);
+    // paused recording leaves the stats be
+    profile_set_enabled(false);
+    tensor_release(tensor_add(actual->tensor, expected->tensor));
+    profile_set_enabled(true);
+    NDEBUG_ASSERT(profile_get_op_stats("tensor", "tensor_add", &stats) && stats.num_calls == 1, "Paused profiler should not record.");
+#else
+    NDEBUG_ASSERT(!recorded, "Nothing should be recorded without CORAL_PROFILE.");
+#endif
+    FILE* summary = tmpfile();
+    profile_print_summary(summary);
+    NDEBUG_ASSERT(ftell(summary) > 0, "Summary should be written.");
+    fclose(summary);
+    profile_reset();
+    tensor_release(sum);
+    printf("PASS.\n");
+}
+
+void test_in_place(){
+    printf("Testing in place operations...");
+    size_t matrix_dims[2] = {3, 4};
+    size_t row_dims[1] = {4};
+    size_t column_dims[2] = {3, 1};
+    tensor_t* x = new_tensor_with_dims(2, matrix_dims);
+    tensor_t* row = new_tensor_with_dims(1, row_dims);
+    tensor_t* column = new_tensor_with_dims(2, column_dims);
+    tensor_entry_t* x_data = x->data;
+    // in place ops write into the destination buffer, and allocate nothing
+    arena_begin();
+    arena_t* graph_arena = arena_get_graph_arena();
+    size_t bytes_used = arena_get_bytes_used(graph_arena);
+    tensor_in_place_add(x, row); // x[i, j] = 4i + 2j
+    tensor_in_place_multiply(x, column); // x[i, j] = (4i + 2j) i
+    tensor_in_place_add(x, x); // x[i, j] = 2 (4i + 2j) i
+    tensor_in_place_subtract(x, column); // x[i, j] = 2 (4i + 2j) i - i
+    NDEBUG_ASSERT(arena_get_bytes_used(graph_arena) == bytes_used, "In place operations should not allocate.");
+    tensor_t* accumulated = tensor_new_like_with_value(x, 1.0);
+    bytes_used = arena_get_bytes_used(graph_arena);
+    tensor_in_place_add_multiply(accumulated, column, row); // 1 + ij
+    tensor_in_place_add_scaled(accumulated, x, 0.5); // 1 + ij + (4i + 2j) i - i / 2
+    NDEBUG_ASSERT(arena_get_bytes_used(graph_arena) == bytes_used, "In place operations should not allocate.");
+    arena_end();
+    arena_reset();
+    NDEBUG_ASSERT(x->data == x_data, "In place operations should not replace the destination buffer.");
+    for(size_t i = 0; i < 3; i++){
+        for(size_t j = 0; j < 4; j++){
+            tensor_entry_t expected_x = 2.0 * (4 * i + 2 * j) * i - i;
+            NDEBUG_ASSERT(tensor_get_entry(x, i * 4 + j) == expected_x, "In place operation is incorrect.");
+        }
+    }
+    // the scalar and strided fallbacks of the accumulating kernels
+    tensor_t* dest = tensor_new(shape_new(2, matrix_dims));
+    size_t scalar_dims[1] = {1};
+    tensor_t* two = tensor_new(shape_new(1, scalar_dims));
+    tensor_set_to_scalar_value(two, 2.0);
+    tensor_in_place_add_multiply(dest, column, row);
+    tensor_in_place_add_multiply(dest, row, two);
+    tensor_in_place_add_scaled(dest, column, -1.0);
+    for(size_t i = 0; i < 3; i++){
+        for(size_t j = 0; j < 4; j++){
+            tensor_entry_t expected = (tensor_entry_t) (i * j + 2 * j) - i;
+            NDEBUG_ASSERT(tensor_get_entry(dest, i * 4 + j) == expected, "Accumulating operation is incorrect.");
+        }
+    }
+    printf("PASS.\n");
+}
+
 void test_variable_multiply();
 void test_varaible_square();
 void test_variable_abs();
-void test_broadcast();
+void test_broadcast(){
+    printf("Testing broadcasting fast paths...");
+    size_t matrix_dims[2] = {3, 37};
+    tensor_t* x = new_tensor_with_dims(2, matrix_dims);
+    tensor_t* two = tensor_new_like_with_value(x, 2.0);
+    // equal shapes
+    tensor_t* product = tensor_multiply(x, two);
+    tensor_t* quotient = tensor_divide(x, two);
+    for(size_t index = 0; index < 3 * 37; index++){
+        NDEBUG_ASSERT(tensor_get_entry(product, index) == 2.0 * index, "Equal shape multiply is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry(quotient, index) == index / 2.0, "Equal shape divide is incorrect.");
+    }
+    // scalar on either side
+    size_t cube_dims[3] = {2, 3, 5};
+    size_t scalar_dims[1] = {1};
+    tensor_t* cube = new_tensor_with_dims(3, cube_dims);
+    tensor_t* four = tensor_new(shape_new(1, scalar_dims));
+    tensor_set_to_scalar_value(four, 4.0);
+    tensor_t* right_difference = tensor_subtract(cube, four);
+    tensor_t* left_difference = tensor_subtract(four, cube);
+    NDEBUG_ASSERT(shape_equal(left_difference->shape, cube->shape), "Scalar broadcast has incorrect shape.");
+    for(size_t index = 0; index < 30; index++){
+        NDEBUG_ASSERT(tensor_get_entry(right_difference, index) == (tensor_entry_t) index - 4, "Scalar right subtract is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry(left_difference, index) == 4 - (tensor_entry_t) index, "Scalar left subtract is incorrect.");
+    }
+    // trailing suffix, with and without leading dimensions of length one
+    size_t batch_dims[3] = {4, 3, 5};
+    size_t suffix_dims[2] = {3, 5};
+    size_t row_dims[2] = {1, 5};
+    tensor_t* batch = new_tensor_with_dims(3, batch_dims);
+    tensor_t* suffix = new_tensor_with_dims(2, suffix_dims);
+    tensor_t* row = new_tensor_with_dims(2, row_dims);
+    tensor_t* suffix_sum = tensor_add(batch, suffix);
+    tensor_t* swapped_suffix_sum = tensor_add(suffix, batch);
+    tensor_t* row_sum = tensor_add(batch, row);
+    for(size_t index = 0; index < 60; index++){
+        // NOTE: the predicate is pasted into a format string, so no modulo inside the asserts
+        tensor_entry_t expected_suffix_sum = index + index % 15;
+        tensor_entry_t expected_row_sum = index + index % 5;
+        NDEBUG_ASSERT(tensor_get_entry(suffix_sum, index) == expected_suffix_sum, "Suffix broadcast is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry(swapped_suffix_sum, index) == expected_suffix_sum, "Suffix broadcast is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry(row_sum, index) == expected_row_sum, "Suffix broadcast is incorrect.");
+    }
+    // general broadcast, falls back to the strided broadcast plan
+    size_t column_dims[2] = {3, 1};
+    size_t wide_row_dims[2] = {1, 4};
+    tensor_t* column = new_tensor_with_dims(2, column_dims);
+    tensor_t* wide_row = new_tensor_with_dims(2, wide_row_dims);
+    tensor_t* outer_sum = tensor_add(column, wide_row);
+    for(size_t row_index = 0; row_index < 3; row_index++){
+        for(size_t column_index = 0; column_index < 4; column_index++){
+            NDEBUG_ASSERT(tensor_get_entry(outer_sum, row_index * 4 + column_index) == row_index + column_index, "General broadcast is incorrect.");
+        }
+    }
+    printf("PASS.\n");
+}
 void test_loss();
 
-void test_backwards();
+void test_backwards(){
+    printf("Testing backwards...");
+    // deep graphs are scheduled without recursion
+    const int depth = 100000;
+    variable_t* start = variable_new(1, 3);
+    variable_set_to_scalar_value(start, 1.0);
+    arena_begin();
+    variable_t* chain = start;
+    for(int index = 0; index < depth; index++){
+        chain = variable_add(chain, start);
+    }
+    backwards(variable_sum(chain));
+    arena_end();
+    arena_reset();
+    for(size_t index = 0; index < 3; index++){
+        NDEBUG_ASSERT(tensor_get_entry(start->gradient, index) == depth + 1, "Deep chain gradient is incorrect.");
+    }
+    // repeated passes over a plan accumulate into leaves only
+    variable_t* x = variable_new(1, 4);
+    variable_set_to_scalar_value(x, 3.0);
+    variable_t* square = variable_multiply(x, x);
+    variable_t* total = variable_sum(variable_add(square, x));
+    backward_plan_t* plan = backward_plan_new(total);
+    NDEBUG_ASSERT(backward_plan_get_num_nodes(plan) == 4, "Plan should contain every reachable node once.");
+    backward_plan_run(plan);
+    backward_plan_run(plan);
+    for(size_t index = 0; index < 4; index++){
+        NDEBUG_ASSERT(tensor_get_entry(x->gradient, index) == 2 * 7.0, "Leaf gradient should accumulate over passes.");
+        NDEBUG_ASSERT(tensor_get_entry(square->gradient, index) == 1.0, "Interior gradient should be recomputed.");
+    }
+    // backpropagation from an intermediate vertex ignores its consumers outside of the subgraph
+    tensor_set_to_scalar_value(x->gradient, 0);
+    variable_t* partial = variable_sum(square);
+    backwards(partial);
+    for(size_t index = 0; index < 4; index++){
+        NDEBUG_ASSERT(tensor_get_entry(x->gradient, index) == 6.0, "Intermediate vertex gradient is incorrect.");
+    }
+    // rebinding to a graph of the same structure reuses the plan
+    tensor_set_to_scalar_value(x->gradient, 0);
+    variable_t* y = variable_new(1, 4);
+    variable_set_to_scalar_value(y, 5.0);
+    variable_t* same_structure = variable_sum(variable_add(variable_multiply(y, y), y));
+    NDEBUG_ASSERT(backward_plan_rebind(plan, same_structure), "Plan should rebind to a graph of the same structure.");
+    backward_plan_run(plan);
+    for(size_t index = 0; index < 4; index++){
+        NDEBUG_ASSERT(tensor_get_entry(y->gradient, index) == 11.0, "Rebound plan gradient is incorrect.");
+    }
+    NDEBUG_ASSERT(tensor_get_entry(x->gradient, 0) == 0, "Rebound plan should not touch the old graph.");
+    // and is rebuilt for a graph of a different structure
+    variable_t* other_structure = variable_sum(variable_multiply(variable_add(y, y), y));
+    NDEBUG_ASSERT(!backward_plan_rebind(plan, other_structure), "Plan should not rebind to a graph of a different structure.");
+    NDEBUG_ASSERT(backward_plan_get_root(plan) == other_structure, "Rebuilt plan should have the new root.");
+    tensor_set_to_scalar_value(y->gradient, 0);
+    backward_plan_run(plan);
+    for(size_t index = 0; index < 4; index++){
+        NDEBUG_ASSERT(tensor_get_entry(y->gradient, index) == 4 * 5.0, "Rebuilt plan gradient is incorrect.");
+    }
+    backward_plan_free(plan);
+    printf("PASS.\n");
+}
+
+void test_parallel_backwards(){
+    printf("Testing parallel backwards...");
+    const int num_branches = 8;
+    variable_t* x = variable_new(2, 16, 16);
+    variable_in_place_apply_index_fn(x, &index_small_integer);
+    variable_t* weights[8];
+    for(int branch = 0; branch < num_branches; branch++){
+        weights[branch] = variable_new(2, 16, 16);
+        variable_set_to_scalar_value(weights[branch], branch + 1);
+    }
+    // independent heads sharing an input, summed into one loss
+    variable_t* loss = NULL;
+    for(int branch = 0; branch < num_branches; branch++){
+        variable_t* head = variable_sum(variable_add(variable_matmul(x, weights[branch]), x));
+        loss = loss ? variable_add(loss, head) : head;
+    }
+    backward_plan_t* plan = backward_plan_new(loss);
+    NDEBUG_ASSERT(backward_plan_get_width(plan) > 1, "Independent heads should widen the graph.");
+    backward_plan_run(plan);
+    tensor_t* serial_gradient = tensor_copy(x->gradient);
+    tensor_set_to_scalar_value(x->gradient, 0);
+    parallel_set_num_threads(4);
+    for(int run = 0; run < 4; run++){
+        tensor_set_to_scalar_value(x->gradient, 0);
+        backward_plan_run(plan);
+        NDEBUG_ASSERT(tensor_equal(x->gradient, serial_gradient), "Parallel gradient should match the serial gradient.");
+    }
+    parallel_set_num_threads(1);
+    backward_plan_free(plan);
+    printf("PASS.\n");
+}
+
+static tensor_entry_t entry_square(tensor_entry_t entry){
+    return entry * entry;
+}
+
+// left and right are (10 x 9 x 7), row is (7), column is (10 x 1 x 7)
+static tensor_t* run_parallel_kernels(tensor_t* left, tensor_t* right, tensor_t* row, tensor_t* column){
+    tensor_t* result = tensor_add(left, right);
+    tensor_in_place_multiply(result, row);
+    tensor_in_place_multiply_by_scalar(result, 3.0);
+    tensor_in_place_apply_entry_fn(result, &entry_square);
+    tensor_in_place_add_multiply(result, left, right);
+    tensor_in_place_add_scaled(result, right, -2.0);
+    // strided broadcast of (10 x 1 x 7) against (9 x 7)
+    tensor_t* strided = tensor_subtract(column, tensor_view_as_shape(row, row->shape));
+    tensor_in_place_add(result, strided);
+    return result;
+}
+
+void test_parallel_kernels(){
+    printf("Testing parallel kernels...");
+    size_t dims[3] = {10, 9, 7};
+    size_t row_dims[1] = {7};
+    size_t column_dims[3] = {10, 1, 7};
+    size_t matrix_dims[2] = {9, 7};
+    tensor_t* left = new_tensor_with_dims(3, dims);
+    tensor_in_place_apply_index_fn(left, &index_small_integer);
+    tensor_t* right = tensor_copy(left);
+    tensor_in_place_add_scaled(right, new_matrix(2, matrix_dims), 1.0);
+    tensor_t* row = tensor_new(shape_new(1, row_dims));
+    tensor_set_to_scalar_value(row, 2.0);
+    tensor_t* column = new_tensor_with_dims(3, column_dims);
+    tensor_t* serial_result = run_parallel_kernels(left, right, row, column);
+    tensor_t* serial_sum = tensor_sum(serial_result);
+    // tiny grains so that every kernel is split
+    size_t default_grain_sizes[PARALLEL_NUM_OPS];
+    for(int op = 0; op < PARALLEL_NUM_OPS; op++){
+        default_grain_sizes[op] = parallel_get_grain_size(op);
+        parallel_set_grain_size(op, 5);
+        NDEBUG_ASSERT(parallel_get_grain_size(op) == 5, "Grain size was not set.");
+    }
+    parallel_set_num_threads(4);
+    tensor_t* parallel_result = run_parallel_kernels(left, right, row, column);
+    NDEBUG_ASSERT(tensor_equal(parallel_result, serial_result), "Parallel kernels should match the serial kernels.");
+    // the sum of integers is exact however it is split
+    tensor_t* parallel_sum = tensor_sum(serial_result);
+    NDEBUG_ASSERT(tensor_equal(parallel_sum, serial_sum), "Parallel sum should match the serial sum.");
+    parallel_set_num_threads(3);
+    NDEBUG_ASSERT(tensor_equal(tensor_sum(serial_result), parallel_sum), "Sum should not depend on the number of threads.");
+    parallel_set_num_threads(1);
+    for(int op = 0; op < PARALLEL_NUM_OPS; op++){
+        parallel_set_grain_size(op, default_grain_sizes[op]);
+    }
+    printf("PASS.\n");
+}
+
+// reference axis reduction of a 3-D tensor, summing (or taking the max) over the dims flagged in is_reduced
+static bool reduction_matches_reference(tensor_t* tensor, tensor_t* reduced, bool* is_reduced, bool is_max){
+    size_t* dims = tensor->shape->dims;
+    for(size_t i = 0; i < dims[0]; i++){
+        for(size_t j = 0; j < dims[1]; j++){
+            for(size_t k = 0; k < dims[2]; k++){
+                size_t reduced_index = (is_reduced[0] ? 0 : i) * reduced->shape->strides[0] + (is_reduced[1] ? 0 : j) * reduced->shape->strides[1] + (is_reduced[2] ? 0 : k) * reduced->shape->strides[2];
+                // only the first entry of each group accumulates the reference
+                if((is_reduced[0] && i) || (is_reduced[1] && j) || (is_reduced[2] && k)){
+                    continue;
+                }
+                tensor_entry_t expected = is_max ? -1e30 : 0;
+                for(size_t ri = (is_reduced[0] ? 0 : i); ri < (is_reduced[0] ? dims[0] : i + 1); ri++){
+                    for(size_t rj = (is_reduced[1] ? 0 : j); rj < (is_reduced[1] ? dims[1] : j + 1); rj++){
+                        for(size_t rk = (is_reduced[2] ? 0 : k); rk < (is_reduced[2] ? dims[2] : k + 1); rk++){
+                            tensor_entry_t entry = tensor_get_entry(tensor, ri * tensor->shape->strides[0] + rj * tensor->shape->strides[1] + rk);
+                            expected = is_max ? (entry > expected ? entry : expected) : expected + entry;
+                        }
+                    }
+                }
+                if(tensor_get_entry(reduced, reduced_index) != expected){
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void test_reductions(){
+    printf("Testing reductions...");
+    size_t dims[3] = {4, 5, 130};
+    tensor_t* tensor = new_tensor_with_dims(3, dims);
+    tensor_in_place_apply_index_fn(tensor, &index_small_integer);
+    // every subset of the dimensions
+    for(int mask = 1; mask < 8; mask++){
+        int reduced_dims[3];
+        int num_reduced_dims = 0;
+        bool is_reduced[3];
+        for(int dim_index = 0; dim_index < 3; dim_index++){
+            is_reduced[dim_index] = (mask >> dim_index) & 1;
+            if(is_reduced[dim_index]){
+                reduced_dims[num_reduced_dims++] = dim_index;
+            }
+        }
+        tensor_t* sum = tensor_sum_dims(tensor, num_reduced_dims, reduced_dims);
+        tensor_t* max = tensor_max_dims(tensor, num_reduced_dims, reduced_dims);
+        NDEBUG_ASSERT(TENSOR_NUM_DIMS(sum) == 3, "Reduced dimensions should be kept.");
+        NDEBUG_ASSERT(reduction_matches_reference(tensor, sum, is_reduced, false), "Sum along dimensions is incorrect.");
+        NDEBUG_ASSERT(reduction_matches_reference(tensor, max, is_reduced, true), "Max along dimensions is incorrect.");
+    }
+    // reduction to a broadcast shape
+    NDEBUG_ASSERT(tensor_reduce_to_shape(tensor, tensor->shape) == tensor, "Reducing to the same shape should be skipped.");
+    int outer_and_inner[2] = {0, 2};
+    size_t column_dims[2] = {5, 1};
+    tensor_t* columns = tensor_reduce_to_shape(tensor, shape_new(2, column_dims));
+    NDEBUG_ASSERT(shape_equal(columns->shape, shape_new(2, column_dims)), "Reduced tensor has the wrong shape.");
+    NDEBUG_ASSERT(memcmp(columns->data, tensor_sum_dims(tensor, 2, outer_and_inner)->data, 5 * sizeof(tensor_entry_t)) == 0, "Reduction to shape is incorrect.");
+    int leading[2] = {0, 1};
+    size_t row_dims[1] = {130};
+    tensor_t* row = tensor_reduce_to_shape(tensor, shape_new(1, row_dims));
+    NDEBUG_ASSERT(memcmp(row->data, tensor_sum_dims(tensor, 2, leading)->data, 130 * sizeof(tensor_entry_t)) == 0, "Reduction to shape is incorrect.");
+    int middle[1] = {1};
+    tensor_t* mean = tensor_mean_dims(tensor, 1, middle);
+    tensor_in_place_multiply_by_scalar(mean, 5);
+    NDEBUG_ASSERT(tensor_equal(mean, tensor_sum_dims(tensor, 1, middle)), "Mean along dimensions is incorrect.");
+    // long sums stay accurate, a single float accumulator drifts by several percent here
+    size_t long_dims[1] = {1 << 22};
+    tensor_t* long_tensor = tensor_new(shape_new(1, long_dims));
+    tensor_set_to_scalar_value(long_tensor, 0.1);
+    double expected = 0.1f * (double) (1 << 22);
+    double relative_error = (tensor_get_entry(tensor_sum(long_tensor), 0) - expected) / expected;
+    NDEBUG_ASSERT(relative_error < 1e-5 && relative_error > -1e-5, "Long sum is inaccurate.");
+    printf("PASS.\n");
+}
+
+void test_reductions_backwards(){
+    printf("Testing reductions backwards...");
+    variable_t* x = variable_new(2, 3, 4);
+    variable_in_place_apply_index_fn(x, &index_small_integer);
+    set_entry(x, 1, 6.0);
+    set_entry(x, 2, 6.0); // row 0 ties 6, 6
+    int rows[1] = {1};
+    int columns[1] = {0};
+    // max over each row, mean over each column, sum over everything
+    variable_t* row_max = variable_max_dims(x, 1, rows);
+    variable_t* column_mean = variable_mean_dims(x, 1, columns);
+    backwards(variable_sum(variable_add(variable_sum_dims(row_max, 1, columns), variable_sum_dims(column_mean, 1, rows))));
+    for(size_t row = 0; row < 3; row++){
+        for(size_t column = 0; column < 4; column++){
+            size_t index = row * 4 + column;
+            tensor_entry_t entry = get_entry(x, index);
+            tensor_entry_t max_grad = 0;
+            if(entry == get_entry(row_max, row)){
+                max_grad = (row == 0) ? 0.5 : 1.0;
+            }
+            tensor_entry_t grad = tensor_get_entry(x->gradient, index);
+            tensor_entry_t expected = max_grad + 1.0 / 3;
+            NDEBUG_ASSERT(grad - expected < 1e-6 && expected - grad < 1e-6, "Reduction gradient is incorrect.");
+        }
+    }
+    printf("PASS.\n");
+}
+
+static bool nearly_equal(tensor_entry_t left_entry, tensor_entry_t right_entry){
+    tensor_entry_t difference = left_entry - right_entry;
+    return difference < 1e-5 && difference > -1e-5;
+}
 
+void test_fused(){
+    printf("Testing fused expressions...");
+    size_t dims[2] = {7, 300};
+    size_t row_dims[1] = {300};
+    tensor_t* left = new_matrix(2, dims);
+    tensor_t* right = tensor_copy(left);
+    tensor_in_place_apply_index_fn(right, &index_identity);
+    tensor_t* row = new_matrix(1, row_dims);
+    // (left - right)^2 * 3 + row, with a broadcast input
+    fused_expr_t* expr = fused_add(fused_multiply(fused_square(fused_subtract(fused_input(left), fused_input(right))), fused_constant(3)), fused_input(row));
+    tensor_t* difference = tensor_subtract(left, right);
+    tensor_t* expected = tensor_add(tensor_multiply_by_scalar(tensor_multiply(difference, difference), 3), row);
+    tensor_t* fused = fused_evaluate(expr);
+    NDEBUG_ASSERT(tensor_equal(fused, expected), "Fused expression is incorrect.");
+    NDEBUG_ASSERT(fused_evaluate_sum(expr) == tensor_get_entry(tensor_sum(expected), 0), "Fused sum is incorrect.");
+    fused_evaluate_into(fused, expr, true);
+    tensor_in_place_multiply_by_scalar(expected, 2);
+    NDEBUG_ASSERT(tensor_equal(fused, expected), "Fused accumulation is incorrect.");
+    // shared nodes are evaluated once, and the constant-only expression is a scalar
+    fused_expr_t* shared = fused_abs(fused_input(right));
+    fused_expr_t* shared_sum = fused_add(shared, shared);
+    fused_expr_t* constant_expr = fused_negate(fused_constant(4));
+    NDEBUG_ASSERT(tensor_equal(fused_evaluate(shared_sum), tensor_multiply_by_scalar(right, 2)), "Shared nodes are incorrect.");
+    NDEBUG_ASSERT(fused_evaluate_sum(constant_expr) == -4, "Constant expression is incorrect.");
+    // the copies made of broadcast and strided inputs are released once the expression is evaluated
+    fused_expr_t* slice_expr = fused_input(tensor_slice(left, 1, 0, 100));
+    size_t bytes_in_use = pool_get_bytes_in_use();
+    fused_evaluate_into(fused, expr, true);
+    fused_evaluate_sum(slice_expr);
+    NDEBUG_ASSERT(pool_get_bytes_in_use() == bytes_in_use, "Fused evaluation should release its copies of inputs.");
+    // shared nodes are freed once
+    fused_expr_free(expr);
+    fused_expr_free(shared_sum);
+    fused_expr_free(constant_expr);
+    fused_expr_free(slice_expr);
+    printf("PASS.\n");
+}
+
+void test_fused_losses(){
+    printf("Testing fused losses...");
+    variable_t* actual = variable_new(2, 4, 8);
+    variable_t* expected = variable_new(1, 8);
+    variable_in_place_apply_index_fn(actual, &index_small_integer);
+    variable_in_place_apply_index_fn(expected, &index_identity);
+    variable_t* mse = variable_mse_loss(actual, expected);
+    backwards(mse);
+    variable_t* mae = variable_mae_loss(actual, expected);
+    tensor_entry_t squared_error = 0;
+    tensor_entry_t absolute_error = 0;
+    for(size_t index = 0; index < 32; index++){
+        tensor_entry_t difference = get_entry(actual, index) - get_entry(expected, index % 8);
+        squared_error += difference * difference;
+        absolute_error += (difference >= 0) ? difference : -difference;
+        NDEBUG_ASSERT(nearly_equal(tensor_get_entry(actual->gradient, index), 2 * difference / 32), "Mse gradient of actual is incorrect.");
+    }
+    for(size_t column = 0; column < 8; column++){
+        tensor_entry_t expected_grad = 0;
+        for(size_t row = 0; row < 4; row++){
+            expected_grad -= 2 * (get_entry(actual, row * 8 + column) - get_entry(expected, column)) / 32;
+        }
+        NDEBUG_ASSERT(nearly_equal(tensor_get_entry(expected->gradient, column), expected_grad), "Mse gradient of expected is incorrect.");
+    }
+    NDEBUG_ASSERT(nearly_equal(get_entry(mse, 0), squared_error / 32), "Mse loss is incorrect.");
+    NDEBUG_ASSERT(nearly_equal(get_entry(mae, 0), absolute_error / 32), "Mae loss is incorrect.");
+    // the squares and absolute values of unfused chains use the fused gradients too
+    variable_t* x = variable_new(1, 5);
+    variable_in_place_apply_index_fn(x, &index_small_integer);
+    backwards(variable_sum(variable_add(variable_square(x), variable_abs_value(x))));
+    for(size_t index = 0; index < 5; index++){
+        tensor_entry_t entry = get_entry(x, index);
+        NDEBUG_ASSERT(tensor_get_entry(x->gradient, index) == 2 * entry + (entry >= 0 ? 1 : -1), "Square and abs gradients are incorrect.");
+    }
+    printf("PASS.\n");
+}
+
+void test_no_grad(){
+    printf("Testing no grad mode...");
+    variable_t* x = variable_new(1, 6);
+    variable_in_place_apply_index_fn(x, &index_small_integer);
+    coral_no_grad_begin();
+    coral_no_grad_begin();
+    NDEBUG_ASSERT(!coral_is_grad_enabled(), "Grad should be disabled.");
+    variable_t* scale = variable_new(1, 6);
+    variable_set_to_scalar_value(scale, 3.0);
+    variable_t* inference = variable_mse_loss(variable_multiply(x, scale), x);
+    NDEBUG_ASSERT(!inference->gradient && !inference->grad_meta && !scale->gradient, "No grad variables should not allocate gradients or grad meta.");
+    coral_no_grad_end();
+    NDEBUG_ASSERT(!coral_is_grad_enabled(), "No grad mode should nest.");
+    coral_no_grad_end();
+    NDEBUG_ASSERT(coral_is_grad_enabled(), "Grad should be re-enabled.");
+    // a variable created without grad can still take part in a graph, its gradient is allocated on first backward
+    backwards(variable_sum(variable_multiply(x, scale)));
+    for(size_t index = 0; index < 6; index++){
+        NDEBUG_ASSERT(tensor_get_entry(x->gradient, index) == 3.0, "Gradient through no grad input is incorrect.");
+        NDEBUG_ASSERT(tensor_get_entry(scale->gradient, index) == get_entry(x, index), "Lazily allocated gradient is incorrect.");
+    }
+    NDEBUG_ASSERT(tensor_get_entry(variable_get_gradient(inference), 0) == 0, "Lazily allocated gradient should be zero.");
+    printf("PASS.\n");
+}
+
+void test_memory_planning(){
+    printf("Testing memory planning...");
+    // released buffers are reused by the next tensor of the same size class, and cleared
+    size_t dims[2] = {1, 100};
+    tensor_t* released = tensor_new(shape_new(2, dims));
+    tensor_set_to_scalar_value(released, 5.0);
+    tensor_entry_t* data = released->data;
+    tensor_release(released);
+    dims[1] = 90;
+    tensor_t* reused = tensor_new(shape_new(2, dims));
+    NDEBUG_ASSERT(reused->data == data, "Pool should reuse released buffers.");
+    NDEBUG_ASSERT(tensor_get_entry(reused, 89) == 0, "Reused buffers should be cleared.");
+    tensor_t* view = tensor_view_as_shape(reused, shape_new(1, &dims[1]));
+    tensor_release(view);
+    NDEBUG_ASSERT(reused->owns_data && reused->data == data, "Releasing a view should leave its buffer to the viewed tensor.");
+    // a reshaped activation is kept until its view is last used, then its buffer is returned to the pool
+    variable_t* input = variable_new(1, 8);
+    variable_in_place_apply_index_fn(input, &index_small_integer);
+    variable_t* activation = variable_relu(input);
+    size_t flat_size = 8;
+    variable_t* reshaped = variable_reshape(activation, shape_new(1, &flat_size));
+    variable_t* reshaped_loss = variable_sum(variable_square(reshaped));
+    tensor_entry_t* activation_data = activation->tensor->data;
+    backward_plan_t* reshape_plan = backward_plan_new(reshaped_loss);
+    backward_plan_set_memory_planning(reshape_plan, true);
+    backward_plan_run(reshape_plan);
+    backward_plan_free(reshape_plan);
+    NDEBUG_ASSERT(!activation->tensor->data && !reshaped->tensor->data, "Reshaped activations should be released.");
+    bool activation_reused = false;
+    for(int attempt = 0; attempt < 8 && !activation_reused; attempt++){
+        activation_reused = tensor_new(activation->tensor->shape)->data == activation_data;
+    }
+    NDEBUG_ASSERT(activation_reused, "Pool should reuse the buffers of reshaped activations.");
+    for(size_t index = 0; index < 8; index++){
+        tensor_entry_t entry = get_entry(input, index);
+        NDEBUG_ASSERT(tensor_get_entry(input->gradient, index) == (entry > 0 ? 2 * entry : 0), "Gradient through reshaped activation is incorrect.");
+    }
+    for(int num_threads = 1; num_threads <= 4; num_threads *= 4){
+        parallel_set_num_threads(num_threads);
+        variable_t* x = variable_new(1, 8);
+        variable_t* w = variable_new(1, 8);
+        variable_in_place_apply_index_fn(x, &index_small_integer);
+        variable_set_to_scalar_value(w, 3.0);
+        // loss = sum(x * x * w + |x|), the branches run concurrently with more than one thread
+        variable_t* square = variable_square(x);
+        variable_t* product = variable_multiply(square, w);
+        variable_t* abs_value = variable_abs_value(x);
+        variable_t* total = variable_add(product, abs_value);
+        variable_t* loss = variable_sum(total);
+        backward_plan_t* plan = backward_plan_new(loss);
+        backward_plan_set_memory_planning(plan, true);
+        NDEBUG_ASSERT(backward_plan_get_width(plan) == 2, "Plan should have two independent branches.");
+        size_t bytes_cached = pool_get_bytes_cached();
+        backward_plan_run(plan);
+        backward_plan_free(plan);
+        NDEBUG_ASSERT(pool_get_bytes_cached() > bytes_cached, "Planned backward pass should return buffers to the pool.");
+        NDEBUG_ASSERT(!square->gradient && !product->gradient && !abs_value->gradient && !total->gradient, "Interior gradients should be released.");
+        NDEBUG_ASSERT(!square->tensor->data && !product->tensor->data && !abs_value->tensor->data && !total->tensor->data, "Interior activations should be released.");
+        NDEBUG_ASSERT(loss->tensor->data && x->tensor->data && w->tensor->data, "Root and leaf activations should be kept.");
+        for(size_t index = 0; index < 8; index++){
+            tensor_entry_t entry = get_entry(x, index);
+            NDEBUG_ASSERT(tensor_get_entry(x->gradient, index) == 2 * entry * 3.0 + (entry >= 0 ? 1 : -1), "Planned gradient of x is incorrect.");
+            NDEBUG_ASSERT(tensor_get_entry(w->gradient, index) == entry * entry, "Planned gradient of w is incorrect.");
+        }
+    }
+    parallel_set_num_threads(1);
+    printf("PASS.\n");
+}
+
+// h * w + |h|, with the weight passed in as context
+static variable_t* checkpoint_layer(variable_t* input, void* context){
+    variable_t* weight = (variable_t*) context;
+    return variable_add(variable_multiply(input, weight), variable_abs_value(input));
+}
+
+// two layers, the second of which is a nested segment
+static variable_t* checkpoint_block(variable_t* input, void* context){
+    return checkpoint_unary(&checkpoint_layer, checkpoint_layer(input, context), context);
+}
+
+static variable_t* checkpoint_pair(variable_t* left_input, variable_t* right_input, void* context){
+    UNUSED(context);
+    return variable_multiply(variable_square(left_input), right_input);
+}
+
+// the segments over constants, the weight passed in as context is their only parameter
+static variable_t* checkpoint_scale(variable_t* input, void* context){
+    return variable_multiply(input, (variable_t*) context);
+}
+
+static variable_t* checkpoint_scaled_pair(variable_t* left_input, variable_t* right_input, void* context){
+    return variable_multiply(variable_multiply(left_input, right_input), (variable_t*) context);
+}
+
+void test_checkpoint(){
+    printf("Testing gradient checkpointing...");
+    int depth = 4;
+    tensor_t* expected_gradients[3] = {NULL, NULL, NULL};
+    for(int checkpointed = 0; checkpointed < 2; checkpointed++){
+        variable_t* x = variable_new(1, 8);
+        variable_t* w = variable_new(1, 8);
+        variable_t* z = variable_new(1, 8);
+        variable_in_place_apply_index_fn(x, &index_small_integer);
+        variable_set_to_scalar_value(w, 0.5);
+        variable_set_to_scalar_value(z, 2.0);
+        variable_t* h = x;
+        for(int layer = 0; layer < depth; layer++){
+            variable_t* block = checkpointed ? checkpoint_unary(&checkpoint_block, h, w) : checkpoint_layer(checkpoint_layer(h, w), w);
+            NDEBUG_ASSERT(!checkpointed || block->grad_meta->inputs[0]->variable == h, "Checkpointed segment should be a single node.");
+            h = block;
+        }
+        variable_t* loss = variable_sum(checkpointed ? checkpoint_binary(&checkpoint_pair, h, z, NULL) : checkpoint_pair(h, z, NULL));
+        backward_plan_t* plan = backward_plan_new(loss);
+        // the segments hide the weight: loss, pair, z, the blocks and x
+        NDEBUG_ASSERT(!checkpointed || backward_plan_get_num_nodes(plan) == depth + 4, "Checkpointed graph has the wrong number of nodes.");
+        backward_plan_run(plan);
+        backward_plan_free(plan);
+        variable_t* leaves[3] = {x, w, z};
+        for(int leaf = 0; leaf < 3; leaf++){
+            if(!checkpointed){
+                expected_gradients[leaf] = tensor_copy(leaves[leaf]->gradient);
+            }else{
+                NDEBUG_ASSERT(tensor_equal(leaves[leaf]->gradient, expected_gradients[leaf]), "Checkpointed gradient should match the recorded one.");
+            }
+        }
+    }
+    // segments whose inputs are all constant still backpropagate into the parameters they capture
+    variable_t* constant = variable_new(1, 8);
+    variable_t* weight = variable_new(1, 8);
+    variable_set_to_scalar_value(constant, 2.0);
+    variable_set_to_scalar_value(weight, 3.0);
+    variable_set_requires_grad(constant, false);
+    variable_t* scaled = checkpoint_unary(&checkpoint_scale, constant, weight);
+    // the interior constant is read by the recomputation, so memory planning keeps it until then
+    variable_t* squared_constant = variable_square(constant);
+    variable_t* scaled_pair = checkpoint_binary(&checkpoint_scaled_pair, squared_constant, constant, weight);
+    NDEBUG_ASSERT(scaled->requires_grad && scaled_pair->requires_grad, "Segments capturing parameters should require grad.");
+    variable_t* constant_loss = variable_add(variable_sum(scaled), variable_sum(scaled_pair));
+    backward_plan_t* constant_plan = backward_plan_new(constant_loss);
+    backward_plan_set_memory_planning(constant_plan, true);
+    backward_plan_run(constant_plan);
+    backward_plan_free(constant_plan);
+    NDEBUG_ASSERT(!squared_constant->gradient, "Constant inputs of segments should not get gradients.");
+    for(size_t index = 0; index < 8; index++){
+        NDEBUG_ASSERT(tensor_get_entry(constant->gradient, index) == 0, "Constant inputs of segments should not be accumulated into.");
+        NDEBUG_ASSERT(tensor_get_entry(weight->gradient, index) == 2.0 + 8.0, "Gradient of parameter captured over constants is incorrect.");
+    }
+    printf("PASS.\n");
+}
+
+// sum(reshape(w * (x * x) + b)^2), so that d/dw = 2 (w x^2 + b) x^2
+static variable_t* constant_input_model(variable_t* x, variable_t* w, variable_t* b, variable_t** hidden){
+    size_t dims[2] = {3, 2};
+    *hidden = variable_add(variable_multiply(w, variable_multiply(x, x)), b);
+    return variable_sum(variable_square(variable_reshape(*hidden, shape_new(2, dims))));
+}
+
+void test_requires_grad(){
+    printf("Testing requires grad...");
+    for(int planned = 0; planned < 2; planned++){
+        variable_t* x = variable_new(2, 2, 3);
+        variable_t* w = variable_new(2, 2, 3);
+        variable_t* b = variable_new(1, 3);
+        variable_in_place_apply_index_fn(x, &index_centered);
+        variable_in_place_apply_index_fn(w, &index_small_integer);
+        variable_set_to_scalar_value(b, 0.5);
+        variable_set_requires_grad(x, false);
+        variable_t* hidden;
+        variable_t* loss = constant_input_model(x, w, b, &hidden);
+        variable_t* squared_x = hidden->grad_meta->inputs[0]->variable->grad_meta->inputs[1]->variable;
+        NDEBUG_ASSERT(!squared_x->requires_grad && hidden->requires_grad && loss->requires_grad, "Only ops over constants should not require grad.");
+        backward_plan_t* plan = backward_plan_new(loss);
+        backward_plan_set_memory_planning(plan, planned);
+        backward_plan_run(plan);
+        // the constant subgraph is skipped, even without memory planning
+        NDEBUG_ASSERT(tensor_equal(x->gradient, tensor_new_zeros_like(x->tensor)) && squared_x->gradient == NULL, "Constant subgraphs should get no gradients.");
+        for(size_t index = 0; index < 6; index++){
+            tensor_entry_t x_entry = get_entry(x, index);
+            tensor_entry_t expected = 2 * (get_entry(w, index) * x_entry * x_entry + 0.5) * x_entry * x_entry;
+            NDEBUG_ASSERT(fabsf(tensor_get_entry(w->gradient, index) - expected) < 1e-5, "Gradient through a constant is incorrect.");
+        }
+        tensor_entry_t expected_bias_gradient = 0;
+        for(size_t row = 0; row < 2; row++){
+            tensor_entry_t x_entry = get_entry(x, 3 * row + 1);
+            expected_bias_gradient += 2 * (get_entry(w, 3 * row + 1) * x_entry * x_entry + 0.5);
+        }
+        NDEBUG_ASSERT(fabsf(tensor_get_entry(b->gradient, 1) - expected_bias_gradient) < 1e-5, "Gradient of a broadcast input is incorrect.");
+        // add and reshape have their only input take the gradient of their output, rather than a copy of it
+        variable_t* reshaped = loss->grad_meta->inputs[0]->variable->grad_meta->inputs[0]->variable;
+        variable_t* product = hidden->grad_meta->inputs[0]->variable;
+        NDEBUG_ASSERT(planned || (hidden->gradient->data == reshaped->gradient->data && product->gradient->data == hidden->gradient->data), "Gradients should be passed through.");
+        backward_plan_free(plan);
+    }
+    // a checkpointed segment over a constant still gets the gradient of the other input
+    variable_t* constant = variable_new(1, 4);
+    variable_t* z = variable_new(1, 4);
+    variable_in_place_apply_index_fn(constant, &index_small_integer);
+    variable_set_requires_grad(constant, false);
+    backwards(variable_sum(checkpoint_binary(&checkpoint_pair, constant, z, NULL)));
+    NDEBUG_ASSERT(tensor_equal(constant->gradient, tensor_new_zeros_like(constant->tensor)) && tensor_get_entry(z->gradient, 3) == 25, "Checkpointed gradient past a constant is incorrect.");
+    // and with the constant on the right, whose recomputed gradient is dropped rather than kept for a later pass
+    variable_set_to_scalar_value(z, 1.0);
+    backward_plan_t* checkpoint_plan = backward_plan_new(variable_sum(checkpoint_binary(&checkpoint_pair, z, constant, NULL)));
+    size_t bytes_in_use = 0;
+    for(int run = 0; run < 3; run++){
+        tensor_set_to_scalar_value(z->gradient, 0);
+        backward_plan_run(checkpoint_plan);
+        NDEBUG_ASSERT(run < 2 || pool_get_bytes_in_use() == bytes_in_use, "Checkpointed passes past a constant should not leak.");
+        bytes_in_use = pool_get_bytes_in_use();
+    }
+    NDEBUG_ASSERT(tensor_get_entry(z->gradient, 3) == 2 * get_entry(constant, 3), "Checkpointed gradient before a constant is incorrect.");
+    backward_plan_free(checkpoint_plan);
+    // a frozen parameter keeps the gradient its module points into
+    module_t* frozen_model = module_new();
+    variable_t* frozen_weight = variable_new(2, 2, 3);
+    variable_t* bias = variable_new(1, 3);
+    module_add_parameter(frozen_model, "weight", frozen_weight);
+    module_add_parameter(frozen_model, "bias", bias);
+    variable_set_requires_grad(frozen_weight, false);
+    variable_t* frozen_input = variable_new(2, 4, 2);
+    variable_set_to_scalar_value(frozen_input, 1.0);
+    backwards(variable_sum(variable_add(variable_matmul(frozen_input, frozen_weight), bias)));
+    NDEBUG_ASSERT(tensor_get_entry(frozen_weight->gradient, 0) == 0 && tensor_get_entry(bias->gradient, 0) == 4, "Frozen parameters should keep an unaccumulated gradient.");
+    module_zero_grad(frozen_model);
+    NDEBUG_ASSERT(tensor_get_entry(bias->gradient, 0) == 0, "Module gradients should be zeroed.");
+    module_free(frozen_model);
+    printf("PASS.\n");
+}
+
+// relu(x @ w + b), centered along the batch, transposed through tanh, plus a penalty on w
+static variable_t* graph_model(variable_t* x, variable_t* w, variable_t* b, variable_t* y){
+    int batch_dim[1] = {0};
+    variable_t* hidden = variable_relu(variable_add(variable_matmul(x, w), b));
+    variable_t* centered = variable_subtract(hidden, variable_mean_dims(hidden, 1, batch_dim));
+    variable_t* output = variable_tanh(variable_transpose(centered, 0, 1));
+    return variable_add(variable_mse_loss(output, y), variable_sum(variable_square(w)));
+}
+
+static bool tensors_close(tensor_t* tensor, tensor_t* expected){
+    for(size_t index = 0; index < expected->shape->size; index++){
+        tensor_entry_t expected_entry = tensor_get_entry(expected, index);
+        if(fabsf(tensor_get_entry(tensor, index) - expected_entry) > 1e-5f * (1 + fabsf(expected_entry))){
+            return false;
+        }
+    }
+    return true;
+}
+
+void test_graph(){
+    printf("Testing graph capture and replay...");
+    variable_t* x = variable_new(2, 4, 3);
+    variable_t* w = variable_new(2, 3, 2);
+    variable_t* b = variable_new(2, 1, 2);
+    variable_t* y = variable_new(2, 2, 4);
+    variable_in_place_apply_index_fn(x, &index_centered);
+    variable_in_place_apply_index_fn(w, &index_centered);
+    variable_set_to_scalar_value(b, 0.25);
+    variable_set_to_scalar_value(y, 0.5);
+    graph_t* graph = graph_capture(graph_model(x, w, b, y));
+    NDEBUG_ASSERT(graph_get_num_ops(graph) == 11, "Captured graph has the wrong number of ops.");
+    variable_t* leaves[4] = {x, w, b, y};
+    for(int iteration = 0; iteration < 3; iteration++){
+        // a new batch, and a parameter update
+        for(size_t index = 0; index < 12; index++){
+            set_entry(x, index, get_entry(x, index) * (iteration + 1) - 0.125 * index);
+        }
+        set_entry(w, iteration, get_entry(w, iteration) - 0.5);
+        for(int leaf = 0; leaf < 4; leaf++){
+            tensor_set_to_scalar_value(leaves[leaf]->gradient, 0);
+        }
+        size_t num_allocations = tensor_get_num_allocations();
+        graph_replay_forward(graph);
+        NDEBUG_ASSERT(tensor_get_num_allocations() == num_allocations, "Replayed forward pass should not allocate tensors.");
+        graph_replay(graph);
+        variable_t* copies[4];
+        for(int leaf = 0; leaf < 4; leaf++){
+            copies[leaf] = variable_copy(leaves[leaf]);
+        }
+        variable_t* expected_loss = graph_model(copies[0], copies[1], copies[2], copies[3]);
+        backwards(expected_loss);
+        NDEBUG_ASSERT(tensors_close(graph_get_root(graph)->tensor, expected_loss->tensor), "Replayed loss should match a fresh forward pass.");
+        for(int leaf = 0; leaf < 4; leaf++){
+            NDEBUG_ASSERT(tensors_close(leaves[leaf]->gradient, copies[leaf]->gradient), "Replayed gradient should match a fresh backward pass.");
+        }
+    }
+    graph_free(graph);
+    printf("PASS.\n");
+}
+
+// the expected value of an entry of a parameter and its optimizer state (the velocity in first_moment for sgd), in double
+typedef struct {
+    double data, first_moment, second_moment;
+} adam_reference_t;
+
+void test_optimizers(){
+    printf("Testing optimizers...");
+    // small grains so that chunks cross from parameter to parameter
+    size_t grain_size = parallel_get_grain_size(PARALLEL_OP_ELEMENTWISE);
+    parallel_set_grain_size(PARALLEL_OP_ELEMENTWISE, 7);
+    parallel_set_num_threads(4);
+    for(int kind = 0; kind < 3; kind++){
+        module_t* model = module_new();
+        variable_t* weight = variable_new(2, 5, 7);
+        variable_t* bias = variable_new(1, 3);
+        variable_in_place_apply_index_fn(weight, &index_centered);
+        variable_set_to_scalar_value(bias, 1.0);
+        module_add_parameter(model, "weight", weight);
+        module_add_parameter(model, "bias", bias);
+        NDEBUG_ASSERT(module_get_num_entries(model) == 38 && module_find_parameter(model, "bias") == bias, "Module has the wrong parameters.");
+        NDEBUG_ASSERT(module_find_parameter(model, "missing") == NULL, "Module should not find a missing parameter.");
+        variable_t* parameters[2] = {weight, bias};
+        adam_reference_t reference[38];
+        for(int parameter = 0, entry = 0; parameter < 2; parameter++){
+            for(size_t index = 0; index < parameters[parameter]->tensor->shape->size; index++, entry++){
+                reference[entry] = (adam_reference_t){get_entry(parameters[parameter], index), 0, 0};
+            }
+        }
+        optimizer_t* optimizer = kind == 0 ? optimizer_new_sgd(model, 0.5, 0) : kind == 1 ? optimizer_new_sgd(model, 0.5, 0.9) : optimizer_new_adam(model, 0.1, 0.9, 0.999, 1e-8);
+        for(int step = 1; step <= 3; step++){
+            module_zero_grad(model);
+            for(int parameter = 0; parameter < 2; parameter++){
+                NDEBUG_ASSERT(tensor_get_entry(parameters[parameter]->gradient, 2) == 0, "Gradients should be zeroed.");
+                tensor_in_place_apply_index_fn(parameters[parameter]->gradient, &index_centered);
+            }
+            optimizer_step(optimizer);
+            for(int parameter = 0, entry = 0; parameter < 2; parameter++){
+                for(size_t index = 0; index < parameters[parameter]->tensor->shape->size; index++, entry++){
+                    double gradient = index_centered(index);
+                    adam_reference_t* expected = &reference[entry];
+                    if(kind == 2){
+                        expected->first_moment = 0.9 * expected->first_moment + 0.1 * gradient;
+                        expected->second_moment = 0.999 * expected->second_moment + 0.001 * gradient * gradient;
+                        double first_moment_hat = expected->first_moment / (1 - pow(0.9, step));
+                        double second_moment_hat = expected->second_moment / (1 - pow(0.999, step));
+                        expected->data -= 0.1 * first_moment_hat / (sqrt(second_moment_hat) + 1e-8);
+                    }else{
+                        expected->first_moment = (kind == 1 ? 0.9 * expected->first_moment : 0) + gradient;
+                        expected->data -= 0.5 * expected->first_moment;
+                    }
+                    NDEBUG_ASSERT(fabs(get_entry(parameters[parameter], index) - expected->data) < 1e-5, "Optimizer step is incorrect.");
+                }
+            }
+        }
+        NDEBUG_ASSERT(optimizer_get_num_steps(optimizer) == 3, "Optimizer should count its steps.");
+        optimizer_free(optimizer);
+        module_free(model);
+    }
+    parallel_set_num_threads(1);
+    parallel_set_grain_size(PARALLEL_OP_ELEMENTWISE, grain_size);
+    printf("PASS.\n");
+}
+
+void test_flat_parameters(){
+    printf("Testing flat parameters...");
+    module_t* model = module_new();
+    variable_t* weight = variable_new(2, 3, 4);
+    variable_t* bias = variable_new(1, 4);
+    variable_in_place_apply_index_fn(weight, &index_centered);
+    variable_set_to_scalar_value(bias, 0.5);
+    module_add_parameter(model, "weight", weight);
+    module_add_parameter(model, "bias", bias);
+    tensor_t* weight_tensor = weight->tensor;
+    tensor_t* expected_weight = tensor_copy(weight->tensor);
+    module_flatten(model);
+    tensor_t* data_bucket = module_get_data_bucket(model);
+    tensor_t* gradient_bucket = module_get_gradient_bucket(model);
+    NDEBUG_ASSERT(module_is_flat(model) && module_get_num_spans(model) == 1, "Flat module should be a single span.");
+    NDEBUG_ASSERT(data_bucket->shape->size == 16 && gradient_bucket->shape->size == 16, "Buckets should hold every entry.");
+    NDEBUG_ASSERT(weight->tensor == weight_tensor && weight->tensor->data == data_bucket->data, "Parameters should keep their tensors, moved into the bucket.");
+    NDEBUG_ASSERT(bias->tensor->data == data_bucket->data + 12 && bias->gradient->data == gradient_bucket->data + 12, "Parameters should be laid out in order.");
+    NDEBUG_ASSERT(tensor_equal(weight->tensor, expected_weight) && get_entry(bias, 3) == 0.5, "Flattening should keep the values of the parameters.");
+    // gradients accumulate into the bucket
+    variable_t* input = variable_new(2, 2, 3);
+    variable_set_to_scalar_value(input, 1.0);
+    backwards(variable_sum(variable_add(variable_matmul(input, weight), bias)));
+    for(size_t index = 0; index < 16; index++){
+        NDEBUG_ASSERT(tensor_get_entry(gradient_bucket, index) == 2, "Gradients should accumulate into the bucket.");
+    }
+    optimizer_t* optimizer = optimizer_new_sgd(model, 0.25, 0);
+    optimizer_step(optimizer);
+    NDEBUG_ASSERT(get_entry(bias, 0) == 0 && get_entry(weight, 5) == tensor_get_entry(expected_weight, 5) - 0.5, "Flat optimizer step is incorrect.");
+    module_zero_grad(model);
+    for(size_t index = 0; index < 16; index++){
+        NDEBUG_ASSERT(tensor_get_entry(gradient_bucket, index) == 0, "Gradient bucket should be zeroed.");
+    }
+    optimizer_free(optimizer);
+    module_free(model);
+    printf("PASS.\n");
+}
+
+static module_t* weights_model(size_t bias_size){
+    module_t* model = module_new();
+    variable_t* weight = variable_new(2, 2, 3);
+    variable_t* bias = variable_new(1, bias_size);
+    module_add_parameter(model, "weight", weight);
+    module_add_parameter(model, "bias", bias);
+    return model;
+}
+
+void test_weights(){
+    printf("Testing weights files...");
+    module_t* model = weights_model(4);
+    variable_t* weight = module_find_parameter(model, "weight");
+    variable_in_place_apply_index_fn(weight, &index_centered);
+    variable_set_to_scalar_value(module_find_parameter(model, "bias"), 0.5);
+    char path[] = "/tmp/coral_weights_XXXXXX";
+    int fd = mkstemp(path);
+    NDEBUG_ASSERT(fd >= 0 && weights_save(model, path), "Weights should be saved.");
+    close(fd);
+    weights_file_t* file = weights_open(path);
+    NDEBUG_ASSERT(file && weights_get_num_tensors(file) == 2 && strcmp(weights_get_name(file, 1), "bias") == 0, "Weights file has the wrong tensors.");
+    // loading points the parameters into the mapping
+    module_t* loaded_model = weights_model(4);
+    NDEBUG_ASSERT(weights_load(file, loaded_model), "Weights should load into a matching module.");
+    variable_t* loaded_weight = module_find_parameter(loaded_model, "weight");
+    uintptr_t address = (uintptr_t) loaded_weight->tensor->data;
+    uintptr_t misalignment = address % WEIGHTS_ALIGNMENT;
+    NDEBUG_ASSERT(loaded_weight->tensor->data == weights_get_tensor(file, "weight")->data && misalignment == 0, "Parameters should point into the mapping, aligned.");
+    NDEBUG_ASSERT(tensor_equal(loaded_weight->tensor, weight->tensor) && get_entry(module_find_parameter(loaded_model, "bias"), 3) == 0.5, "Loaded weights are incorrect.");
+    NDEBUG_ASSERT(weights_get_tensor(file, "missing") == NULL, "Missing tensors should not be found.");
+    // flat modules copy into their bucket
+    module_t* flat_model = weights_model(4);
+    module_flatten(flat_model);
+    NDEBUG_ASSERT(weights_load(file, flat_model), "Weights should load into a flat module.");
+    NDEBUG_ASSERT(tensor_equal(module_find_parameter(flat_model, "weight")->tensor, weight->tensor), "Weights should be copied into the bucket.");
+    NDEBUG_ASSERT(module_find_parameter(flat_model, "weight")->tensor->data == module_get_data_bucket(flat_model)->data, "Flat parameters should stay in the bucket.");
+    module_t* mismatched_model = weights_model(5);
+    tensor_entry_t* mismatched_data = module_find_parameter(mismatched_model, "weight")->tensor->data;
+    NDEBUG_ASSERT(!weights_load(file, mismatched_model) && module_find_parameter(mismatched_model, "weight")->tensor->data == mismatched_data, "Mismatched weights should not load.");
+    // the mapping is private: training the loaded parameters leaves the file be, though it shows through the mapping
+    tensor_in_place_apply_index_fn(loaded_weight->gradient, &index_centered);
+    optimizer_t* optimizer = optimizer_new_sgd(loaded_model, 1.0, 0);
+    optimizer_step(optimizer);
+    NDEBUG_ASSERT(get_entry(loaded_weight, 0) == 0, "Loaded parameters should be trainable.");
+    optimizer_free(optimizer);
+    weights_close(file);
+    file = weights_open(path);
+    NDEBUG_ASSERT(tensor_equal(weights_get_tensor(file, "weight"), weight->tensor), "Training should not write to the file.");
+    weights_close(file);
+    // any dtype can be saved
+    tensor_t* half_tensor = tensor_to_dtype(weight->tensor, TENSOR_FLOAT16);
+    const char* names[1] = {"half"};
+    NDEBUG_ASSERT(weights_save_tensors(path, 1, names, &half_tensor), "Tensors should be saved.");
+    file = weights_open(path);
+    tensor_t* loaded_half_tensor = weights_get_tensor(file, "half");
+    NDEBUG_ASSERT(loaded_half_tensor->dtype == TENSOR_FLOAT16 && tensor_equal(loaded_half_tensor, half_tensor), "Float16 tensors should round trip.");
+    weights_close(file);
+    FILE* garbage = fopen(path, "w");
+    fprintf(garbage, "not a weights file, but long enough to hold a header");
+    fclose(garbage);
+    NDEBUG_ASSERT(weights_open(path) == NULL, "Other files should not open as weights files.");
+    remove(path);
+    module_free(model);
+    module_free(loaded_model);
+    module_free(flat_model);
+    module_free(mismatched_model);
+    printf("PASS.\n");
+}
+
+// batch i holds entries 100 * i + index
+static bool fill_counting_batch(void* context, size_t batch_index, tensor_t** batch){
+    size_t num_batches = *(size_t*) context;
+    if(batch_index >= num_batches){
+        return false;
+    }
+    for(size_t index = 0; index < batch[0]->shape->size; index++){
+        batch[0]->data[index] = 100 * batch_index + index;
+    }
+    return true;
+}
+
+void test_loader(){
+    printf("Testing data loader...");
+    size_t dims[2] = {4, 3};
+    shape_t* shape = shape_new(2, dims);
+    size_t num_batches = 7;
+    for(int num_buffers = 1; num_buffers <= 3; num_buffers++){
+        loader_t* loader = loader_new(1, &shape, num_buffers, &fill_counting_batch, &num_batches);
+        size_t num_allocations = tensor_get_num_allocations();
+        tensor_entry_t* buffers[3] = {NULL, NULL, NULL};
+        tensor_t* batch[1];
+        size_t batch_index = 0;
+        while(loader_next(loader, batch)){
+            NDEBUG_ASSERT(batch[0]->shape == shape && tensor_get_entry(batch[0], 11) == 100 * batch_index + 11, "Batches are incorrect.");
+            // buffers are reused in turn
+            size_t buffer_index = batch_index % num_buffers;
+            NDEBUG_ASSERT(buffers[buffer_index] == NULL || buffers[buffer_index] == batch[0]->data, "Buffers should be reused in turn.");
+            buffers[buffer_index] = batch[0]->data;
+            batch_index++;
+        }
+        NDEBUG_ASSERT(batch_index == num_batches && !loader_next(loader, batch), "Every batch should be loaded once.");
+        NDEBUG_ASSERT(tensor_get_num_allocations() == num_allocations, "Loading should not allocate tensors.");
+        loader_free(loader);
+    }
+    // freeing ahead of the end stops the loader thread
+    num_batches = 1000;
+    loader_t* early_loader = loader_new(1, &shape, 2, &fill_counting_batch, &num_batches);
+    tensor_t* batch[2];
+    NDEBUG_ASSERT(loader_next(early_loader, batch), "A batch should be loaded.");
+    loader_free(early_loader);
+    // records of 3 inputs and a target, batches of 4 of them, dropping the last 2 of 10
+    char path[] = "/tmp/coral_records_XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    FILE* file = fopen(path, "wb");
+    for(int entry = 0; entry < 40; entry++){
+        tensor_entry_t value = entry;
+        fwrite(&value, sizeof(tensor_entry_t), 1, file);
+    }
+    fclose(file);
+    size_t target_dims[2] = {4, 1};
+    shape_t* shapes[2] = {shape, shape_new(2, target_dims)};
+    loader_t* record_loader = loader_new_from_records(path, 2, shapes, 2);
+    for(size_t batch_index = 0; batch_index < 2; batch_index++){
+        NDEBUG_ASSERT(loader_next(record_loader, batch), "A batch of records should be loaded.");
+        for(size_t sample = 0; sample < 4; sample++){
+            size_t record = 4 * batch_index + sample;
+            NDEBUG_ASSERT(tensor_get_entry(batch[0], 3 * sample + 2) == 4 * record + 2 && tensor_get_entry(batch[1], sample) == 4 * record + 3, "Records are decoded incorrectly.");
+        }
+    }
+    NDEBUG_ASSERT(!loader_next(record_loader, batch), "The partial batch should be dropped.");
+    loader_free(record_loader);
+    shapes[1] = shape;
+    NDEBUG_ASSERT(loader_new_from_records(path, 2, shapes, 2) == NULL, "Files of partial records should not load.");
+    NDEBUG_ASSERT(loader_new_from_records("/tmp/coral_missing_records", 2, shapes, 2) == NULL, "Missing files should not load.");
+    remove(path);
+    printf("PASS.\n");
+}
+
+// a rank of a world of threads on this host
+typedef struct {
+    int rank;
+    int world_size;
+    int base_port;
+    bool compress;
+    size_t count;
+    tensor_entry_t* data;
+    module_t* module; // reduced over plan instead of data when set
+    backward_plan_t* plan;
+    bool succeeded;
+} comm_rank_t;
+
+static void* run_comm_rank(void* raw_rank){
+    comm_rank_t* rank = (comm_rank_t*) raw_rank;
+    const char* hosts[3] = {"127.0.0.1", "localhost", "127.0.0.1"};
+    comm_t* comm = comm_new(rank->rank, rank->world_size, hosts, rank->base_port);
+    rank->succeeded = comm != NULL && comm_get_rank(comm) == rank->rank;
+    if(!rank->succeeded){
+        return NULL;
+    }
+    if(!rank->module){
+        rank->succeeded = comm_all_reduce_mean(comm, rank->data, rank->count, rank->compress);
+        comm_free(comm);
+        return NULL;
+    }
+    // buckets of at most 4 entries: the weight alone, then the bias
+    comm_reducer_t* reducer = comm_reducer_new(comm, rank->module, 4, rank->compress);
+    rank->succeeded = comm_reducer_get_num_buckets(reducer) == 2;
+    for(int iteration = 0; iteration < 2; iteration++){
+        module_zero_grad(rank->module);
+        comm_reducer_attach(reducer, rank->plan);
+        backward_plan_run(rank->plan);
+        rank->succeeded = comm_reducer_wait(reducer) && rank->succeeded;
+    }
+    comm_reducer_free(reducer);
+    comm_free(comm);
+    return NULL;
+}
+
+static void run_comm_world(comm_rank_t* ranks, int world_size){
+    pthread_t threads[3];
+    for(int rank = 0; rank < world_size; rank++){
+        pthread_create(&threads[rank], NULL, &run_comm_rank, &ranks[rank]);
+    }
+    for(int rank = 0; rank < world_size; rank++){
+        pthread_join(threads[rank], NULL);
+        NDEBUG_ASSERT(ranks[rank].succeeded, "Every rank should communicate.");
+    }
+}
+
+void test_comm(){
+    printf("Testing ring all-reduce...");
+    int base_port = 20000 + getpid() % 20000;
+    // fewer, as many and more entries than ranks
+    size_t counts[3] = {2, 3, 1000};
+    for(int count_index = 0; count_index < 3; count_index++){
+        for(int compress = 0; compress <= 1; compress++){
+            size_t count = counts[count_index];
+            comm_rank_t ranks[3];
+            for(int rank = 0; rank < 3; rank++){
+                ranks[rank] = (comm_rank_t) {rank, 3, base_port, compress, count, (tensor_entry_t*) malloc(count * sizeof(tensor_entry_t)), NULL, NULL, false};
+                for(size_t index = 0; index < count; index++){
+                    ranks[rank].data[index] = 1000 * rank + index + 0.25;
+                }
+            }
+            run_comm_world(ranks, 3);
+            base_port += 3;
+            for(size_t index = 0; index < count; index++){
+                tensor_entry_t expected = 1000 + index + 0.25;
+                tensor_entry_t tolerance = compress ? fabsf(expected) / 1024 : 1e-4;
+                NDEBUG_ASSERT(fabsf(ranks[0].data[index] - expected) <= tolerance, "All-reduce should average.");
+                NDEBUG_ASSERT(ranks[1].data[index] == ranks[0].data[index] && ranks[2].data[index] == ranks[0].data[index], "Every rank should have the same average.");
+            }
+            for(int rank = 0; rank < 3; rank++){
+                free(ranks[rank].data);
+            }
+        }
+    }
+    // data-parallel backward passes over two ranks, each with its own inputs
+    module_t* models[2];
+    variable_t* losses[2];
+    comm_rank_t ranks[2];
+    tensor_t* local_gradients[2];
+    for(int rank = 0; rank < 2; rank++){
+        models[rank] = weights_model(3);
+        module_flatten(models[rank]);
+        variable_in_place_apply_index_fn(module_find_parameter(models[rank], "weight"), &index_centered);
+        variable_t* x = variable_new(2, 4, 2);
+        variable_set_to_scalar_value(x, rank + 1);
+        losses[rank] = variable_mean(variable_add(variable_matmul(x, module_find_parameter(models[rank], "weight")), module_find_parameter(models[rank], "bias")));
+        ranks[rank] = (comm_rank_t) {rank, 2, base_port, false, 0, NULL, models[rank], backward_plan_new(losses[rank]), false};
+        module_zero_grad(models[rank]);
+        backward_plan_run(ranks[rank].plan);
+        local_gradients[rank] = tensor_copy(module_get_gradient_bucket(models[rank]));
+    }
+    run_comm_world(ranks, 2);
+    tensor_t* expected = tensor_add(local_gradients[0], local_gradients[1]);
+    tensor_in_place_divide_by_scalar(expected, 2);
+    for(int rank = 0; rank < 2; rank++){
+        NDEBUG_ASSERT(tensor_equal(module_get_gradient_bucket(models[rank]), expected), "Reduced gradients should be the average.");
+        backward_plan_free(ranks[rank].plan);
+        module_free(models[rank]);
+    }
+    // a frozen parameter is never finalized, so its bucket (the bias alone) should not wait on it
+    module_t* frozen_model = weights_model(3);
+    module_flatten(frozen_model);
+    variable_t* frozen_bias = module_find_parameter(frozen_model, "bias");
+    variable_set_requires_grad(frozen_bias, false);
+    variable_t* x = variable_new(2, 4, 2);
+    variable_set_to_scalar_value(x, 1.0);
+    variable_t* loss = variable_mean(variable_add(variable_matmul(x, module_find_parameter(frozen_model, "weight")), frozen_bias));
+    comm_rank_t frozen_rank = {0, 1, base_port + 2, false, 0, NULL, frozen_model, backward_plan_new(loss), false};
+    run_comm_world(&frozen_rank, 1);
+    NDEBUG_ASSERT(tensor_get_entry(frozen_bias->gradient, 0) == 0, "Frozen parameters should not accumulate gradients.");
+    backward_plan_free(frozen_rank.plan);
+    module_free(frozen_model);
+    printf("PASS.\n");
+}
+
+void test_batched_ops(){
+    printf("Testing batched ops...");
+    // a number of tensors which is not a multiple of any vector width
+    size_t num_tensors = 37;
+    size_t dims[2] = {2, 3};
+    size_t right_dims[2] = {3, 2};
+    size_t product_dims[2] = {2, 2};
+    shape_t* shape = shape_new(2, dims);
+    tensor_batch_t* left_batch = tensor_batch_new(num_tensors, shape);
+    tensor_batch_t* right_batch = tensor_batch_new(num_tensors, shape);
+    tensor_batch_t* matmul_right_batch = tensor_batch_new(num_tensors, shape_new(2, right_dims));
+    tensor_t* left_tensors[37];
+    tensor_t* right_tensors[37];
+    tensor_t* matmul_right_tensors[37];
+    for(size_t index = 0; index < num_tensors; index++){
+        left_tensors[index] = new_tensor_with_dims(2, dims);
+        tensor_in_place_multiply_by_scalar(left_tensors[index], index + 1);
+        right_tensors[index] = new_tensor_with_dims(2, dims);
+        tensor_in_place_apply_index_fn(right_tensors[index], &index_centered);
+        tensor_in_place_add(right_tensors[index], tensor_new_from_entry(index));
+        matmul_right_tensors[index] = tensor_copy(right_tensors[index]);
+        tensor_in_place_view_as_shape(matmul_right_tensors[index], shape_new(2, right_dims));
+        tensor_batch_set(left_batch, index, left_tensors[index]);
+        tensor_batch_set(right_batch, index, right_tensors[index]);
+        tensor_batch_set(matmul_right_batch, index, matmul_right_tensors[index]);
+    }
+    NDEBUG_ASSERT(tensor_equal(tensor_batch_get(left_batch, 5), left_tensors[5]), "Batched tensors should be stored.");
+    tensor_batch_t* sum_batch = tensor_batch_new(num_tensors, shape);
+    tensor_batch_t* relu_batch = tensor_batch_new(num_tensors, shape);
+    tensor_batch_t* product_batch = tensor_batch_new(num_tensors, shape_new(2, product_dims));
+    size_t num_allocations = tensor_get_num_allocations();
+    tensor_add_batched(sum_batch, left_batch, right_batch);
+    tensor_relu_batched(relu_batch, right_batch);
+    tensor_matmul_batched(product_batch, left_batch, matmul_right_batch);
+    NDEBUG_ASSERT(tensor_get_num_allocations() == num_allocations, "Batched ops should not allocate.");
+    for(size_t index = 0; index < num_tensors; index++){
+        NDEBUG_ASSERT(tensor_equal(tensor_batch_get(sum_batch, index), tensor_add(left_tensors[index], right_tensors[index])), "Batched add is incorrect.");
+        NDEBUG_ASSERT(tensor_equal(tensor_batch_get(relu_batch, index), tensor_relu(right_tensors[index])), "Batched relu is incorrect.");
+        NDEBUG_ASSERT(tensor_equal(tensor_batch_get(product_batch, index), tensor_matmul(left_tensors[index], matmul_right_tensors[index])), "Batched matmul is incorrect.");
+    }
+    // in place, and broadcasting a batch of one tensor (a row) to every tensor
+    size_t row_dims[1] = {3};
+    tensor_batch_t* row_batch = tensor_batch_new(1, shape_new(1, row_dims));
+    tensor_t* row = new_tensor_with_dims(1, row_dims);
+    tensor_batch_set(row_batch, 0, row);
+    tensor_multiply_batched(left_batch, left_batch, row_batch);
+    for(size_t index = 0; index < num_tensors; index++){
+        NDEBUG_ASSERT(tensor_equal(tensor_batch_get(left_batch, index), tensor_multiply(left_tensors[index], row)), "Broadcast batched multiply is incorrect.");
+    }
+    tensor_batch_release(left_batch);
+    tensor_batch_release(right_batch);
+    printf("PASS.\n");
+}
 
 int main(){
+    test_shapes();
+    test_broadcast_plans();
+    test_views();
+    test_high_rank();
+    test_op_tables();
+    test_batched_ops();
     test_variable_equality();
     test_variable_add();
     test_variable_subtract();
+    test_broadcast();
+    test_matmul();
+    test_matmul_backwards();
+    test_dtypes();
+    test_arena();
+    test_storage_allocator();
+    test_profiler();
+    test_in_place();
+    test_backwards();
+    test_parallel_backwards();
+    test_parallel_kernels();
+    test_reductions();
+    test_reductions_backwards();
+    test_fused();
+    test_fused_losses();
+    test_no_grad();
+    test_memory_planning();
+    test_checkpoint();
+    test_requires_grad();
+    test_graph();
+    test_optimizers();
+    test_flat_parameters();
+    test_weights();
+    test_loader();
+    test_comm();
     printf("All tests passed! :D");
     return 0;
 }
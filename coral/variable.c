@@ -2,7 +2,9 @@
 #include "tensor.h"
 #include "grad.h"
 #include "shape.h"
-#include "util.h"
+#include "utils.h"
+#include "arena.h"
+#include "fused.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -12,10 +14,13 @@
 */
 
 variable_t* variable_new_from_tensor(tensor_t* tensor){
-    variable_t* new_variable = (variable_t *) malloc(sizeof(variable_t));
+    variable_t* new_variable = (variable_t *) arena_malloc(sizeof(variable_t));
     new_variable->tensor = tensor;
-    new_variable->gradient = tensor_new_zeros_like(tensor);
-    new_variable->grad_meta = grad_meta_new();
+    // in no-grad mode both are allocated lazily, see variable_get_gradient
+    bool grad_enabled = coral_is_grad_enabled();
+    new_variable->gradient = grad_enabled ? tensor_new_zeros_like(tensor) : NULL;
+    new_variable->grad_meta = grad_enabled ? grad_meta_new() : NULL;
+    new_variable->requires_grad = true;
     return new_variable;
 }
 
@@ -88,6 +93,12 @@ variable_t* variable_copy(variable_t* old_variable){
     return variable_new_from_tensor(new_tensor);
 }
 
+void variable_set_requires_grad(variable_t* variable, bool requires_grad){
+    NDEBUG_ASSERT(!variable->grad_meta || variable->grad_meta->num_inputs == 0, "Only leaves can be told whether they require grad!\n");
+    // the gradient is kept, as the modules a parameter is registered with point into it
+    variable->requires_grad = requires_grad;
+}
+
 /**
  * COMPARATORS
 */
@@ -127,7 +138,7 @@ void variable_display_with_gradient(variable_t* variable, char* name){
     printf("Tensor:\n");
     tensor_display(variable->tensor);
     printf("Gradient:\n");
-    tensor_display(variable->gradient);
+    tensor_display(variable_get_gradient(variable));
 }
 
 void variable_set_to_scalar(variable_t* variable, tensor_entry_t value){
@@ -138,8 +149,18 @@ void variable_set_to_scalar(variable_t* variable, tensor_entry_t value){
  * GRADIENTS: return grad with respect to input, possible as a function of both input and other_input
  * NOTE: grad functions are shape agnostic, the reduction to the correct shape occurs with the call to tensor_reduce_to_shape in grad.c
  * to account for operations in which broadcasting occurs
+ * ACCUMULATE GRADIENTS: add the grad with respect to input straight into input->gradient, skipping the
+ * temporary, and return false when the grad would have to be reduced (the input was broadcast)
+ * NOTE: grad functions must return a fresh tensor (never a view of, or one of, their arguments), grad.c releases it once accumulated
+ * ops whose grads do not read every forward value say so with set_*_grad_needs, so that planned backward passes can release them early
+ * FORWARD OPS: recompute the output of an op into its existing tensor, so that captured graphs are replayed without
+ * allocating (see graph.h)
 */
 
+static inline tensor_t* input_tensor(variable_t* output, int input_index){
+    return output->grad_meta->inputs[input_index]->variable->tensor;
+}
+
 
 /**
  * INTERNAL ATOMIC FUNCTIONS
@@ -149,18 +170,45 @@ void variable_set_to_scalar(variable_t* variable, tensor_entry_t value){
  * rely on these functions to update the computation graph
 */
 
+// op outputs get their gradient on their first update during a backward pass, see update_unary_grad
+static variable_t* output_new(tensor_t* tensor){
+    variable_t* new_variable = (variable_t *) arena_malloc(sizeof(variable_t));
+    new_variable->tensor = tensor;
+    new_variable->gradient = NULL;
+    new_variable->grad_meta = NULL;
+    new_variable->requires_grad = false;
+    return new_variable;
+}
+
 static inline tensor_t* add_backwards_grad(variable_t* input, variable_t* other_input, variable_t* output){
     UNUSED(input);
     UNUSED(other_input);
     return tensor_copy(output->gradient);
 }
 
+static inline bool add_backwards_accumulate_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    UNUSED(other_input);
+    if(!shape_equal(input->gradient->shape, output->gradient->shape)){
+        return false;
+    }
+    tensor_in_place_add(input->gradient, output->gradient);
+    return true;
+}
+
+static void add_forward(variable_t* output){
+    tensor_add_into(output->tensor, input_tensor(output, 0), input_tensor(output, 1));
+}
+
 // performs component-wise addition
 variable_t* add(variable_t* left_variable, variable_t* right_variable, bool use_grad){
     tensor_t* new_tensor = tensor_add(left_variable->tensor, right_variable->tensor);
-    variable_t* new_variable = variable_new_from_tensor(new_tensor);
+    variable_t* new_variable = output_new(new_tensor);
     if(use_grad){
-        set_binary_grad_meta(new_variable, left_variable, right_variable, &add_backwards_grad, &add_backwards_grad);
+        set_binary_grad_meta(new_variable, left_variable, right_variable, &add_backwards_grad, &add_backwards_grad, "add");
+        set_binary_accumulate_grad_ops(new_variable, &add_backwards_accumulate_grad, &add_backwards_accumulate_grad);
+        set_binary_grad_needs(new_variable, GRAD_NEEDS_NONE, GRAD_NEEDS_NONE);
+        set_binary_passes_gradient(new_variable, true, true);
+        set_forward_op(new_variable, &add_forward);
     } 
     return new_variable;
 }
@@ -173,12 +221,29 @@ tensor_t* subtract_backwards_grad(variable_t* input, variable_t* other_input, va
     return output_grad;
 }
 
+bool subtract_backwards_accumulate_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    UNUSED(other_input);
+    if(!shape_equal(input->gradient->shape, output->gradient->shape)){
+        return false;
+    }
+    tensor_in_place_add_scaled(input->gradient, output->gradient, -1);
+    return true;
+}
+
+static void subtract_forward(variable_t* output){
+    tensor_subtract_into(output->tensor, input_tensor(output, 0), input_tensor(output, 1));
+}
+
 // performs component-wise addition
 variable_t* subtract(variable_t* left_variable, variable_t* right_variable, bool use_grad){
     tensor_t* new_tensor = tensor_subtract(left_variable->tensor, right_variable->tensor);
-    variable_t* new_variable = variable_new_from_tensor(new_tensor);
+    variable_t* new_variable = output_new(new_tensor);
     if(use_grad){
-        set_binary_grad_meta(new_variable, left_variable, right_variable, &add_backwards_grad, &subtract_backwards_grad);
+        set_binary_grad_meta(new_variable, left_variable, right_variable, &add_backwards_grad, &subtract_backwards_grad, "subtract");
+        set_binary_accumulate_grad_ops(new_variable, &add_backwards_accumulate_grad, &subtract_backwards_accumulate_grad);
+        set_binary_grad_needs(new_variable, GRAD_NEEDS_NONE, GRAD_NEEDS_NONE);
+        set_binary_passes_gradient(new_variable, true, false);
+        set_forward_op(new_variable, &subtract_forward);
     } 
     return new_variable;
 }
@@ -188,53 +253,146 @@ tensor_t* multiply_backwards_grad(variable_t* input, variable_t* other_input, va
     return tensor_multiply(output->gradient, other_input->tensor);
 }
 
+bool multiply_backwards_accumulate_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    if(!shape_equal(input->gradient->shape, output->gradient->shape)){
+        return false;
+    }
+    tensor_in_place_add_multiply(input->gradient, output->gradient, other_input->tensor);
+    return true;
+}
+
+static void multiply_forward(variable_t* output){
+    tensor_multiply_into(output->tensor, input_tensor(output, 0), input_tensor(output, 1));
+}
+
 // returns a new variable whose value is given by the sum of left_variable and right_variable
 variable_t* multiply(variable_t* left_variable, variable_t* right_variable, bool use_grad){
     tensor_t* new_tensor = tensor_multiply(left_variable->tensor, right_variable->tensor);
-    variable_t* new_variable = variable_new_from_tensor(new_tensor);
+    variable_t* new_variable = output_new(new_tensor);
     if(use_grad){
-        set_binary_grad_meta(new_variable, left_variable, right_variable, &multiply_backwards_grad, &multiply_backwards_grad);
+        set_binary_grad_meta(new_variable, left_variable, right_variable, &multiply_backwards_grad, &multiply_backwards_grad, "multiply");
+        set_binary_accumulate_grad_ops(new_variable, &multiply_backwards_accumulate_grad, &multiply_backwards_accumulate_grad);
+        set_binary_grad_needs(new_variable, GRAD_NEEDS_OTHER_INPUT, GRAD_NEEDS_OTHER_INPUT);
+        set_forward_op(new_variable, &multiply_forward);
     } 
     return new_variable;
 }
 
+// the fused gradients below evaluate their expression, then free it
+static tensor_t* evaluate_fused_grad(fused_expr_t* grad_expr){
+    tensor_t* gradient = fused_evaluate(grad_expr);
+    fused_expr_free(grad_expr);
+    return gradient;
+}
+
+// gradient += grad_expr, false (and nothing accumulated) when grad_expr has another shape
+static bool accumulate_fused_grad(tensor_t* gradient, fused_expr_t* grad_expr){
+    bool same_shape = shape_equal(gradient->shape, fused_get_shape(grad_expr));
+    if(same_shape){
+        fused_evaluate_into(gradient, grad_expr, true);
+    }
+    fused_expr_free(grad_expr);
+    return same_shape;
+}
+
+// 2 * variable * grad, fused into a single pass
+static fused_expr_t* square_backwards_expr(variable_t* variable, variable_t* result){
+    return fused_multiply(fused_multiply(fused_constant(2.0), fused_input(variable->tensor)), fused_input(result->gradient));
+}
+
 tensor_t* square_backwards_grad(variable_t* variable, variable_t* result){
-    return tensor_multiply(tensor_multiply_by_scalar(variable->tensor, 2.0), result->gradient);
+    return evaluate_fused_grad(square_backwards_expr(variable, result));
+}
+
+bool square_backwards_accumulate_grad(variable_t* variable, variable_t* result){
+    if(!shape_equal(variable->gradient->shape, result->gradient->shape)){
+        return false;
+    }
+    return accumulate_fused_grad(variable->gradient, square_backwards_expr(variable, result));
 }
 
 // note that square is equivalent (in terms of correctness of result and grad meta update) to multiply
 
+static void square_forward(variable_t* output){
+    tensor_multiply_into(output->tensor, input_tensor(output, 0), input_tensor(output, 0));
+}
+
 variable_t* square(variable_t* variable, bool use_grad){
-    variable_t* new_variable = variable_new_from_tensor(tensor_multiply(variable->tensor, variable->tensor));
+    variable_t* new_variable = output_new(tensor_multiply(variable->tensor, variable->tensor));
     if(use_grad){
-        set_unary_grad_meta(new_variable, variable, &square_backwards_grad);
+        set_unary_grad_meta(new_variable, variable, &square_backwards_grad, "square");
+        set_unary_accumulate_grad_op(new_variable, &square_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_INPUT);
+        set_forward_op(new_variable, &square_forward);
     }
     return new_variable;
 }
 
+static fused_expr_t* abs_value_backwards_expr(variable_t* input, variable_t* result){
+    return fused_multiply(fused_abs_grad(fused_input(input->tensor)), fused_input(result->gradient));
+}
+
 tensor_t* abs_value_backwards_grad(variable_t* input, variable_t* result){
-    return tensor_multiply(tensor_abs(input->tensor), result->gradient);
+    return evaluate_fused_grad(abs_value_backwards_expr(input, result));
+}
+
+bool abs_value_backwards_accumulate_grad(variable_t* input, variable_t* result){
+    if(!shape_equal(input->gradient->shape, result->gradient->shape)){
+        return false;
+    }
+    return accumulate_fused_grad(input->gradient, abs_value_backwards_expr(input, result));
+}
+
+static void abs_value_forward(variable_t* output){
+    tensor_abs_into(output->tensor, input_tensor(output, 0));
 }
 
 // returns a new variable whose value is given by the absolute value of variable
 static variable_t* abs_value(variable_t* variable, bool use_grad){
     tensor_t* new_tensor = tensor_abs(variable->tensor);
-    variable_t* new_variable =  variable_new_from_tensor(new_tensor);
+    variable_t* new_variable =  output_new(new_tensor);
     if(use_grad){
-        set_unary_grad_meta(new_variable, variable, &abs_value_backwards_grad);
+        set_unary_grad_meta(new_variable, variable, &abs_value_backwards_grad, "abs");
+        set_unary_accumulate_grad_op(new_variable, &abs_value_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_INPUT);
+        set_forward_op(new_variable, &abs_value_forward);
     }
     return new_variable;
 }
 
+// reductions keep the reduced dimensions (with length 1), so reducing to the shape of the output recomputes it
+static void sum_forward(variable_t* output){
+    tensor_reduce_to_shape_into(output->tensor, input_tensor(output, 0));
+}
+
+static void mean_forward(variable_t* output){
+    tensor_t* input = input_tensor(output, 0);
+    tensor_reduce_to_shape_into(output->tensor, input);
+    tensor_in_place_divide_by_scalar(output->tensor, (tensor_entry_t) input->shape->size / output->tensor->shape->size);
+}
+
+static void max_dims_forward(variable_t* output){
+    tensor_max_to_shape_into(output->tensor, input_tensor(output, 0));
+}
+
 tensor_t* sum_backwards_grad(variable_t* input, variable_t* result){
     return tensor_multiply(tensor_sum_grad(input->tensor), result->gradient);
 
 }
 
+// the (scalar) gradient of the sum is broadcast into the input's gradient
+bool sum_backwards_accumulate_grad(variable_t* input, variable_t* result){
+    tensor_in_place_add(input->gradient, result->gradient);
+    return true;
+}
+
 variable_t* sum(variable_t* variable, bool use_grad){
-    variable_t* new_variable = variable_new_from_tensor(tensor_sum(variable->tensor));
+    variable_t* new_variable = output_new(tensor_sum(variable->tensor));
     if(use_grad){
-        set_unary_grad_meta(new_variable, variable, &sum_backwards_grad);
+        set_unary_grad_meta(new_variable, variable, &sum_backwards_grad, "sum");
+        set_unary_accumulate_grad_op(new_variable, &sum_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_NONE);
+        set_forward_op(new_variable, &sum_forward);
     }
     return new_variable;
 }
@@ -243,44 +401,481 @@ tensor_t* mean_backwards_grad(variable_t* input, variable_t* result){
     return tensor_multiply(tensor_mean_grad(input->tensor), result->gradient);
 }
 
+bool mean_backwards_accumulate_grad(variable_t* input, variable_t* result){
+    tensor_in_place_add_scaled(input->gradient, result->gradient, 1.0 / input->tensor->shape->size);
+    return true;
+}
+
 variable_t* mean(variable_t* variable, bool use_grad){
-    variable_t* new_variable = variable_new_from_tensor(tensor_mean(variable->tensor));
+    variable_t* new_variable = output_new(tensor_mean(variable->tensor));
+    if(use_grad){
+        set_unary_grad_meta(new_variable, variable, &mean_backwards_grad, "mean");
+        set_unary_accumulate_grad_op(new_variable, &mean_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_NONE);
+        set_forward_op(new_variable, &mean_forward);
+    }
+    return new_variable;
+}
+
+// the gradient of a reduction over dimensions keeps them with length 1, so it broadcasts into the input's gradient
+tensor_t* sum_dims_backwards_grad(variable_t* input, variable_t* result){
+    return tensor_multiply(tensor_sum_grad(input->tensor), result->gradient);
+}
+
+bool sum_dims_backwards_accumulate_grad(variable_t* input, variable_t* result){
+    tensor_in_place_add(input->gradient, result->gradient);
+    return true;
+}
+
+variable_t* sum_dims(variable_t* variable, int num_reduced_dims, int* reduced_dims, bool use_grad){
+    variable_t* new_variable = output_new(tensor_sum_dims(variable->tensor, num_reduced_dims, reduced_dims));
+    if(use_grad){
+        set_unary_grad_meta(new_variable, variable, &sum_dims_backwards_grad, "sum_dims");
+        set_unary_accumulate_grad_op(new_variable, &sum_dims_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_NONE);
+        set_forward_op(new_variable, &sum_forward);
+    }
+    return new_variable;
+}
+
+tensor_t* mean_dims_backwards_grad(variable_t* input, variable_t* result){
+    tensor_entry_t scale = (tensor_entry_t) result->tensor->shape->size / input->tensor->shape->size;
+    return tensor_multiply(tensor_new_like_with_value(input->tensor, scale), result->gradient);
+}
+
+bool mean_dims_backwards_accumulate_grad(variable_t* input, variable_t* result){
+    tensor_entry_t scale = (tensor_entry_t) result->tensor->shape->size / input->tensor->shape->size;
+    tensor_in_place_add_scaled(input->gradient, result->gradient, scale);
+    return true;
+}
+
+variable_t* mean_dims(variable_t* variable, int num_reduced_dims, int* reduced_dims, bool use_grad){
+    variable_t* new_variable = output_new(tensor_mean_dims(variable->tensor, num_reduced_dims, reduced_dims));
+    if(use_grad){
+        set_unary_grad_meta(new_variable, variable, &mean_dims_backwards_grad, "mean_dims");
+        set_unary_accumulate_grad_op(new_variable, &mean_dims_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_NONE);
+        set_forward_op(new_variable, &mean_forward);
+    }
+    return new_variable;
+}
+
+tensor_t* max_dims_backwards_grad(variable_t* input, variable_t* result){
+    return tensor_multiply(tensor_max_dims_grad(input->tensor, result->tensor), result->gradient);
+}
+
+bool max_dims_backwards_accumulate_grad(variable_t* input, variable_t* result){
+    tensor_t* max_grad = tensor_max_dims_grad(input->tensor, result->tensor);
+    tensor_in_place_add_multiply(input->gradient, max_grad, result->gradient);
+    tensor_release(max_grad);
+    return true;
+}
+
+variable_t* max_dims(variable_t* variable, int num_reduced_dims, int* reduced_dims, bool use_grad){
+    variable_t* new_variable = output_new(tensor_max_dims(variable->tensor, num_reduced_dims, reduced_dims));
+    if(use_grad){
+        set_unary_grad_meta(new_variable, variable, &max_dims_backwards_grad, "max_dims");
+        set_unary_accumulate_grad_op(new_variable, &max_dims_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_INPUT | GRAD_NEEDS_OUTPUT);
+        set_forward_op(new_variable, &max_dims_forward);
+    }
+    return new_variable;
+}
+
+/**
+ * VIEWS
+ * outputs share the data of their input (see tensor_transpose and friends), so the forward pass copies nothing
+ * the gradient of a view is the gradient of its output, laid back out in the shape of the input
+*/
+
+typedef struct {
+    int inverse_dims[TENSOR_MAX_DIMS]; // permute
+    int dim; // slice
+    size_t start; // slice
+} view_context_t;
+
+// views share the data of their input, so there is nothing to recompute
+static void view_forward(variable_t* output){
+    UNUSED(output);
+}
+
+static inline view_context_t* view_context_new(void){
+    return (view_context_t*) arena_malloc(sizeof(view_context_t));
+}
+
+tensor_t* permute_backwards_grad(variable_t* input, variable_t* output){
+    UNUSED(input);
+    view_context_t* context = (view_context_t*) output->grad_meta->op_context;
+    return tensor_copy(tensor_permute(output->gradient, context->inverse_dims));
+}
+
+bool permute_backwards_accumulate_grad(variable_t* input, variable_t* output){
+    view_context_t* context = (view_context_t*) output->grad_meta->op_context;
+    tensor_in_place_add(input->gradient, tensor_permute(output->gradient, context->inverse_dims));
+    return true;
+}
+
+variable_t* permute(variable_t* variable, int* dims, bool use_grad){
+    variable_t* new_variable = output_new(tensor_permute(variable->tensor, dims));
+    if(use_grad){
+        view_context_t* context = view_context_new();
+        for(int dim_index = 0; dim_index < TENSOR_NUM_DIMS(variable->tensor); dim_index++){
+            context->inverse_dims[dims[dim_index]] = dim_index;
+        }
+        set_unary_grad_meta(new_variable, variable, &permute_backwards_grad, "permute");
+        set_unary_accumulate_grad_op(new_variable, &permute_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_NONE);
+        set_forward_op(new_variable, &view_forward);
+        new_variable->grad_meta->op_context = context;
+    }
+    return new_variable;
+}
+
+// the gradient is zero outside of the slice
+tensor_t* slice_backwards_grad(variable_t* input, variable_t* output){
+    view_context_t* context = (view_context_t*) output->grad_meta->op_context;
+    tensor_t* gradient = tensor_new_zeros_like(input->tensor);
+    size_t end = context->start + output->tensor->shape->dims[context->dim];
+    tensor_in_place_add(tensor_slice(gradient, context->dim, context->start, end), output->gradient);
+    return gradient;
+}
+
+bool slice_backwards_accumulate_grad(variable_t* input, variable_t* output){
+    view_context_t* context = (view_context_t*) output->grad_meta->op_context;
+    size_t end = context->start + output->tensor->shape->dims[context->dim];
+    tensor_in_place_add(tensor_slice(input->gradient, context->dim, context->start, end), output->gradient);
+    return true;
+}
+
+variable_t* slice(variable_t* variable, int dim, size_t start, size_t end, bool use_grad){
+    variable_t* new_variable = output_new(tensor_slice(variable->tensor, dim, start, end));
+    if(use_grad){
+        view_context_t* context = view_context_new();
+        context->dim = dim;
+        context->start = start;
+        set_unary_grad_meta(new_variable, variable, &slice_backwards_grad, "slice");
+        set_unary_accumulate_grad_op(new_variable, &slice_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_NONE);
+        set_forward_op(new_variable, &view_forward);
+        new_variable->grad_meta->op_context = context;
+    }
+    return new_variable;
+}
+
+// summed over the expanded dimensions by grad.c, as for any broadcast
+tensor_t* expand_backwards_grad(variable_t* input, variable_t* output){
+    UNUSED(input);
+    return tensor_copy(output->gradient);
+}
+
+bool expand_backwards_accumulate_grad(variable_t* input, variable_t* output){
+    tensor_t* reduced_gradient = tensor_reduce_to_shape(output->gradient, input->tensor->shape);
+    tensor_in_place_add(input->gradient, reduced_gradient);
+    if(reduced_gradient != output->gradient){
+        tensor_release(reduced_gradient);
+    }
+    return true;
+}
+
+variable_t* expand(variable_t* variable, shape_t* shape, bool use_grad){
+    variable_t* new_variable = output_new(tensor_expand(variable->tensor, shape));
     if(use_grad){
-        set_unary_grad_meta(new_variable, variable, &mean_backwards_grad);
+        set_unary_grad_meta(new_variable, variable, &expand_backwards_grad, "expand");
+        set_unary_accumulate_grad_op(new_variable, &expand_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_NONE);
+        set_forward_op(new_variable, &view_forward);
+    }
+    return new_variable;
+}
+
+tensor_t* reshape_backwards_grad(variable_t* input, variable_t* output){
+    return tensor_copy(tensor_view_as_shape(output->gradient, input->tensor->shape));
+}
+
+bool reshape_backwards_accumulate_grad(variable_t* input, variable_t* output){
+    tensor_in_place_add(input->gradient, tensor_view_as_shape(output->gradient, input->tensor->shape));
+    return true;
+}
+
+// a view of contiguous inputs, copied from strided ones (and so not replayed, see graph.h)
+variable_t* reshape(variable_t* variable, shape_t* shape, bool use_grad){
+    variable_t* new_variable = output_new(tensor_view_as_shape(variable->tensor, shape));
+    if(use_grad){
+        set_unary_grad_meta(new_variable, variable, &reshape_backwards_grad, "reshape");
+        set_unary_accumulate_grad_op(new_variable, &reshape_backwards_accumulate_grad);
+        set_unary_grad_needs(new_variable, GRAD_NEEDS_NONE);
+        set_unary_passes_gradient(new_variable, true);
+        if(tensor_is_contiguous(variable->tensor)){
+            set_forward_op(new_variable, &view_forward);
+        }
+    }
+    return new_variable;
+}
+
+/**
+ * FUSED LOSSES
+ * the difference, its square (or absolute value) and the mean are evaluated in a single fused pass,
+ * and so are the gradients, without materializing any intermediate
+*/
+
+static inline tensor_entry_t loss_grad_scale(variable_t* output, fused_expr_t* difference){
+    return tensor_get_entry(output->gradient, 0) / fused_get_shape(difference)->size;
+}
+
+// d mse / d actual = 2 * (actual - expected) * grad / size
+static fused_expr_t* mse_loss_backwards_expr(variable_t* actual, variable_t* expected, variable_t* output, tensor_entry_t sign){
+    fused_expr_t* difference = fused_subtract(fused_input(actual->tensor), fused_input(expected->tensor));
+    return fused_multiply(difference, fused_constant(sign * 2 * loss_grad_scale(output, difference)));
+}
+
+// d mae / d actual = abs_grad(actual - expected) * grad / size
+static fused_expr_t* mae_loss_backwards_expr(variable_t* actual, variable_t* expected, variable_t* output, tensor_entry_t sign){
+    fused_expr_t* difference = fused_subtract(fused_input(actual->tensor), fused_input(expected->tensor));
+    return fused_multiply(fused_abs_grad(difference), fused_constant(sign * loss_grad_scale(output, difference)));
+}
+
+tensor_t* mse_loss_actual_backwards_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    return evaluate_fused_grad(mse_loss_backwards_expr(input, other_input, output, 1));
+}
+
+tensor_t* mse_loss_expected_backwards_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    return evaluate_fused_grad(mse_loss_backwards_expr(other_input, input, output, -1));
+}
+
+tensor_t* mae_loss_actual_backwards_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    return evaluate_fused_grad(mae_loss_backwards_expr(input, other_input, output, 1));
+}
+
+tensor_t* mae_loss_expected_backwards_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    return evaluate_fused_grad(mae_loss_backwards_expr(other_input, input, output, -1));
+}
+
+bool mse_loss_actual_backwards_accumulate_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    return accumulate_fused_grad(input->gradient, mse_loss_backwards_expr(input, other_input, output, 1));
+}
+
+bool mse_loss_expected_backwards_accumulate_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    return accumulate_fused_grad(input->gradient, mse_loss_backwards_expr(other_input, input, output, -1));
+}
+
+bool mae_loss_actual_backwards_accumulate_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    return accumulate_fused_grad(input->gradient, mae_loss_backwards_expr(input, other_input, output, 1));
+}
+
+bool mae_loss_expected_backwards_accumulate_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    return accumulate_fused_grad(input->gradient, mae_loss_backwards_expr(other_input, input, output, -1));
+}
+
+static tensor_entry_t mse_loss_value(tensor_t* actual, tensor_t* expected){
+    fused_expr_t* squared_difference = fused_square(fused_subtract(fused_input(actual), fused_input(expected)));
+    tensor_entry_t loss = fused_evaluate_sum(squared_difference) / fused_get_shape(squared_difference)->size;
+    fused_expr_free(squared_difference);
+    return loss;
+}
+
+static tensor_entry_t mae_loss_value(tensor_t* actual, tensor_t* expected){
+    fused_expr_t* absolute_difference = fused_abs(fused_subtract(fused_input(actual), fused_input(expected)));
+    tensor_entry_t loss = fused_evaluate_sum(absolute_difference) / fused_get_shape(absolute_difference)->size;
+    fused_expr_free(absolute_difference);
+    return loss;
+}
+
+static void mse_loss_forward(variable_t* output){
+    tensor_set_entry(output->tensor, 0, mse_loss_value(input_tensor(output, 0), input_tensor(output, 1)));
+}
+
+static void mae_loss_forward(variable_t* output){
+    tensor_set_entry(output->tensor, 0, mae_loss_value(input_tensor(output, 0), input_tensor(output, 1)));
+}
+
+variable_t* mse_loss(variable_t* actual, variable_t* expected, bool use_grad){
+    variable_t* new_variable = output_new(tensor_new_from_entry(mse_loss_value(actual->tensor, expected->tensor)));
+    if(use_grad){
+        set_binary_grad_meta(new_variable, actual, expected, &mse_loss_actual_backwards_grad, &mse_loss_expected_backwards_grad, "mse_loss");
+        set_binary_accumulate_grad_ops(new_variable, &mse_loss_actual_backwards_accumulate_grad, &mse_loss_expected_backwards_accumulate_grad);
+        set_binary_grad_needs(new_variable, GRAD_NEEDS_INPUT | GRAD_NEEDS_OTHER_INPUT, GRAD_NEEDS_INPUT | GRAD_NEEDS_OTHER_INPUT);
+        set_forward_op(new_variable, &mse_loss_forward);
+    }
+    return new_variable;
+}
+
+variable_t* mae_loss(variable_t* actual, variable_t* expected, bool use_grad){
+    variable_t* new_variable = output_new(tensor_new_from_entry(mae_loss_value(actual->tensor, expected->tensor)));
+    if(use_grad){
+        set_binary_grad_meta(new_variable, actual, expected, &mae_loss_actual_backwards_grad, &mae_loss_expected_backwards_grad, "mae_loss");
+        set_binary_accumulate_grad_ops(new_variable, &mae_loss_actual_backwards_accumulate_grad, &mae_loss_expected_backwards_accumulate_grad);
+        set_binary_grad_needs(new_variable, GRAD_NEEDS_INPUT | GRAD_NEEDS_OTHER_INPUT, GRAD_NEEDS_INPUT | GRAD_NEEDS_OTHER_INPUT);
+        set_forward_op(new_variable, &mae_loss_forward);
+    }
+    return new_variable;
+}
+
+/**
+ * ACTIVATIONS
+ * elementwise, so the gradients are fused expressions of the input (or output) and the output gradient
+*/
+
+static variable_t* activation(variable_t* variable, tensor_t* (* op)(tensor_t*), variable_forward_op_t forward_op, variable_unary_grad_op_t grad_op, variable_unary_accumulate_grad_op_t accumulate_grad_op, grad_needs_t grad_needs, const char* op_name, bool use_grad){
+    variable_t* new_variable = output_new((*op)(variable->tensor));
+    if(use_grad){
+        set_unary_grad_meta(new_variable, variable, grad_op, op_name);
+        set_unary_accumulate_grad_op(new_variable, accumulate_grad_op);
+        set_unary_grad_needs(new_variable, grad_needs);
+        set_forward_op(new_variable, forward_op);
+    }
+    return new_variable;
+}
+
+#define DEFINE_ACTIVATION(name, grad_expression, grad_needs)                                                  \
+    static fused_expr_t* name##_backwards_expr(variable_t* input, variable_t* output){                        \
+        return (grad_expression);                                                                             \
+    }                                                                                                         \
+    tensor_t* name##_backwards_grad(variable_t* input, variable_t* output){                                   \
+        return evaluate_fused_grad(name##_backwards_expr(input, output));                                     \
+    }                                                                                                         \
+    bool name##_backwards_accumulate_grad(variable_t* input, variable_t* output){                             \
+        return accumulate_fused_grad(input->gradient, name##_backwards_expr(input, output));                  \
+    }                                                                                                         \
+    static void name##_forward(variable_t* output){                                                           \
+        tensor_##name##_into(output->tensor, input_tensor(output, 0));                                        \
+    }                                                                                                         \
+    static variable_t* activation_##name(variable_t* variable, bool use_grad){                                \
+        return activation(variable, &tensor_##name, &name##_forward, &name##_backwards_grad, &name##_backwards_accumulate_grad, grad_needs, #name, use_grad); \
+    }
+
+#define INPUT_EXPR fused_input(input->tensor)
+#define OUTPUT_EXPR fused_input(output->tensor)
+#define OUTPUT_GRADIENT_EXPR fused_input(output->gradient)
+
+DEFINE_ACTIVATION(relu, fused_multiply(fused_relu_grad(INPUT_EXPR), OUTPUT_GRADIENT_EXPR), GRAD_NEEDS_INPUT)
+// d exp(x) = exp(x), d log(x) = 1 / x, d tanh(x) = 1 - tanh(x)^2
+DEFINE_ACTIVATION(exp, (UNUSED(input), fused_multiply(OUTPUT_EXPR, OUTPUT_GRADIENT_EXPR)), GRAD_NEEDS_OUTPUT)
+DEFINE_ACTIVATION(log, fused_divide(OUTPUT_GRADIENT_EXPR, INPUT_EXPR), GRAD_NEEDS_INPUT)
+DEFINE_ACTIVATION(tanh, (UNUSED(input), fused_multiply(fused_tanh_grad(OUTPUT_EXPR), OUTPUT_GRADIENT_EXPR)), GRAD_NEEDS_OUTPUT)
+
+#undef INPUT_EXPR
+#undef OUTPUT_EXPR
+#undef OUTPUT_GRADIENT_EXPR
+
+// d(left @ right)/d(left) = grad @ right^T
+tensor_t* matmul_left_backwards_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    UNUSED(input);
+    return tensor_matmul_transposed(output->gradient, other_input->tensor, false, true);
+}
+
+// d(left @ right)/d(right) = left^T @ grad
+tensor_t* matmul_right_backwards_grad(variable_t* input, variable_t* other_input, variable_t* output){
+    UNUSED(input);
+    return tensor_matmul_transposed(other_input->tensor, output->gradient, true, false);
+}
+
+static void matmul_forward(variable_t* output){
+    tensor_matmul_into(output->tensor, input_tensor(output, 0), input_tensor(output, 1));
+}
+
+// batched matrix product, see tensor_matmul
+variable_t* matmul(variable_t* left_variable, variable_t* right_variable, bool use_grad){
+    tensor_t* new_tensor = tensor_matmul(left_variable->tensor, right_variable->tensor);
+    variable_t* new_variable = output_new(new_tensor);
+    if(use_grad){
+        set_binary_grad_meta(new_variable, left_variable, right_variable, &matmul_left_backwards_grad, &matmul_right_backwards_grad, "matmul");
+        set_binary_grad_needs(new_variable, GRAD_NEEDS_OTHER_INPUT, GRAD_NEEDS_OTHER_INPUT);
+        set_forward_op(new_variable, &matmul_forward);
     }
     return new_variable;
 }
 
 /**
  * EXTERNAL FUNCTIONS
+ * record the graph unless called in no-grad mode (see coral_no_grad_begin)
 */
 
 variable_t* variable_add(variable_t* left_variable, variable_t* right_variable){
-    return add(left_variable, right_variable, true);
+    return add(left_variable, right_variable, coral_is_grad_enabled());
 }
 
 variable_t* variable_subtract(variable_t* left_variable, variable_t* right_variable){
-    return subtract(left_variable, right_variable, true);
+    return subtract(left_variable, right_variable, coral_is_grad_enabled());
 }
 
 variable_t* variable_multiply(variable_t* left_variable, variable_t* right_variable){
-    return multiply(left_variable, right_variable, true);
+    return multiply(left_variable, right_variable, coral_is_grad_enabled());
+}
+
+variable_t* variable_matmul(variable_t* left_variable, variable_t* right_variable){
+    return matmul(left_variable, right_variable, coral_is_grad_enabled());
 }
 
 variable_t* variable_square(variable_t* variable){
-    return square(variable, true);
+    return square(variable, coral_is_grad_enabled());
 }
 
 variable_t* variable_abs_value(variable_t* variable){
-    return abs_value(variable, true);
+    return abs_value(variable, coral_is_grad_enabled());
+}
+
+variable_t* variable_relu(variable_t* variable){
+    return activation_relu(variable, coral_is_grad_enabled());
+}
+
+variable_t* variable_exp(variable_t* variable){
+    return activation_exp(variable, coral_is_grad_enabled());
+}
+
+variable_t* variable_log(variable_t* variable){
+    return activation_log(variable, coral_is_grad_enabled());
+}
+
+variable_t* variable_tanh(variable_t* variable){
+    return activation_tanh(variable, coral_is_grad_enabled());
 }
 
 variable_t* variable_sum(variable_t* variable){
-    return sum(variable, true);
+    return sum(variable, coral_is_grad_enabled());
 }
 
 variable_t* variable_mean(variable_t* variable){
-    return mean(variable, true);
+    return mean(variable, coral_is_grad_enabled());
+}
+
+variable_t* variable_sum_dims(variable_t* variable, int num_reduced_dims, int* reduced_dims){
+    return sum_dims(variable, num_reduced_dims, reduced_dims, coral_is_grad_enabled());
+}
+
+variable_t* variable_mean_dims(variable_t* variable, int num_reduced_dims, int* reduced_dims){
+    return mean_dims(variable, num_reduced_dims, reduced_dims, coral_is_grad_enabled());
+}
+
+variable_t* variable_max_dims(variable_t* variable, int num_reduced_dims, int* reduced_dims){
+    return max_dims(variable, num_reduced_dims, reduced_dims, coral_is_grad_enabled());
+}
+
+variable_t* variable_transpose(variable_t* variable, int dim0, int dim1){
+    int num_dims = TENSOR_NUM_DIMS(variable->tensor);
+    NDEBUG_ASSERT(0 <= dim0 && dim0 < num_dims && 0 <= dim1 && dim1 < num_dims, "Transposed dimension out of range!\n");
+    int dims[TENSOR_MAX_DIMS];
+    for(int dim_index = 0; dim_index < num_dims; dim_index++){
+        dims[dim_index] = dim_index;
+    }
+    dims[dim0] = dim1;
+    dims[dim1] = dim0;
+    return permute(variable, dims, coral_is_grad_enabled());
+}
+
+variable_t* variable_permute(variable_t* variable, int* dims){
+    return permute(variable, dims, coral_is_grad_enabled());
+}
+
+variable_t* variable_slice(variable_t* variable, int dim, size_t start, size_t end){
+    return slice(variable, dim, start, end, coral_is_grad_enabled());
+}
+
+variable_t* variable_expand(variable_t* variable, shape_t* shape){
+    return expand(variable, shape, coral_is_grad_enabled());
+}
+
+variable_t* variable_reshape(variable_t* variable, shape_t* shape){
+    return reshape(variable, shape, coral_is_grad_enabled());
 }
 
 /**
@@ -289,12 +884,12 @@ variable_t* variable_mean(variable_t* variable){
 
 // mean absolute error
 variable_t* variable_mae_loss(variable_t* actual, variable_t* expected){
-    return variable_mean(variable_abs_value(variable_subtract(actual, expected)));
+    return mae_loss(actual, expected, coral_is_grad_enabled());
 }
 
 // mean squared error
 variable_t* variable_mse_loss(variable_t* actual, variable_t* expected){
-    return variable_mean(variable_square(variable_subtract(actual, expected)));
+    return mse_loss(actual, expected, coral_is_grad_enabled());
 }
 
 
@@ -2,6 +2,7 @@
 #define VARIABLE_H
 
 #include "tensor.h"
+#include "arena.h"
 #include <stdbool.h>
 
 // wrapper around tensor
@@ -13,6 +14,9 @@ struct variable {
     tensor_t* tensor;
     tensor_t* gradient;
     grad_meta_t* grad_meta;
+    // whether backward passes compute the gradient of the variable: leaves do unless told otherwise (see
+    // variable_set_requires_grad), op outputs when one of their inputs does, so that subgraphs over constants are skipped
+    bool requires_grad;
 };
 
 variable_t* variable_new(int num_dims, ...);
@@ -22,6 +26,9 @@ variable_t* variable_view_as_shape(variable_t* variable, shape_t* new_shape);
 variable_t* variable_new_like(variable_t* old_variable);
 variable_t* variable_new_like_with_value(variable_t* old_variable, tensor_entry_t value);
 variable_t* variable_copy(variable_t* old_variable);
+// for leaves (e.g. inputs, targets and frozen parameters), before building graphs from them
+// a leaf which does not require grad keeps its gradient, but backward passes no longer accumulate into it
+void variable_set_requires_grad(variable_t* variable, bool requires_grad);
 
 bool variable_equal(variable_t* left_variable, variable_t* right_variable);
 bool variable_alias(variable_t* left_variable, variable_t* right_variable);
@@ -34,36 +41,85 @@ typedef variable_t* (* variable_binary_op_t)(variable_t* left_variable, variable
 typedef variable_t* (* variable_unary_op_t)(variable_t* left_variable, variable_t* right_variable);
 typedef tensor_t* (* variable_binary_grad_op_t)(variable_t* input, variable_t* other_input, variable_t* output);
 typedef tensor_t* (* variable_unary_grad_op_t)(variable_t* input, variable_t* output);
-typedef void (* generic_op_t)();
+// accumulate the gradient straight into input->gradient, return false if they cannot (e.g. a reduction is needed)
+typedef bool (* variable_binary_accumulate_grad_op_t)(variable_t* input, variable_t* other_input, variable_t* output);
+typedef bool (* variable_unary_accumulate_grad_op_t)(variable_t* input, variable_t* output);
+typedef void (* generic_op_t)(void);
+// recomputes output->tensor in place from the tensors of its inputs, see graph.h
+typedef void (* variable_forward_op_t)(variable_t* output);
 
 #define variable_grad_op_t generic_op_t
 
+// the forward values a grad op reads, activations no grad op reads can be released early, see backward_plan_set_memory_planning
+// shapes are always kept, only the data of a released activation is gone
+typedef enum {
+    GRAD_NEEDS_NONE = 0,
+    GRAD_NEEDS_INPUT = 1,
+    GRAD_NEEDS_OTHER_INPUT = 2,
+    GRAD_NEEDS_OUTPUT = 4,
+    GRAD_NEEDS_ALL = 7,
+} grad_needs_t;
+
 // differentiable input
 typedef struct {
     variable_t* variable;
     variable_grad_op_t grad_op;
+    variable_grad_op_t accumulate_grad_op; // optional, preferred over grad_op when set
+    grad_needs_t grad_needs; // GRAD_NEEDS_ALL unless the op says otherwise
+    bool passes_gradient; // the gradient of the input is that of the output, in the shape of the input (add, reshape), see grad.c
+    bool always_runs; // the grad op runs even when the input does not require grad, for the gradients it accumulates elsewhere (checkpoint.c)
 } input_t;
 
 static inline input_t* input_new(variable_t* input, variable_grad_op_t grad_op){
-    input_t* new_input = (input_t*) malloc(sizeof(input_t));
+    input_t* new_input = (input_t*) arena_malloc(sizeof(input_t));
     new_input->variable = input;
     new_input->grad_op = grad_op;
+    new_input->accumulate_grad_op = NULL;
+    new_input->grad_needs = GRAD_NEEDS_ALL;
+    new_input->passes_gradient = false;
+    new_input->always_runs = false;
     return new_input;
 }
 
+#define GRAD_MAX_INPUTS 2
+
 struct grad_meta{
-    int ref_count;
+    int ref_count; // consumers yet to propagate into this node during a backward pass
     int num_inputs; // 0 for leaf
-    input_t* inputs[2];
+    input_t* inputs[GRAD_MAX_INPUTS];
+    void* op_context; // state of the op which produced this node, read by its grad ops (see checkpoint.c)
+    const char* op_name; // of the op which produced this node, names its backward pass in profiles (see profile.h)
+    variable_forward_op_t forward_op; // NULL for leaves, and for ops which cannot be replayed (see graph.h)
+    unsigned long plan_epoch; // traversal which last discovered this node, see grad.c
+    int plan_index;
 };
 
 static inline grad_meta_t* grad_meta_new(){
-    grad_meta_t* new_grad_meta = (grad_meta_t*) malloc(sizeof(grad_meta_t));
+    grad_meta_t* new_grad_meta = (grad_meta_t*) arena_malloc(sizeof(grad_meta_t));
     new_grad_meta->ref_count = 0;
     new_grad_meta->num_inputs = 0;
+    new_grad_meta->op_context = NULL;
+    new_grad_meta->op_name = NULL;
+    new_grad_meta->forward_op = NULL;
+    new_grad_meta->plan_epoch = 0;
+    new_grad_meta->plan_index = -1;
     return new_grad_meta;
 }
 
+// variables created in no-grad mode have neither a gradient nor grad meta until they are first needed
+static inline void variable_ensure_grad_meta(variable_t* variable){
+    if(!variable->grad_meta){
+        variable->grad_meta = grad_meta_new();
+    }
+}
+
+static inline tensor_t* variable_get_gradient(variable_t* variable){
+    if(!variable->gradient){
+        variable->gradient = tensor_new_zeros_like(variable->tensor);
+    }
+    return variable->gradient;
+}
+
 void variable_display(variable_t* variable, char* name);
 void variable_display_with_gradient(variable_t* variable, char* name);
 
@@ -74,8 +130,26 @@ void variable_in_place_view_as_shape(variable_t* variable, shape_t* new_shape);
 variable_t* variable_add(variable_t* left_variable, variable_t* right_variable);
 variable_t* variable_subtract(variable_t* left_variable, variable_t* right_variable);
 variable_t* variable_multiply(variable_t* left_variable, variable_t* right_variable);
+variable_t* variable_matmul(variable_t* left_variable, variable_t* right_variable);
+variable_t* variable_square(variable_t* variable);
 variable_t* variable_abs_value(variable_t* variable);
+variable_t* variable_relu(variable_t* variable);
+variable_t* variable_exp(variable_t* variable);
+variable_t* variable_log(variable_t* variable);
+variable_t* variable_tanh(variable_t* variable);
 variable_t* variable_sum(variable_t* variable);
+variable_t* variable_mean(variable_t* variable);
+// reduced dimensions are kept with length 1
+variable_t* variable_sum_dims(variable_t* variable, int num_reduced_dims, int* reduced_dims);
+variable_t* variable_mean_dims(variable_t* variable, int num_reduced_dims, int* reduced_dims);
+variable_t* variable_max_dims(variable_t* variable, int num_reduced_dims, int* reduced_dims);
+// views which share the data of variable, see tensor_transpose and friends
+variable_t* variable_transpose(variable_t* variable, int dim0, int dim1);
+variable_t* variable_permute(variable_t* variable, int* dims);
+variable_t* variable_slice(variable_t* variable, int dim, size_t start, size_t end);
+variable_t* variable_expand(variable_t* variable, shape_t* shape);
+// unlike variable_view_as_shape, differentiable (through the gradient of its output, reshaped)
+variable_t* variable_reshape(variable_t* variable, shape_t* shape);
 
 variable_t* variable_mae_loss(variable_t* actual, variable_t* expected);
 variable_t* variable_mse_loss(variable_t* actual, variable_t* expected);
@@ -0,0 +1,215 @@
+#include "weights.h"
+#include "assert.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WEIGHTS_MAGIC "CORALWTS"
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_tensors;
+    uint64_t file_size;
+} weights_header_t;
+
+typedef struct {
+    char name[WEIGHTS_MAX_NAME_LENGTH];
+    uint32_t dtype;
+    uint32_t num_dims;
+    uint64_t dims[SHAPE_MAX_DIMS];
+    uint64_t offset; // of the entries, from the start of the file
+    uint64_t size; // in bytes
+    float scale;
+    int32_t zero_point;
+} weights_entry_t;
+
+struct weights_file {
+    void* mapping;
+    size_t size;
+    const weights_header_t* header;
+    const weights_entry_t* entries;
+};
+
+static inline uint64_t align_up(uint64_t offset){
+    return (offset + WEIGHTS_ALIGNMENT - 1) / WEIGHTS_ALIGNMENT * WEIGHTS_ALIGNMENT;
+}
+
+static inline size_t tensor_size_in_bytes(tensor_t* tensor){
+    return tensor->shape->size * dtype_get_size(tensor->dtype);
+}
+
+/**
+ * SAVING
+*/
+
+bool weights_save_tensors(const char* path, int num_tensors, const char* const* names, tensor_t* const* tensors){
+    weights_entry_t* entries = (weights_entry_t*) calloc(num_tensors > 0 ? num_tensors : 1, sizeof(weights_entry_t));
+    NDEBUG_ASSERT(entries != NULL, "Failed to allocate weights table.\n");
+    uint64_t offset = align_up(sizeof(weights_header_t) + num_tensors * sizeof(weights_entry_t));
+    for(int index = 0; index < num_tensors; index++){
+        tensor_t* tensor = tensors[index];
+        weights_entry_t* entry = &entries[index];
+        NDEBUG_ASSERT(strlen(names[index]) < WEIGHTS_MAX_NAME_LENGTH, "Tensor name %s is too long!\n", names[index]);
+        strcpy(entry->name, names[index]);
+        entry->dtype = tensor->dtype;
+        entry->num_dims = TENSOR_NUM_DIMS(tensor);
+        for(int dim_index = 0; dim_index < TENSOR_NUM_DIMS(tensor); dim_index++){
+            entry->dims[dim_index] = tensor->shape->dims[dim_index];
+        }
+        entry->offset = offset;
+        entry->size = tensor_size_in_bytes(tensor);
+        entry->scale = tensor->quantization.scale;
+        entry->zero_point = tensor->quantization.zero_point;
+        offset = align_up(offset + entry->size);
+    }
+    weights_header_t header = {WEIGHTS_MAGIC, WEIGHTS_VERSION, num_tensors, offset};
+    FILE* file = fopen(path, "wb");
+    if(!file){
+        free(entries);
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    written = written && fwrite(entries, sizeof(weights_entry_t), num_tensors, file) == (size_t) num_tensors;
+    static const char padding[WEIGHTS_ALIGNMENT] = {0};
+    for(int index = 0; index < num_tensors && written; index++){
+        long position = ftell(file);
+        written = position >= 0 && fwrite(padding, 1, entries[index].offset - position, file) == entries[index].offset - position;
+        tensor_t* contiguous_tensor = tensor_contiguous(tensors[index]);
+        written = written && fwrite(contiguous_tensor->data, 1, entries[index].size, file) == entries[index].size;
+        if(contiguous_tensor != tensors[index]){
+            tensor_release(contiguous_tensor);
+        }
+    }
+    // up to the size recorded in the header
+    long position = ftell(file);
+    written = written && position >= 0 && fwrite(padding, 1, offset - position, file) == offset - position;
+    free(entries);
+    return (fclose(file) == 0) && written;
+}
+
+bool weights_save(module_t* module, const char* path){
+    int num_parameters = module_get_num_parameters(module);
+    const char** names = (const char**) malloc((num_parameters + 1) * sizeof(const char*));
+    tensor_t** tensors = (tensor_t**) malloc((num_parameters + 1) * sizeof(tensor_t*));
+    NDEBUG_ASSERT(names && tensors, "Failed to allocate weights table.\n");
+    for(int index = 0; index < num_parameters; index++){
+        names[index] = module_get_parameter_name(module, index);
+        tensors[index] = module_get_parameter(module, index)->tensor;
+    }
+    bool saved = weights_save_tensors(path, num_parameters, names, tensors);
+    free(names);
+    free(tensors);
+    return saved;
+}
+
+/**
+ * LOADING
+ * the table is checked once when the file is opened, so that the tensors can be read from it as they are
+*/
+
+static bool entry_is_valid(const weights_entry_t* entry, size_t file_size){
+    if(memchr(entry->name, '\0', WEIGHTS_MAX_NAME_LENGTH) == NULL || entry->dtype > TENSOR_INT8){
+        return false;
+    }
+    if(entry->num_dims < 1 || entry->num_dims > SHAPE_MAX_DIMS){
+        return false;
+    }
+    uint64_t size = dtype_get_size((tensor_dtype_t) entry->dtype);
+    for(uint32_t dim_index = 0; dim_index < entry->num_dims; dim_index++){
+        size *= entry->dims[dim_index];
+    }
+    uint64_t misalignment = entry->offset % WEIGHTS_ALIGNMENT;
+    return size == entry->size && misalignment == 0 && entry->offset <= file_size && entry->size <= file_size - entry->offset;
+}
+
+weights_file_t* weights_open(const char* path){
+    int descriptor = open(path, O_RDONLY);
+    if(descriptor < 0){
+        return NULL;
+    }
+    struct stat status;
+    if(fstat(descriptor, &status) != 0 || (size_t) status.st_size < sizeof(weights_header_t)){
+        close(descriptor);
+        return NULL;
+    }
+    size_t size = status.st_size;
+    // private and writable, so that parameters loaded from the file can still be trained
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if(mapping == MAP_FAILED){
+        return NULL;
+    }
+    const weights_header_t* header = (const weights_header_t*) mapping;
+    bool valid = memcmp(header->magic, WEIGHTS_MAGIC, sizeof(header->magic)) == 0 && header->version == WEIGHTS_VERSION
+        && header->file_size == size && header->num_tensors <= (size - sizeof(weights_header_t)) / sizeof(weights_entry_t);
+    const weights_entry_t* entries = (const weights_entry_t*) (header + 1);
+    for(uint32_t index = 0; valid && index < header->num_tensors; index++){
+        valid = entry_is_valid(&entries[index], size);
+    }
+    if(!valid){
+        munmap(mapping, size);
+        return NULL;
+    }
+    weights_file_t* new_file = (weights_file_t*) malloc(sizeof(weights_file_t));
+    NDEBUG_ASSERT(new_file != NULL, "Failed to allocate weights file.\n");
+    *new_file = (weights_file_t) {mapping, size, header, entries};
+    return new_file;
+}
+
+void weights_close(weights_file_t* file){
+    munmap(file->mapping, file->size);
+    free(file);
+}
+
+int weights_get_num_tensors(weights_file_t* file){
+    return file->header->num_tensors;
+}
+
+const char* weights_get_name(weights_file_t* file, int index){
+    NDEBUG_ASSERT(0 <= index && index < weights_get_num_tensors(file), "Tensor index out of range.\n");
+    return file->entries[index].name;
+}
+
+tensor_t* weights_get_tensor(weights_file_t* file, const char* name){
+    for(int index = 0; index < weights_get_num_tensors(file); index++){
+        const weights_entry_t* entry = &file->entries[index];
+        if(strcmp(entry->name, name) != 0){
+            continue;
+        }
+        size_t dims[SHAPE_MAX_DIMS];
+        for(uint32_t dim_index = 0; dim_index < entry->num_dims; dim_index++){
+            dims[dim_index] = entry->dims[dim_index];
+        }
+        quantization_t quantization = {entry->scale, entry->zero_point};
+        return tensor_new_from_data((char*) file->mapping + entry->offset, shape_new(entry->num_dims, dims), (tensor_dtype_t) entry->dtype, quantization);
+    }
+    return NULL;
+}
+
+bool weights_load(weights_file_t* file, module_t* module){
+    int num_parameters = module_get_num_parameters(module);
+    tensor_t** tensors = (tensor_t**) malloc((num_parameters + 1) * sizeof(tensor_t*));
+    NDEBUG_ASSERT(tensors != NULL, "Failed to allocate weights table.\n");
+    bool matches = true;
+    for(int index = 0; index < num_parameters && matches; index++){
+        tensor_t* parameter_tensor = module_get_parameter(module, index)->tensor;
+        tensors[index] = weights_get_tensor(file, module_get_parameter_name(module, index));
+        matches = tensors[index] && tensors[index]->dtype == TENSOR_FLOAT32 && shape_equal(tensors[index]->shape, parameter_tensor->shape);
+    }
+    for(int index = 0; index < num_parameters && matches; index++){
+        if(module_is_flat(module)){
+            tensor_t* parameter_tensor = module_get_parameter(module, index)->tensor;
+            memcpy(parameter_tensor->data, tensors[index]->data, tensor_size_in_bytes(parameter_tensor));
+        }else{
+            module_set_parameter_data(module, index, tensors[index]->data);
+        }
+    }
+    free(tensors);
+    return matches;
+}
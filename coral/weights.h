@@ -0,0 +1,48 @@
+#ifndef WEIGHTS_H
+#define WEIGHTS_H
+
+#include "module.h"
+#include <stdbool.h>
+
+/**
+ * weights files
+ * a versioned binary format for sets of named tensors: a header, a table with the name, dtype, shape and
+ * quantization of every tensor and the offset of its entries, and the entries themselves, each aligned to
+ * WEIGHTS_ALIGNMENT bytes, in native byte order
+ * files are opened by mapping them into memory, and the tensors read from them point straight into the
+ * mapping, so nothing is copied or parsed beyond the table, and replicas which load the same file share its
+ * pages (the mapping is private, so pages written to, e.g. by training, are copied first, and the file is never
+ * written to, though the writes show through every tensor read from the same open file)
+ *
+ *     weights_save(model, "model.weights");
+ *     weights_file_t* weights = weights_open("model.weights"); weights_load(weights, model);
+ *
+ * tensors read from a file are valid until it is closed
+*/
+
+#define WEIGHTS_VERSION 1
+#define WEIGHTS_ALIGNMENT 64
+// including the terminating NUL
+#define WEIGHTS_MAX_NAME_LENGTH 128
+
+typedef struct weights_file weights_file_t;
+
+// false if the file cannot be written
+bool weights_save_tensors(const char* path, int num_tensors, const char* const* names, tensor_t* const* tensors);
+// the parameters of module, under their names
+bool weights_save(module_t* module, const char* path);
+
+// NULL if the file cannot be read, or is not a weights file of this version
+weights_file_t* weights_open(const char* path);
+void weights_close(weights_file_t* file);
+int weights_get_num_tensors(weights_file_t* file);
+const char* weights_get_name(weights_file_t* file, int index);
+// a tensor pointing into the mapping, NULL when the file has no tensor called name
+tensor_t* weights_get_tensor(weights_file_t* file, const char* name);
+
+// points every parameter of module at the tensor of the same name (which must have its shape and be float32),
+// false (leaving the module alone) when one is missing or does not match
+// the entries of a flat module are copied into its bucket instead
+bool weights_load(weights_file_t* file, module_t* module);
+
+#endif // WEIGHTS_H